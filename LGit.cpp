@@ -14,15 +14,18 @@ extern "C" BOOL APIENTRY DllMain(HANDLE hModule, DWORD reason, LPVOID _res)
 		case DLL_PROCESS_ATTACH:
 			OutputDebugString("**Visual Git DllMain** proc attach\n");
 			dllInstance = (HINSTANCE)hModule;
+			LGitTraceProcessAttach();
 			break;
 		case DLL_THREAD_ATTACH:
 			OutputDebugString("**Visual Git DllMain** thread attach\n");
 			break;
 		case DLL_THREAD_DETACH:
 			OutputDebugString("**Visual Git DllMain** thread deattach\n");
+			LGitTraceThreadDetach();
 			break;
 		case DLL_PROCESS_DETACH:
 			OutputDebugString("**Visual Git DllMain** proc deattach\n");
+			LGitTraceProcessDetach();
 			break;
     }
     return TRUE;
@@ -43,7 +46,7 @@ static void LGitInitOpts(void)
 		"VisualGit");
 	/* Load options that are config-time from the registry. */
 	HKEY key;
-	DWORD valueLen = 255, type = REG_SZ;
+	DWORD valueLen = 255, type = REG_SZ, traceLevel, scanThreads, renameLimit;
 	BYTE value[255];
 	int ret;
 
@@ -90,6 +93,56 @@ static void LGitInitOpts(void)
 		LGitLog(" ! Failed to load certificate bundle value\n");
 	}
 
+	/* Tracing, for diagnosing things on someone else's machine */
+	valueLen = 255;
+	type = REG_SZ;
+	ret = RegQueryValueEx(key,
+		"TraceFile",
+		NULL,
+		&type,
+		value,
+		&valueLen);
+	if (ret == ERROR_SUCCESS && type == REG_SZ) {
+		LGitTraceSetFile((const char*)value);
+	}
+	valueLen = sizeof(DWORD);
+	type = REG_DWORD;
+	ret = RegQueryValueEx(key,
+		"TraceLevel",
+		NULL,
+		&type,
+		(BYTE*)&traceLevel,
+		&valueLen);
+	if (ret == ERROR_SUCCESS && type == REG_DWORD) {
+		LGitTraceSetLevel(traceLevel);
+	}
+
+	/* Workers for scanning whole directories; 0 is one per processor */
+	valueLen = sizeof(DWORD);
+	type = REG_DWORD;
+	ret = RegQueryValueEx(key,
+		"ScanThreads",
+		NULL,
+		&type,
+		(BYTE*)&scanThreads,
+		&valueLen);
+	if (ret == ERROR_SUCCESS && type == REG_DWORD) {
+		LGitSetScanThreads(scanThreads);
+	}
+
+	/* Most file pairs compared looking for renames; 0 is the default */
+	valueLen = sizeof(DWORD);
+	type = REG_DWORD;
+	ret = RegQueryValueEx(key,
+		"RenameLimit",
+		NULL,
+		&type,
+		(BYTE*)&renameLimit,
+		&valueLen);
+	if (ret == ERROR_SUCCESS && type == REG_DWORD) {
+		LGitSetRenameLimit(renameLimit);
+	}
+
 	RegCloseKey(key);
 }
 
@@ -132,11 +185,13 @@ SCCRTN SccInitialize (LPVOID * context,				// SCC provider contex
 					  LPLONG checkoutCommentLen,	// Check out comment max length
 					  LPLONG commentLen)			// Other comments max length
 {
+	LGitTraceInit();
 	LGitLog("**SccInitialize**\n");
 	LGitLog("  Caller = %s\n", callerName);
 	int init_count = git_libgit2_init();
 	if (init_count < 0) {
 		LGitLibraryError(hWnd, "Error initializing LGit");
+		LGitTraceShutdown();
 		return SCC_E_INITIALIZEFAILED;
 	}
 	LGitLog("  InitCount = %d\n", init_count);
@@ -171,6 +226,7 @@ SCCRTN SccInitialize (LPVOID * context,				// SCC provider contex
 		ZeroMemory(*context, sizeof(LGitContext));
 		strlcpy(ctx->appName, callerName, SCC_NAME_LEN);
 		ctx->dllInst = dllInstance;
+		LGitStatsInit(ctx);
 
 		/* gets reinitialized on project, but here, for empty proj */
 		LGitInitializeFonts(ctx);
@@ -189,6 +245,8 @@ SCCRTN SccUninitialize (LPVOID context)
 	LGitContext *ctx = (LGitContext*)context;
 	int uninit_count;
 
+	/* Annotate windows don't wait for their blames to finish */
+	LGitBlameWaitAll();
 	uninit_count = git_libgit2_shutdown();
 	LGitLog("**SccUninitialize** Context=%p\n", context);
 	LGitLog("  Uninit count  =%d\n", uninit_count);
@@ -202,8 +260,15 @@ SCCRTN SccUninitialize (LPVOID context)
 	} else {
 		ImageList_Destroy(ctx->refTypeIl);
 
+		wchar_t stats_path[MAX_PATH];
+		if (LGitStatsDefaultPath(stats_path, MAX_PATH)) {
+			LGitStatsDump(ctx, stats_path);
+		}
+		LGitStatsFree(ctx);
+
 		free(context);
 		LGitLog("  Freed context\n");
 	}
+	LGitTraceShutdown();
 	return SCC_OK;
 }
\ No newline at end of file
@@ -133,6 +133,22 @@ SOURCE=.\apply.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\batchst.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\blame.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\blamewin.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\bloom.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\branch.cpp
 # End Source File
 # Begin Source File
@@ -145,6 +161,10 @@ SOURCE=.\cert.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\cgraph.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\checkout.cpp
 # End Source File
 # Begin Source File
@@ -177,10 +197,22 @@ SOURCE=.\diff.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\diffdoc.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\diffwin.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\dirindex.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\events.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\format.cpp
 # End Source File
 # Begin Source File
@@ -189,10 +221,26 @@ SOURCE=.\gitconf.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\histcach.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\histmodl.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\history.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\histsrch.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\lanes.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\LGit.cpp
 # End Source File
 # Begin Source File
@@ -205,10 +253,22 @@ SOURCE=.\merge.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\parscan.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\patchout.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\path.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\pathtab.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\progress.cpp
 # End Source File
 # Begin Source File
@@ -225,6 +285,10 @@ SOURCE=.\query.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\quickdif.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\remote.cpp
 # End Source File
 # Begin Source File
@@ -245,14 +309,30 @@ SOURCE=.\runscc.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\session.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\sigwin.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\similar.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\stage.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\statcach.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\stats.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\status.cpp
 # End Source File
 # Begin Source File
@@ -270,12 +350,24 @@ SOURCE=.\tag.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\trace.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\unicode.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\upstream.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\winutil.cpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\worddiff.cpp
+# End Source File
 # End Group
 # Begin Group "Header Files"
 
@@ -22,8 +22,16 @@
 /* this is in wide codepoints */
 #define LGitUtf8ToWide(utf8, wide, widesize) MultiByteToWideChar(CP_UTF8, 0, utf8, -1, wide, widesize)
 
-/* XXX: Use a case-insensitive comparator */
-typedef std::set<std::string> CheckoutQueue;
+/* Flat bitset indexed by path ID; see pathtab.cpp */
+typedef std::vector<DWORD> LGitPathBits;
+
+/* Windows paths are case-insensitive, so containers keyed by them should be */
+struct LGitPathLess {
+	bool operator()(const std::string &a, const std::string &b) const
+	{
+		return _stricmp(a.c_str(), b.c_str()) < 0;
+	}
+};
 
 /* Defining here so they can be defined in ctx; used in cmdopts.cpp */
 typedef struct _LGitCommitOpts {
@@ -33,6 +41,28 @@ typedef struct _LGitGetOpts {
 	BOOL pull;
 } LGitGetOpts;
 
+/* Block reused between calls for normalized paths; see path.cpp */
+typedef struct _LGitPathScratch {
+	char *block;
+	size_t size;
+	BOOL busy;
+} LGitPathScratch;
+
+/* Opaque, defined in pathtab.cpp */
+typedef struct _LGitPathTable LGitPathTable;
+/* Opaque, defined in statcach.cpp */
+typedef struct _LGitStatusCache LGitStatusCache;
+/* Opaque, defined in session.cpp */
+typedef struct _LGitSession LGitSession;
+/* Opaque, defined in dirindex.cpp */
+typedef struct _LGitDirIndex LGitDirIndex;
+/* Opaque, defined in events.cpp */
+typedef struct _LGitEvents LGitEvents;
+/* Opaque, defined in upstream.cpp */
+typedef struct _LGitUpstream LGitUpstream;
+/* Opaque, defined in stats.cpp */
+typedef struct _LGitStats LGitStats;
+
 typedef struct _LGitContext {
 	/* housekeeping */
 	BOOL active;
@@ -41,8 +71,25 @@ typedef struct _LGitContext {
 	BOOL addSccSuccess;
 	/* git state */
 	git_repository *repo;
+	/* Paths interned to IDs, for per-path state */
+	LGitPathTable *pathTable;
 	/* used for faking checkout status */
-	CheckoutQueue *checkouts;
+	LGitPathBits *checkouts;
+	/* path -> status results, so the IDE asking again doesn't rescan */
+	LGitStatusCache *statusCache;
+	/* Index, config and such kept between calls; borrow via session.cpp */
+	LGitSession *session;
+	/* Directories in HEAD's tree, for directory queries */
+	LGitDirIndex *dirIndex;
+	/* Background watcher and queue for SccGetEvents */
+	LGitEvents *events;
+	/* What the upstream branch changed, for "changed on server" queries */
+	LGitUpstream *upstream;
+	/* Timings of Scc* calls, for the lifetime of the context */
+	LGitStats *stats;
+	/* Background commit-graph writer, if one's been started */
+	HANDLE graphWriter;
+	volatile LONG graphWriterCancel;
 	/* callbacks and such provided by IDE */
 	OPTNAMECHANGEPFN renameCb;
 	LPVOID renameData;
@@ -54,6 +101,10 @@ typedef struct _LGitContext {
 	char path[1024], workdir_path[1024];
 	/* path isn't really used right now */
 	wchar_t workdir_path_utf16[1024];
+	/* workdir_path without the trailing backslash, case-folded */
+	char workdir_fold[1024];
+	size_t workdir_len;
+	LGitPathScratch pathScratch;
 	char appName[SCC_NAME_SIZE];
 	/* SCC provided username, used for some remote contexts */
 	char username[SCC_USER_SIZE];
@@ -70,6 +121,37 @@ typedef struct _LGitContext {
 /* LGit.cpp */
 const char* LGitCommandName(enum SCCCOMMAND command);
 
+/* stats.cpp */
+/* Powers of two ms; the last catches everything longer */
+#define LGIT_STATS_BUCKETS 16
+
+typedef struct _LGitOpStats {
+	LONG calls;
+	DWORD total_ms, cpu_ms, max_ms;
+	LONG files;
+	LONG histogram[LGIT_STATS_BUCKETS];
+} LGitOpStats;
+
+typedef void (*LGitStatsCallback)(const char *op, const LGitOpStats *stats, void *payload);
+
+/* Times from construction to the end of the scope, for any return path */
+struct LGitOpTimer {
+	LGitContext *ctx;
+	const char *op;
+	LONG files;
+	DWORD start, start_cpu;
+	LGitOpTimer(LPVOID context, const char *op, LONG files);
+	~LGitOpTimer();
+};
+
+void LGitStatsInit(LGitContext *ctx);
+void LGitStatsFree(LGitContext *ctx);
+void LGitStatsRecord(LGitContext *ctx, const char *op, DWORD ms, DWORD cpu_ms, LONG files);
+DWORD LGitStatsPercentile(const LGitOpStats *entry, int percent);
+void LGitStatsForeach(LGitContext *ctx, LGitStatsCallback cb, void *payload);
+BOOL LGitStatsDump(LGitContext *ctx, const wchar_t *path);
+BOOL LGitStatsDefaultPath(wchar_t *buf, size_t bufsz);
+
 /* caps.cpp */
 LONG LGitGetCaps(void);
 
@@ -77,6 +159,44 @@ LONG LGitGetCaps(void);
 LGIT_API SCCRTN LGitOpenProject(LPVOID context, HWND hWnd,  LPSTR lpUser, LPSTR lpProjName, LPCSTR lpLocalProjPath, LPSTR lpAuxProjPath, LPCSTR lpComment, LPTEXTOUTPROC lpTextOutProc, LONG dwFlags);
 LGIT_API SCCRTN LGitGetProjPath(LPVOID context, HWND hWnd, LPSTR lpUser, LPSTR lpProjName, LPSTR lpLocalPath, LPSTR lpAuxProjPath, BOOL bAllowChangePath, LPBOOL pbNew);
 
+/* trace.cpp */
+#define LGTL_ERROR 0
+#define LGTL_WARN 1
+#define LGTL_INFO 2
+#define LGTL_DEBUG 3
+
+/* Anything above this is compiled out */
+#ifndef LGIT_TRACE_LEVEL
+#ifdef _DEBUG
+#define LGIT_TRACE_LEVEL LGTL_DEBUG
+#else
+#define LGIT_TRACE_LEVEL LGTL_INFO
+#endif
+#endif
+
+void LGitTraceProcessAttach(void);
+void LGitTraceProcessDetach(void);
+void LGitTraceThreadDetach(void);
+void LGitTraceInit(void);
+void LGitTraceShutdown(void);
+void LGitTraceSetLevel(int level);
+void LGitTraceSetFile(const char *path);
+void LGitTraceFlush(void);
+void LGitTraceV(int level, const char *format_str, va_list va);
+void LGitTrace(int level, const char *format_str, ...);
+void LGitTraceDebug(const char *format_str, ...);
+
+/*
+ * For per-file and per-entry messages. No variadic macros in VC6, so when
+ * compiled out, the call is left unevaluated instead; format strings must be
+ * literals either way, since they're formatted later.
+ */
+#if LGIT_TRACE_LEVEL >= LGTL_DEBUG
+#define LGitLogDebug LGitTraceDebug
+#else
+#define LGitLogDebug 1 ? (void)0 : LGitTraceDebug
+#endif
+
 /* logging.cpp */
 void LGitLog(const char *format_str, ...);
 void LGitLibraryError(HWND hWnd, LPCSTR title);
@@ -87,6 +207,22 @@ LGIT_API void LGitTranslateStringChars(char *buf, int char1, int char2);
 LGIT_API void LGitTranslateStringCharsW(wchar_t *buf, int char1, int char2);
 const char *LGitStripBasePath(LGitContext *ctx, const char *abs);
 const wchar_t *LGitStripBasePathW(LGitContext *ctx, const wchar_t *abs);
+typedef struct _LGitPathBatch {
+	/* Relative with forward slashes, or NULL if outside of the workdir */
+	char **paths;
+	LONG count;
+	/* What the paths live in, and if it's the context's */
+	char *block;
+	BOOL shared;
+} LGitPathBatch;
+
+void LGitPreparePathPrefix(LGitContext *ctx);
+int LGitNormalizePath(LGitContext *ctx, const char *ansi, char *buf, size_t bufsz);
+BOOL LGitNormalizePaths(LGitContext *ctx, LONG nFiles, LPCSTR *lpFileNames, LGitPathBatch *batch);
+void LGitFreePathBatch(LGitContext *ctx, LGitPathBatch *batch);
+void LGitFreePathScratch(LGitContext *ctx);
+BOOL LGitGetPrivateDir(git_repository *repo, wchar_t *buf, size_t bufsz);
+BOOL LGitFileStatChanged(const wchar_t *path, WIN32_FILE_ATTRIBUTE_DATA *attr);
 LGIT_API BOOL LGitGetProjectNameFromPath(char *project, const char *path, size_t bufsz);
 void LGitOpenFiles(LGitContext *ctx, git_strarray *paths);
 BOOL LGitCreateShortcut(LGitContext *ctx, HWND hwnd);
@@ -111,6 +247,89 @@ const char *LGitBranchType(git_branch_t type);
 void LGitLfToCrLf(char *crlf, const char *lf, size_t crlf_len);
 void LGitSetWindowTextFromCommitMessage(HWND ctrl, UINT codepage, const char *message);
 
+/* batchst.cpp */
+typedef struct _LGitBatchStatusEntry {
+	/* UTF-8 and relative to workdir with forward slashes, NULL if outside */
+	const char *path;
+	/* Interned path ID, 0 if outside */
+	LONG id;
+	/* As if from git_status_file */
+	int rc;
+	unsigned int flags;
+	/* Index of the first request for the same file, or -1 */
+	LONG duplicate_of;
+	/* Answered from the status cache instead of the scan */
+	BOOL cached;
+} LGitBatchStatusEntry;
+
+LGitBatchStatusEntry *LGitBatchStatus(LGitContext *ctx, LONG nFiles, LPCSTR *lpFileNames);
+void LGitFreeBatchStatus(LGitBatchStatusEntry *entries, LONG nFiles);
+
+/* pathtab.cpp */
+void LGitPathTableInit(LGitContext *ctx);
+void LGitPathTableFree(LGitContext *ctx);
+LONG LGitFindPath(LGitContext *ctx, const char *path);
+LONG LGitInternPath(LGitContext *ctx, const char *path);
+const char *LGitPathFromId(LGitContext *ctx, LONG id);
+void LGitPathBitsSet(LGitPathBits *bits, LONG id);
+void LGitPathBitsClear(LGitPathBits *bits, LONG id);
+BOOL LGitPathBitsTest(const LGitPathBits *bits, LONG id);
+
+/* statcach.cpp */
+void LGitStatusCacheInit(LGitContext *ctx);
+void LGitStatusCacheFree(LGitContext *ctx);
+BOOL LGitStatusCacheValidate(LGitContext *ctx);
+BOOL LGitStatusCacheLookup(LGitContext *ctx, const char *path, int *rc, unsigned int *flags);
+void LGitStatusCacheStore(LGitContext *ctx, const char *path, int rc, unsigned int flags);
+void LGitStatusCacheInvalidate(LGitContext *ctx);
+void LGitStatusCacheStats(LGitContext *ctx, LONG *hits, LONG *misses, LONG *invalidations);
+
+/* session.cpp */
+void LGitSessionInit(LGitContext *ctx);
+void LGitSessionFree(LGitContext *ctx);
+git_index *LGitSessionIndex(LGitContext *ctx);
+git_config *LGitSessionConfig(LGitContext *ctx);
+git_tree *LGitSessionHeadTree(LGitContext *ctx);
+void LGitSessionInvalidateConfig(LGitContext *ctx);
+
+/* dirindex.cpp */
+void LGitDirIndexInit(LGitContext *ctx);
+void LGitDirIndexFree(LGitContext *ctx);
+LONG LGitDirIndexStatus(LGitContext *ctx, const char *relative_path);
+
+/* events.cpp */
+void LGitEventsInit(LGitContext *ctx);
+void LGitEventsFree(LGitContext *ctx);
+void LGitEventsEnable(LGitContext *ctx, BOOL enable);
+void LGitEventsWatch(LGitContext *ctx, const char *path, int rc, unsigned int flags);
+BOOL LGitEventsNext(LGitContext *ctx,
+					char *path,
+					size_t pathsz,
+					int *rc,
+					unsigned int *flags,
+					LONG *remaining);
+
+/* upstream.cpp */
+void LGitUpstreamInit(LGitContext *ctx);
+void LGitUpstreamFree(LGitContext *ctx);
+BOOL LGitUpstreamRefresh(LGitContext *ctx);
+LONG LGitUpstreamLookup(LGitContext *ctx, const char *path, const char **other);
+
+/* parscan.cpp */
+typedef struct _LGitScanResult {
+	/* Relative to workdir with forward slashes */
+	std::string path;
+	unsigned int flags;
+} LGitScanResult;
+
+void LGitSetScanThreads(DWORD threads);
+int LGitScanThreadCount(void);
+BOOL LGitParallelStatus(LGitContext *ctx,
+						const git_status_options *sopts,
+						const char **prefixes,
+						int prefix_count,
+						std::vector<LGitScanResult> *results);
+
 /* checkout.cpp */
 SCCRTN LGitCheckoutStaged(LGitContext *ctx, HWND hwnd, git_strarray *paths);
 SCCRTN LGitCheckoutHead(LGitContext *ctx, HWND hwnd, git_strarray *paths);
@@ -120,6 +339,7 @@ SCCRTN LGitCheckoutTree(LGitContext *ctx, HWND hwnd, const git_oid *commit_oid);
 void LGitPushCheckout(LGitContext *ctx, const char *fileName);
 BOOL LGitPopCheckout(LGitContext *ctx, const char *fileName);
 BOOL LGitIsCheckout(LGitContext *ctx, const char *fileName);
+BOOL LGitIsCheckoutId(LGitContext *ctx, LONG id);
 
 /* coutcflt.cpp */
 SCCRTN LGitInitCheckoutNotifyCallbacks(LGitContext *ctx, HWND hwnd, git_checkout_options *co_opts);
@@ -146,6 +366,141 @@ SCCRTN LGitCherryPickCommit(LGitContext *ctx, HWND hwnd, const git_oid *commit_o
 SCCRTN LGitHistoryForRefByName(LPVOID context, HWND hWnd, const char *ref);
 SCCRTN LGitHistory(LPVOID context, HWND hWnd, git_strarray *paths);
 
+/* bloom.cpp */
+typedef struct _LGitChangedPaths LGitChangedPaths;
+
+LGitChangedPaths *LGitChangedPathsOpen(git_repository *repo);
+void LGitChangedPathsClose(LGitChangedPaths *cp);
+BOOL LGitChangedPathsUsable(const git_strarray *paths);
+int LGitChangedPathsQuery(LGitChangedPaths *cp, const git_oid *oid, const git_strarray *paths);
+int LGitChangedPathsMake(git_commit *commit, git_pathspec *ps, std::string *filter);
+void LGitChangedPathsAdd(LGitChangedPaths *cp, const git_oid *oid, const std::string &filter);
+int LGitChangedPathsCompute(LGitChangedPaths *cp, git_commit *commit, git_pathspec *ps);
+
+/* cgraph.cpp */
+typedef struct _LGitCommitGraph LGitCommitGraph;
+typedef struct _LGitGraphWalk LGitGraphWalk;
+
+/* Position for commits that aren't in the commit-graph */
+#define LGIT_GRAPH_NONE 0xFFFFFFFF
+
+LGitCommitGraph *LGitCommitGraphOpen(git_repository *repo);
+void LGitCommitGraphClose(LGitCommitGraph *graph);
+DWORD LGitCommitGraphCount(LGitCommitGraph *graph);
+BOOL LGitCommitGraphFind(LGitCommitGraph *graph, const git_oid *oid, DWORD *pos);
+void LGitCommitGraphOid(LGitCommitGraph *graph, DWORD pos, git_oid *oid);
+void LGitCommitGraphTree(LGitCommitGraph *graph, DWORD pos, git_oid *tree);
+DWORD LGitCommitGraphGeneration(LGitCommitGraph *graph, DWORD pos);
+git_time_t LGitCommitGraphTime(LGitCommitGraph *graph, DWORD pos);
+int LGitCommitGraphParents(LGitCommitGraph *graph, DWORD pos, DWORD *parents, int max);
+LGitGraphWalk *LGitGraphWalkNew(git_repository *repo, LGitCommitGraph *graph, BOOL topological);
+void LGitGraphWalkFree(LGitGraphWalk *walk);
+int LGitGraphWalkPush(LGitGraphWalk *walk, const git_oid *oid);
+int LGitGraphWalkNext(LGitGraphWalk *walk, git_oid *oid, DWORD *pos);
+int LGitAheadBehind(git_repository *repo, LGitCommitGraph *graph, size_t *ahead, size_t *behind, const git_oid *local, const git_oid *upstream);
+int LGitDescendantOf(git_repository *repo, LGitCommitGraph *graph, const git_oid *commit, const git_oid *ancestor);
+void LGitCommitGraphUpdate(LGitContext *ctx);
+void LGitCommitGraphStopUpdate(LGitContext *ctx);
+
+/* lanes.cpp */
+typedef struct _LGitLanes LGitLanes;
+
+/* Lanes past this are laid out, but can't be drawn */
+#define LGIT_LANE_MAX 32
+
+/* One row of the history graph; bits are lanes */
+typedef struct _LGitLaneRow {
+	/* Lines that go straight through */
+	DWORD pass;
+	/* Lines from the top into the commit, and from it to the bottom */
+	DWORD in, out;
+	/* The lane the commit's in */
+	LONG node;
+} LGitLaneRow;
+
+LGitLanes *LGitLanesNew(void);
+void LGitLanesFree(LGitLanes *lanes);
+void LGitLanesAdd(LGitLanes *lanes, const git_oid *oid, const git_oid *parents, int parent_count, LGitLaneRow *row);
+LONG LGitLanesWidest(LGitLanes *lanes);
+
+/* histmodl.cpp */
+typedef struct _LGitHistoryModel LGitHistoryModel;
+
+/* A parent that isn't a row, i.e. it's filtered out */
+#define LGIT_HISTORY_NO_PARENT 0xFFFFFFFF
+
+/* Also the on-disk record in the history cache, so keep it fixed-size */
+typedef struct _LGitHistoryRow {
+	git_oid oid;
+	git_time when;
+	/* index into authors */
+	LONG author;
+	/* offset into the string pool */
+	DWORD summary;
+	/*
+	 * Counted from the last row, so they don't move when newer commits go
+	 * on top; only the first two parents are kept.
+	 */
+	DWORD parent_count;
+	DWORD parents[2];
+} LGitHistoryRow;
+
+/* Posted to the window given to LGitHistoryModelStart, wParam is the state */
+#define WM_LGIT_HISTORY_ROWS (WM_APP + 1)
+
+typedef enum _LGitHistoryModelState {
+	LGHM_WALKING = 0,
+	LGHM_DONE = 1,
+	LGHM_CANCELLED = 2,
+	LGHM_FAILED = 3,
+} LGitHistoryModelState;
+
+typedef enum _LGitHistoryColumn {
+	LGHM_COLUMN_OID = 0,
+	LGHM_COLUMN_AUTHOR = 1,
+	LGHM_COLUMN_WHEN = 2,
+	LGHM_COLUMN_SUMMARY = 3,
+	/* Drawn by the window from LGitHistoryModelLanes; no text */
+	LGHM_COLUMN_GRAPH = 4,
+} LGitHistoryColumn;
+
+LGitHistoryModel *LGitHistoryModelNew(LGitContext *ctx);
+void LGitHistoryModelFree(LGitHistoryModel *model);
+BOOL LGitHistoryModelStart(LGitHistoryModel *model, HWND notify, const char *ref, git_strarray *paths);
+void LGitHistoryModelStop(LGitHistoryModel *model);
+LONG LGitHistoryModelCount(LGitHistoryModel *model);
+LONG LGitHistoryModelGetState(LGitHistoryModel *model, const char **message);
+BOOL LGitHistoryModelOid(LGitHistoryModel *model, LONG index, git_oid *oid);
+BOOL LGitHistoryModelText(LGitHistoryModel *model, LONG index, int column, wchar_t *buf, size_t bufsz);
+LONG LGitHistoryModelParent(LGitHistoryModel *model, LONG index, int n);
+BOOL LGitHistoryModelLanes(LGitHistoryModel *model, LONG index, LGitLaneRow *row);
+LONG LGitHistoryModelLaneWidth(LGitHistoryModel *model);
+BOOL LGitHistoryModelSearch(LGitHistoryModel *model, const wchar_t *query, const std::vector<LONG> *within, std::vector<LONG> *rows);
+
+/* histsrch.cpp */
+typedef struct _LGitSearchIndex LGitSearchIndex;
+
+LGitSearchIndex *LGitSearchIndexOpen(git_repository *repo);
+void LGitSearchIndexClose(LGitSearchIndex *index);
+BOOL LGitSearchIndexSave(LGitSearchIndex *index);
+BOOL LGitSearchIndexHas(LGitSearchIndex *index, const git_oid *oid);
+void LGitSearchIndexAdd(LGitSearchIndex *index, git_commit *commit);
+BOOL LGitSearchIndexQuery(LGitSearchIndex *index, const char *query, std::vector<git_oid> *oids);
+
+/* histcach.cpp */
+typedef struct _LGitHistoryCache LGitHistoryCache;
+
+LGitHistoryCache *LGitHistoryCacheOpen(git_repository *repo);
+void LGitHistoryCacheClose(LGitHistoryCache *cache);
+const git_oid *LGitHistoryCacheTip(LGitHistoryCache *cache);
+LONG LGitHistoryCacheCount(LGitHistoryCache *cache);
+const LGitHistoryRow *LGitHistoryCacheRows(LGitHistoryCache *cache);
+LONG LGitHistoryCacheAuthorCount(LGitHistoryCache *cache);
+const DWORD *LGitHistoryCacheAuthors(LGitHistoryCache *cache);
+DWORD LGitHistoryCacheStringsLength(LGitHistoryCache *cache);
+const wchar_t *LGitHistoryCacheStrings(LGitHistoryCache *cache);
+BOOL LGitHistoryCacheSave(git_repository *repo, const git_oid *tip, const LGitHistoryRow *rows, LONG count, const DWORD *authors, LONG author_count, const wchar_t *strings, DWORD strings_len);
+
 /* pushpull.cpp */
 typedef enum _LGitPullStrategy {
 	LGPS_FETCH = 0,
@@ -177,19 +532,132 @@ SCCRTN LGitStageDragTarget(LGitContext *ctx, HWND hwnd, HDROP drop);
 /* tag.cpp */
 SCCRTN LGitAddTagDialog(LGitContext *ctx, HWND hwnd);
 
+/* diffdoc.cpp */
+typedef struct _LGitDiffDocument LGitDiffDocument;
+
+/* Posted to the window given to LGitDiffDocumentStart, wParam is the state */
+#define WM_LGIT_DIFF_ROWS (WM_APP + 2)
+
+typedef enum _LGitDiffDocumentState {
+	LGDD_STREAMING = 0,
+	LGDD_DONE = 1,
+	LGDD_CANCELLED = 2,
+	LGDD_FAILED = 3,
+} LGitDiffDocumentState;
+
+/* Also the image list index in the diff window */
+typedef enum _LGitDiffRowKind {
+	LGDR_FILE_A = 0,
+	LGDR_FILE_B = 1,
+	LGDR_BINARY = 2,
+	LGDR_HUNK = 3,
+	LGDR_ADDITION = 4,
+	LGDR_DELETION = 5,
+	LGDR_CONTEXT = 6,
+} LGitDiffRowKind;
+
+typedef enum _LGitDiffSourceType {
+	LGDS_INDEX_TO_WORKDIR = 0,
+	LGDS_TREE_TO_WORKDIR = 1,
+	LGDS_TREE_TO_TREE = 2,
+} LGitDiffSourceType;
+
+/* What to diff, for the worker to do it; NULL trees are the empty tree */
+typedef struct _LGitDiffSource {
+	LGitDiffSourceType type;
+	const git_oid *old_tree, *new_tree;
+	const git_diff_options *diffopts;
+} LGitDiffSource;
+
+LGitDiffDocument *LGitDiffDocumentNew(git_diff *diff);
+LGitDiffDocument *LGitDiffDocumentNewFromSource(git_repository *repo, const LGitDiffSource *source);
+void LGitDiffDocumentFree(LGitDiffDocument *doc);
+BOOL LGitDiffDocumentStart(LGitDiffDocument *doc, HWND notify);
+void LGitDiffDocumentWait(LGitDiffDocument *doc);
+void LGitDiffDocumentStop(LGitDiffDocument *doc);
+LONG LGitDiffDocumentCount(LGitDiffDocument *doc);
+LONG LGitDiffDocumentGetState(LGitDiffDocument *doc, const char **message);
+void LGitDiffDocumentProgress(LGitDiffDocument *doc, LONG *examined, LONG *current, LONG *deltas);
+git_diff *LGitDiffDocumentDiff(LGitDiffDocument *doc);
+DWORD LGitDiffDocumentWidest(LGitDiffDocument *doc);
+int LGitDiffDocumentKind(LGitDiffDocument *doc, LONG index);
+BOOL LGitDiffDocumentText(LGitDiffDocument *doc, LONG index, wchar_t *buf, size_t bufsz);
+LONG LGitDiffDocumentPairCount(LGitDiffDocument *doc);
+BOOL LGitDiffDocumentPair(LGitDiffDocument *doc, LONG index, LONG *left, LONG *right, LONG *block);
+LONG LGitDiffDocumentFoundCount(LGitDiffDocument *doc);
+BOOL LGitDiffDocumentFoundPath(LGitDiffDocument *doc, LONG index, wchar_t *buf, size_t bufsz);
+
+/* worddiff.cpp */
+typedef struct _LGitWordDiff LGitWordDiff;
+
+/* In characters of a row's display text */
+typedef struct _LGitWordSpan {
+	unsigned short start, length;
+} LGitWordSpan;
+
+LGitWordDiff *LGitWordDiffNew(LGitDiffDocument *doc);
+void LGitWordDiffFree(LGitWordDiff *wd);
+BOOL LGitWordDiffSpans(LGitWordDiff *wd, LONG pair, BOOL right, const LGitWordSpan **spans, size_t *count);
+
+/* similar.cpp */
+void LGitSetRenameLimit(DWORD limit);
+int LGitFindRenames(git_diff *diff, BOOL copies, volatile LONG *cancel);
+
+/* blame.cpp */
+typedef struct _LGitBlame LGitBlame;
+
+/* Posted to the window given to LGitBlameStart, wParam is an LGDD_* state */
+#define WM_LGIT_BLAME_LINES (WM_APP + 3)
+
+/* Also the annotate window's column order */
+typedef enum _LGitBlameColumn {
+	LGBL_COLUMN_LINE = 0,
+	LGBL_COLUMN_OID = 1,
+	LGBL_COLUMN_AUTHOR = 2,
+	LGBL_COLUMN_WHEN = 3,
+	LGBL_COLUMN_TEXT = 4,
+} LGitBlameColumn;
+
+LGitBlame *LGitBlameNew(git_repository *repo, const char *path, const git_oid *commit);
+void LGitBlameFree(LGitBlame *blame);
+BOOL LGitBlameStart(LGitBlame *blame, HWND notify);
+void LGitBlameWaitAll(void);
+void LGitBlameSetVisible(LGitBlame *blame, LONG first, LONG last);
+LONG LGitBlameCount(LGitBlame *blame);
+LONG LGitBlameGetState(LGitBlame *blame, const char **message);
+BOOL LGitBlameLineCommit(LGitBlame *blame, LONG index, git_oid *oid);
+BOOL LGitBlameText(LGitBlame *blame, LONG index, int column, wchar_t *buf, size_t bufsz);
+
+/* blamewin.cpp */
+SCCRTN LGitAnnotate(LGitContext *ctx, HWND hwnd, const char *path, const git_oid *commit);
+
 /* diffwin.cpp */
 typedef struct _LGitDiffDialogParams {
 	LGitContext *ctx;
+	/* If NULL, made in the background from source */
 	git_diff *diff;
+	LGitDiffSource source;
 	git_commit *commit;
 	/* Only likely relevant for single-file SccDiff */
 	const char *path;
 	/* Internal done by LGitDiffWindow */
 	HMENU menu;
+	LGitDiffDocument *document;
+	BOOL side_by_side;
+	LGitWordDiff *words;
+	/* Files found so far are listed until there are lines */
+	BOOL found_list;
+	/* Out; how many files differed, if it got that far */
+	size_t deltas;
+	/* Out; the LGDD_* state the compare ended in */
+	LONG state;
 } LGitDiffDialogParams;
 
 int LGitDiffWindow(HWND parent, LGitDiffDialogParams *params);
 
+/* quickdif.cpp */
+BOOL LGitQuickDiff(LGitContext *ctx, const char *path, LONG flags, BOOL *differs);
+
 /* diff.cpp */
 SCCRTN LGitCommitToCommitDiff(LGitContext *ctx, HWND hwnd, git_commit *commit_b, git_commit *commit_a, git_diff_options *diffopts);
 SCCRTN LGitCommitToParentDiff(LGitContext *ctx, HWND hwnd, git_commit *commit, git_diff_options *diffopts);
@@ -201,6 +669,16 @@ SCCRTN LGitApplyPatch(LGitContext *ctx, HWND hwnd, git_diff *diff, git_apply_loc
 SCCRTN LGitFileToDiff(LGitContext *ctx, HWND hwnd, const wchar_t *file, git_diff **out);
 SCCRTN LGitApplyPatchDialog(LGitContext *ctx, HWND hwnd);
 
+/* patchout.cpp */
+typedef struct _LGitPatchWriter LGitPatchWriter;
+
+LGitPatchWriter *LGitPatchWriterOpenFile(const wchar_t *path);
+LGitPatchWriter *LGitPatchWriterOpenClipboard(HWND owner);
+BOOL LGitPatchWriterWrite(LGitPatchWriter *writer, const char *buf, size_t len);
+int LGitPatchWriterDiff(LGitPatchWriter *writer, git_diff *diff);
+BOOL LGitPatchWriterClose(LGitPatchWriter *writer);
+SCCRTN LGitFormatPatches(LGitContext *ctx, HWND hwnd, const git_oid *oids, size_t count, const wchar_t *file_name);
+
 /* sigwin.cpp */
 SCCRTN LGitSignatureDialog(LGitContext *ctx, HWND parent, char *name,  size_t name_sz, char *mail, size_t mail_sz, BOOL enable_set_default);
 SCCRTN LGitGetDefaultSignature(HWND hWnd, LGitContext *ctx, git_signature **signature);
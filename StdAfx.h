@@ -32,12 +32,17 @@
 #include <string.h>
 #include <wchar.h>
 #include <stdarg.h>
+#include <process.h>
 
 // STL
 /* i love C++! STL templates spew "truncated name" warnings. only relevant for debugging... */
 #pragma warning(disable: 4786)
 #include <string>
 #include <set>
+#include <map>
+#include <vector>
+#include <queue>
+#include <algorithm>
 
 #if _DEBUG
 #include <crtdbg.h>
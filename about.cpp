@@ -66,6 +66,159 @@ fin:
 	}
 }
 
+/* Diagnostics */
+
+static LVCOLUMN op_column = {
+	LVCF_TEXT | LVCF_WIDTH, 0, 125, "Operation"
+};
+
+/* The rest are numbers, so right aligned and narrow */
+static const char *stat_columns[] = {
+	"Calls", "Total ms", "Mean ms", "Max ms", "CPU ms", "Files",
+	"~p50 ms", "~p90 ms", "~p99 ms"
+};
+
+typedef struct _LGitDiagnosticsFillParams {
+	HWND lv;
+	int index;
+} LGitDiagnosticsFillParams;
+
+static void InitDiagnosticsView(HWND hwnd, LGitAboutParams *params)
+{
+	HWND lv = GetDlgItem(hwnd, IDC_DIAGNOSTICS_LIST);
+	LVCOLUMN lvc;
+	int i;
+
+	ListView_SetExtendedListViewStyle(lv, LVS_EX_FULLROWSELECT
+		| LVS_EX_HEADERDRAGDROP
+		| LVS_EX_LABELTIP);
+	SendMessage(lv, WM_SETFONT, (WPARAM)params->ctx->listviewFont, TRUE);
+
+	ListView_InsertColumn(lv, 0, &op_column);
+	ZeroMemory(&lvc, sizeof(lvc));
+	lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_FMT;
+	lvc.fmt = LVCFMT_RIGHT;
+	lvc.cx = 60;
+	for (i = 0; i < sizeof(stat_columns) / sizeof(stat_columns[0]); i++) {
+		lvc.pszText = (char*)stat_columns[i];
+		ListView_InsertColumn(lv, i + 1, &lvc);
+	}
+}
+
+static void FillDiagnosticsOp(const char *op, const LGitOpStats *stats, void *payload)
+{
+	LGitDiagnosticsFillParams *params = (LGitDiagnosticsFillParams*)payload;
+	DWORD values[9];
+	char buf[32];
+	LVITEM lvi;
+	int i;
+
+	ZeroMemory(&lvi, sizeof(lvi));
+	lvi.mask = LVIF_TEXT;
+	lvi.iItem = params->index++;
+	lvi.pszText = (char*)op;
+	lvi.iItem = ListView_InsertItem(params->lv, &lvi);
+	if (lvi.iItem == -1) {
+		LGitLog(" ! ListView_InsertItem failed\n");
+		return;
+	}
+	values[0] = stats->calls;
+	values[1] = stats->total_ms;
+	values[2] = stats->calls > 0 ? stats->total_ms / stats->calls : 0;
+	values[3] = stats->max_ms;
+	values[4] = stats->cpu_ms;
+	values[5] = stats->files;
+	/* Only as good as the histogram buckets, hence the ~ */
+	values[6] = LGitStatsPercentile(stats, 50);
+	values[7] = LGitStatsPercentile(stats, 90);
+	values[8] = LGitStatsPercentile(stats, 99);
+	for (i = 0; i < 9; i++) {
+		_snprintf(buf, 32, "%lu", values[i]);
+		ListView_SetItemText(params->lv, lvi.iItem, i + 1, buf);
+	}
+}
+
+static void FillDiagnosticsView(HWND hwnd, LGitAboutParams *params)
+{
+	LGitDiagnosticsFillParams fill_params;
+	fill_params.lv = GetDlgItem(hwnd, IDC_DIAGNOSTICS_LIST);
+	fill_params.index = 0;
+	ListView_DeleteAllItems(fill_params.lv);
+	LGitStatsForeach(params->ctx, FillDiagnosticsOp, &fill_params);
+}
+
+static void SaveDiagnosticsDialog(HWND hwnd, LGitAboutParams *params)
+{
+	OPENFILENAMEW ofn;
+	wchar_t fileName[MAX_PATH];
+	ZeroMemory(&ofn, sizeof(ofn));
+	ZeroMemory(fileName, MAX_PATH);
+	ofn.lStructSize = sizeof(ofn);
+	ofn.hwndOwner = hwnd;
+	ofn.lpstrFilter = L"JSON Lines\0*.jsonl;*.json\0";
+	ofn.lpstrTitle = L"Save Diagnostics";
+	ofn.lpstrDefExt = L"jsonl";
+	ofn.lpstrFile = fileName;
+	ofn.nMaxFile = MAX_PATH;
+	/* Appends, so no overwrite prompt */
+	ofn.Flags = OFN_EXPLORER | OFN_HIDEREADONLY;
+	if (GetSaveFileNameW(&ofn) && !LGitStatsDump(params->ctx, fileName)) {
+		MessageBox(hwnd,
+			"The diagnostics couldn't be written to the file.",
+			"Can't Save Diagnostics",
+			MB_ICONERROR);
+	}
+}
+
+static BOOL CALLBACK DiagnosticsDialogProc(HWND hwnd,
+										   unsigned int iMsg,
+										   WPARAM wParam,
+										   LPARAM lParam)
+{
+	LGitAboutParams *param;
+	param = (LGitAboutParams*)GetWindowLong(hwnd, GWL_USERDATA);
+	switch (iMsg) {
+	case WM_INITDIALOG:
+		param = (LGitAboutParams*)lParam;
+		SetWindowLong(hwnd, GWL_USERDATA, (long)param); /* XXX: 64-bit... */
+		InitDiagnosticsView(hwnd, param);
+		FillDiagnosticsView(hwnd, param);
+		return TRUE;
+	case WM_COMMAND:
+		switch (LOWORD(wParam)) {
+		case IDC_DIAGNOSTICS_SAVE:
+			SaveDiagnosticsDialog(hwnd, param);
+			return TRUE;
+		case IDC_DIAGNOSTICS_REFRESH:
+			FillDiagnosticsView(hwnd, param);
+			return TRUE;
+		case IDOK:
+		case IDCANCEL:
+			EndDialog(hwnd, 1);
+			return TRUE;
+		}
+		return FALSE;
+	default:
+		return FALSE;
+	}
+}
+
+static void DiagnosticsDialog(HWND hwnd, LGitAboutParams *params)
+{
+	switch (DialogBoxParamW(params->ctx->dllInst,
+		MAKEINTRESOURCEW(IDD_DIAGNOSTICS),
+		hwnd,
+		DiagnosticsDialogProc,
+		(LPARAM)params)) {
+	case 0:
+	case -1:
+		LGitLog(" ! Uh-oh, dialog error\n");
+		break;
+	default:
+		break;
+	}
+}
+
 static BOOL CALLBACK AboutDialogProc(HWND hwnd,
 									 unsigned int iMsg,
 									 WPARAM wParam,
@@ -84,6 +237,9 @@ static BOOL CALLBACK AboutDialogProc(HWND hwnd,
 		case IDC_ABOUT_WEB:
 			ShellExecute(NULL, "open", LG_URL, NULL, NULL, SW_SHOWNORMAL);
 			return TRUE;
+		case IDC_ABOUT_DIAGNOSTICS:
+			DiagnosticsDialog(hwnd, param);
+			return TRUE;
 		case IDOK:
 		case IDCANCEL:
 			EndDialog(hwnd, 1);
@@ -242,7 +242,8 @@ SCCRTN SccAddFromScc (LPVOID context,
 	}
 
 	LGitLog (" ! Getting index for share\n");
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		return SCC_E_NONSPECIFICERROR;
 	}
 
@@ -270,7 +271,6 @@ SCCRTN SccAddFromScc (LPVOID context,
 		break;
 	}
 fin:
-	git_index_free(index);
 	return ret;
 }
 
@@ -0,0 +1,174 @@
+/*
+ * Batch status queries. The IDE likes to ask about thousands of files at a
+ * time, and git_status_file per file means rereading the index and walking
+ * from the top each time. Instead, run a single status pass restricted to
+ * exactly the files asked for, then answer in the order given.
+ */
+
+#include "stdafx.h"
+
+/* Path ID -> first entry asking about it, or -1 */
+typedef std::vector<LONG> LGitBatchStatusLookup;
+
+typedef struct _LGitBatchStatusParams {
+	LGitContext *ctx;
+	LGitBatchStatusEntry *entries;
+	LGitBatchStatusLookup *lookup;
+	LONG found;
+} LGitBatchStatusParams;
+
+static int LGitBatchStatusCallback(const char *relative_path,
+								   unsigned int flags,
+								   void *context)
+{
+	LGitBatchStatusParams *params = (LGitBatchStatusParams*)context;
+	LONG id = LGitFindPath(params->ctx, relative_path);
+	if (id == 0 || (size_t)id >= params->lookup->size() || (*params->lookup)[id] == -1) {
+		/* Shouldn't happen with a literal pathspec, but be careful */
+		return 0;
+	}
+	LGitBatchStatusEntry *entry = params->entries + (*params->lookup)[id];
+	entry->rc = 0;
+	entry->flags = flags;
+	params->found++;
+	return 0;
+}
+
+/*
+ * Returns an array of nFiles entries, one per input path, or NULL if out of
+ * memory. Paths outside of the working directory have a NULL path; the rest
+ * are interned, so they're good until the project closes.
+ */
+LGitBatchStatusEntry *LGitBatchStatus(LGitContext *ctx,
+									  LONG nFiles,
+									  LPCSTR *lpFileNames)
+{
+	LGitBatchStatusEntry *entries;
+	LGitBatchStatusLookup lookup;
+	LGitBatchStatusParams params;
+	git_status_options sopts;
+	char **pathspec = NULL;
+	size_t path_count = 0;
+	LONG cached = 0;
+	BOOL use_cache;
+	DWORD begin;
+	LONG i;
+	int rc;
+
+	begin = GetTickCount();
+	use_cache = LGitStatusCacheValidate(ctx);
+	params.ctx = ctx;
+	params.lookup = &lookup;
+	params.found = 0;
+	entries = (LGitBatchStatusEntry*)calloc(nFiles > 0 ? nFiles : 1, sizeof(LGitBatchStatusEntry));
+	if (entries == NULL) {
+		return NULL;
+	}
+	params.entries = entries;
+	pathspec = (char**)calloc(nFiles > 0 ? nFiles : 1, sizeof(char*));
+	if (pathspec == NULL) {
+		free(entries);
+		return NULL;
+	}
+	for (i = 0; i < nFiles; i++) {
+		char raw_path[2048];
+		entries[i].path = NULL;
+		entries[i].id = 0;
+		entries[i].rc = GIT_ENOTFOUND;
+		entries[i].flags = 0;
+		entries[i].duplicate_of = -1;
+		entries[i].cached = FALSE;
+		if (LGitNormalizePath(ctx, lpFileNames[i], raw_path, 2048) < 0) {
+			LGitLogDebug("    Couldn't get base path for %s\n", lpFileNames[i]);
+			continue;
+		}
+		entries[i].id = LGitInternPath(ctx, raw_path);
+		if (entries[i].id == 0) {
+			continue;
+		}
+		entries[i].path = LGitPathFromId(ctx, entries[i].id);
+		/* The IDE can ask about the same file twice (i.e. shared items) */
+		if ((size_t)entries[i].id >= lookup.size()) {
+			lookup.resize(entries[i].id + 1, -1);
+		}
+		if (lookup[entries[i].id] != -1) {
+			entries[i].duplicate_of = lookup[entries[i].id];
+			continue;
+		}
+		lookup[entries[i].id] = i;
+		if (use_cache && LGitStatusCacheLookup(ctx,
+			entries[i].path,
+			&entries[i].rc,
+			&entries[i].flags)) {
+			entries[i].cached = TRUE;
+			cached++;
+			continue;
+		}
+		pathspec[path_count++] = (char*)entries[i].path;
+	}
+
+	if (path_count == 0) {
+		/* An empty pathspec would mean everything; don't bother */
+		goto copy;
+	}
+
+	/*
+	 * Same options git_status_file uses, so results are identical. With
+	 * DISABLE_PATHSPEC_MATCH, libgit2 treats the pathspec as a sorted list
+	 * of literal paths and skips everything else while iterating.
+	 */
+	git_status_options_init(&sopts, GIT_STATUS_OPTIONS_VERSION);
+	sopts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+	sopts.flags = GIT_STATUS_OPT_INCLUDE_IGNORED
+		| GIT_STATUS_OPT_RECURSE_IGNORED_DIRS
+		| GIT_STATUS_OPT_INCLUDE_UNTRACKED
+		| GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS
+		| GIT_STATUS_OPT_INCLUDE_UNMODIFIED
+		| GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH;
+	sopts.pathspec.strings = pathspec;
+	sopts.pathspec.count = path_count;
+
+	rc = git_status_foreach_ext(ctx->repo, &sopts, LGitBatchStatusCallback, &params);
+	if (rc != 0) {
+		/* Report once, not for every file */
+		LGitLibraryError(NULL, "Batch status");
+		for (i = 0; i < nFiles; i++) {
+			entries[i].rc = rc;
+		}
+		goto fin;
+	}
+	/* Not found is as much of an answer as anything else */
+	for (i = 0; i < nFiles; i++) {
+		if (entries[i].path != NULL
+			&& entries[i].duplicate_of == -1
+			&& !entries[i].cached) {
+			LGitStatusCacheStore(ctx, entries[i].path, entries[i].rc, entries[i].flags);
+		}
+	}
+copy:
+	/* Copy results for any files asked about more than once */
+	for (i = 0; i < nFiles; i++) {
+		if (entries[i].duplicate_of != -1) {
+			entries[i].rc = entries[entries[i].duplicate_of].rc;
+			entries[i].flags = entries[entries[i].duplicate_of].flags;
+		}
+	}
+	LGitLog(" ! Batch status: %d files, %d scanned, %d cached, %d found, %u ms\n",
+		nFiles,
+		path_count,
+		cached,
+		params.found,
+		GetTickCount() - begin);
+fin:
+	free(pathspec);
+	return entries;
+}
+
+void LGitFreeBatchStatus(LGitBatchStatusEntry *entries, LONG nFiles)
+{
+	/* Paths belong to the path table */
+	if (entries == NULL) {
+		return;
+	}
+	free(entries);
+}
@@ -0,0 +1,1031 @@
+/*
+ * Blame, for the annotate window: which commit each line of a file last
+ * changed in. libgit2 walks history until every line is accounted for, which
+ * on a big, old file takes a while, so the result is kept on disk per path
+ * and commit, for the last few commits each path was annotated at.
+ *
+ * Asked about a later commit, if a cached one is on its first-parent line,
+ * the cached lines are carried forward a commit at a time: lines in each
+ * commit's diff hunks are that commit's, and everything between the hunks
+ * keeps the origin it had. That's what blame would have found anyway, and it
+ * only costs a blob diff per commit that touched the file. Anything else (a
+ * merge that changed the file, too far back, no cache) gets a full blame,
+ * after a quick one limited to the lines on screen so there's something to
+ * look at while the rest is done.
+ *
+ * Like the diff document, the work is on a thread with its own repository,
+ * and the window is a virtual list over what's known so far. libgit2 can't
+ * be stopped mid-blame, so closing the window doesn't wait for it: the
+ * window and the worker each hold a reference, and the worker finishes (and
+ * caches what it found) on its own.
+ */
+
+#include "stdafx.h"
+
+#define BLAME_CACHE_MAGIC "LGBL"
+#define BLAME_CACHE_VERSION 1
+
+/* How far back along first parents to look for a cached commit */
+#define BLAME_MAX_STEPS 256
+/* How many commits' results are kept for each path */
+#define BLAME_CACHE_PER_PATH 4
+/* Blamed first if the window hasn't said what it's showing */
+#define BLAME_FIRST_LINES 64
+/* A line that hasn't been blamed yet */
+#define BLAME_UNKNOWN 0xFFFFFFFF
+
+typedef struct _LGitBlameLine {
+	/* Into the commit table, or BLAME_UNKNOWN */
+	DWORD commit;
+	/* 1-based, in the file as of that commit */
+	DWORD orig_line;
+} LGitBlameLine;
+
+typedef struct _LGitBlameCommit {
+	git_oid oid;
+	git_time when;
+	/* Into the name pool */
+	DWORD author;
+} LGitBlameCommit;
+
+/* Then the path (not terminated), lines, commits, and the name pool */
+typedef struct _LGitBlameCacheHeader {
+	char magic[4];
+	DWORD version;
+	git_oid commit;
+	/* The file as of the commit, in case the cache is for another path */
+	git_oid blob;
+	DWORD path_len;
+	DWORD line_count;
+	DWORD commit_count;
+	/* In bytes, including each name's terminator */
+	DWORD names_len;
+} LGitBlameCacheHeader;
+
+struct LGitBlameOidLess {
+	bool operator()(const git_oid &a, const git_oid &b) const
+	{
+		return git_oid_cmp(&a, &b) < 0;
+	}
+};
+
+typedef std::map<git_oid, DWORD, LGitBlameOidLess> LGitBlameCommitMap;
+
+typedef struct _LGitBlameCacheEntry {
+	git_oid commit;
+	FILETIME written;
+} LGitBlameCacheEntry;
+
+/* A whole result; what's cached, and what's carried forward */
+typedef struct _LGitBlameMap {
+	std::vector<LGitBlameLine> lines;
+	std::vector<LGitBlameCommit> commits;
+	/* UTF-8 */
+	std::string names;
+	LGitBlameCommitMap by_oid;
+} LGitBlameMap;
+
+struct _LGitBlame {
+	/* The window's and the worker's */
+	volatile LONG refs;
+	char repo_path[1024];
+	char path[1024];
+	git_oid commit;
+	/* The worker's */
+	git_repository *repo;
+	git_oid blob;
+	/* Guards the map and text, which the window reads */
+	CRITICAL_SECTION lock;
+	LGitBlameMap *map;
+	char *text;
+	size_t text_len;
+	std::vector<DWORD> *starts;
+	/* What the window is showing, to blame first */
+	volatile LONG visible_first, visible_last;
+	/* Worker state */
+	volatile LONG cancel;
+	LONG state;
+	char error[256];
+	/* NULL once the window's gone */
+	HWND notify;
+	DWORD begin;
+};
+
+/* Running or not, so libgit2 isn't shut down under them */
+static volatile LONG blame_workers = 0;
+
+LGitBlame *LGitBlameNew(git_repository *repo, const char *path, const git_oid *commit)
+{
+	LGitBlame *blame = (LGitBlame*)calloc(1, sizeof(LGitBlame));
+	if (blame == NULL) {
+		return NULL;
+	}
+	strlcpy(blame->repo_path, git_repository_path(repo), 1024);
+	strlcpy(blame->path, path, 1024);
+	git_oid_cpy(&blame->commit, commit);
+	blame->refs = 1;
+	blame->map = new LGitBlameMap();
+	blame->starts = new std::vector<DWORD>();
+	blame->visible_first = 0;
+	blame->visible_last = BLAME_FIRST_LINES - 1;
+	InitializeCriticalSection(&blame->lock);
+	return blame;
+}
+
+/* The last one out frees it */
+static void LGitBlameRelease(LGitBlame *blame)
+{
+	if (InterlockedDecrement((LPLONG)&blame->refs) != 0) {
+		return;
+	}
+	if (blame->repo != NULL) {
+		git_repository_free(blame->repo);
+	}
+	DeleteCriticalSection(&blame->lock);
+	delete blame->map;
+	delete blame->starts;
+	free(blame->text);
+	free(blame);
+}
+
+/*
+ * For the window, when it's closed. Doesn't wait for the worker; if it's in
+ * the middle of a blame, it'll free it when that's done.
+ */
+void LGitBlameFree(LGitBlame *blame)
+{
+	if (blame == NULL) {
+		return;
+	}
+	InterlockedExchange((LPLONG)&blame->cancel, 1);
+	blame->notify = NULL;
+	LGitBlameRelease(blame);
+}
+
+static void LGitBlamePost(LGitBlame *blame, LONG state)
+{
+	HWND notify = blame->notify;
+	if (notify != NULL) {
+		PostMessage(notify, WM_LGIT_BLAME_LINES, state, 0);
+	}
+}
+
+/* Index of the commit in the map's table, adding it if it's new */
+static DWORD LGitBlameAddCommit(LGitBlameMap *map,
+								const git_oid *oid,
+								const git_signature *author)
+{
+	LGitBlameCommitMap::iterator it;
+	LGitBlameCommit commit;
+	DWORD index;
+	it = map->by_oid.find(*oid);
+	if (it != map->by_oid.end()) {
+		return it->second;
+	}
+	ZeroMemory(&commit, sizeof(commit));
+	git_oid_cpy(&commit.oid, oid);
+	commit.author = map->names.size();
+	if (author != NULL) {
+		commit.when = author->when;
+		map->names += author->name;
+	}
+	map->names += '\0';
+	index = map->commits.size();
+	map->commits.push_back(commit);
+	map->by_oid[*oid] = index;
+	return index;
+}
+
+/* Drops commits no line came from anymore, i.e. after carrying forward */
+static void LGitBlameCompact(LGitBlameMap *map)
+{
+	std::vector<DWORD> remap(map->commits.size(), BLAME_UNKNOWN);
+	std::vector<LGitBlameCommit> commits;
+	LGitBlameCommit commit;
+	std::string names;
+	DWORD old;
+	size_t i;
+	for (i = 0; i < map->lines.size(); i++) {
+		old = map->lines[i].commit;
+		if (old == BLAME_UNKNOWN || old >= remap.size()) {
+			continue;
+		}
+		if (remap[old] == BLAME_UNKNOWN) {
+			commit = map->commits[old];
+			commit.author = names.size();
+			names += map->names.c_str() + map->commits[old].author;
+			names += '\0';
+			remap[old] = commits.size();
+			commits.push_back(commit);
+		}
+		map->lines[i].commit = remap[old];
+	}
+	map->commits.swap(commits);
+	map->names.swap(names);
+	map->by_oid.clear();
+	for (i = 0; i < map->commits.size(); i++) {
+		map->by_oid[map->commits[i].oid] = i;
+	}
+}
+
+/* What the path's cache files start with, in the cache directory */
+static BOOL LGitBlameCachePrefix(LGitBlame *blame, wchar_t *buf, size_t bufsz)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+	wchar_t name[GIT_OID_HEXSZ + 2];
+	git_oid key;
+	if (!LGitGetPrivateDir(blame->repo, buf, bufsz)) {
+		return FALSE;
+	}
+	wcslcat(buf, L"\\blame", bufsz);
+	if (!CreateDirectoryW(buf, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		return FALSE;
+	}
+	/* Paths can be longer than a file name, so use a hash of it */
+	if (git_odb_hash(&key, blame->path, strlen(blame->path), GIT_OBJECT_BLOB) != 0) {
+		return FALSE;
+	}
+	git_oid_tostr(hex, sizeof(hex), &key);
+	name[0] = L'\\';
+	LGitUtf8ToWide(hex, name + 1, GIT_OID_HEXSZ + 1);
+	wcslcat(buf, name, bufsz);
+	return TRUE;
+}
+
+/* The cache file for the path at a commit: the path's hash, -, the commit */
+static BOOL LGitBlameCachePath(LGitBlame *blame, const git_oid *commit, wchar_t *buf, size_t bufsz)
+{
+	char hex[GIT_OID_HEXSZ + 2];
+	wchar_t name[GIT_OID_HEXSZ + 2];
+	if (!LGitBlameCachePrefix(blame, buf, bufsz)) {
+		return FALSE;
+	}
+	hex[0] = '-';
+	git_oid_tostr(hex + 1, GIT_OID_HEXSZ + 1, commit);
+	LGitUtf8ToWide(hex, name, GIT_OID_HEXSZ + 2);
+	wcslcat(buf, name, bufsz);
+	return TRUE;
+}
+
+/* Commits the path has a cached result for, by their file names */
+static void LGitBlameCacheList(LGitBlame *blame, std::vector<LGitBlameCacheEntry> *entries)
+{
+	WIN32_FIND_DATAW fd;
+	LGitBlameCacheEntry entry;
+	wchar_t pattern[1024];
+	char name[MAX_PATH];
+	const char *dash;
+	HANDLE find;
+
+	entries->clear();
+	if (!LGitBlameCachePrefix(blame, pattern, 1024)) {
+		return;
+	}
+	wcslcat(pattern, L"-*", 1024);
+	find = FindFirstFileW(pattern, &fd);
+	if (find == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	do {
+		/* Leftover .lock files don't parse */
+		if (LGitWideToUtf8(fd.cFileName, name, MAX_PATH) == 0
+			|| (dash = strchr(name, '-')) == NULL
+			|| strlen(dash + 1) != GIT_OID_HEXSZ
+			|| git_oid_fromstr(&entry.commit, dash + 1) != 0) {
+			continue;
+		}
+		entry.written = fd.ftLastWriteTime;
+		entries->push_back(entry);
+	} while (FindNextFileW(find, &fd));
+	FindClose(find);
+}
+
+/* Reads the path's cache at commit into map, if it's there and makes sense */
+static BOOL LGitBlameCacheLoad(LGitBlame *blame,
+							   const git_oid *commit,
+							   LGitBlameMap *map,
+							   git_oid *blob)
+{
+	const LGitBlameCacheHeader *header;
+	const LGitBlameLine *lines;
+	const LGitBlameCommit *commits;
+	const char *path, *names;
+	wchar_t cache_path[1024];
+	BYTE *data = NULL;
+	DWORD size, size_high, read, i;
+	HANDLE file;
+	BOOL ret = FALSE;
+
+	if (!LGitBlameCachePath(blame, commit, cache_path, 1024)) {
+		return FALSE;
+	}
+	file = CreateFileW(cache_path,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		/* Never annotated before */
+		return FALSE;
+	}
+	size = GetFileSize(file, &size_high);
+	if (size == 0xFFFFFFFF || size_high != 0 || size < sizeof(LGitBlameCacheHeader)) {
+		goto corrupt;
+	}
+	data = (BYTE*)malloc(size);
+	if (data == NULL) {
+		goto fin;
+	}
+	if (!ReadFile(file, data, size, &read, NULL) || read != size) {
+		goto corrupt;
+	}
+	header = (const LGitBlameCacheHeader*)data;
+	if (memcmp(header->magic, BLAME_CACHE_MAGIC, 4) != 0
+		|| header->version != BLAME_CACHE_VERSION
+		|| header->path_len > size
+		|| header->line_count > size / sizeof(LGitBlameLine)
+		|| header->commit_count > size / sizeof(LGitBlameCommit)
+		|| header->names_len > size
+		|| sizeof(LGitBlameCacheHeader)
+			+ header->path_len
+			+ (header->line_count * sizeof(LGitBlameLine))
+			+ (header->commit_count * sizeof(LGitBlameCommit))
+			+ header->names_len != size) {
+		goto corrupt;
+	}
+	path = (const char*)(data + sizeof(LGitBlameCacheHeader));
+	lines = (const LGitBlameLine*)(path + header->path_len);
+	commits = (const LGitBlameCommit*)(lines + header->line_count);
+	names = (const char*)(commits + header->commit_count);
+	if (header->path_len != strlen(blame->path)
+		|| memcmp(path, blame->path, header->path_len) != 0
+		|| !git_oid_equal(&header->commit, commit)) {
+		/* Some other path with the same hash; just replace it */
+		goto fin;
+	}
+	if (header->names_len > 0 && names[header->names_len - 1] != '\0') {
+		goto corrupt;
+	}
+	for (i = 0; i < header->line_count; i++) {
+		if (lines[i].commit >= header->commit_count) {
+			goto corrupt;
+		}
+	}
+	for (i = 0; i < header->commit_count; i++) {
+		if (commits[i].author >= header->names_len) {
+			goto corrupt;
+		}
+	}
+	map->lines.assign(lines, lines + header->line_count);
+	map->commits.assign(commits, commits + header->commit_count);
+	map->names.assign(names, header->names_len);
+	map->by_oid.clear();
+	for (i = 0; i < header->commit_count; i++) {
+		map->by_oid[commits[i].oid] = i;
+	}
+	git_oid_cpy(blob, &header->blob);
+	ret = TRUE;
+	goto fin;
+corrupt:
+	LGitLog(" ! Blame cache for %s is corrupt or too new, ignoring\n", blame->path);
+fin:
+	free(data);
+	CloseHandle(file);
+	return ret;
+}
+
+/* Only the newest few are kept */
+static void LGitBlameCachePrune(LGitBlame *blame)
+{
+	std::vector<LGitBlameCacheEntry> entries;
+	wchar_t path[1024];
+	size_t i, oldest;
+	LGitBlameCacheList(blame, &entries);
+	while (entries.size() > BLAME_CACHE_PER_PATH) {
+		oldest = entries.size();
+		for (i = 0; i < entries.size(); i++) {
+			/* Not the one just written, even if the clock says so */
+			if (git_oid_equal(&entries[i].commit, &blame->commit)) {
+				continue;
+			}
+			if (oldest == entries.size()
+				|| CompareFileTime(&entries[i].written, &entries[oldest].written) < 0) {
+				oldest = i;
+			}
+		}
+		if (oldest == entries.size()) {
+			break;
+		}
+		if (LGitBlameCachePath(blame, &entries[oldest].commit, path, 1024)) {
+			DeleteFileW(path);
+		}
+		entries.erase(entries.begin() + oldest);
+	}
+}
+
+/* Writes the finished map as the path's cache at the commit */
+static BOOL LGitBlameCacheSave(LGitBlame *blame, LGitBlameMap *map)
+{
+	LGitBlameCacheHeader header;
+	wchar_t path[1024], temp_path[1024];
+	DWORD written;
+	HANDLE file;
+	BOOL ok = TRUE;
+
+	if (!LGitBlameCachePath(blame, &blame->commit, path, 1024)) {
+		return FALSE;
+	}
+	ZeroMemory(&header, sizeof(header));
+	memcpy(header.magic, BLAME_CACHE_MAGIC, 4);
+	header.version = BLAME_CACHE_VERSION;
+	git_oid_cpy(&header.commit, &blame->commit);
+	git_oid_cpy(&header.blob, &blame->blob);
+	header.path_len = strlen(blame->path);
+	header.line_count = map->lines.size();
+	header.commit_count = map->commits.size();
+	header.names_len = map->names.size();
+
+	wcslcpy(temp_path, path, 1024);
+	wcslcat(temp_path, L".lock", 1024);
+	file = CreateFileW(temp_path, GENERIC_WRITE, 0, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		LGitLog("!! Can't write blame cache (GLE %x)\n", GetLastError());
+		return FALSE;
+	}
+#define WRITE_OR_FAIL(ptr, len) if (ok && len > 0 && (!WriteFile(file, ptr, len, &written, NULL) || written != len)) ok = FALSE
+	WRITE_OR_FAIL(&header, sizeof(header));
+	WRITE_OR_FAIL(blame->path, header.path_len);
+	if (header.line_count > 0) {
+		WRITE_OR_FAIL(&map->lines[0], header.line_count * sizeof(LGitBlameLine));
+	}
+	if (header.commit_count > 0) {
+		WRITE_OR_FAIL(&map->commits[0], header.commit_count * sizeof(LGitBlameCommit));
+	}
+	WRITE_OR_FAIL(map->names.data(), header.names_len);
+#undef WRITE_OR_FAIL
+	CloseHandle(file);
+	if (!ok) {
+		LGitLog("!! Failed writing blame cache (GLE %x)\n", GetLastError());
+		DeleteFileW(temp_path);
+		return FALSE;
+	}
+	if (!MoveFileExW(temp_path, path, MOVEFILE_REPLACE_EXISTING)) {
+		/* 9x doesn't have MoveFileEx */
+		DeleteFileW(path);
+		if (!MoveFileW(temp_path, path)) {
+			DeleteFileW(temp_path);
+			return FALSE;
+		}
+	}
+	LGitBlameCachePrune(blame);
+	return TRUE;
+}
+
+/* The file's blob as of commit; GIT_ENOTFOUND if it isn't there */
+static int LGitBlameBlobAt(LGitBlame *blame, git_commit *commit, git_oid *blob)
+{
+	git_tree *tree = NULL;
+	git_tree_entry *entry = NULL;
+	int rc;
+	if ((rc = git_commit_tree(&tree, commit)) != 0) {
+		return rc;
+	}
+	rc = git_tree_entry_bypath(&entry, tree, blame->path);
+	if (rc == 0) {
+		if (git_tree_entry_type(entry) == GIT_OBJECT_BLOB) {
+			git_oid_cpy(blob, git_tree_entry_id(entry));
+		} else {
+			rc = GIT_ENOTFOUND;
+		}
+		git_tree_entry_free(entry);
+	}
+	git_tree_free(tree);
+	return rc;
+}
+
+/* Loads the file's text and splits it, so the window can show it already */
+static int LGitBlameLoadText(LGitBlame *blame, git_commit *commit)
+{
+	git_blob *blob = NULL;
+	const char *content;
+	size_t size, i;
+	int rc;
+	if ((rc = LGitBlameBlobAt(blame, commit, &blame->blob)) != 0) {
+		if (rc == GIT_ENOTFOUND) {
+			git_error_set_str(GIT_ERROR_INVALID, "The file isn't in that commit.");
+		}
+		return rc;
+	}
+	if ((rc = git_blob_lookup(&blob, blame->repo, &blame->blob)) != 0) {
+		return rc;
+	}
+	if (git_blob_is_binary(blob)) {
+		git_blob_free(blob);
+		git_error_set_str(GIT_ERROR_INVALID, "Binary files can't be annotated.");
+		return -1;
+	}
+	content = (const char*)git_blob_rawcontent(blob);
+	size = (size_t)git_blob_rawsize(blob);
+	EnterCriticalSection(&blame->lock);
+	blame->text = (char*)malloc(size + 1);
+	if (blame->text != NULL) {
+		memcpy(blame->text, content, size);
+		blame->text_len = size;
+		/* Same as blame: a last line without a newline still counts */
+		for (i = 0; i < size; i++) {
+			if (i == 0 || content[i - 1] == '\n') {
+				blame->starts->push_back(i);
+			}
+		}
+		blame->map->lines.resize(blame->starts->size());
+		for (i = 0; i < blame->map->lines.size(); i++) {
+			blame->map->lines[i].commit = BLAME_UNKNOWN;
+			blame->map->lines[i].orig_line = 0;
+		}
+	}
+	LeaveCriticalSection(&blame->lock);
+	git_blob_free(blob);
+	if (blame->text == NULL) {
+		git_error_set_str(GIT_ERROR_NOMEMORY, "Out of memory loading the file.");
+		return -1;
+	}
+	return 0;
+}
+
+static int LGitBlameHunkCallback(const git_diff_delta *delta,
+								 const git_diff_hunk *hunk,
+								 void *payload)
+{
+	std::vector<git_diff_hunk> *hunks = (std::vector<git_diff_hunk>*)payload;
+	hunks->push_back(*hunk);
+	return 0;
+}
+
+/*
+ * Moves lines (for the parent's blob) to the child's blob, giving what's in
+ * the hunks to the child. FALSE if the diff doesn't add up to the lines we
+ * have, in which case the caller should just do a full blame.
+ */
+static BOOL LGitBlameApplyDiff(LGitBlame *blame,
+							   LGitBlameMap *map,
+							   const git_oid *old_blob,
+							   const git_oid *new_blob,
+							   git_commit *child)
+{
+	std::vector<git_diff_hunk> hunks;
+	std::vector<LGitBlameLine> lines;
+	git_blob *old_obj = NULL, *new_obj = NULL;
+	git_diff_options diffopts;
+	LGitBlameLine line;
+	size_t i, old_pos = 0, old_begin, j;
+	DWORD commit_index;
+	BOOL ret = FALSE;
+
+	if (old_blob != NULL && git_blob_lookup(&old_obj, blame->repo, old_blob) != 0) {
+		goto fin;
+	}
+	if (new_blob != NULL && git_blob_lookup(&new_obj, blame->repo, new_blob) != 0) {
+		goto fin;
+	}
+	git_diff_options_init(&diffopts, GIT_DIFF_OPTIONS_VERSION);
+	diffopts.context_lines = 0;
+	diffopts.interhunk_lines = 0;
+	if (git_diff_blobs(old_obj, blame->path, new_obj, blame->path, &diffopts,
+		NULL, NULL, LGitBlameHunkCallback, NULL, &hunks) != 0) {
+		goto fin;
+	}
+	/* Only in the table if any lines are the child's */
+	commit_index = BLAME_UNKNOWN;
+	lines.reserve(map->lines.size());
+	for (i = 0; i < hunks.size(); i++) {
+		/* Insertions give the line they come after */
+		old_begin = hunks[i].old_lines == 0 ? hunks[i].old_start : hunks[i].old_start - 1;
+		if (old_begin < old_pos || old_begin > map->lines.size()) {
+			goto fin;
+		}
+		lines.insert(lines.end(), map->lines.begin() + old_pos, map->lines.begin() + old_begin);
+		if (hunks[i].new_lines > 0 && commit_index == BLAME_UNKNOWN) {
+			commit_index = LGitBlameAddCommit(map, git_commit_id(child), git_commit_author(child));
+		}
+		for (j = 0; j < (size_t)hunks[i].new_lines; j++) {
+			line.commit = commit_index;
+			line.orig_line = lines.size() + 1;
+			lines.push_back(line);
+		}
+		old_pos = old_begin + hunks[i].old_lines;
+	}
+	if (old_pos > map->lines.size()) {
+		goto fin;
+	}
+	lines.insert(lines.end(), map->lines.begin() + old_pos, map->lines.end());
+	map->lines.swap(lines);
+	ret = TRUE;
+fin:
+	if (old_obj != NULL) {
+		git_blob_free(old_obj);
+	}
+	if (new_obj != NULL) {
+		git_blob_free(new_obj);
+	}
+	return ret;
+}
+
+/* Shows a finished map, if it's for the file we loaded */
+static BOOL LGitBlameTake(LGitBlame *blame, LGitBlameMap *map)
+{
+	BOOL ret = FALSE;
+	EnterCriticalSection(&blame->lock);
+	if (map->lines.size() == blame->map->lines.size()) {
+		blame->map->lines.swap(map->lines);
+		blame->map->commits.swap(map->commits);
+		blame->map->names.swap(map->names);
+		blame->map->by_oid.swap(map->by_oid);
+		ret = TRUE;
+	}
+	LeaveCriticalSection(&blame->lock);
+	return ret;
+}
+
+/*
+ * Brings a cached result up to the commit we want, from the closest cached
+ * commit behind it on first parents (sorted), if any. exact is if it was
+ * cached as is. FALSE means do a full blame.
+ */
+static BOOL LGitBlameFromCache(LGitBlame *blame,
+							   git_commit *target,
+							   const std::vector<git_oid> *cached_commits,
+							   BOOL *exact)
+{
+	std::vector<git_commit*> chain;
+	LGitBlameMap cached;
+	git_commit *current = NULL, *parent;
+	git_oid old_blob, new_blob;
+	BOOL has_old, has_new, loaded, ret = FALSE;
+	size_t i, changed = 0;
+	int rc;
+
+	*exact = FALSE;
+	if (cached_commits->size() == 0) {
+		return FALSE;
+	}
+	/* Newest first, back to (not including) the cached commit */
+	if (git_commit_dup(&current, target) != 0) {
+		return FALSE;
+	}
+	while (!std::binary_search(cached_commits->begin(),
+		cached_commits->end(),
+		*git_commit_id(current),
+		LGitBlameOidLess())) {
+		if (chain.size() == BLAME_MAX_STEPS
+			|| git_commit_parentcount(current) == 0
+			|| git_commit_parent(&parent, current, 0) != 0) {
+			git_commit_free(current);
+			goto fin;
+		}
+		chain.push_back(current);
+		current = parent;
+	}
+	loaded = LGitBlameCacheLoad(blame, git_commit_id(current), &cached, &old_blob);
+	git_commit_free(current);
+	if (!loaded) {
+		goto fin;
+	}
+	has_old = TRUE;
+	for (i = chain.size(); i > 0; i--) {
+		if (blame->cancel) {
+			goto fin;
+		}
+		rc = LGitBlameBlobAt(blame, chain[i - 1], &new_blob);
+		if (rc != 0 && rc != GIT_ENOTFOUND) {
+			goto fin;
+		}
+		has_new = rc == 0;
+		if (has_old == has_new && (!has_new || git_oid_equal(&old_blob, &new_blob))) {
+			continue;
+		}
+		/* A merge's lines could have come from the other side */
+		if (git_commit_parentcount(chain[i - 1]) > 1) {
+			goto fin;
+		}
+		if (!LGitBlameApplyDiff(blame, &cached,
+			has_old ? &old_blob : NULL,
+			has_new ? &new_blob : NULL,
+			chain[i - 1])) {
+			goto fin;
+		}
+		git_oid_cpy(&old_blob, &new_blob);
+		has_old = has_new;
+		changed++;
+	}
+	/* Should be the file we loaded, but check before trusting it */
+	if (!has_old || !git_oid_equal(&old_blob, &blame->blob)) {
+		goto fin;
+	}
+	ret = LGitBlameTake(blame, &cached);
+	if (ret && chain.size() == 0) {
+		LGitLog(" ! Blame: %s from cache in %u ms\n",
+			blame->path,
+			GetTickCount() - blame->begin);
+		*exact = TRUE;
+	} else if (ret) {
+		LGitLog(" ! Blame: carried %s forward %d commits (%d changed it) in %u ms\n",
+			blame->path,
+			chain.size(),
+			changed,
+			GetTickCount() - blame->begin);
+	}
+fin:
+	for (i = 0; i < chain.size(); i++) {
+		git_commit_free(chain[i]);
+	}
+	return ret;
+}
+
+/* Blames lines min to max (1-based, 0 for all) into the map */
+static int LGitBlameRun(LGitBlame *blame, size_t min_line, size_t max_line)
+{
+	git_blame *result = NULL;
+	git_blame_options opts;
+	const git_blame_hunk *hunk;
+	LGitBlameLine line;
+	size_t i, j, index;
+	DWORD commit_index;
+	int rc;
+
+	git_blame_options_init(&opts, GIT_BLAME_OPTIONS_VERSION);
+	git_oid_cpy(&opts.newest_commit, &blame->commit);
+	opts.min_line = min_line;
+	opts.max_line = max_line;
+	if ((rc = git_blame_file(&result, blame->repo, blame->path, &opts)) != 0) {
+		return rc;
+	}
+	EnterCriticalSection(&blame->lock);
+	for (i = 0; i < git_blame_get_hunk_count(result); i++) {
+		hunk = git_blame_get_hunk_byindex(result, i);
+		commit_index = LGitBlameAddCommit(blame->map, &hunk->final_commit_id, hunk->final_signature);
+		for (j = 0; j < hunk->lines_in_hunk; j++) {
+			index = hunk->final_start_line_number - 1 + j;
+			if (index >= blame->map->lines.size()) {
+				break;
+			}
+			line.commit = commit_index;
+			line.orig_line = hunk->orig_start_line_number + j;
+			blame->map->lines[index] = line;
+		}
+	}
+	LeaveCriticalSection(&blame->lock);
+	git_blame_free(result);
+	return 0;
+}
+
+static int LGitBlameFull(LGitBlame *blame)
+{
+	LONG first = blame->visible_first, last = blame->visible_last;
+	LONG count = blame->map->lines.size();
+	int rc;
+	if (blame->cancel) {
+		return GIT_EUSER;
+	}
+	/* libgit2 can't be stopped mid-blame, so a small pass goes first */
+	if (first < 0) {
+		first = 0;
+	}
+	if (last >= count) {
+		last = count - 1;
+	}
+	if (count > BLAME_FIRST_LINES && first <= last) {
+		if ((rc = LGitBlameRun(blame, first + 1, last + 1)) != 0) {
+			return rc;
+		}
+		LGitLog(" ! Blame: lines %d-%d of %s in %u ms\n",
+			first + 1,
+			last + 1,
+			blame->path,
+			GetTickCount() - blame->begin);
+		LGitBlamePost(blame, LGDD_STREAMING);
+	}
+	if (blame->cancel) {
+		return GIT_EUSER;
+	}
+	if ((rc = LGitBlameRun(blame, 0, 0)) != 0) {
+		return rc;
+	}
+	LGitLog(" ! Blame: all %d lines of %s in %u ms\n",
+		count,
+		blame->path,
+		GetTickCount() - blame->begin);
+	return 0;
+}
+
+static unsigned __stdcall LGitBlameWorker(void *context)
+{
+	LGitBlame *blame = (LGitBlame*)context;
+	std::vector<LGitBlameCacheEntry> entries;
+	std::vector<git_oid> cached_commits;
+	git_commit *commit = NULL;
+	const git_error *gerror;
+	LONG state;
+	BOOL from_cache = FALSE;
+	size_t i;
+	int rc;
+
+	if ((rc = git_repository_open(&blame->repo, blame->repo_path)) != 0
+		|| (rc = git_commit_lookup(&commit, blame->repo, &blame->commit)) != 0
+		|| (rc = LGitBlameLoadText(blame, commit)) != 0) {
+		goto fin;
+	}
+	LGitBlamePost(blame, LGDD_STREAMING);
+	LGitBlameCacheList(blame, &entries);
+	for (i = 0; i < entries.size(); i++) {
+		cached_commits.push_back(entries[i].commit);
+	}
+	std::sort(cached_commits.begin(), cached_commits.end(), LGitBlameOidLess());
+	if (!LGitBlameFromCache(blame, commit, &cached_commits, &from_cache)) {
+		rc = LGitBlameFull(blame);
+	}
+	if (rc == 0 && !from_cache) {
+		/* The window reads the table, so it can't be renumbered under it */
+		EnterCriticalSection(&blame->lock);
+		LGitBlameCompact(blame->map);
+		LeaveCriticalSection(&blame->lock);
+		/* Nothing else changes the map, so no need to lock to read it */
+		LGitBlameCacheSave(blame, blame->map);
+	}
+fin:
+	if (commit != NULL) {
+		git_commit_free(commit);
+	}
+	if (rc == 0) {
+		state = LGDD_DONE;
+	} else if (blame->cancel) {
+		state = LGDD_CANCELLED;
+	} else {
+		/* Errors are per thread, so keep it for the window */
+		gerror = git_error_last();
+		strlcpy(blame->error,
+			gerror != NULL ? gerror->message : "libgit2 returned a null error.",
+			sizeof(blame->error));
+		LGitLog("!! Blame failed (%d): %s\n", rc, blame->error);
+		state = LGDD_FAILED;
+	}
+	blame->state = state;
+	LGitBlamePost(blame, state);
+	LGitBlameRelease(blame);
+	InterlockedDecrement((LPLONG)&blame_workers);
+	return 0;
+}
+
+/* The window is sent WM_LGIT_BLAME_LINES as lines are known, with the state */
+BOOL LGitBlameStart(LGitBlame *blame, HWND notify)
+{
+	HANDLE thread;
+	unsigned thread_id;
+	blame->notify = notify;
+	blame->cancel = 0;
+	blame->state = LGDD_STREAMING;
+	blame->error[0] = '\0';
+	blame->begin = GetTickCount();
+	/* The worker's reference; it lets go when it's done */
+	InterlockedIncrement((LPLONG)&blame->refs);
+	InterlockedIncrement((LPLONG)&blame_workers);
+	thread = (HANDLE)_beginthreadex(NULL, 0, LGitBlameWorker, blame, 0, &thread_id);
+	if (thread == NULL) {
+		LGitLog("!! Couldn't start blame worker\n");
+		InterlockedDecrement((LPLONG)&blame_workers);
+		InterlockedDecrement((LPLONG)&blame->refs);
+		blame->state = LGDD_FAILED;
+		return FALSE;
+	}
+	/* Nobody waits on it */
+	CloseHandle(thread);
+	return TRUE;
+}
+
+/* Workers can outlive their windows, but not libgit2 */
+void LGitBlameWaitAll(void)
+{
+	if (blame_workers > 0) {
+		LGitLog(" ! Waiting for %d blame workers\n", blame_workers);
+	}
+	while (blame_workers > 0) {
+		Sleep(50);
+	}
+}
+
+/* Lines (0-based) the window is showing, so they're blamed first */
+void LGitBlameSetVisible(LGitBlame *blame, LONG first, LONG last)
+{
+	InterlockedExchange((LPLONG)&blame->visible_first, first);
+	InterlockedExchange((LPLONG)&blame->visible_last, last);
+}
+
+LONG LGitBlameCount(LGitBlame *blame)
+{
+	LONG count;
+	EnterCriticalSection(&blame->lock);
+	count = blame->map->lines.size();
+	LeaveCriticalSection(&blame->lock);
+	return count;
+}
+
+/* One of LGDD_*; if failed, message gets why */
+LONG LGitBlameGetState(LGitBlame *blame, const char **message)
+{
+	if (message != NULL) {
+		*message = blame->error;
+	}
+	return blame->state;
+}
+
+/* The commit the line came from; FALSE if it isn't known (yet) */
+BOOL LGitBlameLineCommit(LGitBlame *blame, LONG index, git_oid *oid)
+{
+	BOOL ret = FALSE;
+	DWORD commit;
+	EnterCriticalSection(&blame->lock);
+	if (index >= 0 && index < (LONG)blame->map->lines.size()) {
+		commit = blame->map->lines[index].commit;
+		if (commit != BLAME_UNKNOWN) {
+			git_oid_cpy(oid, &blame->map->commits[commit].oid);
+			ret = TRUE;
+		}
+	}
+	LeaveCriticalSection(&blame->lock);
+	return ret;
+}
+
+/* The line without its ending; tabs become two spaces, like the diff window */
+static void LGitBlameLineText(LGitBlame *blame, LONG index, wchar_t *buf, size_t bufsz)
+{
+	char line[1024];
+	const char *text;
+	size_t len, i, out;
+	text = blame->text + (*blame->starts)[index];
+	len = (index + 1 < (LONG)blame->starts->size()
+		? (*blame->starts)[index + 1]
+		: blame->text_len) - (*blame->starts)[index];
+	for (i = 0, out = 0; i < len && out < sizeof(line) - 2 && out < bufsz; i++) {
+		if (text[i] == '\t') {
+			line[out++] = ' ';
+			line[out++] = ' ';
+		} else if (text[i] != '\r' && text[i] != '\n') {
+			line[out++] = text[i];
+		}
+	}
+	line[out] = '\0';
+	LGitUtf8ToWide(line, buf, bufsz);
+}
+
+/* Text for an annotate list view column, only made when it's asked for */
+BOOL LGitBlameText(LGitBlame *blame, LONG index, int column, wchar_t *buf, size_t bufsz)
+{
+	char oid_str[GIT_OID_HEXSZ + 1], name[256];
+	LGitBlameCommit commit;
+	BOOL known = FALSE;
+	ZeroMemory(&commit, sizeof(commit));
+	if (bufsz < 1) {
+		return FALSE;
+	}
+	buf[0] = L'\0';
+	EnterCriticalSection(&blame->lock);
+	if (index < 0 || index >= (LONG)blame->map->lines.size()) {
+		LeaveCriticalSection(&blame->lock);
+		return FALSE;
+	}
+	if (blame->map->lines[index].commit != BLAME_UNKNOWN) {
+		commit = blame->map->commits[blame->map->lines[index].commit];
+		strlcpy(name, blame->map->names.c_str() + commit.author, sizeof(name));
+		known = TRUE;
+	}
+	if (column == LGBL_COLUMN_TEXT) {
+		LGitBlameLineText(blame, index, buf, bufsz);
+	}
+	LeaveCriticalSection(&blame->lock);
+	switch (column) {
+	case LGBL_COLUMN_LINE:
+		_snwprintf(buf, bufsz, L"%d", index + 1);
+		buf[bufsz - 1] = L'\0';
+		break;
+	case LGBL_COLUMN_OID:
+		if (known) {
+			/* Short, the full one is in the commit info */
+			git_oid_tostr(oid_str, 9, &commit.oid);
+			LGitUtf8ToWide(oid_str, buf, bufsz);
+		}
+		break;
+	case LGBL_COLUMN_AUTHOR:
+		if (known) {
+			LGitUtf8ToWide(name, buf, bufsz);
+		}
+		break;
+	case LGBL_COLUMN_WHEN:
+		if (known) {
+			LGitTimeToStringW(&commit.when, buf, bufsz);
+		}
+		break;
+	}
+	return TRUE;
+}
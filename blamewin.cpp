@@ -0,0 +1,194 @@
+/*
+ * Annotate window: a file's lines next to the commit each came from.
+ */
+
+#include "stdafx.h"
+
+static LVCOLUMNW line_column = {
+	LVCF_TEXT | LVCF_WIDTH, 0, 50, L"Line"
+};
+static LVCOLUMNW oid_column = {
+	LVCF_TEXT | LVCF_WIDTH, 0, 65, L"Commit"
+};
+static LVCOLUMNW author_column = {
+	LVCF_TEXT | LVCF_WIDTH, 0, 125, L"Author"
+};
+static LVCOLUMNW when_column = {
+	LVCF_TEXT | LVCF_WIDTH, 0, 125, L"Authored At"
+};
+static LVCOLUMNW text_column = {
+	LVCF_TEXT | LVCF_WIDTH, 0, 400, L"Text"
+};
+
+typedef struct _LGitAnnotateDialogParams {
+	LGitContext *ctx;
+	const char *path;
+	git_oid commit;
+	LGitBlame *blame;
+} LGitAnnotateDialogParams;
+
+static void SetAnnotateTitleBar(HWND hwnd, LGitAnnotateDialogParams *params)
+{
+	wchar_t title[1024], path[512];
+	char oid_str[GIT_OID_HEXSZ + 1];
+	LGitUtf8ToWide(params->path, path, 512);
+	git_oid_tostr(oid_str, 9, &params->commit);
+	_snwprintf(title, 1024, L"Annotate %s at %S", path, oid_str);
+	title[1023] = L'\0';
+	if (params->blame != NULL
+		&& LGitBlameGetState(params->blame, NULL) == LGDD_STREAMING) {
+		wcslcat(title, L" (Blaming)", 1024);
+	}
+	SetWindowTextW(hwnd, title);
+}
+
+static void InitAnnotateView(HWND hwnd, LGitAnnotateDialogParams *params)
+{
+	HWND lv = GetDlgItem(hwnd, IDC_BLAME_LINES);
+	ListView_SetUnicodeFormat(lv, TRUE);
+	ListView_SetExtendedListViewStyle(lv, LVS_EX_FULLROWSELECT
+		| LVS_EX_HEADERDRAGDROP
+		| LVS_EX_LABELTIP);
+	SendMessage(lv, LVM_INSERTCOLUMNW, LGBL_COLUMN_LINE, (LPARAM)&line_column);
+	SendMessage(lv, LVM_INSERTCOLUMNW, LGBL_COLUMN_OID, (LPARAM)&oid_column);
+	SendMessage(lv, LVM_INSERTCOLUMNW, LGBL_COLUMN_AUTHOR, (LPARAM)&author_column);
+	SendMessage(lv, LVM_INSERTCOLUMNW, LGBL_COLUMN_WHEN, (LPARAM)&when_column);
+	SendMessage(lv, LVM_INSERTCOLUMNW, LGBL_COLUMN_TEXT, (LPARAM)&text_column);
+	LGitSetMonospaceFont(params->ctx, lv);
+}
+
+static BOOL FillAnnotateView(HWND hwnd, LGitAnnotateDialogParams *params)
+{
+	params->blame = LGitBlameNew(params->ctx->repo, params->path, &params->commit);
+	if (params->blame == NULL) {
+		LGitLog(" ! Couldn't alloc blame\n");
+		return FALSE;
+	}
+	return LGitBlameStart(params->blame, hwnd);
+}
+
+static void BlameLinesArrived(HWND hwnd, LGitAnnotateDialogParams *params, LONG state)
+{
+	HWND lv = GetDlgItem(hwnd, IDC_BLAME_LINES);
+	const char *message;
+	int count = LGitBlameCount(params->blame);
+	if (ListView_GetItemCount(lv) != count) {
+		ListView_SetItemCountEx(lv, count, LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
+	}
+	/* Lines already there may have just been blamed */
+	InvalidateRect(lv, NULL, FALSE);
+	SetAnnotateTitleBar(hwnd, params);
+	if (state == LGDD_FAILED
+		&& LGitBlameGetState(params->blame, &message) == LGDD_FAILED) {
+		MessageBoxA(hwnd, message, "Annotate", MB_ICONERROR | MB_OK);
+	}
+}
+
+static void ShowSelectedLineCommit(HWND hwnd, LGitAnnotateDialogParams *params)
+{
+	HWND lv = GetDlgItem(hwnd, IDC_BLAME_LINES);
+	int selected = ListView_GetNextItem(lv, -1, LVNI_SELECTED);
+	git_commit *commit = NULL;
+	git_oid oid;
+	if (selected == -1 || !LGitBlameLineCommit(params->blame, selected, &oid)) {
+		return;
+	}
+	if (git_commit_lookup(&commit, params->ctx->repo, &oid) != 0) {
+		LGitLibraryError(hwnd, "git_commit_lookup");
+		return;
+	}
+	LGitViewCommitInfo(params->ctx, hwnd, commit, NULL);
+	git_commit_free(commit);
+}
+
+static BOOL CALLBACK AnnotateDialogProc(HWND hwnd,
+										unsigned int iMsg,
+										WPARAM wParam,
+										LPARAM lParam)
+{
+	LGitAnnotateDialogParams *param;
+	switch (iMsg) {
+	case WM_INITDIALOG:
+		param = (LGitAnnotateDialogParams*)lParam;
+		LGitSetWindowIcon(hwnd, param->ctx->dllInst, MAKEINTRESOURCE(IDI_HISTORY));
+		SetWindowLong(hwnd, GWL_USERDATA, (long)param); /* XXX: 64-bit... */
+		InitAnnotateView(hwnd, param);
+		if (!FillAnnotateView(hwnd, param)) {
+			EndDialog(hwnd, 0);
+		}
+		SetAnnotateTitleBar(hwnd, param);
+		LGitControlFillsParentDialog(hwnd, IDC_BLAME_LINES);
+		return TRUE;
+	case WM_SIZE:
+		LGitControlFillsParentDialog(hwnd, IDC_BLAME_LINES);
+		return TRUE;
+	case WM_LGIT_BLAME_LINES:
+		param = (LGitAnnotateDialogParams*)GetWindowLong(hwnd, GWL_USERDATA);
+		BlameLinesArrived(hwnd, param, wParam);
+		return TRUE;
+	case WM_NOTIFY:
+		param = (LGitAnnotateDialogParams*)GetWindowLong(hwnd, GWL_USERDATA);
+		if (wParam != IDC_BLAME_LINES) {
+			return FALSE;
+		}
+		switch (((LPNMHDR)lParam)->code) {
+		case LVN_GETDISPINFOW:
+			{
+				NMLVDISPINFOW *di = (NMLVDISPINFOW*)lParam;
+				if (di->item.mask & LVIF_TEXT) {
+					LGitBlameText(param->blame,
+						di->item.iItem,
+						di->item.iSubItem,
+						di->item.pszText,
+						di->item.cchTextMax);
+				}
+			}
+			return TRUE;
+		case LVN_ODCACHEHINT:
+			{
+				/* What's on screen, so a full blame does those first */
+				NMLVCACHEHINT *hint = (NMLVCACHEHINT*)lParam;
+				LGitBlameSetVisible(param->blame, hint->iFrom, hint->iTo);
+			}
+			return TRUE;
+		case LVN_ITEMACTIVATE:
+			ShowSelectedLineCommit(hwnd, param);
+			return TRUE;
+		}
+		return FALSE;
+	case WM_COMMAND:
+		switch (LOWORD(wParam)) {
+		case IDOK:
+		case IDCANCEL:
+			EndDialog(hwnd, 1);
+			return TRUE;
+		}
+		return FALSE;
+	default:
+		return FALSE;
+	}
+}
+
+/* Path is relative with forward slashes; a NULL commit is HEAD */
+SCCRTN LGitAnnotate(LGitContext *ctx, HWND hwnd, const char *path, const git_oid *commit)
+{
+	LGitAnnotateDialogParams params;
+	LGitLog("**LGitAnnotate** Context=%p\n", ctx);
+	LGitLog("  path %s\n", path);
+	ZeroMemory(&params, sizeof(params));
+	params.ctx = ctx;
+	params.path = path;
+	if (commit != NULL) {
+		git_oid_cpy(&params.commit, commit);
+	} else if (git_reference_name_to_id(&params.commit, ctx->repo, "HEAD") != 0) {
+		LGitLibraryError(hwnd, "git_reference_name_to_id");
+		return SCC_E_NONSPECIFICERROR;
+	}
+	DialogBoxParamW(ctx->dllInst,
+		MAKEINTRESOURCEW(IDD_BLAME),
+		hwnd,
+		AnnotateDialogProc,
+		(LPARAM)&params);
+	LGitBlameFree(params.blame);
+	return SCC_OK;
+}
@@ -0,0 +1,499 @@
+/*
+ * Changed-path Bloom filters, so file history can skip the tree diff for
+ * commits that can't have touched the file. This is the same idea as git's
+ * commit-graph changed-path filters, but kept in our own file so cgraph.cpp
+ * doesn't have to write them; see git's technical/commit-graph docs.
+ *
+ * Each commit with one parent gets a filter of every path (and every leading
+ * directory) that changed from its parent. Filters are made the first time
+ * a file history walk gets to a commit, then saved to .git/lgit/ so the next
+ * walk doesn't have to.
+ */
+
+#include "stdafx.h"
+
+#define CHANGED_PATHS_MAGIC "LGCP"
+#define CHANGED_PATHS_VERSION 1
+
+/* git's parameters: 10 bits per entry, 7 hashes, give up past 512 paths */
+#define BITS_PER_ENTRY 10
+#define NUM_HASHES 7
+#define MAX_CHANGED_PATHS 512
+
+typedef struct _LGitChangedPathsHeader {
+	char magic[4];
+	DWORD version;
+	DWORD count;
+	DWORD data_len;
+} LGitChangedPathsHeader;
+
+/* Sorted by OID on disk */
+typedef struct _LGitChangedPathsRecord {
+	git_oid oid;
+	DWORD offset;
+	DWORD len;
+} LGitChangedPathsRecord;
+
+struct _LGitChangedPaths {
+	wchar_t path[1024];
+	/* The whole file as it was read */
+	BYTE *file;
+	LGitChangedPathsHeader *header;
+	LGitChangedPathsRecord *records;
+	BYTE *data;
+	/* Made since, keyed by raw OID bytes */
+	std::map<std::string, std::string> *added;
+	/* Statistics */
+	LONG queries, negatives, computed;
+};
+
+/* MurmurHash3 (x86, 32-bit), which is what git uses for these */
+static DWORD LGitMurmur3(DWORD seed, const BYTE *data, size_t len)
+{
+	const DWORD c1 = 0xcc9e2d51, c2 = 0x1b873593;
+	DWORD h = seed, k;
+	size_t i, blocks = len / 4;
+
+	for (i = 0; i < blocks; i++) {
+		k = data[i * 4]
+			| (data[i * 4 + 1] << 8)
+			| (data[i * 4 + 2] << 16)
+			| (data[i * 4 + 3] << 24);
+		k *= c1;
+		k = (k << 15) | (k >> 17);
+		k *= c2;
+		h ^= k;
+		h = (h << 13) | (h >> 19);
+		h = h * 5 + 0xe6546b64;
+	}
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= data[blocks * 4 + 2] << 16;
+	case 2:
+		k ^= data[blocks * 4 + 1] << 8;
+	case 1:
+		k ^= data[blocks * 4];
+		k *= c1;
+		k = (k << 15) | (k >> 17);
+		k *= c2;
+		h ^= k;
+	}
+	h ^= (DWORD)len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+ * Windows filesystems don't care about case, and neither does libgit2's
+ * pathspec matching with core.ignorecase, so neither can the filter.
+ */
+static void LGitBloomKey(const char *path, size_t len, DWORD *h1, DWORD *h2)
+{
+	BYTE folded[1024];
+	size_t i;
+	if (len > sizeof(folded)) {
+		len = sizeof(folded);
+	}
+	for (i = 0; i < len; i++) {
+		folded[i] = (BYTE)tolower((unsigned char)path[i]);
+	}
+	*h1 = LGitMurmur3(0x293ae76f, folded, len);
+	*h2 = LGitMurmur3(0x7e646e2c, folded, len);
+}
+
+static void LGitBloomAdd(BYTE *filter, DWORD len, const char *path, size_t path_len)
+{
+	DWORD h1, h2, bits = len * 8, i;
+	LGitBloomKey(path, path_len, &h1, &h2);
+	for (i = 0; i < NUM_HASHES; i++) {
+		DWORD bit = (h1 + i * h2) % bits;
+		filter[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+static BOOL LGitBloomContains(const BYTE *filter, DWORD len, const char *path)
+{
+	DWORD h1, h2, bits = len * 8, i;
+	LGitBloomKey(path, strlen(path), &h1, &h2);
+	for (i = 0; i < NUM_HASHES; i++) {
+		DWORD bit = (h1 + i * h2) % bits;
+		if (!(filter[bit / 8] & (1 << (bit % 8)))) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static BOOL LGitChangedPathsLoad(LGitChangedPaths *cp)
+{
+	HANDLE file;
+	DWORD size, read, i;
+	file = CreateFileW(cp->path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return FALSE;
+	}
+	size = GetFileSize(file, NULL);
+	if (size == 0xFFFFFFFF || size < sizeof(LGitChangedPathsHeader)) {
+		CloseHandle(file);
+		return FALSE;
+	}
+	cp->file = (BYTE*)malloc(size);
+	if (cp->file == NULL) {
+		CloseHandle(file);
+		return FALSE;
+	}
+	if (!ReadFile(file, cp->file, size, &read, NULL) || read != size) {
+		goto err;
+	}
+	CloseHandle(file);
+	cp->header = (LGitChangedPathsHeader*)cp->file;
+	/* Count is checked on its own first, so the multiply can't wrap */
+	if (memcmp(cp->header->magic, CHANGED_PATHS_MAGIC, 4) != 0
+		|| cp->header->version != CHANGED_PATHS_VERSION
+		|| cp->header->count > size / sizeof(LGitChangedPathsRecord)
+		|| sizeof(LGitChangedPathsHeader)
+			+ (cp->header->count * sizeof(LGitChangedPathsRecord))
+			+ cp->header->data_len != size) {
+		goto corrupt;
+	}
+	cp->records = (LGitChangedPathsRecord*)(cp->file + sizeof(LGitChangedPathsHeader));
+	cp->data = (BYTE*)(cp->records + cp->header->count);
+	/* Every filter has to be in the data, and have bits to hash to */
+	for (i = 0; i < cp->header->count; i++) {
+		if (cp->records[i].len == 0
+			|| cp->records[i].offset > cp->header->data_len
+			|| cp->records[i].len > cp->header->data_len - cp->records[i].offset) {
+			goto corrupt;
+		}
+	}
+	return TRUE;
+corrupt:
+	LGitLog(" ! Changed paths index is corrupt or too new, ignoring\n");
+	free(cp->file);
+	cp->file = NULL;
+	cp->header = NULL;
+	cp->records = NULL;
+	cp->data = NULL;
+	return FALSE;
+err:
+	CloseHandle(file);
+	free(cp->file);
+	cp->file = NULL;
+	return FALSE;
+}
+
+LGitChangedPaths *LGitChangedPathsOpen(git_repository *repo)
+{
+	LGitChangedPaths *cp;
+	cp = (LGitChangedPaths*)calloc(1, sizeof(LGitChangedPaths));
+	if (cp == NULL) {
+		return NULL;
+	}
+	if (!LGitGetPrivateDir(repo, cp->path, 1024)) {
+		free(cp);
+		return NULL;
+	}
+	wcslcat(cp->path, L"\\changed-paths", 1024);
+	cp->added = new std::map<std::string, std::string>();
+	if (LGitChangedPathsLoad(cp)) {
+		LGitLog(" ! Loaded %d changed path filters\n", cp->header->count);
+	}
+	return cp;
+}
+
+/* Merges what we've made with what was on disk */
+static BOOL LGitChangedPathsSave(LGitChangedPaths *cp)
+{
+	LGitChangedPathsHeader header;
+	LGitChangedPathsRecord record;
+	std::map<std::string, std::string>::iterator it;
+	DWORD old_count, i, offset, written;
+	wchar_t temp_path[1024];
+	HANDLE file;
+	BOOL ok = TRUE;
+
+	old_count = cp->header != NULL ? cp->header->count : 0;
+	memcpy(header.magic, CHANGED_PATHS_MAGIC, 4);
+	header.version = CHANGED_PATHS_VERSION;
+	header.count = old_count + cp->added->size();
+	header.data_len = cp->header != NULL ? cp->header->data_len : 0;
+	for (it = cp->added->begin(); it != cp->added->end(); it++) {
+		header.data_len += it->second.size();
+	}
+
+	wcslcpy(temp_path, cp->path, 1024);
+	wcslcat(temp_path, L".lock", 1024);
+	file = CreateFileW(temp_path, GENERIC_WRITE, 0, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		LGitLog("!! Can't write changed paths index (GLE %x)\n", GetLastError());
+		return FALSE;
+	}
+#define WRITE_OR_FAIL(ptr, len) if (ok && (!WriteFile(file, ptr, len, &written, NULL) || written != len)) ok = FALSE
+	WRITE_OR_FAIL(&header, sizeof(header));
+	/* Records, merging both sorted lists; old data comes first in the pool */
+	offset = cp->header != NULL ? cp->header->data_len : 0;
+	it = cp->added->begin();
+	i = 0;
+	while (ok && (i < old_count || it != cp->added->end())) {
+		if (it == cp->added->end()
+			|| (i < old_count && memcmp(cp->records[i].oid.id, it->first.data(), GIT_OID_RAWSZ) < 0)) {
+			WRITE_OR_FAIL(&cp->records[i], sizeof(LGitChangedPathsRecord));
+			i++;
+		} else {
+			memcpy(record.oid.id, it->first.data(), GIT_OID_RAWSZ);
+			record.offset = offset;
+			record.len = it->second.size();
+			offset += record.len;
+			WRITE_OR_FAIL(&record, sizeof(LGitChangedPathsRecord));
+			it++;
+		}
+	}
+	if (cp->header != NULL) {
+		WRITE_OR_FAIL(cp->data, cp->header->data_len);
+	}
+	for (it = cp->added->begin(); ok && it != cp->added->end(); it++) {
+		WRITE_OR_FAIL(it->second.data(), it->second.size());
+	}
+#undef WRITE_OR_FAIL
+	CloseHandle(file);
+	if (!ok) {
+		LGitLog("!! Failed writing changed paths index (GLE %x)\n", GetLastError());
+		DeleteFileW(temp_path);
+		return FALSE;
+	}
+	if (!MoveFileExW(temp_path, cp->path, MOVEFILE_REPLACE_EXISTING)) {
+		/* 9x doesn't have MoveFileEx */
+		DeleteFileW(cp->path);
+		if (!MoveFileW(temp_path, cp->path)) {
+			DeleteFileW(temp_path);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+void LGitChangedPathsClose(LGitChangedPaths *cp)
+{
+	if (cp == NULL) {
+		return;
+	}
+	LGitLog(" ! Changed paths: %d queries, %d ruled out, %d filters made\n",
+		cp->queries,
+		cp->negatives,
+		cp->computed);
+	if (cp->added->size() > 0) {
+		LGitChangedPathsSave(cp);
+	}
+	delete cp->added;
+	if (cp->file != NULL) {
+		free(cp->file);
+	}
+	free(cp);
+}
+
+static BOOL LGitChangedPathsFind(LGitChangedPaths *cp, const git_oid *oid, const BYTE **filter, DWORD *len)
+{
+	std::string key((const char*)oid->id, GIT_OID_RAWSZ);
+	std::map<std::string, std::string>::iterator it = cp->added->find(key);
+	if (it != cp->added->end()) {
+		*filter = (const BYTE*)it->second.data();
+		*len = it->second.size();
+		return TRUE;
+	}
+	if (cp->header == NULL) {
+		return FALSE;
+	}
+	LONG low = 0, high = (LONG)cp->header->count - 1;
+	while (low <= high) {
+		LONG mid = low + (high - low) / 2;
+		int cmp = git_oid_cmp(&cp->records[mid].oid, oid);
+		if (cmp == 0) {
+			*filter = cp->data + cp->records[mid].offset;
+			*len = cp->records[mid].len;
+			return TRUE;
+		} else if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return FALSE;
+}
+
+/* Filters only work for exact paths, not patterns */
+BOOL LGitChangedPathsUsable(const git_strarray *paths)
+{
+	size_t i;
+	if (paths == NULL || paths->count == 0) {
+		return FALSE;
+	}
+	for (i = 0; i < paths->count; i++) {
+		if (strpbrk(paths->strings[i], "*?[\\") != NULL) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Returns 0 if the commit definitely didn't change any of the paths since its
+ * first parent, 1 if it might have, or -1 if there's no filter for it.
+ */
+int LGitChangedPathsQuery(LGitChangedPaths *cp, const git_oid *oid, const git_strarray *paths)
+{
+	const BYTE *filter;
+	DWORD len;
+	size_t i;
+	if (!LGitChangedPathsFind(cp, oid, &filter, &len)) {
+		return -1;
+	}
+	cp->queries++;
+	for (i = 0; i < paths->count; i++) {
+		char path[1024];
+		strlcpy(path, paths->strings[i], 1024);
+		/* "dir/" is in the filter as "dir" */
+		size_t path_len = strlen(path);
+		while (path_len > 0 && path[path_len - 1] == '/') {
+			path[--path_len] = '\0';
+		}
+		if (LGitBloomContains(filter, len, path)) {
+			return 1;
+		}
+	}
+	cp->negatives++;
+	return 0;
+}
+
+typedef struct _LGitChangedPathsCollect {
+	std::set<std::string> *paths;
+	BOOL too_many;
+} LGitChangedPathsCollect;
+
+static int LGitChangedPathsFileCallback(const git_diff_delta *delta, float progress, void *payload)
+{
+	LGitChangedPathsCollect *collect = (LGitChangedPathsCollect*)payload;
+	const char *names[2];
+	int i;
+	names[0] = delta->old_file.path;
+	names[1] = delta->new_file.path;
+	for (i = 0; i < 2; i++) {
+		std::string path(names[i]);
+		/* Every leading directory changed too */
+		while (!path.empty() && collect->paths->insert(path).second) {
+			size_t slash = path.rfind('/');
+			if (slash == std::string::npos) {
+				break;
+			}
+			path.erase(slash);
+		}
+	}
+	if (collect->paths->size() > MAX_CHANGED_PATHS) {
+		collect->too_many = TRUE;
+		return GIT_EUSER;
+	}
+	return 0;
+}
+
+/*
+ * Makes the filter for a commit with one parent into filter, without adding
+ * it, so it can be called from any thread with the commit's repository. If
+ * ps isn't NULL, returns if the diff matched it the same as
+ * LGitChangedPathsQuery would, so the caller doesn't have to diff again.
+ */
+int LGitChangedPathsMake(git_commit *commit, git_pathspec *ps, std::string *filter)
+{
+	git_commit *parent = NULL;
+	git_tree *a = NULL, *b = NULL;
+	git_diff *diff = NULL;
+	git_diff_options diffopts;
+	std::set<std::string> paths;
+	std::set<std::string>::iterator it;
+	LGitChangedPathsCollect collect;
+	BYTE *bits;
+	DWORD len;
+	int rc, ret = -1;
+
+	if (git_commit_parentcount(commit) != 1) {
+		return -1;
+	}
+	if (git_commit_parent(&parent, commit, 0) != 0
+		|| git_commit_tree(&a, parent) != 0
+		|| git_commit_tree(&b, commit) != 0) {
+		goto fin;
+	}
+	git_diff_options_init(&diffopts, GIT_DIFF_OPTIONS_VERSION);
+	if (git_diff_tree_to_tree(&diff, git_commit_owner(commit), a, b, &diffopts) != 0) {
+		goto fin;
+	}
+	collect.paths = &paths;
+	collect.too_many = FALSE;
+	rc = git_diff_foreach(diff, LGitChangedPathsFileCallback, NULL, NULL, NULL, &collect);
+	if (rc != 0 && !collect.too_many) {
+		goto fin;
+	}
+	if (collect.too_many) {
+		/* Like git, a single all-ones byte means "anything" */
+		filter->assign(1, (char)0xff);
+	} else {
+		len = (paths.size() * BITS_PER_ENTRY + 7) / 8;
+		if (len == 0) {
+			len = 1;
+		}
+		bits = (BYTE*)calloc(len, 1);
+		if (bits == NULL) {
+			goto fin;
+		}
+		for (it = paths.begin(); it != paths.end(); it++) {
+			LGitBloomAdd(bits, len, it->c_str(), it->size());
+		}
+		filter->assign((const char*)bits, len);
+		free(bits);
+	}
+	if (ps == NULL) {
+		ret = 1;
+	} else {
+		/* The diff's already here; no need for the filter's false positives */
+		rc = git_pathspec_match_diff(NULL, diff, GIT_PATHSPEC_NO_MATCH_ERROR, ps);
+		ret = rc == 0 ? 1 : (rc == GIT_ENOTFOUND ? 0 : -1);
+	}
+fin:
+	if (diff != NULL) {
+		git_diff_free(diff);
+	}
+	if (a != NULL) {
+		git_tree_free(a);
+	}
+	if (b != NULL) {
+		git_tree_free(b);
+	}
+	if (parent != NULL) {
+		git_commit_free(parent);
+	}
+	return ret;
+}
+
+/* Keeps a filter from LGitChangedPathsMake, to be saved on close */
+void LGitChangedPathsAdd(LGitChangedPaths *cp, const git_oid *oid, const std::string &filter)
+{
+	(*cp->added)[std::string((const char*)oid->id, GIT_OID_RAWSZ)] = filter;
+	cp->computed++;
+}
+
+/* Makes and keeps the filter for a commit; see LGitChangedPathsMake */
+int LGitChangedPathsCompute(LGitChangedPaths *cp, git_commit *commit, git_pathspec *ps)
+{
+	std::string filter;
+	int ret = LGitChangedPathsMake(commit, ps, &filter);
+	/* Only empty if it failed before the filter was made */
+	if (!filter.empty()) {
+		LGitChangedPathsAdd(cp, git_commit_id(commit), filter);
+	}
+	return ret;
+}
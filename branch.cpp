@@ -154,6 +154,34 @@ static void InitBranchView(HWND hwnd, LGitBranchDialogParams* params)
 	ListView_SetImageList(lv, params->ctx->refTypeIl, LVSIL_SMALL);
 }
 
+/* For local branches with an upstream, i.e. ", 2 ahead, 1 behind" */
+static void AppendAheadBehind(LGitContext *ctx,
+							  LGitCommitGraph *graph,
+							  git_reference *ref,
+							  wchar_t *buf,
+							  size_t bufsz)
+{
+	git_reference *upstream = NULL;
+	const git_oid *local_oid, *upstream_oid;
+	size_t ahead, behind;
+	wchar_t counts[64];
+	if (git_branch_upstream(&upstream, ref) != 0) {
+		return;
+	}
+	local_oid = git_reference_target(ref);
+	upstream_oid = git_reference_target(upstream);
+	if (local_oid != NULL && upstream_oid != NULL
+		&& LGitAheadBehind(ctx->repo, graph, &ahead, &behind, local_oid, upstream_oid) == 0) {
+		if (ahead == 0 && behind == 0) {
+			wcslcat(buf, L", Up to Date", bufsz);
+		} else {
+			_snwprintf(counts, 64, L", %u ahead, %u behind", ahead, behind);
+			wcslcat(buf, counts, bufsz);
+		}
+	}
+	git_reference_free(upstream);
+}
+
 static void FillBranchView(HWND hwnd, LGitBranchDialogParams *params)
 {
 	HWND lv = GetDlgItem(hwnd, IDC_BRANCH_LIST);
@@ -162,11 +190,14 @@ static void FillBranchView(HWND hwnd, LGitBranchDialogParams *params)
 	ListView_DeleteAllItems(lv);
 	git_reference_iterator *iter = NULL;
 	git_reference *ref = NULL;
+	LGitCommitGraph *graph = NULL;
 	int rc;
 	if (git_reference_iterator_new(&iter, params->ctx->repo) != 0) {
 		LGitLibraryError(hwnd, "git_reference_iterator_new");
 		return;
 	}
+	/* Makes ahead/behind cheap; without it, it's libgit2 walking commits */
+	graph = LGitCommitGraphOpen(params->ctx->repo);
 	LVITEMW lvi;
 	while ((rc = git_reference_next(&ref, iter)) == 0) {
 		wchar_t name_utf16[128];
@@ -196,18 +227,22 @@ static void FillBranchView(HWND hwnd, LGitBranchDialogParams *params)
 		LGitUtf8ToWide(git_reference_name(ref), name_utf16, 128);
 		lvi.pszText = name_utf16;
 		SendMessage(lv, LVM_SETITEMW, 0, (LPARAM)&lvi);
-		wchar_t type_str[32];
-		ZeroMemory(type_str, 32);
+		wchar_t type_str[64];
+		ZeroMemory(type_str, sizeof(type_str));
 		if (git_branch_is_checked_out(ref)) {
-			wcslcat(type_str, L", Checked Out", 32);
+			wcslcat(type_str, L", Checked Out", 64);
 		}
 		if (git_branch_is_head(ref)) {
-			wcslcat(type_str, L", HEAD", 32);
+			wcslcat(type_str, L", HEAD", 64);
+		}
+		if (git_reference_is_branch(ref)) {
+			AppendAheadBehind(params->ctx, graph, ref, type_str, 64);
 		}
 		lvi.iSubItem = 2;
 		lvi.pszText = (wchar_t*)(type_str[0] == L',' ? type_str + 2 : type_str);
 		SendMessage(lv, LVM_SETITEMW, 0, (LPARAM)&lvi);
 	}
+	LGitCommitGraphClose(graph);
 	if (rc != GIT_ITEROVER) {
 		LGitLibraryError(hwnd, "git_reference_next");
 		return;
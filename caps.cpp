@@ -24,8 +24,8 @@ LONG LGitGetCaps(void)
 		| SCC_CAP_GETCOMMANDOPTIONS
 		/* SccQueryInfo */
 		| SCC_CAP_QUERYINFO
-		/* SccGetEvents; Not support, may not make sense */
-		/* | SCC_CAP_GETEVENTS */
+		/* SccGetEvents; fed by a watcher thread, see events.cpp */
+		| SCC_CAP_GETEVENTS
 		/* SccGetProjPath */
 		| SCC_CAP_GETPROJPATH
 		/* SccAddFromScc; "share" in IDE */
@@ -96,8 +96,8 @@ SCCEXTERNC SCCRTN EXTFUN __cdecl SccGetExtendedCapabilities (LPVOID pContext,
 	case SCC_EXCAP_ENUM_CHANGED_FILES:
 		/* SccEnumChangedFiles */
 		LGitLog("  SCC_EXCAP_ENUM_CHANGED_FILES\n");
-		/* We support this, but the semantics VS wants are hard w/ git. */
-		*pbSupported = FALSE;
+		/* Against the upstream branch as of the last fetch */
+		*pbSupported = TRUE;
 		break;
 	case SCC_EXCAP_POPULATELIST_DIR:
 		/* SccPopulateDirList */
@@ -168,8 +168,8 @@ SCCRTN SccSetOption (LPVOID context,
 		return SCC_I_SHARESUBPROJOK;
 	case SCC_OPT_EVENTQUEUE:
 		LGitLog("  SCC_OPT_EVENTQUEUE <- %x\n", dwVal);
-		// Don't care
-		return SCC_E_OPNOTSUPPORTED;
+		LGitEventsEnable(ctx, dwVal == SCC_OPT_EQ_ENABLE);
+		return SCC_OK;
 	case SCC_OPT_SCCCHECKOUTONLY:
 		LGitLog("  SCC_OPT_SCCCHECKOUTONLY <- %x\n", dwVal);
 		/* We don't offer "checkout" through RunScc */
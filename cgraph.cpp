@@ -0,0 +1,1390 @@
+/*
+ * Commit-graph support. git can keep the parents, root tree, commit time and
+ * generation number of every commit in objects/info/commit-graph, which is
+ * enough to walk history without inflating any commit objects. We use it
+ * when it's there, and write it after commits and fetches so it stays that
+ * way; see git's technical/commit-graph-format docs for the layout.
+ *
+ * Only the single file form is handled. A split graph (commit-graph-chain),
+ * or a file with chunks we don't know how to write, means git is already
+ * maintaining it, and the writer leaves it alone.
+ */
+
+#include "stdafx.h"
+
+#define GRAPH_SIGNATURE "CGPH"
+#define GRAPH_VERSION 1
+#define GRAPH_HASH_SHA1 1
+
+#define CHUNK_OIDF 0x4f494446
+#define CHUNK_OIDL 0x4f49444c
+#define CHUNK_CDAT 0x43444154
+#define CHUNK_EDGE 0x45444745
+
+#define HEADER_SIZE 8
+#define CHUNK_ENTRY_SIZE 12
+#define FANOUT_SIZE (256 * 4)
+#define CDAT_ENTRY_SIZE (GIT_OID_RAWSZ + 16)
+
+#define PARENT_NONE 0x70000000
+#define PARENT_EXTRA_EDGES 0x80000000
+#define EDGE_LAST 0x80000000
+#define GENERATION_MAX 0x3FFFFFFF
+
+struct _LGitCommitGraph {
+	HANDLE file, mapping;
+	const BYTE *data;
+	DWORD size;
+	DWORD count;
+	/* Chunks, pointing into the mapping */
+	const BYTE *fanout, *oids, *commits, *edges;
+	DWORD edge_count;
+	/* Has chunks we wouldn't write back out */
+	BOOL foreign_chunks;
+};
+
+static DWORD LGitGetBE32(const BYTE *p)
+{
+	return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) | ((DWORD)p[2] << 8) | p[3];
+}
+
+static void LGitPutBE32(BYTE *p, DWORD value)
+{
+	p[0] = (BYTE)(value >> 24);
+	p[1] = (BYTE)(value >> 16);
+	p[2] = (BYTE)(value >> 8);
+	p[3] = (BYTE)value;
+}
+
+static BOOL LGitCommitGraphPath(git_repository *repo, const char *name, wchar_t *buf, size_t bufsz)
+{
+	char path[1024];
+	/* Worktrees share the objects directory */
+	strlcpy(path, git_repository_commondir(repo), 1024);
+	strlcat(path, "objects/info/", 1024);
+	strlcat(path, name, 1024);
+	LGitTranslateStringChars(path, '/', '\\');
+	return LGitUtf8ToWide(path, buf, bufsz) > 0;
+}
+
+static BOOL LGitCommitGraphEnabled(git_repository *repo)
+{
+	git_config *config = NULL;
+	int enabled = 1;
+	if (git_repository_config_snapshot(&config, repo) == 0) {
+		/* Left alone if it isn't set; git defaults to on */
+		git_config_get_bool(&enabled, config, "core.commitGraph");
+		git_config_free(config);
+	}
+	return enabled;
+}
+
+void LGitCommitGraphClose(LGitCommitGraph *graph)
+{
+	if (graph == NULL) {
+		return;
+	}
+	if (graph->data != NULL) {
+		UnmapViewOfFile(graph->data);
+	}
+	if (graph->mapping != NULL) {
+		CloseHandle(graph->mapping);
+	}
+	if (graph->file != INVALID_HANDLE_VALUE) {
+		CloseHandle(graph->file);
+	}
+	free(graph);
+}
+
+/* Returns NULL if there's no usable commit-graph; callers fall back */
+LGitCommitGraph *LGitCommitGraphOpen(git_repository *repo)
+{
+	LGitCommitGraph *graph;
+	wchar_t path[1024];
+	const BYTE *entry;
+	DWORD size_high, chunks, i, id, offset, next, len;
+	DWORD oids_len = 0, commits_len = 0;
+
+	if (!LGitCommitGraphEnabled(repo)
+		|| !LGitCommitGraphPath(repo, "commit-graph", path, 1024)) {
+		return NULL;
+	}
+	graph = (LGitCommitGraph*)calloc(1, sizeof(LGitCommitGraph));
+	if (graph == NULL) {
+		return NULL;
+	}
+	/* Share delete, so the writer can replace it under us */
+	graph->file = CreateFileW(path,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+	if (graph->file == INVALID_HANDLE_VALUE) {
+		/* The usual case for most repositories */
+		goto fail;
+	}
+	graph->size = GetFileSize(graph->file, &size_high);
+	if (graph->size == 0xFFFFFFFF || size_high != 0
+		|| graph->size < HEADER_SIZE + CHUNK_ENTRY_SIZE + GIT_OID_RAWSZ) {
+		goto corrupt;
+	}
+	graph->mapping = CreateFileMappingW(graph->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (graph->mapping == NULL) {
+		LGitLog("!! Can't map commit-graph (GLE %x)\n", GetLastError());
+		goto fail;
+	}
+	graph->data = (const BYTE*)MapViewOfFile(graph->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (graph->data == NULL) {
+		LGitLog("!! Can't map commit-graph (GLE %x)\n", GetLastError());
+		goto fail;
+	}
+	if (memcmp(graph->data, GRAPH_SIGNATURE, 4) != 0
+		|| graph->data[4] != GRAPH_VERSION
+		|| graph->data[5] != GRAPH_HASH_SHA1
+		|| graph->data[7] != 0) {
+		/* Last one is the count of base graphs; only in split graphs */
+		goto corrupt;
+	}
+	chunks = graph->data[6];
+	if (HEADER_SIZE + (chunks + 1) * CHUNK_ENTRY_SIZE > graph->size - GIT_OID_RAWSZ) {
+		goto corrupt;
+	}
+	for (i = 0; i < chunks; i++) {
+		entry = graph->data + HEADER_SIZE + i * CHUNK_ENTRY_SIZE;
+		id = LGitGetBE32(entry);
+		offset = LGitGetBE32(entry + 8);
+		/* The table ends with an entry for where the last chunk ends */
+		next = LGitGetBE32(entry + CHUNK_ENTRY_SIZE + 8);
+		if (LGitGetBE32(entry + 4) != 0
+			|| LGitGetBE32(entry + CHUNK_ENTRY_SIZE + 4) != 0
+			|| offset > next
+			|| next > graph->size - GIT_OID_RAWSZ) {
+			goto corrupt;
+		}
+		len = next - offset;
+		switch (id) {
+		case CHUNK_OIDF:
+			if (len != FANOUT_SIZE) {
+				goto corrupt;
+			}
+			graph->fanout = graph->data + offset;
+			break;
+		case CHUNK_OIDL:
+			graph->oids = graph->data + offset;
+			oids_len = len;
+			break;
+		case CHUNK_CDAT:
+			graph->commits = graph->data + offset;
+			commits_len = len;
+			break;
+		case CHUNK_EDGE:
+			graph->edges = graph->data + offset;
+			graph->edge_count = len / 4;
+			break;
+		default:
+			graph->foreign_chunks = TRUE;
+			break;
+		}
+	}
+	if (graph->fanout == NULL || graph->oids == NULL || graph->commits == NULL) {
+		goto corrupt;
+	}
+	graph->count = LGitGetBE32(graph->fanout + 255 * 4);
+	if (graph->count > graph->size / CDAT_ENTRY_SIZE
+		|| oids_len != graph->count * GIT_OID_RAWSZ
+		|| commits_len != graph->count * CDAT_ENTRY_SIZE) {
+		goto corrupt;
+	}
+	return graph;
+corrupt:
+	LGitLog("!! Commit-graph is unusable, ignoring it\n");
+fail:
+	LGitCommitGraphClose(graph);
+	return NULL;
+}
+
+DWORD LGitCommitGraphCount(LGitCommitGraph *graph)
+{
+	return graph->count;
+}
+
+BOOL LGitCommitGraphFind(LGitCommitGraph *graph, const git_oid *oid, DWORD *pos)
+{
+	DWORD lo, hi, mid;
+	int cmp;
+	lo = oid->id[0] == 0 ? 0 : LGitGetBE32(graph->fanout + (oid->id[0] - 1) * 4);
+	hi = LGitGetBE32(graph->fanout + oid->id[0] * 4);
+	if (hi > graph->count) {
+		return FALSE;
+	}
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = memcmp(oid->id, graph->oids + mid * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+		if (cmp == 0) {
+			*pos = mid;
+			return TRUE;
+		} else if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return FALSE;
+}
+
+void LGitCommitGraphOid(LGitCommitGraph *graph, DWORD pos, git_oid *oid)
+{
+	git_oid_fromraw(oid, graph->oids + pos * GIT_OID_RAWSZ);
+}
+
+void LGitCommitGraphTree(LGitCommitGraph *graph, DWORD pos, git_oid *tree)
+{
+	git_oid_fromraw(tree, graph->commits + pos * CDAT_ENTRY_SIZE);
+}
+
+/* Zero means the writer didn't compute it (old versions of git) */
+DWORD LGitCommitGraphGeneration(LGitCommitGraph *graph, DWORD pos)
+{
+	return LGitGetBE32(graph->commits + pos * CDAT_ENTRY_SIZE + GIT_OID_RAWSZ + 8) >> 2;
+}
+
+/* Committer time, like git_commit_time */
+git_time_t LGitCommitGraphTime(LGitCommitGraph *graph, DWORD pos)
+{
+	const BYTE *entry = graph->commits + pos * CDAT_ENTRY_SIZE + GIT_OID_RAWSZ + 8;
+	return ((git_time_t)(LGitGetBE32(entry) & 3) << 32) | LGitGetBE32(entry + 4);
+}
+
+/*
+ * Fills in up to max parent positions, returning how many parents there are
+ * in all, or -1 if the graph is corrupt.
+ */
+int LGitCommitGraphParents(LGitCommitGraph *graph, DWORD pos, DWORD *parents, int max)
+{
+	const BYTE *entry = graph->commits + pos * CDAT_ENTRY_SIZE + GIT_OID_RAWSZ;
+	DWORD parent1, parent2, edge, value;
+	int count = 0;
+
+	parent1 = LGitGetBE32(entry);
+	parent2 = LGitGetBE32(entry + 4);
+	if (parent1 == PARENT_NONE) {
+		return 0;
+	} else if (parent1 >= graph->count) {
+		return -1;
+	}
+	if (count < max) {
+		parents[count] = parent1;
+	}
+	count++;
+	if (parent2 == PARENT_NONE) {
+		return count;
+	} else if (!(parent2 & PARENT_EXTRA_EDGES)) {
+		if (parent2 >= graph->count) {
+			return -1;
+		}
+		if (count < max) {
+			parents[count] = parent2;
+		}
+		return count + 1;
+	}
+	/* Octopus merges keep the rest of their parents in the edge list */
+	for (edge = parent2 & ~PARENT_EXTRA_EDGES; ; edge++) {
+		if (edge >= graph->edge_count) {
+			return -1;
+		}
+		value = LGitGetBE32(graph->edges + edge * 4);
+		if ((value & ~EDGE_LAST) >= graph->count) {
+			return -1;
+		}
+		if (count < max) {
+			parents[count] = value & ~EDGE_LAST;
+		}
+		count++;
+		if (value & EDGE_LAST) {
+			break;
+		}
+	}
+	return count;
+}
+
+/* Same, but grows the vector to fit (it must start non-empty) */
+static int LGitCommitGraphParentsV(LGitCommitGraph *graph, DWORD pos, std::vector<DWORD> &parents)
+{
+	int count = LGitCommitGraphParents(graph, pos, &parents[0], (int)parents.size());
+	if (count > (int)parents.size()) {
+		parents.resize(count);
+		count = LGitCommitGraphParents(graph, pos, &parents[0], (int)parents.size());
+	}
+	return count;
+}
+
+/*
+ * Walker, newest commit first like GIT_SORT_TIME. Commits in the graph never
+ * get looked up; ones made since it was written do, like a revwalk would.
+ *
+ * Topological walks are still by time, but a commit is held back until all
+ * of its children are out, like git's incremental topo order. Children
+ * always have a higher generation, so exploring ahead down to a commit's
+ * generation is enough to know how many children it has left.
+ */
+typedef struct _LGitGraphWalkItem {
+	DWORD generation;
+	git_time_t time;
+	git_oid oid;
+	DWORD pos;
+} LGitGraphWalkItem;
+
+struct LGitGraphWalkOlder {
+	bool operator()(const LGitGraphWalkItem &a, const LGitGraphWalkItem &b) const
+	{
+		return a.time < b.time;
+	}
+};
+
+struct LGitGraphWalkLower {
+	bool operator()(const LGitGraphWalkItem &a, const LGitGraphWalkItem &b) const
+	{
+		return a.generation < b.generation;
+	}
+};
+
+typedef std::priority_queue<LGitGraphWalkItem,
+	std::vector<LGitGraphWalkItem>,
+	LGitGraphWalkOlder> LGitGraphWalkQueue;
+
+typedef std::priority_queue<LGitGraphWalkItem,
+	std::vector<LGitGraphWalkItem>,
+	LGitGraphWalkLower> LGitGraphExploreQueue;
+
+struct _LGitGraphWalk {
+	git_repository *repo;
+	LGitCommitGraph *graph;
+	/* Ready to come out */
+	LGitGraphWalkQueue *queue;
+	/* Already queued; by position if in the graph, else by raw OID */
+	std::vector<bool> *seen_pos;
+	std::set<std::string> *seen;
+	std::vector<DWORD> *parents;
+	/* Topological walks only */
+	BOOL topological;
+	/* Found, but their parents not counted yet; highest generation first */
+	LGitGraphExploreQueue *explore;
+	/* One more than the children not out yet, or 0 if not found yet */
+	std::vector<LONG> *indegree_pos;
+	std::map<std::string, LONG> *indegree;
+	/* Of commits that aren't in the graph */
+	std::map<std::string, DWORD> *generations;
+	/* Pushed, to queue once their children have been counted */
+	std::vector<LGitGraphWalkItem> *starts;
+	/* Statistics */
+	LONG from_graph, inflated;
+};
+
+/*
+ * graph can be NULL, in which case it's a slower revwalk. Topological is
+ * like adding GIT_SORT_TOPOLOGICAL, which drawing the graph needs.
+ */
+LGitGraphWalk *LGitGraphWalkNew(git_repository *repo, LGitCommitGraph *graph, BOOL topological)
+{
+	LGitGraphWalk *walk;
+	walk = (LGitGraphWalk*)calloc(1, sizeof(LGitGraphWalk));
+	if (walk == NULL) {
+		return NULL;
+	}
+	/* Written by a git too old to number generations; no use for ordering */
+	if (topological && graph != NULL && graph->count > 0
+		&& LGitCommitGraphGeneration(graph, 0) == 0) {
+		LGitLog(" ! Graph walk: no generations, not using the commit-graph\n");
+		graph = NULL;
+	}
+	walk->repo = repo;
+	walk->topological = topological;
+	walk->graph = graph;
+	walk->queue = new LGitGraphWalkQueue();
+	walk->seen_pos = new std::vector<bool>(graph != NULL ? graph->count : 0, false);
+	walk->seen = new std::set<std::string>();
+	walk->parents = new std::vector<DWORD>(16);
+	walk->explore = new LGitGraphExploreQueue();
+	walk->indegree_pos = new std::vector<LONG>(topological && graph != NULL ? graph->count : 0, 0);
+	walk->indegree = new std::map<std::string, LONG>();
+	walk->generations = new std::map<std::string, DWORD>();
+	walk->starts = new std::vector<LGitGraphWalkItem>();
+	return walk;
+}
+
+void LGitGraphWalkFree(LGitGraphWalk *walk)
+{
+	if (walk == NULL) {
+		return;
+	}
+	LGitLog(" ! Graph walk: %d commits from graph, %d inflated\n",
+		walk->from_graph,
+		walk->inflated);
+	delete walk->queue;
+	delete walk->seen_pos;
+	delete walk->seen;
+	delete walk->parents;
+	delete walk->explore;
+	delete walk->indegree_pos;
+	delete walk->indegree;
+	delete walk->generations;
+	delete walk->starts;
+	free(walk);
+}
+
+static void LGitGraphWalkItemAt(LGitGraphWalk *walk, DWORD pos, LGitGraphWalkItem *item)
+{
+	item->pos = pos;
+	item->generation = LGitCommitGraphGeneration(walk->graph, pos);
+	item->time = LGitCommitGraphTime(walk->graph, pos);
+	LGitCommitGraphOid(walk->graph, pos, &item->oid);
+}
+
+static void LGitGraphWalkEnqueuePos(LGitGraphWalk *walk, DWORD pos)
+{
+	LGitGraphWalkItem item;
+	if ((*walk->seen_pos)[pos]) {
+		return;
+	}
+	(*walk->seen_pos)[pos] = true;
+	LGitGraphWalkItemAt(walk, pos, &item);
+	walk->queue->push(item);
+}
+
+/*
+ * Generation of a commit that isn't in the graph, worked out from its
+ * parents like the writer does. Those are only ones made since the graph
+ * was written, so there aren't usually many. Parents that can't be loaded
+ * (i.e. cut off by a shallow clone) count as roots.
+ */
+static int LGitGraphWalkGeneration(LGitGraphWalk *walk, const git_oid *oid, DWORD *generation)
+{
+	std::map<std::string, DWORD>::iterator it;
+	std::vector<git_oid> pending;
+	git_commit *commit = NULL;
+	const git_oid *parent;
+	std::string key;
+	DWORD pos, parent_generation, max_generation;
+	unsigned int i, count;
+	BOOL ready;
+	int rc;
+
+	pending.push_back(*oid);
+	while (!pending.empty()) {
+		key.assign((const char*)pending.back().id, GIT_OID_RAWSZ);
+		if (walk->generations->find(key) != walk->generations->end()) {
+			pending.pop_back();
+			continue;
+		}
+		if ((rc = git_commit_lookup(&commit, walk->repo, &pending.back())) != 0) {
+			if (pending.size() == 1) {
+				return rc;
+			}
+			(*walk->generations)[key] = 0;
+			pending.pop_back();
+			continue;
+		}
+		ready = TRUE;
+		max_generation = 0;
+		count = git_commit_parentcount(commit);
+		for (i = 0; i < count; i++) {
+			parent = git_commit_parent_id(commit, i);
+			if (walk->graph != NULL && LGitCommitGraphFind(walk->graph, parent, &pos)) {
+				parent_generation = LGitCommitGraphGeneration(walk->graph, pos);
+			} else {
+				it = walk->generations->find(std::string((const char*)parent->id, GIT_OID_RAWSZ));
+				if (it == walk->generations->end()) {
+					pending.push_back(*parent);
+					ready = FALSE;
+					continue;
+				}
+				parent_generation = it->second;
+			}
+			if (parent_generation > max_generation) {
+				max_generation = parent_generation;
+			}
+		}
+		git_commit_free(commit);
+		if (ready) {
+			(*walk->generations)[key] = max_generation + 1;
+			pending.pop_back();
+		}
+	}
+	key.assign((const char*)oid->id, GIT_OID_RAWSZ);
+	*generation = (*walk->generations)[key];
+	return 0;
+}
+
+static int LGitGraphWalkEnqueue(LGitGraphWalk *walk, const git_oid *oid)
+{
+	LGitGraphWalkItem item;
+	git_commit *commit = NULL;
+	std::string key;
+	int rc;
+	if (walk->graph != NULL && LGitCommitGraphFind(walk->graph, oid, &item.pos)) {
+		LGitGraphWalkEnqueuePos(walk, item.pos);
+		return 0;
+	}
+	key.assign((const char*)oid->id, GIT_OID_RAWSZ);
+	if (walk->seen->find(key) != walk->seen->end()) {
+		return 0;
+	}
+	if ((rc = git_commit_lookup(&commit, walk->repo, oid)) != 0) {
+		return rc;
+	}
+	walk->seen->insert(key);
+	item.pos = LGIT_GRAPH_NONE;
+	item.generation = 0;
+	item.time = git_commit_time(commit);
+	git_oid_cpy(&item.oid, oid);
+	git_commit_free(commit);
+	walk->queue->push(item);
+	return 0;
+}
+
+/* Any commit, in the graph or not, with its generation */
+static int LGitGraphWalkItemFor(LGitGraphWalk *walk, const git_oid *oid, LGitGraphWalkItem *item)
+{
+	git_commit *commit = NULL;
+	DWORD pos;
+	int rc;
+	if (walk->graph != NULL && LGitCommitGraphFind(walk->graph, oid, &pos)) {
+		LGitGraphWalkItemAt(walk, pos, item);
+		return 0;
+	}
+	if ((rc = git_commit_lookup(&commit, walk->repo, oid)) != 0) {
+		return rc;
+	}
+	item->pos = LGIT_GRAPH_NONE;
+	item->time = git_commit_time(commit);
+	git_oid_cpy(&item->oid, oid);
+	git_commit_free(commit);
+	return LGitGraphWalkGeneration(walk, oid, &item->generation);
+}
+
+/* Parents cut off by a shallow clone are left out, like they're roots */
+static int LGitGraphWalkParentItems(LGitGraphWalk *walk,
+									const LGitGraphWalkItem *item,
+									std::vector<LGitGraphWalkItem> *parents)
+{
+	LGitGraphWalkItem parent;
+	git_commit *commit = NULL;
+	unsigned int i, count;
+	int rc;
+
+	parents->clear();
+	if (item->pos != LGIT_GRAPH_NONE) {
+		rc = LGitCommitGraphParentsV(walk->graph, item->pos, *walk->parents);
+		if (rc < 0) {
+			git_error_set_str(GIT_ERROR_INVALID, "The commit-graph is corrupt.");
+			return -1;
+		}
+		for (i = 0; i < (unsigned int)rc; i++) {
+			LGitGraphWalkItemAt(walk, (*walk->parents)[i], &parent);
+			parents->push_back(parent);
+		}
+		return 0;
+	}
+	if ((rc = git_commit_lookup(&commit, walk->repo, &item->oid)) != 0) {
+		return rc;
+	}
+	count = git_commit_parentcount(commit);
+	for (i = 0; i < count; i++) {
+		rc = LGitGraphWalkItemFor(walk, git_commit_parent_id(commit, i), &parent);
+		if (rc == GIT_ENOTFOUND) {
+			continue;
+		} else if (rc != 0) {
+			git_commit_free(commit);
+			return rc;
+		}
+		parents->push_back(parent);
+	}
+	git_commit_free(commit);
+	return 0;
+}
+
+static LONG *LGitGraphWalkIndegree(LGitGraphWalk *walk, const LGitGraphWalkItem *item)
+{
+	if (item->pos != LGIT_GRAPH_NONE) {
+		return &(*walk->indegree_pos)[item->pos];
+	}
+	return &(*walk->indegree)[std::string((const char*)item->oid.id, GIT_OID_RAWSZ)];
+}
+
+/* Counts the children of everything at or above min_generation */
+static int LGitGraphWalkExplore(LGitGraphWalk *walk, DWORD min_generation)
+{
+	std::vector<LGitGraphWalkItem> parents;
+	LGitGraphWalkItem item;
+	LONG *indegree;
+	size_t i;
+	int rc;
+
+	while (!walk->explore->empty() && walk->explore->top().generation >= min_generation) {
+		item = walk->explore->top();
+		walk->explore->pop();
+		if ((rc = LGitGraphWalkParentItems(walk, &item, &parents)) != 0) {
+			return rc;
+		}
+		for (i = 0; i < parents.size(); i++) {
+			indegree = LGitGraphWalkIndegree(walk, &parents[i]);
+			if (*indegree == 0) {
+				*indegree = 2;
+				walk->explore->push(parents[i]);
+			} else {
+				(*indegree)++;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Topological walks can't queue a start until they know nothing reaches it */
+static int LGitGraphWalkStart(LGitGraphWalk *walk, const git_oid *oid)
+{
+	LGitGraphWalkItem item;
+	LONG *indegree;
+	int rc;
+	if (!walk->topological) {
+		return LGitGraphWalkEnqueue(walk, oid);
+	}
+	if ((rc = LGitGraphWalkItemFor(walk, oid, &item)) != 0) {
+		return rc;
+	}
+	indegree = LGitGraphWalkIndegree(walk, &item);
+	if (*indegree == 0) {
+		*indegree = 1;
+		walk->explore->push(item);
+		walk->starts->push_back(item);
+	}
+	return 0;
+}
+
+static int LGitGraphWalkNextTopological(LGitGraphWalk *walk, git_oid *oid, DWORD *pos)
+{
+	std::vector<LGitGraphWalkItem> parents;
+	LGitGraphWalkItem item;
+	LONG *indegree;
+	DWORD min_generation;
+	size_t i;
+	int rc;
+
+	if (walk->starts->size() > 0) {
+		/* One start could be behind another */
+		min_generation = (*walk->starts)[0].generation;
+		for (i = 1; i < walk->starts->size(); i++) {
+			min_generation = min(min_generation, (*walk->starts)[i].generation);
+		}
+		if ((rc = LGitGraphWalkExplore(walk, min_generation)) != 0) {
+			return rc;
+		}
+		for (i = 0; i < walk->starts->size(); i++) {
+			if (*LGitGraphWalkIndegree(walk, &(*walk->starts)[i]) == 1) {
+				walk->queue->push((*walk->starts)[i]);
+			}
+		}
+		walk->starts->clear();
+	}
+	if (walk->queue->empty()) {
+		return GIT_ITEROVER;
+	}
+	item = walk->queue->top();
+	walk->queue->pop();
+	if ((rc = LGitGraphWalkParentItems(walk, &item, &parents)) != 0) {
+		return rc;
+	}
+	for (i = 0; i < parents.size(); i++) {
+		/* Then every child it has has been counted */
+		if ((rc = LGitGraphWalkExplore(walk, parents[i].generation)) != 0) {
+			return rc;
+		}
+		indegree = LGitGraphWalkIndegree(walk, &parents[i]);
+		if (--(*indegree) == 1) {
+			walk->queue->push(parents[i]);
+		}
+	}
+	if (item.pos != LGIT_GRAPH_NONE) {
+		walk->from_graph++;
+	} else {
+		walk->inflated++;
+	}
+	git_oid_cpy(oid, &item.oid);
+	if (pos != NULL) {
+		*pos = item.pos;
+	}
+	return 0;
+}
+
+/* Starts from a commit, or anything that peels to one (i.e. a tag) */
+int LGitGraphWalkPush(LGitGraphWalk *walk, const git_oid *oid)
+{
+	git_object *obj = NULL, *peeled = NULL;
+	DWORD pos;
+	int rc;
+	if (walk->graph != NULL && LGitCommitGraphFind(walk->graph, oid, &pos)) {
+		return LGitGraphWalkStart(walk, oid);
+	}
+	if ((rc = git_object_lookup(&obj, walk->repo, oid, GIT_OBJECT_ANY)) != 0) {
+		return rc;
+	}
+	rc = git_object_peel(&peeled, obj, GIT_OBJECT_COMMIT);
+	git_object_free(obj);
+	if (rc != 0) {
+		return rc;
+	}
+	rc = LGitGraphWalkStart(walk, git_object_id(peeled));
+	git_object_free(peeled);
+	return rc;
+}
+
+/*
+ * Like git_revwalk_next, but also gives the commit's graph position, or
+ * LGIT_GRAPH_NONE if it isn't in the graph.
+ */
+int LGitGraphWalkNext(LGitGraphWalk *walk, git_oid *oid, DWORD *pos)
+{
+	LGitGraphWalkItem item;
+	git_commit *commit = NULL;
+	unsigned int i, count;
+	int parents, rc;
+	if (walk->topological) {
+		return LGitGraphWalkNextTopological(walk, oid, pos);
+	}
+	if (walk->queue->empty()) {
+		return GIT_ITEROVER;
+	}
+	item = walk->queue->top();
+	walk->queue->pop();
+	if (item.pos != LGIT_GRAPH_NONE) {
+		parents = LGitCommitGraphParentsV(walk->graph, item.pos, *walk->parents);
+		if (parents < 0) {
+			git_error_set_str(GIT_ERROR_INVALID, "The commit-graph is corrupt.");
+			return -1;
+		}
+		for (i = 0; i < (unsigned int)parents; i++) {
+			LGitGraphWalkEnqueuePos(walk, (*walk->parents)[i]);
+		}
+		walk->from_graph++;
+	} else {
+		/* Newer than the graph, or there isn't one */
+		if ((rc = git_commit_lookup(&commit, walk->repo, &item.oid)) != 0) {
+			return rc;
+		}
+		count = git_commit_parentcount(commit);
+		for (i = 0; i < count; i++) {
+			if ((rc = LGitGraphWalkEnqueue(walk, git_commit_parent_id(commit, i))) != 0) {
+				git_commit_free(commit);
+				return rc;
+			}
+		}
+		git_commit_free(commit);
+		walk->inflated++;
+	}
+	git_oid_cpy(oid, &item.oid);
+	if (pos != NULL) {
+		*pos = item.pos;
+	}
+	return 0;
+}
+
+/*
+ * Ahead/behind and reachability. Parents always have a lower generation than
+ * their children, so going by generation instead of time means a commit is
+ * never visited before everything that can reach it, and anything with a
+ * lower generation than what's being looked for can be skipped entirely.
+ */
+typedef struct _LGitGenerationItem {
+	DWORD generation;
+	DWORD pos;
+} LGitGenerationItem;
+
+struct LGitGenerationLower {
+	bool operator()(const LGitGenerationItem &a, const LGitGenerationItem &b) const
+	{
+		return a.generation < b.generation;
+	}
+};
+
+#define PAINT_LOCAL 1
+#define PAINT_UPSTREAM 2
+#define PAINT_BOTH (PAINT_LOCAL | PAINT_UPSTREAM)
+#define PAINT_QUEUED 4
+#define PAINT_DONE 8
+
+/* Same arguments as git_graph_ahead_behind, which it falls back to */
+int LGitAheadBehind(git_repository *repo,
+					LGitCommitGraph *graph,
+					size_t *ahead,
+					size_t *behind,
+					const git_oid *local,
+					const git_oid *upstream)
+{
+	std::priority_queue<LGitGenerationItem,
+		std::vector<LGitGenerationItem>,
+		LGitGenerationLower> queue;
+	std::vector<BYTE> paint;
+	std::vector<DWORD> parents(16);
+	LGitGenerationItem item;
+	DWORD local_pos, upstream_pos;
+	BYTE flags, before;
+	/* Queued commits only reachable from one side; done when there's none */
+	LONG interesting = 0;
+	int count, i;
+
+	if (graph == NULL
+		|| !LGitCommitGraphFind(graph, local, &local_pos)
+		|| !LGitCommitGraphFind(graph, upstream, &upstream_pos)
+		|| LGitCommitGraphGeneration(graph, local_pos) == 0
+		|| LGitCommitGraphGeneration(graph, upstream_pos) == 0) {
+		return git_graph_ahead_behind(ahead, behind, repo, local, upstream);
+	}
+	*ahead = *behind = 0;
+	paint.resize(graph->count, 0);
+	paint[local_pos] |= PAINT_LOCAL;
+	paint[upstream_pos] |= PAINT_UPSTREAM;
+	paint[local_pos] |= PAINT_QUEUED;
+	item.pos = local_pos;
+	item.generation = LGitCommitGraphGeneration(graph, local_pos);
+	queue.push(item);
+	if (upstream_pos != local_pos) {
+		paint[upstream_pos] |= PAINT_QUEUED;
+		item.pos = upstream_pos;
+		item.generation = LGitCommitGraphGeneration(graph, upstream_pos);
+		queue.push(item);
+		interesting = 2;
+	}
+	while (interesting > 0 && !queue.empty()) {
+		item = queue.top();
+		queue.pop();
+		paint[item.pos] |= PAINT_DONE;
+		flags = paint[item.pos] & PAINT_BOTH;
+		if (flags != PAINT_BOTH) {
+			interesting--;
+			if (flags == PAINT_LOCAL) {
+				(*ahead)++;
+			} else {
+				(*behind)++;
+			}
+		}
+		count = LGitCommitGraphParentsV(graph, item.pos, parents);
+		if (count < 0) {
+			LGitLog("!! Commit-graph is corrupt, falling back\n");
+			return git_graph_ahead_behind(ahead, behind, repo, local, upstream);
+		}
+		for (i = 0; i < count; i++) {
+			DWORD parent = parents[i];
+			before = paint[parent];
+			paint[parent] |= flags;
+			if (!(before & PAINT_QUEUED)) {
+				paint[parent] |= PAINT_QUEUED;
+				item.pos = parent;
+				item.generation = LGitCommitGraphGeneration(graph, parent);
+				queue.push(item);
+				if (flags != PAINT_BOTH) {
+					interesting++;
+				}
+			} else if (!(before & PAINT_DONE)
+				&& (before & PAINT_BOTH) != PAINT_BOTH
+				&& (paint[parent] & PAINT_BOTH) == PAINT_BOTH) {
+				interesting--;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Same arguments and results as git_graph_descendant_of */
+int LGitDescendantOf(git_repository *repo,
+					 LGitCommitGraph *graph,
+					 const git_oid *commit,
+					 const git_oid *ancestor)
+{
+	std::vector<bool> seen;
+	std::vector<DWORD> stack, parents(16);
+	DWORD commit_pos, ancestor_pos, min_generation, pos;
+	int count, i;
+
+	if (git_oid_equal(commit, ancestor)) {
+		return 0;
+	}
+	if (graph == NULL
+		|| !LGitCommitGraphFind(graph, commit, &commit_pos)
+		|| !LGitCommitGraphFind(graph, ancestor, &ancestor_pos)
+		|| LGitCommitGraphGeneration(graph, ancestor_pos) == 0) {
+		return git_graph_descendant_of(repo, commit, ancestor);
+	}
+	/* Nothing at or below its generation can reach it */
+	min_generation = LGitCommitGraphGeneration(graph, ancestor_pos);
+	if (LGitCommitGraphGeneration(graph, commit_pos) <= min_generation) {
+		return 0;
+	}
+	seen.resize(graph->count, false);
+	stack.push_back(commit_pos);
+	while (!stack.empty()) {
+		pos = stack.back();
+		stack.pop_back();
+		count = LGitCommitGraphParentsV(graph, pos, parents);
+		if (count < 0) {
+			LGitLog("!! Commit-graph is corrupt, falling back\n");
+			return git_graph_descendant_of(repo, commit, ancestor);
+		}
+		for (i = 0; i < count; i++) {
+			if (parents[i] == ancestor_pos) {
+				return 1;
+			}
+			if (seen[parents[i]]
+				|| LGitCommitGraphGeneration(graph, parents[i]) <= min_generation) {
+				continue;
+			}
+			seen[parents[i]] = true;
+			stack.push_back(parents[i]);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Writer. Everything already in the graph is copied over as is; only
+ * commits reachable from a reference that it doesn't have get looked up.
+ */
+typedef struct _LGitGraphEntry {
+	git_oid oid, tree;
+	git_time_t time;
+	DWORD generation;
+	/* Range in the parent list */
+	DWORD first_parent, parent_count;
+} LGitGraphEntry;
+
+static bool LGitGraphEntryLess(const LGitGraphEntry &a, const LGitGraphEntry &b)
+{
+	return git_oid_cmp(&a.oid, &b.oid) < 0;
+}
+
+/* Output file that hashes what's written, for the trailing checksum */
+typedef struct _LGitGraphFile {
+	HANDLE file;
+	HCRYPTHASH hash;
+	BYTE buf[0x10000];
+	DWORD len;
+	BOOL ok;
+} LGitGraphFile;
+
+static void LGitGraphFileFlush(LGitGraphFile *out)
+{
+	DWORD written;
+	if (out->ok && out->len > 0
+		&& (!CryptHashData(out->hash, out->buf, out->len, 0)
+		|| !WriteFile(out->file, out->buf, out->len, &written, NULL)
+		|| written != out->len)) {
+		out->ok = FALSE;
+	}
+	out->len = 0;
+}
+
+static void LGitGraphFileWrite(LGitGraphFile *out, const void *data, DWORD len)
+{
+	const BYTE *cur = (const BYTE*)data;
+	DWORD chunk;
+	while (len > 0) {
+		if (out->len == sizeof(out->buf)) {
+			LGitGraphFileFlush(out);
+		}
+		chunk = min(len, sizeof(out->buf) - out->len);
+		memcpy(out->buf + out->len, cur, chunk);
+		out->len += chunk;
+		cur += chunk;
+		len -= chunk;
+	}
+}
+
+static void LGitGraphFileWrite32(LGitGraphFile *out, DWORD value)
+{
+	BYTE buf[4];
+	LGitPutBE32(buf, value);
+	LGitGraphFileWrite(out, buf, 4);
+}
+
+static BOOL LGitCommitGraphWriteFile(const wchar_t *path,
+									 std::vector<LGitGraphEntry> &entries,
+									 std::vector<DWORD> &parent_pos,
+									 DWORD edge_count)
+{
+	LGitGraphFile *out;
+	HCRYPTPROV prov = 0;
+	BYTE header[HEADER_SIZE], checksum[GIT_OID_RAWSZ];
+	DWORD chunks, offset, i, j, fanout, edge, written, checksum_len;
+	DWORD chunk_ids[4] = { CHUNK_OIDF, CHUNK_OIDL, CHUNK_CDAT, CHUNK_EDGE };
+	DWORD chunk_lens[4];
+	wchar_t temp_path[1024];
+	BOOL ok;
+
+	out = (LGitGraphFile*)calloc(1, sizeof(LGitGraphFile));
+	if (out == NULL) {
+		return FALSE;
+	}
+	out->ok = TRUE;
+	if (!CryptAcquireContext(&prov, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)
+		|| !CryptCreateHash(prov, CALG_SHA1, 0, 0, &out->hash)) {
+		LGitLog("!! Can't hash commit-graph (GLE %x)\n", GetLastError());
+		if (prov != 0) {
+			CryptReleaseContext(prov, 0);
+		}
+		free(out);
+		return FALSE;
+	}
+	wcslcpy(temp_path, path, 1024);
+	wcslcat(temp_path, L".lock", 1024);
+	/* Same lock file git uses, so neither of us clobbers the other */
+	out->file = CreateFileW(temp_path, GENERIC_WRITE, 0, NULL,
+		CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (out->file == INVALID_HANDLE_VALUE) {
+		LGitLog(" ! Can't lock commit-graph (GLE %x)\n", GetLastError());
+		CryptDestroyHash(out->hash);
+		CryptReleaseContext(prov, 0);
+		free(out);
+		return FALSE;
+	}
+
+	chunks = edge_count > 0 ? 4 : 3;
+	chunk_lens[0] = FANOUT_SIZE;
+	chunk_lens[1] = entries.size() * GIT_OID_RAWSZ;
+	chunk_lens[2] = entries.size() * CDAT_ENTRY_SIZE;
+	chunk_lens[3] = edge_count * 4;
+	memcpy(header, GRAPH_SIGNATURE, 4);
+	header[4] = GRAPH_VERSION;
+	header[5] = GRAPH_HASH_SHA1;
+	header[6] = (BYTE)chunks;
+	header[7] = 0;
+	LGitGraphFileWrite(out, header, HEADER_SIZE);
+	offset = HEADER_SIZE + (chunks + 1) * CHUNK_ENTRY_SIZE;
+	for (i = 0; i <= chunks; i++) {
+		LGitGraphFileWrite32(out, i < chunks ? chunk_ids[i] : 0);
+		LGitGraphFileWrite32(out, 0);
+		LGitGraphFileWrite32(out, offset);
+		if (i < chunks) {
+			offset += chunk_lens[i];
+		}
+	}
+	/* OIDF: how many OIDs start with each byte or lower */
+	for (i = 0, fanout = 0; i < 256; i++) {
+		while (fanout < entries.size() && entries[fanout].oid.id[0] <= i) {
+			fanout++;
+		}
+		LGitGraphFileWrite32(out, fanout);
+	}
+	/* OIDL */
+	for (i = 0; i < entries.size(); i++) {
+		LGitGraphFileWrite(out, entries[i].oid.id, GIT_OID_RAWSZ);
+	}
+	/* CDAT */
+	for (i = 0, edge = 0; i < entries.size(); i++) {
+		LGitGraphEntry *entry = &entries[i];
+		git_time_t time = entry->time < 0 ? 0 : entry->time;
+		if (time > (((git_time_t)1 << 34) - 1)) {
+			time = ((git_time_t)1 << 34) - 1;
+		}
+		LGitGraphFileWrite(out, entry->tree.id, GIT_OID_RAWSZ);
+		LGitGraphFileWrite32(out, entry->parent_count > 0
+			? parent_pos[entry->first_parent]
+			: PARENT_NONE);
+		if (entry->parent_count > 2) {
+			LGitGraphFileWrite32(out, PARENT_EXTRA_EDGES | edge);
+			edge += entry->parent_count - 1;
+		} else {
+			LGitGraphFileWrite32(out, entry->parent_count > 1
+				? parent_pos[entry->first_parent + 1]
+				: PARENT_NONE);
+		}
+		LGitGraphFileWrite32(out, (entry->generation << 2) | (DWORD)((time >> 32) & 3));
+		LGitGraphFileWrite32(out, (DWORD)(time & 0xFFFFFFFF));
+	}
+	/* EDGE: parents past the first, for octopus merges */
+	for (i = 0; i < entries.size(); i++) {
+		LGitGraphEntry *entry = &entries[i];
+		if (entry->parent_count <= 2) {
+			continue;
+		}
+		for (j = 1; j < entry->parent_count; j++) {
+			LGitGraphFileWrite32(out, parent_pos[entry->first_parent + j]
+				| (j == entry->parent_count - 1 ? EDGE_LAST : 0));
+		}
+	}
+	LGitGraphFileFlush(out);
+	checksum_len = GIT_OID_RAWSZ;
+	if (out->ok && (!CryptGetHashParam(out->hash, HP_HASHVAL, checksum, &checksum_len, 0)
+		|| !WriteFile(out->file, checksum, GIT_OID_RAWSZ, &written, NULL)
+		|| written != GIT_OID_RAWSZ)) {
+		out->ok = FALSE;
+	}
+	ok = out->ok;
+	CloseHandle(out->file);
+	CryptDestroyHash(out->hash);
+	CryptReleaseContext(prov, 0);
+	free(out);
+
+	if (!ok) {
+		LGitLog("!! Failed writing commit-graph (GLE %x)\n", GetLastError());
+		DeleteFileW(temp_path);
+		return FALSE;
+	}
+	/* This fails if someone has it mapped; the next commit or fetch retries */
+	if (!MoveFileExW(temp_path, path, MOVEFILE_REPLACE_EXISTING)) {
+		LGitLog("!! Can't replace commit-graph (GLE %x)\n", GetLastError());
+		DeleteFileW(temp_path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static BOOL LGitCommitGraphWrite(git_repository *repo, volatile LONG *cancel)
+{
+	LGitCommitGraph *old = NULL;
+	std::vector<LGitGraphEntry> entries;
+	std::vector<git_oid> parent_oids, stack;
+	std::vector<DWORD> parent_pos, parents(16), pending;
+	std::set<std::string> added;
+	std::vector<LGitGraphEntry>::iterator found;
+	git_strarray refs;
+	git_commit *commit = NULL;
+	git_object *obj = NULL, *peeled = NULL;
+	LGitGraphEntry entry;
+	wchar_t path[1024];
+	DWORD old_count = 0, edge_count = 0, i, j, cur, max_generation, begin;
+	BOOL ret = FALSE, ready;
+	int count;
+
+	begin = GetTickCount();
+	if (!LGitCommitGraphEnabled(repo)
+		|| git_repository_is_shallow(repo)
+		|| !LGitCommitGraphPath(repo, "commit-graphs\\commit-graph-chain", path, 1024)) {
+		return FALSE;
+	}
+	if (GetFileAttributesW(path) != 0xFFFFFFFF) {
+		LGitLog(" ! Split commit-graph, leaving it to git\n");
+		return FALSE;
+	}
+	if (!LGitCommitGraphPath(repo, "commit-graph", path, 1024)) {
+		return FALSE;
+	}
+	old = LGitCommitGraphOpen(repo);
+	if (old != NULL && old->foreign_chunks) {
+		LGitLog(" ! Commit-graph has more than we'd write, leaving it to git\n");
+		LGitCommitGraphClose(old);
+		return FALSE;
+	}
+
+	/* Copy the old graph over */
+	if (old != NULL) {
+		old_count = old->count;
+		entries.reserve(old_count);
+		for (i = 0; i < old_count; i++) {
+			LGitCommitGraphOid(old, i, &entry.oid);
+			LGitCommitGraphTree(old, i, &entry.tree);
+			entry.time = LGitCommitGraphTime(old, i);
+			entry.generation = LGitCommitGraphGeneration(old, i);
+			count = LGitCommitGraphParentsV(old, i, parents);
+			if (count < 0) {
+				LGitLog("!! Old commit-graph is corrupt, starting over\n");
+				entries.clear();
+				parent_oids.clear();
+				old_count = 0;
+				LGitCommitGraphClose(old);
+				old = NULL;
+				break;
+			}
+			entry.first_parent = parent_oids.size();
+			entry.parent_count = count;
+			for (j = 0; j < (DWORD)count; j++) {
+				git_oid parent_oid;
+				LGitCommitGraphOid(old, parents[j], &parent_oid);
+				parent_oids.push_back(parent_oid);
+			}
+			entries.push_back(entry);
+		}
+	}
+
+	/* Then whatever the references can reach that it doesn't have */
+	if (git_reference_list(&refs, repo) != 0) {
+		LGitLog("!! Can't list references for commit-graph\n");
+		goto fin;
+	}
+	for (i = 0; i <= refs.count; i++) {
+		git_oid oid;
+		/* Detached HEAD isn't in the list */
+		const char *name = i < refs.count ? refs.strings[i] : "HEAD";
+		if (git_reference_name_to_id(&oid, repo, name) != 0
+			|| git_object_lookup(&obj, repo, &oid, GIT_OBJECT_ANY) != 0) {
+			continue;
+		}
+		/* Tags can point at trees and blobs too */
+		if (git_object_peel(&peeled, obj, GIT_OBJECT_COMMIT) == 0) {
+			stack.push_back(*git_object_id(peeled));
+			git_object_free(peeled);
+		}
+		git_object_free(obj);
+	}
+	git_strarray_dispose(&refs);
+	while (!stack.empty()) {
+		git_oid oid = stack.back();
+		std::string key((const char*)oid.id, GIT_OID_RAWSZ);
+		stack.pop_back();
+		if (*cancel) {
+			goto fin;
+		}
+		if ((old != NULL && LGitCommitGraphFind(old, &oid, &cur))
+			|| added.find(key) != added.end()) {
+			continue;
+		}
+		/* A missing commit means the graph wouldn't be closed */
+		if (git_commit_lookup(&commit, repo, &oid) != 0) {
+			LGitLog("!! Missing commit %s, not writing commit-graph\n", git_oid_tostr_s(&oid));
+			goto fin;
+		}
+		added.insert(key);
+		git_oid_cpy(&entry.oid, &oid);
+		git_oid_cpy(&entry.tree, git_commit_tree_id(commit));
+		entry.time = git_commit_time(commit);
+		entry.generation = 0;
+		entry.first_parent = parent_oids.size();
+		entry.parent_count = git_commit_parentcount(commit);
+		for (j = 0; j < entry.parent_count; j++) {
+			parent_oids.push_back(*git_commit_parent_id(commit, j));
+			stack.push_back(*git_commit_parent_id(commit, j));
+		}
+		entries.push_back(entry);
+		git_commit_free(commit);
+		commit = NULL;
+	}
+	if (entries.size() == old_count) {
+		LGitLog(" ! Commit-graph is up to date (%u commits)\n", old_count);
+		goto fin;
+	}
+	/* The old mapping would keep us from replacing the file */
+	LGitCommitGraphClose(old);
+	old = NULL;
+
+	std::sort(entries.begin(), entries.end(), LGitGraphEntryLess);
+	parent_pos.resize(parent_oids.size());
+	for (i = 0; i < entries.size(); i++) {
+		for (j = 0; j < entries[i].parent_count; j++) {
+			git_oid_cpy(&entry.oid, &parent_oids[entries[i].first_parent + j]);
+			found = std::lower_bound(entries.begin(), entries.end(), entry, LGitGraphEntryLess);
+			if (found == entries.end() || !git_oid_equal(&found->oid, &entry.oid)) {
+				LGitLog("!! Commit-graph wouldn't be closed, not writing it\n");
+				goto fin;
+			}
+			parent_pos[entries[i].first_parent + j] = found - entries.begin();
+		}
+		if (entries[i].parent_count > 2) {
+			edge_count += entries[i].parent_count - 1;
+		}
+	}
+	/* Generations for new commits, parents first */
+	for (i = 0; i < entries.size(); i++) {
+		if (entries[i].generation != 0) {
+			continue;
+		}
+		pending.push_back(i);
+		while (!pending.empty()) {
+			cur = pending.back();
+			if (entries[cur].generation != 0) {
+				pending.pop_back();
+				continue;
+			}
+			ready = TRUE;
+			max_generation = 0;
+			for (j = 0; j < entries[cur].parent_count; j++) {
+				DWORD parent = parent_pos[entries[cur].first_parent + j];
+				if (entries[parent].generation == 0) {
+					pending.push_back(parent);
+					ready = FALSE;
+				} else if (entries[parent].generation > max_generation) {
+					max_generation = entries[parent].generation;
+				}
+			}
+			if (ready) {
+				entries[cur].generation = min(max_generation + 1, GENERATION_MAX);
+				pending.pop_back();
+			}
+		}
+	}
+	if (*cancel) {
+		goto fin;
+	}
+	ret = LGitCommitGraphWriteFile(path, entries, parent_pos, edge_count);
+	if (ret) {
+		LGitLog(" ! Wrote commit-graph: %u commits (%u new) in %u ms\n",
+			entries.size(),
+			entries.size() - old_count,
+			GetTickCount() - begin);
+	}
+fin:
+	if (commit != NULL) {
+		git_commit_free(commit);
+	}
+	LGitCommitGraphClose(old);
+	return ret;
+}
+
+typedef struct _LGitGraphWriterParams {
+	char path[1024];
+	volatile LONG *cancel;
+} LGitGraphWriterParams;
+
+static unsigned __stdcall LGitCommitGraphWriter(void *context)
+{
+	LGitGraphWriterParams *params = (LGitGraphWriterParams*)context;
+	git_repository *repo = NULL;
+	/* Our own, since the IDE keeps using the context's */
+	if (git_repository_open(&repo, params->path) == 0) {
+		LGitCommitGraphWrite(repo, params->cancel);
+		git_repository_free(repo);
+	}
+	free(params);
+	return 0;
+}
+
+/*
+ * Brings the commit-graph up to date in the background, i.e. after making a
+ * commit or fetching. If it's still going from last time, that'll do.
+ */
+void LGitCommitGraphUpdate(LGitContext *ctx)
+{
+	LGitGraphWriterParams *params;
+	unsigned thread_id;
+	if (ctx->graphWriter != NULL) {
+		if (WaitForSingleObject(ctx->graphWriter, 0) == WAIT_TIMEOUT) {
+			return;
+		}
+		CloseHandle(ctx->graphWriter);
+		ctx->graphWriter = NULL;
+	}
+	params = (LGitGraphWriterParams*)calloc(1, sizeof(LGitGraphWriterParams));
+	if (params == NULL) {
+		return;
+	}
+	strlcpy(params->path, git_repository_path(ctx->repo), 1024);
+	params->cancel = &ctx->graphWriterCancel;
+	ctx->graphWriterCancel = 0;
+	ctx->graphWriter = (HANDLE)_beginthreadex(NULL, 0, LGitCommitGraphWriter, params, 0, &thread_id);
+	if (ctx->graphWriter == NULL) {
+		LGitLog("!! Couldn't start commit-graph writer\n");
+		free(params);
+		return;
+	}
+	SetThreadPriority(ctx->graphWriter, THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+/* Called before the repository goes away */
+void LGitCommitGraphStopUpdate(LGitContext *ctx)
+{
+	if (ctx->graphWriter == NULL) {
+		return;
+	}
+	InterlockedExchange((LPLONG)&ctx->graphWriterCancel, 1);
+	WaitForSingleObject(ctx->graphWriter, INFINITE);
+	CloseHandle(ctx->graphWriter);
+	ctx->graphWriter = NULL;
+}
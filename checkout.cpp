@@ -111,6 +111,7 @@ SCCRTN LGitCheckoutRef(LGitContext *ctx, HWND hwnd, git_reference *branch)
 	ret = SCC_OK;
 	LGitProgressDeinit(ctx);
 err:
+	LGitStatusCacheInvalidate(ctx);
 	LGitFinishCheckoutNotify(ctx, hwnd, &co_opts);
 	if (new_branch != NULL) {
 		git_reference_free(new_branch);
@@ -184,6 +185,7 @@ SCCRTN LGitCheckoutTree(LGitContext *ctx,
 	LGitProgressDeinit(ctx);
 	ret = SCC_OK;
 err:
+	LGitStatusCacheInvalidate(ctx);
 	LGitFinishCheckoutNotify(ctx, hwnd, &co_opts);
 	if (commit != NULL) {
 		git_commit_free(commit);
@@ -219,6 +221,7 @@ SCCRTN LGitCheckoutStaged(LGitContext *ctx, HWND hwnd, git_strarray *paths)
 	}
 
 	LGitProgressDeinit(ctx);
+	LGitStatusCacheInvalidate(ctx);
 	LGitFinishCheckoutNotify(ctx, hwnd, &co_opts);
 	return ret;
 }
@@ -251,6 +254,7 @@ SCCRTN LGitCheckoutHead(LGitContext *ctx, HWND hwnd, git_strarray *paths)
 	}
 
 	LGitProgressDeinit(ctx);
+	LGitStatusCacheInvalidate(ctx);
 	LGitFinishCheckoutNotify(ctx, hwnd, &co_opts);
 	return ret;
 }
@@ -266,7 +270,7 @@ static SCCRTN LGitCheckoutInternal (LPVOID context,
 									LPCMDOPTS pvOptions)
 {
 	int i, path_count;
-	char **paths;
+	LGitPathBatch batch;
 	LGitContext *ctx = (LGitContext*)context;
 
 	/*
@@ -277,24 +281,18 @@ static SCCRTN LGitCheckoutInternal (LPVOID context,
 	LGitLog("  flags %x", dwFlags);
 	LGitLog("  files %d", nFiles);
 
-	paths = (char**)calloc(sizeof(char*), nFiles);
-	if (paths == NULL) {
+	if (!LGitNormalizePaths(ctx, nFiles, lpFileNames, &batch)) {
 		return SCC_E_NONSPECIFICERROR;
 	}
 	path_count = 0;
 	for (i = 0; i < nFiles; i++) {
-		char *path = LGitAnsiToUtf8Alloc(lpFileNames[i]);
-		const char *raw_path = LGitStripBasePath(ctx, path);
-		if (raw_path == NULL) {
-			LGitLog("    Couldn't get base path for %s\n", path);
-			free(path);
+		if (batch.paths[i] == NULL) {
+			LGitLog("    Couldn't get base path for %s\n", lpFileNames[i]);
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
-		LGitLog("    %s\n", raw_path);
-		paths[path_count++] = (char*)raw_path;
-		LGitPopCheckout(ctx, raw_path);
+		LGitLog("    %s\n", batch.paths[i]);
+		batch.paths[path_count++] = batch.paths[i];
+		LGitPopCheckout(ctx, batch.paths[i]);
 	}
 	/*
 	for (i = 0; i < path_count; i++) {
@@ -302,12 +300,12 @@ static SCCRTN LGitCheckoutInternal (LPVOID context,
 	}
 	*/
 	git_strarray strpaths;
-	strpaths.strings = paths;
+	strpaths.strings = batch.paths;
 	strpaths.count = path_count;
 
 	/* XXX: Use opts to check if we should checkout from idx or head */
 	SCCRTN ret = LGitCheckoutHead(ctx, hWnd, &strpaths);
-	LGitFreePathList(paths, path_count);
+	LGitFreePathBatch(ctx, &batch);
 	return SCC_OK;
 }
 
@@ -321,6 +319,7 @@ SCCRTN SccUncheckout (LPVOID context,
 					  LONG dwFlags,
 					  LPCMDOPTS pvOptions)
 {
+	LGitOpTimer timer(context, "SccUncheckout", nFiles);
 	LGitLog("**SccUncheckout** Context=%p\n", context);
 	return LGitCheckoutInternal(context, hWnd, nFiles, lpFileNames, dwFlags, pvOptions);
 }
@@ -337,6 +336,7 @@ SCCRTN SccGet (LPVOID context,
 			   LONG dwFlags,
 			   LPCMDOPTS pvOptions)
 {
+	LGitOpTimer timer(context, "SccGet", nFiles);
 	LGitLog("**SccGet** Context=%p\n", context);
 	LGitLog("  options %p", pvOptions);
 	LGitGetOpts *getOpts = (LGitGetOpts*)pvOptions;
@@ -362,22 +362,32 @@ static void LGitUnmarkReadOnly(LPCSTR fileName)
 
 void LGitPushCheckout(LGitContext *ctx, const char *fileName)
 {
-	ctx->checkouts->insert(std::string(fileName));
+	LONG id = LGitInternPath(ctx, fileName);
+	if (id != 0) {
+		LGitPathBitsSet(ctx->checkouts, id);
+	}
 }
 
 BOOL LGitPopCheckout(LGitContext *ctx, const char *fileName)
 {
-	std::string name = std::string(fileName);
-	BOOL exists = ctx->checkouts->count(name);
+	/* Never interned means never checked out */
+	LONG id = LGitFindPath(ctx, fileName);
+	BOOL exists = LGitPathBitsTest(ctx->checkouts, id);
 	if (exists) {
-		ctx->checkouts->erase(name);
+		LGitPathBitsClear(ctx->checkouts, id);
 	}
 	return exists;
 }
 
 BOOL LGitIsCheckout(LGitContext *ctx, const char *fileName)
 {
-	return ctx->checkouts->count(std::string(fileName));
+	return LGitIsCheckoutId(ctx, LGitFindPath(ctx, fileName));
+}
+
+/* For loops that already have the ID, so they don't hash again */
+BOOL LGitIsCheckoutId(LGitContext *ctx, LONG id)
+{
+	return LGitPathBitsTest(ctx->checkouts, id);
 }
 
 SCCRTN SccCheckout (LPVOID context, 
@@ -390,6 +400,7 @@ SCCRTN SccCheckout (LPVOID context,
 {
 	LGitContext *ctx = (LGitContext*)context;
 	int i;
+	LGitOpTimer timer(context, "SccCheckout", nFiles);
 	LGitLog("**SccCheckout** Context=%p\n", context);
 	LGitLog("  flags %x", dwFlags);
 	LGitLog("  files %d", nFiles);
@@ -399,15 +410,11 @@ SCCRTN SccCheckout (LPVOID context,
 	 * files, so what we'll do is just temporarily add them to a list.
 	 */
 	for (i = 0; i < nFiles; i++) {
-		char path[2048];
-		LGitAnsiToUtf8(lpFileNames[i], path, 2048);
-		const char *raw_path = LGitStripBasePath(ctx, path);
-		if (raw_path == NULL) {
-			LGitLog("    Couldn't get base path for %s\n", path);
+		char raw_path[2048];
+		if (LGitNormalizePath(ctx, lpFileNames[i], raw_path, 2048) < 0) {
+			LGitLog("    Couldn't get base path for %s\n", lpFileNames[i]);
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
 		LGitLog("    Checking out %s\n", raw_path);
 		LGitPushCheckout(ctx, raw_path);
 		/* there's no point in converting */
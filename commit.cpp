@@ -127,6 +127,8 @@ SCCRTN LGitCommitIndex(HWND hWnd,
 	git_repository_state_cleanup(ctx->repo);
 	git_repository_message_remove(ctx->repo);
 	LGitLog(" ! Made commit\n");
+	LGitCommitGraphUpdate(ctx);
+	LGitStatusCacheInvalidate(ctx);
 fin:
 	if (parent != NULL) {
 		git_object_free(parent);
@@ -191,6 +193,8 @@ SCCRTN LGitCommitIndexAmendHead(HWND hWnd,
 	git_repository_state_cleanup(ctx->repo);
 	git_repository_message_remove(ctx->repo);
 	LGitLog(" ! Made commit\n");
+	LGitCommitGraphUpdate(ctx);
+	LGitStatusCacheInvalidate(ctx);
 fin:
 	if (parent_commit != NULL) {
 		git_commit_free(parent_commit);
@@ -228,27 +232,25 @@ SCCRTN SccCheckin (LPVOID context,
 	int i;
 	LGitContext *ctx = (LGitContext*)context;
 
+	LGitOpTimer timer(context, "SccCheckin", nFiles);
 	LGitLog("**SccCheckin** Context=%p\n", context);
 	LGitLog("  comment %s", lpComment);
 	LGitLog("  flags %x", dwFlags);
 	LGitLog("  files %d", nFiles);
 	LGitLog("  opts  %p", pvOptions);
 
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		LGitLibraryError(hWnd, "Checkin (getting index)");
 		return SCC_E_NONSPECIFICERROR;
 	}
 
 	for (i = 0; i < nFiles; i++) {
-		char path[2048];
-		LGitAnsiToUtf8(lpFileNames[i], path, 2048);
-		const char *raw_path = LGitStripBasePath(ctx, path);
-		if (raw_path == NULL) {
-			LGitLog("    Couldn't get base path for %s\n", path);
+		char raw_path[2048];
+		if (LGitNormalizePath(ctx, lpFileNames[i], raw_path, 2048) < 0) {
+			LGitLog("    Couldn't get base path for %s\n", lpFileNames[i]);
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
 		LGitLog("    %s\n", raw_path);
 		if (git_index_add_bypath(index, raw_path) != 0) {
 			LGitLibraryError(hWnd, raw_path);
@@ -266,7 +268,6 @@ SCCRTN SccCheckin (LPVOID context,
 	}
 fin:
 	free(commit_message);
-	git_index_free(index);
 	git_signature_free(signature);
 	return inner_ret;
 }
@@ -290,12 +291,14 @@ SCCRTN SccAdd (LPVOID context,
 	int i;
 	LGitContext *ctx = (LGitContext*)context;
 
+	LGitOpTimer timer(context, "SccAdd", nFiles);
 	LGitLog("**SccAdd** Context=%p\n", context);
 	LGitLog("  comment %s", lpComment);
 	LGitLog("  files %d", nFiles);
 	LGitLog("  opts  %p", pvOptions);
 
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		LGitLibraryError(hWnd, "Add (getting index)");
 		return SCC_E_NONSPECIFICERROR;
 	}
@@ -311,15 +314,11 @@ SCCRTN SccAdd (LPVOID context,
 		 * (Maybe we could use it to convert behind the IDE's back...)
 		 */
 		LGitLog("    Flags: %x\n", pdwFlags[i]);
-		char path[2048];
-		LGitAnsiToUtf8(lpFileNames[i], path, 2048);
-		const char *raw_path = LGitStripBasePath(ctx, path);
-		if (raw_path == NULL) {
-			LGitLog("    Couldn't get base path for %s\n", path);
+		char raw_path[2048];
+		if (LGitNormalizePath(ctx, lpFileNames[i], raw_path, 2048) < 0) {
+			LGitLog("    Couldn't get base path for %s\n", lpFileNames[i]);
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
 		LGitLog("    %s\n", raw_path);
 		if (git_index_add_bypath(index, raw_path) != 0) {
 			LGitLibraryError(hWnd, raw_path);
@@ -337,7 +336,6 @@ SCCRTN SccAdd (LPVOID context,
 	}
 fin:
 	free(commit_message);
-	git_index_free(index);
 	git_signature_free(signature);
 	return inner_ret;
 }
@@ -362,27 +360,25 @@ SCCRTN SccRemove (LPVOID context,
 	int i;
 	LGitContext *ctx = (LGitContext*)context;
 
+	LGitOpTimer timer(context, "SccRemove", nFiles);
 	LGitLog("**SccRemove** Context=%p\n", context);
 	LGitLog("  comment %s", lpComment);
 	LGitLog("  flags %x", dwFlags);
 	LGitLog("  files %d", nFiles);
 	LGitLog("  opts  %p", pvOptions);
 
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		LGitLibraryError(hWnd, "Remove (getting index)");
 		return SCC_E_NONSPECIFICERROR;
 	}
 
 	for (i = 0; i < nFiles; i++) {
-		char path[2048];
-		LGitAnsiToUtf8(lpFileNames[i], path, 2048);
-		const char *raw_path = LGitStripBasePath(ctx, path);
-		if (raw_path == NULL) {
-			LGitLog("    Couldn't get base path for %s\n", path);
+		char raw_path[2048];
+		if (LGitNormalizePath(ctx, lpFileNames[i], raw_path, 2048) < 0) {
+			LGitLog("    Couldn't get base path for %s\n", lpFileNames[i]);
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
 		LGitLog("    Removing %s\n", raw_path);
 		if (git_index_remove_bypath(index, raw_path) != 0) {
 			LGitLibraryError(hWnd, raw_path);
@@ -400,7 +396,6 @@ SCCRTN SccRemove (LPVOID context,
 	}
 fin:
 	free(commit_message);
-	git_index_free(index);
 	git_signature_free(signature);
 	return inner_ret;
 }
@@ -418,28 +413,26 @@ SCCRTN SccRename (LPVOID context,
 	char o_path[1024], n_path[1024], comment[COMMITMSGSZ];
 
 	/* OLD */
+	LGitOpTimer timer(context, "SccRename", 1);
 	LGitLog("**SccRename** Context=%p\n", context);
-	LGitAnsiToUtf8(lpFileName, o_path, 1024);
-	o_stripped_path = LGitStripBasePath(ctx, o_path);
-	if (o_stripped_path == NULL) {
+	if (LGitNormalizePath(ctx, lpFileName, o_path, 1024) < 0) {
 		LGitLog("    Couldn't get base path for %s\n", lpFileName);
 		inner_ret = SCC_E_OPNOTPERFORMED;
 		goto fail;
 	}
-	LGitTranslateStringChars(o_path, '\\', '/');
+	o_stripped_path = o_path;
 	LGitLog("  Old %s\n", o_stripped_path);
 	/* NEW */
-	LGitAnsiToUtf8(lpNewName, n_path, 1024);
-	n_stripped_path = LGitStripBasePath(ctx, n_path);
-	if (n_stripped_path == NULL) {
+	if (LGitNormalizePath(ctx, lpNewName, n_path, 1024) < 0) {
 		LGitLog("    Couldn't get base path for %s\n", lpNewName);
 		inner_ret = SCC_E_OPNOTPERFORMED;
 		goto fail;
 	}
-	LGitTranslateStringChars(n_path, '\\', '/');
+	n_stripped_path = n_path;
 	LGitLog("  New %s\n", n_stripped_path);
 	/* Take a slightly roundabout method */
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		LGitLibraryError(hWnd, "Remove (getting index)");
 		inner_ret = SCC_E_NONSPECIFICERROR;
 		goto fail;
@@ -466,7 +459,6 @@ SCCRTN SccRename (LPVOID context,
 	inner_ret = LGitCommitIndex(hWnd, ctx, index, comment, signature, signature);
 	LGitPopCheckout(ctx, o_stripped_path);
 fail:
-	git_index_free(index);
 	git_signature_free(signature);
 	return inner_ret;
 }
\ No newline at end of file
@@ -239,8 +239,8 @@ SCCRTN LGitCreateCommitDialog(LGitContext *ctx, HWND hwnd, BOOL amend_last, cons
 	 */
 	if (proposed_index != NULL) {
 		index = proposed_index;
-	} else if (git_repository_index(&index, ctx->repo) != 0) {
-		LGitLibraryError(hwnd, "git_repository_error");
+	} else if ((index = LGitSessionIndex(ctx)) == NULL) {
+		LGitLibraryError(hwnd, "git_repository_index");
 		ret = SCC_E_NONSPECIFICERROR;
 		goto err;
 	}
@@ -250,9 +250,6 @@ SCCRTN LGitCreateCommitDialog(LGitContext *ctx, HWND hwnd, BOOL amend_last, cons
 		ret = LGitCommitIndex(hwnd, ctx, index, cc_params.message, cc_params.author, cc_params.committer);
 	}
 err:
-	if (proposed_index == NULL) {
-		git_index_free(index);
-	}
 	git_signature_free(cc_params.author);
 	git_signature_free(cc_params.committer);
 	return ret;
@@ -128,10 +128,13 @@ static void FillRefsView(HWND hwnd, LGitCommitInfoDialogParams *params)
 	size_t i;
 	const git_oid *this_oid = git_commit_id(params->commit);
 	const git_oid *ref_oid = NULL;
+	LGitCommitGraph *graph = NULL;
 	if (git_reference_list(&refs, params->ctx->repo) != 0) {
 		LGitLibraryError(hwnd, "git_reference_iterator_new");
 		return;
 	}
+	/* Generation numbers let each check stop early */
+	graph = LGitCommitGraphOpen(params->ctx->repo);
 	/* this can be slow; progress dialog and make quantifiable w/ list */
 	LGitProgressInit(params->ctx, "Checking References for Commit", 0);
 	/* XXX: make blocking since we can switch tabs between */
@@ -159,7 +162,7 @@ static void FillRefsView(HWND hwnd, LGitCommitInfoDialogParams *params)
 		/* it's accepted if the ref_oid is NULL; i.e. origin/HEAD */
 		if (ref_oid != NULL
 			&& (git_oid_equal(ref_oid, this_oid) == 1
-			|| git_graph_descendant_of(params->ctx->repo, ref_oid, this_oid) == 1)) {
+			|| LGitDescendantOf(params->ctx->repo, graph, ref_oid, this_oid) == 1)) {
 			/* XXX: this could be a listview like refs dialog instead */
 			wchar_t name_utf16[128];
 			LGitUtf8ToWide(name, name_utf16, 128);
@@ -170,6 +173,7 @@ static void FillRefsView(HWND hwnd, LGitCommitInfoDialogParams *params)
 		}
 	}
 	LGitProgressDeinit(params->ctx);
+	LGitCommitGraphClose(graph);
 	git_strarray_dispose(&refs);
 }
 
@@ -13,27 +13,22 @@ SCCRTN LGitDiffInternal (LPVOID context,
 	git_diff_options diffopts;
 	git_diff *diff;
 	size_t deltas;
+	BOOL differs;
+	SCCRTN ret = SCC_OK;
 	
 	LGitDiffDialogParams params;
 
-	const char *raw_path;
-	char path[1024], path_utf8[1024], *path_ptr;
+	char path[1024], *path_ptr;
 	LGitContext *ctx = (LGitContext*)context;
 
 	LGitLog("  Flags %x, %s\n", dwFlags, lpFileName);
 
 	git_diff_options_init(&diffopts, GIT_DIFF_OPTIONS_VERSION);
-	LGitInitDiffProgressCallback(ctx, &diffopts);
 
-	LGitAnsiToUtf8(lpFileName, path_utf8, 1024);
-	raw_path = LGitStripBasePath(ctx, path_utf8);
-	if (raw_path == NULL) {
+	if (LGitNormalizePath(ctx, lpFileName, path, 1024) < 0) {
 		LGitLog("     Couldn't get base path for %s\n", lpFileName);
 		return SCC_E_NONSPECIFICERROR;
 	}
-	/* Translate because libgit2 operates with forward slashes */
-	strlcpy(path, raw_path, 1024);
-	LGitTranslateStringChars(path, '\\', '/');
 
 	/* Work around a very weird C quirk where &array == array are the same */
 	path_ptr = path;
@@ -52,42 +47,54 @@ SCCRTN LGitDiffInternal (LPVOID context,
 	 * Conceptually, SccDiff is "what's different from the commited copy".
 	 * This is similar to a straight "git diff" with a specific file, that is,
 	 * we're comparing the working tree to HEAD.
+	 *
+	 * If it's a quick diff, don't pop up a UI; the IDE is waiting on the
+	 * answer, so that one has to be done here and now.
 	 */
-	LGitProgressInit(ctx, "Diffing Stage to Working Tree", 0);
-	LGitProgressStart(ctx, hWnd, FALSE);
-	if (git_diff_index_to_workdir(&diff, ctx->repo, NULL, &diffopts) != 0) {
-		LGitProgressDeinit(ctx);
-		LGitLibraryError(hWnd, "SccDiff git_diff_index_to_workdir");
-		return SCC_E_NONSPECIFICERROR;
-	}
-	LGitProgressDeinit(ctx);
-	/* XXX: Rename detection with git_diff_find_similar? */
-	deltas = git_diff_num_deltas(diff);
-
-	/* If it's a quick diff, don't pop up a UI */
-	if (dwFlags & SCC_DIFF_QUICK_DIFF)
-	{
-		/* Contents only. We don't (yet?) support timestamp diff */
-		goto fin;
+	if (dwFlags & SCC_DIFF_QUICK_DIFF) {
+		/* Usually the stage and a stat can say, without any diff */
+		if (LGitQuickDiff(ctx, path, dwFlags, &differs)) {
+			return differs ? SCC_I_FILEDIFFERS : SCC_OK;
+		}
+		if (git_diff_index_to_workdir(&diff, ctx->repo, NULL, &diffopts) != 0) {
+			LGitLibraryError(hWnd, "SccDiff git_diff_index_to_workdir");
+			return SCC_E_NONSPECIFICERROR;
+		}
+		/*
+		 * No rename detection; a renamed file differs either way, and
+		 * the diff window pairs them up when it's looked at.
+		 */
+		deltas = git_diff_num_deltas(diff);
+		git_diff_free(diff);
+		return deltas > 0 ? SCC_I_FILEDIFFERS : SCC_OK;
 	}
 
+	/* Otherwise the window does it in the background */
+	ZeroMemory(&params, sizeof(LGitDiffDialogParams));
 	params.ctx = ctx;
-	params.diff = diff;
+	params.diff = NULL;
+	params.source.type = LGDS_INDEX_TO_WORKDIR;
+	params.source.diffopts = &diffopts;
 	params.path = path;
 	params.commit = NULL;
 	switch (LGitDiffWindow(hWnd, &params)) {
 	case 0:
 	case -1:
 		LGitLog(" ! Uh-oh, dialog error\n");
-		git_diff_free(diff);
-		return SCC_E_NONSPECIFICERROR;
+		ret = SCC_E_NONSPECIFICERROR;
+		break;
 	default:
+		/* Closed before it was done comparing; we can't say either way */
+		if (params.state == LGDD_CANCELLED) {
+			ret = SCC_I_OPERATIONCANCELED;
+		} else if (params.state != LGDD_DONE) {
+			ret = SCC_E_NONSPECIFICERROR;
+		} else {
+			ret = params.deltas > 0 ? SCC_I_FILEDIFFERS : SCC_OK;
+		}
 		break;
 	}
-
-fin:
-	git_diff_free(diff);
-	return deltas > 0 ? SCC_I_FILEDIFFERS : SCC_OK;
+	return ret;
 }
 
 /*
@@ -102,6 +109,7 @@ SCCRTN SccDiff (LPVOID context,
 				LONG dwFlags,
 				LPCMDOPTS pvOptions)
 {
+	LGitOpTimer timer(context, "SccDiff", 1);
 	LGitLog("**SccDiff** Context=%p\n", context);
 	return LGitDiffInternal(context, hWnd, lpFileName, dwFlags, pvOptions);
 }
@@ -112,6 +120,7 @@ SCCRTN SccDirDiff (LPVOID context,
 				   LONG dwFlags,
 				   LPCMDOPTS pvOptions)
 {
+	LGitOpTimer timer(context, "SccDirDiff", 1);
 	LGitLog("**SccDirDiff** Context=%p\n", context);
 	return LGitDiffInternal(context, hWnd, lpFileName, dwFlags, pvOptions);
 }
@@ -124,47 +133,24 @@ SCCRTN LGitCommitToCommitDiff(LGitContext *ctx,
 {
 	LGitLog("**LGitCommitToCommitDiff** Context=%p\n", ctx);
 	SCCRTN ret = SCC_OK;
-	git_tree *a, *b;
 	const git_oid *oid_a, *oid_b;
 	oid_a = git_commit_id(commit_a);
 	LGitLog("  A %s\n", git_oid_tostr_s(oid_a));
 	oid_b = git_commit_id(commit_b);
 	LGitLog("  B %s\n", git_oid_tostr_s(oid_b));
-	git_diff *diff;
-	if (git_commit_tree(&a, commit_a) != 0) {
-		LGitLibraryError(hwnd, "match_with_parent git_commit_tree A");
-		goto fin;
-	}
-	if (git_commit_tree(&b, commit_b) != 0) {
-		LGitLibraryError(hwnd, "match_with_parent git_commit_tree B");
-		ret = SCC_E_NONSPECIFICERROR;
-		goto fin;
-	}
-	/* XXX: ugly because we don't know if we have callbacks or not */
-	if (diffopts->progress_cb != NULL) {
-		LGitProgressInit(ctx, "Diffing Commits", 0);
-		LGitProgressStart(ctx, hwnd, FALSE);
-		/* it is safe to call uninit without guard, but leaves a message */
-	}
-	if (git_diff_tree_to_tree(&diff, git_commit_owner(commit_b), a, b, diffopts) != 0) {
-		if (diffopts->progress_cb != NULL) {
-			LGitProgressDeinit(ctx);
-		}
-		LGitLibraryError(hwnd, "match_with_parent git_diff_tree_to_tree");
-		ret = SCC_E_NONSPECIFICERROR;
-		goto fin;
-	}
-	if (diffopts->progress_cb != NULL) {
-		LGitProgressDeinit(ctx);
-	}
 	/* make a title */
 	char msg[128];
 	_snprintf(msg, 128, "%s..", git_oid_tostr_s(oid_a));
 	strlcat(msg, git_oid_tostr_s(oid_b), 128);
-	/* now display the dialog */
+	/* now display the dialog; it compares the trees itself */
 	LGitDiffDialogParams diff_params;
+	ZeroMemory(&diff_params, sizeof(LGitDiffDialogParams));
 	diff_params.ctx = ctx;
-	diff_params.diff = diff;
+	diff_params.diff = NULL;
+	diff_params.source.type = LGDS_TREE_TO_TREE;
+	diff_params.source.old_tree = git_commit_tree_id(commit_a);
+	diff_params.source.new_tree = git_commit_tree_id(commit_b);
+	diff_params.source.diffopts = diffopts;
 	diff_params.path = msg;
 	diff_params.commit = commit_b;
 	switch (LGitDiffWindow(hwnd, &diff_params)) {
@@ -172,20 +158,10 @@ SCCRTN LGitCommitToCommitDiff(LGitContext *ctx,
 	case -1:
 		LGitLog(" ! Uh-oh, dialog error\n");
 		ret = SCC_E_NONSPECIFICERROR;
-		goto fin;
+		break;
 	default:
 		break;
 	}
-fin:
-	if (diff != NULL) {
-		git_diff_free(diff);
-	}
-	if (a != NULL) {
-		git_tree_free(a);
-	}
-	if (b != NULL) {
-		git_tree_free(b);
-	}
 	return ret;
 }
 
@@ -221,11 +197,10 @@ fin:
 
 SCCRTN LGitDiffStageToWorkdir(LGitContext *ctx, HWND hwnd, git_strarray *paths)
 {
-	LGitLog("**LGitCommitToCommitDiff** Context=%p\n", ctx);
+	LGitLog("**LGitDiffStageToWorkdir** Context=%p\n", ctx);
 	SCCRTN ret = SCC_OK;
 	LGitDiffDialogParams params;
 	ZeroMemory(&params, sizeof(LGitDiffDialogParams));
-	git_diff *diff = NULL;
 	/* XXX: config opts since we have no flags? allow passing in? */
 	git_diff_options diffopts;
 	git_diff_options_init(&diffopts, GIT_DIFF_OPTIONS_VERSION);
@@ -233,19 +208,12 @@ SCCRTN LGitDiffStageToWorkdir(LGitContext *ctx, HWND hwnd, git_strarray *paths)
 		diffopts.pathspec.strings = paths->strings;
 		diffopts.pathspec.count = paths->count;
 	}
-	LGitInitDiffProgressCallback(ctx, &diffopts);
-	/* repo index on null */
-	LGitProgressInit(ctx, "Diffing Stage to Working Tree", 0);
-	LGitProgressStart(ctx, hwnd, FALSE);
-	if (git_diff_index_to_workdir(&diff, ctx->repo, NULL, &diffopts) != 0) {
-		LGitLibraryError(hwnd, "git_diff_index_to_workdir");
-		ret = SCC_E_NONSPECIFICERROR;
-		goto fin;
-	}
-	LGitProgressDeinit(ctx);
 
+	/* repo index on null */
 	params.ctx = ctx;
-	params.diff = diff;
+	params.diff = NULL;
+	params.source.type = LGDS_INDEX_TO_WORKDIR;
+	params.source.diffopts = &diffopts;
 	params.path = "Stage to Working Directory";
 	params.commit = NULL;
 	switch (LGitDiffWindow(hwnd, &params)) {
@@ -253,14 +221,10 @@ SCCRTN LGitDiffStageToWorkdir(LGitContext *ctx, HWND hwnd, git_strarray *paths)
 	case -1:
 		LGitLog(" ! Uh-oh, dialog error\n");
 		ret = SCC_E_NONSPECIFICERROR;
-		goto fin;
+		break;
 	default:
 		break;
 	}
-fin:
-	if (diff != NULL) {
-		git_diff_free(diff);
-	}
 	return ret;
 }
 
@@ -271,7 +235,6 @@ SCCRTN LGitDiffTreeToWorkdir(LGitContext *ctx, HWND hwnd, git_strarray *paths, g
 	SCCRTN ret = SCC_OK;
 	LGitDiffDialogParams params;
 	ZeroMemory(&params, sizeof(LGitDiffDialogParams));
-	git_diff *diff = NULL;
 	/* XXX: config opts since we have no flags? allow passing in? */
 	git_diff_options diffopts;
 	git_diff_options_init(&diffopts, GIT_DIFF_OPTIONS_VERSION);
@@ -279,15 +242,6 @@ SCCRTN LGitDiffTreeToWorkdir(LGitContext *ctx, HWND hwnd, git_strarray *paths, g
 		diffopts.pathspec.strings = paths->strings;
 		diffopts.pathspec.count = paths->count;
 	}
-	LGitInitDiffProgressCallback(ctx, &diffopts);
-	LGitProgressInit(ctx, "Diffing Tree to Working Tree", 0);
-	LGitProgressStart(ctx, hwnd, FALSE);
-	if (git_diff_tree_to_workdir(&diff, ctx->repo, tree, &diffopts) != 0) {
-		LGitLibraryError(hwnd, "git_diff_index_to_workdir");
-		ret = SCC_E_NONSPECIFICERROR;
-		goto fin;
-	}
-	LGitProgressDeinit(ctx);
 
 	char title[128];
 	if (tree != NULL) {
@@ -298,20 +252,19 @@ SCCRTN LGitDiffTreeToWorkdir(LGitContext *ctx, HWND hwnd, git_strarray *paths, g
 		params.path = "Empty Tree to Working Directory";
 	}
 	params.ctx = ctx;
-	params.diff = diff;
+	params.diff = NULL;
+	params.source.type = LGDS_TREE_TO_WORKDIR;
+	params.source.old_tree = tree != NULL ? git_tree_id(tree) : NULL;
+	params.source.diffopts = &diffopts;
 	params.commit = NULL;
 	switch (LGitDiffWindow(hwnd, &params)) {
 	case 0:
 	case -1:
 		LGitLog(" ! Uh-oh, dialog error\n");
 		ret = SCC_E_NONSPECIFICERROR;
-		goto fin;
+		break;
 	default:
 		break;
 	}
-fin:
-	if (diff != NULL) {
-		git_diff_free(diff);
-	}
 	return ret;
-}
\ No newline at end of file
+}
@@ -0,0 +1,687 @@
+/*
+ * Diff document: the lines of a diff, streamed in on a worker thread and
+ * kept as spans into one text buffer. The diff window is a virtual list over
+ * it, so display text (tabs expanded, converted to UTF-16) is only made for
+ * rows that are actually on screen.
+ *
+ * Given a source instead of a diff, the worker makes the diff too, so the
+ * window is up (and can be closed) while libgit2 is still comparing. Files
+ * are listed as libgit2 finds they differ, for the window to show until
+ * there are lines.
+ *
+ * Rows are also paired up as they come in, for showing old and new side by
+ * side. Deletions and the additions right after them are a changed block,
+ * lined up one to one, with gaps on the shorter side; everything else is on
+ * both sides. Pairs only refer to rows, so that's all they cost.
+ */
+
+#include "stdafx.h"
+
+/* Rows to have before telling the window the first time, then how often */
+#define FIRST_PAGE_SIZE 64
+#define PAGE_SIZE 8192
+#define PAGE_INTERVAL 100
+
+/* Longer lines are cut off; nobody is reading 16 MB of one line anyway */
+#define MAX_LINE_LENGTH 0xFFFFFF
+
+typedef struct _LGitDiffRow {
+	/* into the text buffer */
+	DWORD offset;
+	unsigned length : 24;
+	/* LGitDiffRowKind, also the image index */
+	unsigned kind : 8;
+} LGitDiffRow;
+
+typedef struct _LGitDiffPair {
+	/* Rows on each side, or -1 for a gap */
+	LONG left, right;
+	/* First pair of the changed block it's in, or -1 if it's not in one */
+	LONG block;
+} LGitDiffPair;
+
+struct _LGitDiffDocument {
+	git_diff *diff;
+	/* If we make the diff ourselves, from what; it's in our repository */
+	BOOL from_source;
+	char repo_path[1024];
+	git_repository *repo;
+	LGitDiffSourceType type;
+	git_oid old_tree, new_tree;
+	BOOL has_old_tree, has_new_tree;
+	git_diff_options diffopts;
+	/* Progress, for the window to show; not guarded */
+	volatile LONG examined, found, deltas, current;
+	/* Guards everything below that the window reads */
+	CRITICAL_SECTION lock;
+	LGitDiffRow *rows;
+	LONG count, capacity;
+	char *text;
+	DWORD text_len, text_cap;
+	/* In characters, after tabs are expanded; for sizing the column */
+	DWORD widest;
+	/* Paths of the files found to differ while comparing */
+	std::vector<std::string> *found_paths;
+	LGitDiffPair *pairs;
+	LONG pair_count, pair_capacity;
+	/* The changed block being paired; rows in each run are consecutive */
+	LONG del_start, dels, add_start, adds;
+	/* Worker state */
+	HANDLE thread;
+	volatile LONG cancel;
+	LONG state;
+	char error[256];
+	HWND notify;
+	LONG posted;
+	DWORD begin, last_post;
+};
+
+LGitDiffDocument *LGitDiffDocumentNew(git_diff *diff)
+{
+	LGitDiffDocument *doc;
+	doc = (LGitDiffDocument*)calloc(1, sizeof(LGitDiffDocument));
+	if (doc == NULL) {
+		return NULL;
+	}
+	doc->diff = diff;
+	doc->found_paths = new std::vector<std::string>();
+	InitializeCriticalSection(&doc->lock);
+	return doc;
+}
+
+/*
+ * Makes the diff on the worker as well. Anything the options point to (i.e.
+ * the pathspec) must outlive the document.
+ */
+LGitDiffDocument *LGitDiffDocumentNewFromSource(git_repository *repo, const LGitDiffSource *source)
+{
+	LGitDiffDocument *doc = LGitDiffDocumentNew(NULL);
+	if (doc == NULL) {
+		return NULL;
+	}
+	doc->from_source = TRUE;
+	strlcpy(doc->repo_path, git_repository_path(repo), 1024);
+	doc->type = source->type;
+	if (source->old_tree != NULL) {
+		git_oid_cpy(&doc->old_tree, source->old_tree);
+		doc->has_old_tree = TRUE;
+	}
+	if (source->new_tree != NULL) {
+		git_oid_cpy(&doc->new_tree, source->new_tree);
+		doc->has_new_tree = TRUE;
+	}
+	if (source->diffopts != NULL) {
+		memcpy(&doc->diffopts, source->diffopts, sizeof(git_diff_options));
+	} else {
+		git_diff_options_init(&doc->diffopts, GIT_DIFF_OPTIONS_VERSION);
+	}
+	return doc;
+}
+
+void LGitDiffDocumentFree(LGitDiffDocument *doc)
+{
+	if (doc == NULL) {
+		return;
+	}
+	LGitDiffDocumentStop(doc);
+	/* Only ours if we made it */
+	if (doc->from_source) {
+		if (doc->diff != NULL) {
+			git_diff_free(doc->diff);
+		}
+		if (doc->repo != NULL) {
+			git_repository_free(doc->repo);
+		}
+	}
+	DeleteCriticalSection(&doc->lock);
+	delete doc->found_paths;
+	free(doc->rows);
+	free(doc->pairs);
+	free(doc->text);
+	free(doc);
+}
+
+/* Must be called with the lock held */
+static BOOL LGitDiffDocumentAddPair(LGitDiffDocument *doc, LONG left, LONG right, LONG block)
+{
+	LGitDiffPair *pair;
+	if (doc->pair_count == doc->pair_capacity) {
+		LONG new_cap = doc->pair_capacity ? doc->pair_capacity * 2 : 4096;
+		LGitDiffPair *new_pairs = (LGitDiffPair*)realloc(doc->pairs, new_cap * sizeof(LGitDiffPair));
+		if (new_pairs == NULL) {
+			return FALSE;
+		}
+		doc->pairs = new_pairs;
+		doc->pair_capacity = new_cap;
+	}
+	pair = doc->pairs + doc->pair_count++;
+	pair->left = left;
+	pair->right = right;
+	pair->block = block;
+	return TRUE;
+}
+
+/* Lines up the pending block; must be called with the lock held */
+static BOOL LGitDiffDocumentFlushBlock(LGitDiffDocument *doc)
+{
+	LONG i, length, block = doc->pair_count;
+	length = doc->dels > doc->adds ? doc->dels : doc->adds;
+	for (i = 0; i < length; i++) {
+		if (!LGitDiffDocumentAddPair(doc,
+			i < doc->dels ? doc->del_start + i : -1,
+			i < doc->adds ? doc->add_start + i : -1,
+			block)) {
+			return FALSE;
+		}
+	}
+	doc->dels = doc->adds = 0;
+	return TRUE;
+}
+
+/* Must be called with the lock held */
+static BOOL LGitDiffDocumentPairRow(LGitDiffDocument *doc, LGitDiffRowKind kind, LONG index)
+{
+	LGitDiffPair *last;
+	switch (kind) {
+	case LGDR_DELETION:
+		/* Deletions after additions start another block */
+		if (doc->adds > 0 && !LGitDiffDocumentFlushBlock(doc)) {
+			return FALSE;
+		}
+		if (doc->dels++ == 0) {
+			doc->del_start = index;
+		}
+		return TRUE;
+	case LGDR_ADDITION:
+		if (doc->adds++ == 0) {
+			doc->add_start = index;
+		}
+		return TRUE;
+	}
+	if (!LGitDiffDocumentFlushBlock(doc)) {
+		return FALSE;
+	}
+	switch (kind) {
+	case LGDR_FILE_A:
+		return LGitDiffDocumentAddPair(doc, index, -1, -1);
+	case LGDR_FILE_B:
+		/* Always right after its old file */
+		last = doc->pair_count > 0 ? doc->pairs + doc->pair_count - 1 : NULL;
+		if (last != NULL && last->right == -1 && last->block == -1) {
+			last->right = index;
+			return TRUE;
+		}
+		return LGitDiffDocumentAddPair(doc, -1, index, -1);
+	default:
+		return LGitDiffDocumentAddPair(doc, index, index, -1);
+	}
+}
+
+/* Must be called with the lock held */
+static BOOL LGitDiffDocumentAddRow(LGitDiffDocument *doc,
+								   LGitDiffRowKind kind,
+								   const char *text,
+								   size_t len)
+{
+	LGitDiffRow *row;
+	DWORD width, i;
+	if (len > MAX_LINE_LENGTH) {
+		len = MAX_LINE_LENGTH;
+	}
+	if (doc->count == doc->capacity) {
+		LONG new_cap = doc->capacity ? doc->capacity * 2 : 4096;
+		LGitDiffRow *new_rows = (LGitDiffRow*)realloc(doc->rows, new_cap * sizeof(LGitDiffRow));
+		if (new_rows == NULL) {
+			return FALSE;
+		}
+		doc->rows = new_rows;
+		doc->capacity = new_cap;
+	}
+	if (doc->text_len + len > doc->text_cap) {
+		DWORD new_cap = doc->text_cap ? doc->text_cap : 0x40000;
+		while (doc->text_len + len > new_cap) {
+			new_cap *= 2;
+		}
+		char *new_text = (char*)realloc(doc->text, new_cap);
+		if (new_text == NULL) {
+			return FALSE;
+		}
+		doc->text = new_text;
+		doc->text_cap = new_cap;
+	}
+	row = doc->rows + doc->count++;
+	row->offset = doc->text_len;
+	row->length = len;
+	row->kind = kind;
+	memcpy(doc->text + doc->text_len, text, len);
+	doc->text_len += len;
+	/* Close enough for UTF-8; a few wide characters won't hurt */
+	for (i = 0, width = len; i < len; i++) {
+		if (text[i] == '\t') {
+			width++;
+		}
+	}
+	if (width > doc->widest) {
+		doc->widest = width;
+	}
+	return LGitDiffDocumentPairRow(doc, kind, doc->count - 1);
+}
+
+/* Don't flood the window with messages; the timer also covers comparing */
+static void LGitDiffDocumentMaybePost(LGitDiffDocument *doc)
+{
+	if ((doc->posted == 0 && doc->count >= FIRST_PAGE_SIZE)
+		|| (doc->count - doc->posted >= PAGE_SIZE)
+		|| (GetTickCount() - doc->last_post >= PAGE_INTERVAL)) {
+		if (doc->posted == 0 && doc->count > 0) {
+			LGitLog(" ! Diff: first %d rows in %u ms\n",
+				doc->count,
+				GetTickCount() - doc->begin);
+		}
+		doc->posted = doc->count;
+		doc->last_post = GetTickCount();
+		PostMessage(doc->notify, WM_LGIT_DIFF_ROWS, LGDD_STREAMING, 0);
+	}
+}
+
+static int LGitDiffDocumentAdd(LGitDiffDocument *doc,
+							   LGitDiffRowKind kind,
+							   const char *text,
+							   size_t len)
+{
+	BOOL ok;
+	if (doc->cancel) {
+		return GIT_EUSER;
+	}
+	EnterCriticalSection(&doc->lock);
+	ok = LGitDiffDocumentAddRow(doc, kind, text, len);
+	LeaveCriticalSection(&doc->lock);
+	if (!ok) {
+		LGitLog("!! Out of memory adding diff line\n");
+		return GIT_EUSER;
+	}
+	LGitDiffDocumentMaybePost(doc);
+	return 0;
+}
+
+static int LGitDiffDocumentFileCallback(const git_diff_delta *delta,
+										float progress,
+										void *payload)
+{
+	LGitDiffDocument *doc = (LGitDiffDocument*)payload;
+	char line[1024];
+	int rc;
+	doc->current++;
+	_snprintf(line, sizeof(line), "(%o) %s", delta->old_file.mode, delta->old_file.path);
+	line[sizeof(line) - 1] = '\0';
+	if ((rc = LGitDiffDocumentAdd(doc, LGDR_FILE_A, line, strlen(line))) != 0) {
+		return rc;
+	}
+	_snprintf(line, sizeof(line), "(%o) %s", delta->new_file.mode, delta->new_file.path);
+	line[sizeof(line) - 1] = '\0';
+	return LGitDiffDocumentAdd(doc, LGDR_FILE_B, line, strlen(line));
+}
+
+static int LGitDiffDocumentBinaryCallback(const git_diff_delta *delta,
+										  const git_diff_binary *binary,
+										  void *payload)
+{
+	LGitDiffDocument *doc = (LGitDiffDocument*)payload;
+	const char *message = "Binary file differs";
+	return LGitDiffDocumentAdd(doc, LGDR_BINARY, message, strlen(message));
+}
+
+static int LGitDiffDocumentHunkCallback(const git_diff_delta *delta,
+										const git_diff_hunk *hunk,
+										void *payload)
+{
+	LGitDiffDocument *doc = (LGitDiffDocument*)payload;
+	return LGitDiffDocumentAdd(doc, LGDR_HUNK, hunk->header, hunk->header_len);
+}
+
+static int LGitDiffDocumentLineCallback(const git_diff_delta *delta,
+										const git_diff_hunk *hunk,
+										const git_diff_line *line,
+										void *payload)
+{
+	LGitDiffDocument *doc = (LGitDiffDocument*)payload;
+	LGitDiffRowKind kind;
+	switch (line->origin) {
+	case GIT_DIFF_LINE_ADDITION:
+		kind = LGDR_ADDITION;
+		break;
+	case GIT_DIFF_LINE_DELETION:
+		kind = LGDR_DELETION;
+		break;
+	default:
+		kind = LGDR_CONTEXT;
+		break;
+	}
+	return LGitDiffDocumentAdd(doc, kind, line->content, line->content_len);
+}
+
+/* libgit2 calls this for every file it looks at while comparing */
+static int LGitDiffDocumentProgressCallback(const git_diff *diff_so_far,
+											const char *old_path,
+											const char *new_path,
+											void *payload)
+{
+	LGitDiffDocument *doc = (LGitDiffDocument*)payload;
+	if (doc->cancel) {
+		return -1;
+	}
+	doc->examined++;
+	LGitDiffDocumentMaybePost(doc);
+	return 0;
+}
+
+/* ...and this for every file that made it into the diff */
+static int LGitDiffDocumentNotifyCallback(const git_diff *diff_so_far,
+										  const git_diff_delta *delta_to_add,
+										  const char *matched_pathspec,
+										  void *payload)
+{
+	LGitDiffDocument *doc = (LGitDiffDocument*)payload;
+	const char *path;
+	if (doc->cancel) {
+		return -1;
+	}
+	if (doc->found++ == 0) {
+		LGitLog(" ! Diff: first delta in %u ms\n", GetTickCount() - doc->begin);
+	}
+	path = delta_to_add->new_file.path != NULL
+		? delta_to_add->new_file.path
+		: delta_to_add->old_file.path;
+	EnterCriticalSection(&doc->lock);
+	doc->found_paths->push_back(path != NULL ? path : "");
+	LeaveCriticalSection(&doc->lock);
+	LGitDiffDocumentMaybePost(doc);
+	return 0;
+}
+
+static int LGitDiffDocumentMakeDiff(LGitDiffDocument *doc)
+{
+	git_tree *old_tree = NULL, *new_tree = NULL;
+	int rc;
+	/* Our own, since the IDE might want the context's while we work */
+	if ((rc = git_repository_open(&doc->repo, doc->repo_path)) != 0) {
+		return rc;
+	}
+	if (doc->has_old_tree
+		&& (rc = git_tree_lookup(&old_tree, doc->repo, &doc->old_tree)) != 0) {
+		goto fin;
+	}
+	if (doc->has_new_tree
+		&& (rc = git_tree_lookup(&new_tree, doc->repo, &doc->new_tree)) != 0) {
+		goto fin;
+	}
+	doc->diffopts.progress_cb = LGitDiffDocumentProgressCallback;
+	doc->diffopts.notify_cb = LGitDiffDocumentNotifyCallback;
+	doc->diffopts.payload = doc;
+	switch (doc->type) {
+	case LGDS_INDEX_TO_WORKDIR:
+		rc = git_diff_index_to_workdir(&doc->diff, doc->repo, NULL, &doc->diffopts);
+		break;
+	case LGDS_TREE_TO_WORKDIR:
+		rc = git_diff_tree_to_workdir(&doc->diff, doc->repo, old_tree, &doc->diffopts);
+		break;
+	case LGDS_TREE_TO_TREE:
+		rc = git_diff_tree_to_tree(&doc->diff, doc->repo, old_tree, new_tree, &doc->diffopts);
+		break;
+	default:
+		git_error_set_str(GIT_ERROR_INVALID, "Unknown kind of diff.");
+		rc = -1;
+		break;
+	}
+	LGitLog(" ! Diff: compared %d files, %d deltas in %u ms\n",
+		doc->examined,
+		doc->found,
+		GetTickCount() - doc->begin);
+	/* Renames are nice to have; without them it's still a correct diff */
+	if (rc == 0 && !doc->cancel
+		&& LGitFindRenames(doc->diff, doc->type == LGDS_TREE_TO_TREE, &doc->cancel) != 0
+		&& !doc->cancel) {
+		LGitLog(" ! Rename detection failed: %s\n",
+			git_error_last() != NULL ? git_error_last()->message : "(null)");
+	}
+fin:
+	if (old_tree != NULL) {
+		git_tree_free(old_tree);
+	}
+	if (new_tree != NULL) {
+		git_tree_free(new_tree);
+	}
+	return rc;
+}
+
+static unsigned __stdcall LGitDiffDocumentWorker(void *context)
+{
+	LGitDiffDocument *doc = (LGitDiffDocument*)context;
+	const git_error *gerror;
+	LONG state;
+	int rc = 0;
+	if (doc->from_source) {
+		rc = LGitDiffDocumentMakeDiff(doc);
+	}
+	/*
+	 * If it's the caller's diff, it belongs to the context's repository, but
+	 * the IDE is stuck behind the modal diff window, so nothing else uses it.
+	 */
+	if (rc == 0) {
+		doc->deltas = git_diff_num_deltas(doc->diff);
+		rc = git_diff_foreach(doc->diff,
+		LGitDiffDocumentFileCallback,
+		LGitDiffDocumentBinaryCallback,
+		LGitDiffDocumentHunkCallback,
+		LGitDiffDocumentLineCallback,
+		doc);
+	}
+	/* A block at the very end has nothing after it to finish it */
+	EnterCriticalSection(&doc->lock);
+	LGitDiffDocumentFlushBlock(doc);
+	LeaveCriticalSection(&doc->lock);
+	if (rc == 0) {
+		state = LGDD_DONE;
+	} else if (doc->cancel) {
+		state = LGDD_CANCELLED;
+	} else {
+		/* Errors are per thread, so keep it for the window */
+		gerror = git_error_last();
+		strlcpy(doc->error,
+			gerror != NULL ? gerror->message : "libgit2 returned a null error.",
+			sizeof(doc->error));
+		LGitLog("!! Diff streaming failed (%d): %s\n", rc, doc->error);
+		state = LGDD_FAILED;
+	}
+	LGitLog(" ! Diff: %d rows, %u bytes of text in %u ms\n",
+		doc->count,
+		doc->text_len,
+		GetTickCount() - doc->begin);
+	doc->state = state;
+	PostMessage(doc->notify, WM_LGIT_DIFF_ROWS, state, 0);
+	return 0;
+}
+
+/* The window is sent WM_LGIT_DIFF_ROWS as rows come in, with the state */
+BOOL LGitDiffDocumentStart(LGitDiffDocument *doc, HWND notify)
+{
+	unsigned thread_id;
+	doc->notify = notify;
+	doc->cancel = 0;
+	doc->state = LGDD_STREAMING;
+	doc->error[0] = '\0';
+	doc->posted = 0;
+	doc->begin = doc->last_post = GetTickCount();
+	doc->thread = (HANDLE)_beginthreadex(NULL, 0, LGitDiffDocumentWorker, doc, 0, &thread_id);
+	if (doc->thread == NULL) {
+		LGitLog("!! Couldn't start diff worker\n");
+		doc->state = LGDD_FAILED;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Waits for the rest of the diff, i.e. before using the diff elsewhere */
+void LGitDiffDocumentWait(LGitDiffDocument *doc)
+{
+	if (doc->thread != NULL) {
+		WaitForSingleObject(doc->thread, INFINITE);
+		CloseHandle(doc->thread);
+		doc->thread = NULL;
+	}
+}
+
+void LGitDiffDocumentStop(LGitDiffDocument *doc)
+{
+	InterlockedExchange((LPLONG)&doc->cancel, 1);
+	LGitDiffDocumentWait(doc);
+}
+
+LONG LGitDiffDocumentCount(LGitDiffDocument *doc)
+{
+	LONG count;
+	EnterCriticalSection(&doc->lock);
+	count = doc->count;
+	LeaveCriticalSection(&doc->lock);
+	return count;
+}
+
+LONG LGitDiffDocumentPairCount(LGitDiffDocument *doc)
+{
+	LONG count;
+	EnterCriticalSection(&doc->lock);
+	count = doc->pair_count;
+	LeaveCriticalSection(&doc->lock);
+	return count;
+}
+
+/*
+ * The rows on each side of a side by side line (-1 for a gap), and the
+ * first line of the changed block it's in (-1 if none).
+ */
+BOOL LGitDiffDocumentPair(LGitDiffDocument *doc, LONG index, LONG *left, LONG *right, LONG *block)
+{
+	BOOL ret = FALSE;
+	EnterCriticalSection(&doc->lock);
+	if (index >= 0 && index < doc->pair_count) {
+		*left = doc->pairs[index].left;
+		*right = doc->pairs[index].right;
+		*block = doc->pairs[index].block;
+		ret = TRUE;
+	}
+	LeaveCriticalSection(&doc->lock);
+	return ret;
+}
+
+LONG LGitDiffDocumentFoundCount(LGitDiffDocument *doc)
+{
+	LONG count;
+	EnterCriticalSection(&doc->lock);
+	count = doc->found_paths->size();
+	LeaveCriticalSection(&doc->lock);
+	return count;
+}
+
+/* Path of a file found to differ, in the order they were found */
+BOOL LGitDiffDocumentFoundPath(LGitDiffDocument *doc, LONG index, wchar_t *buf, size_t bufsz)
+{
+	BOOL ret = FALSE;
+	if (bufsz < 1) {
+		return FALSE;
+	}
+	buf[0] = L'\0';
+	EnterCriticalSection(&doc->lock);
+	if (index >= 0 && (size_t)index < doc->found_paths->size()) {
+		LGitUtf8ToWide((*doc->found_paths)[index].c_str(), buf, bufsz);
+		buf[bufsz - 1] = L'\0';
+		ret = TRUE;
+	}
+	LeaveCriticalSection(&doc->lock);
+	return ret;
+}
+
+/* One of LGDD_*; if failed, message gets why */
+LONG LGitDiffDocumentGetState(LGitDiffDocument *doc, const char **message)
+{
+	if (message != NULL) {
+		*message = doc->error;
+	}
+	return doc->state;
+}
+
+/*
+ * How far along it is: files looked at while comparing, then which of how
+ * many deltas is being turned into lines.
+ */
+void LGitDiffDocumentProgress(LGitDiffDocument *doc, LONG *examined, LONG *current, LONG *deltas)
+{
+	*examined = doc->examined;
+	*current = doc->current;
+	*deltas = doc->deltas;
+}
+
+/* Only once it's done; NULL if it couldn't be made */
+git_diff *LGitDiffDocumentDiff(LGitDiffDocument *doc)
+{
+	LGitDiffDocumentWait(doc);
+	return doc->diff;
+}
+
+/* Widest line so far, in characters */
+DWORD LGitDiffDocumentWidest(LGitDiffDocument *doc)
+{
+	return doc->widest;
+}
+
+/* Image for the row; LGDR_CONTEXT has none */
+int LGitDiffDocumentKind(LGitDiffDocument *doc, LONG index)
+{
+	int kind = LGDR_CONTEXT;
+	EnterCriticalSection(&doc->lock);
+	if (index >= 0 && index < doc->count) {
+		kind = doc->rows[index].kind;
+	}
+	LeaveCriticalSection(&doc->lock);
+	return kind;
+}
+
+/*
+ * Display text for a row. The list view doesn't do tabs or newlines, so
+ * tabs become two spaces and the line ending is dropped.
+ */
+BOOL LGitDiffDocumentText(LGitDiffDocument *doc, LONG index, wchar_t *buf, size_t bufsz)
+{
+	char line[1024];
+	const char *text;
+	size_t len, i, out;
+	if (bufsz < 1) {
+		return FALSE;
+	}
+	buf[0] = L'\0';
+	EnterCriticalSection(&doc->lock);
+	if (index < 0 || index >= doc->count) {
+		LeaveCriticalSection(&doc->lock);
+		return FALSE;
+	}
+	text = doc->text + doc->rows[index].offset;
+	len = doc->rows[index].length;
+	/* Only as much as could fit; the view won't ask for more than a screen */
+	for (i = 0, out = 0; i < len && out < sizeof(line) - 2 && out < bufsz; i++) {
+		if (text[i] == '\t') {
+			/* Two spaces because I say so */
+			line[out++] = ' ';
+			line[out++] = ' ';
+		} else if (text[i] == '\r' || text[i] == '\n') {
+			break;
+		} else {
+			line[out++] = text[i];
+		}
+	}
+	LeaveCriticalSection(&doc->lock);
+	line[out] = '\0';
+	if (MultiByteToWideChar(CP_UTF8, 0, line, -1, buf, bufsz) == 0) {
+		/* Probably cut in the middle of a character */
+		buf[bufsz - 1] = L'\0';
+	}
+	return TRUE;
+}
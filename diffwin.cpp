@@ -1,5 +1,10 @@
 /*
  * The diff window, broken out because it's so big.
+ *
+ * It's either one column of the unified diff, or old and new side by side.
+ * Side by side, changed lines that are lined up with each other get what
+ * in them changed highlighted, worked out as they're drawn. While it's
+ * still comparing, it lists the files found to differ so far instead.
  */
 
 #include "stdafx.h"
@@ -9,25 +14,38 @@
 static LVCOLUMN diff_column = {
 	LVCF_TEXT | LVCF_WIDTH, 0, 200, "Diff Line"
 };
+static LVCOLUMN new_column = {
+	LVCF_TEXT | LVCF_WIDTH, 0, 200, "New"
+};
 
-typedef struct _LGitDiffCallbackParams {
-	HWND lv;
-	int index;
-	/* allocated to avoid stack churn/stupid line lengths */
-	char *msg;
-	wchar_t *msgw;
-} LGitDiffCallbackParams;
-
-#define CALLBACK_MSG_SIZE 0x8000
+/* Side by side backgrounds; the second is for changed words */
+#define DIFF_DELETION_BACK RGB(255, 235, 235)
+#define DIFF_DELETION_WORD RGB(255, 185, 185)
+#define DIFF_ADDITION_BACK RGB(230, 255, 230)
+#define DIFF_ADDITION_WORD RGB(165, 235, 165)
+#define DIFF_GAP_BACK RGB(240, 240, 240)
 
 static void SetDiffTitleBar(HWND hwnd, LGitDiffDialogParams* params)
 {
+	char title[256], progress[64];
+	LONG examined, current, deltas;
 	if (params->path) {
-		char title[256];
 		_snprintf(title, 256, "Diff for %s", params->path);
-		SetWindowText(hwnd, title);
+	} else {
+		strlcpy(title, "Diff", 256);
+	}
+	/* Say how far along it is until it's done */
+	if (params->document != NULL
+		&& LGitDiffDocumentGetState(params->document, NULL) == LGDD_STREAMING) {
+		LGitDiffDocumentProgress(params->document, &examined, &current, &deltas);
+		if (deltas == 0) {
+			_snprintf(progress, 64, " (Comparing, %d files)", examined);
+		} else {
+			_snprintf(progress, 64, " (File %d of %d)", current, deltas);
+		}
+		strlcat(title, progress, 256);
 	}
-	/* default otherwise */
+	SetWindowText(hwnd, title);
 }
 
 static void InitDiffView(HWND hwnd, LGitDiffDialogParams* params)
@@ -74,252 +92,286 @@ static void InitDiffView(HWND hwnd, LGitDiffDialogParams* params)
 	LGitSetMonospaceFont(params->ctx, lv);
 }
 
-static int LGitDiffFileCallback(const git_diff_delta *delta,
-								float progress,
-								void *payload)
+static BOOL FillDiffView(HWND hwnd, LGitDiffDialogParams* params)
 {
-	LGitDiffCallbackParams *params = (LGitDiffCallbackParams*)payload;
-	LVITEMW lvi;
-	wchar_t path[2048];
-	ZeroMemory(&lvi, sizeof(LVITEMW));
-	lvi.iItem = params->index++;
-	lvi.mask = LVIF_TEXT | LVIF_IMAGE;
-	/* XXX: We should detect similarity and just skim the diff if so. */
-	LGitUtf8ToWide(delta->old_file.path, path, 2048);
-	_snwprintf(params->msgw, CALLBACK_MSG_SIZE, L"(%o) %s",
-		delta->old_file.mode,
-		path);
-	lvi.pszText = params->msgw;
-	lvi.iSubItem = 0;
-	lvi.iImage = 0;
-
-	lvi.iItem = SendMessage(params->lv, LVM_INSERTITEMW, 0, (LPARAM)&lvi);
-	if (lvi.iItem == -1) {
-		LGitLog(" ! ListView_InsertItem failed for file A\n");
-		return 1;
+	HWND lv;
+	lv = GetDlgItem(hwnd, IDC_DIFFTEXT);
+	if (lv == NULL) {
+		LGitLog(" ! Couldn't get diff control\n");
+		return FALSE;
 	}
-	/* Now item B */
-	ZeroMemory(&lvi, sizeof(LVITEMW));
-	lvi.iItem = params->index++;
-	lvi.mask = LVIF_TEXT | LVIF_IMAGE;
-	LGitUtf8ToWide(delta->new_file.path, path, 2048);
-	_snwprintf(params->msgw, CALLBACK_MSG_SIZE, L"(%o) %s",
-		delta->new_file.mode,
-		path);
-	lvi.pszText = params->msgw;
-	lvi.iSubItem = 0;
-	lvi.iImage = 1;
-
-	lvi.iItem = SendMessage(params->lv, LVM_INSERTITEMW, 0, (LPARAM)&lvi);
-	if (lvi.iItem == -1) {
-		LGitLog(" ! ListView_InsertItem failed for file B\n");
-		return 1;
+	if (params->diff != NULL) {
+		params->document = LGitDiffDocumentNew(params->diff);
+	} else {
+		params->document = LGitDiffDocumentNewFromSource(params->ctx->repo, &params->source);
+	}
+	if (params->document == NULL) {
+		LGitLog(" ! Couldn't alloc diff document\n");
+		return FALSE;
+	}
+	params->words = LGitWordDiffNew(params->document);
+	if (params->words == NULL) {
+		LGitLog(" ! Couldn't alloc word diff\n");
+		return FALSE;
 	}
-	return 0;
+	return LGitDiffDocumentStart(params->document, hwnd);
 }
 
-static int LGitDiffBinaryCallback(const git_diff_delta *delta,
-								  const git_diff_binary *binary,
-								  void *payload)
+/* The document row for a cell; side by side, -1 is a gap */
+static LONG DiffItemRow(LGitDiffDialogParams *params, int item, int subitem)
 {
-	LGitDiffCallbackParams *params = (LGitDiffCallbackParams*)payload;
-	LVITEM lvi;
-	ZeroMemory(&lvi, sizeof(LVITEM));
-	lvi.iItem = params->index++;
-	lvi.mask = LVIF_TEXT | LVIF_IMAGE;
-	lvi.pszText = "Binary file differs";
-	lvi.iSubItem = 0;
-	lvi.iImage = 2;
-
-	lvi.iItem = ListView_InsertItem(params->lv, &lvi);
-	if (lvi.iItem == -1) {
-		LGitLog(" ! ListView_InsertItem failed for binary\n");
-		return 1;
+	LONG left, right, block;
+	if (!params->side_by_side) {
+		return item;
+	}
+	if (!LGitDiffDocumentPair(params->document, item, &left, &right, &block)) {
+		return -1;
 	}
-	return 0;
+	return subitem == 0 ? left : right;
 }
 
-static int LGitDiffHunkCallback(const git_diff_delta *delta,
-								const git_diff_hunk *hunk,
-								void *payload)
+static LONG DiffItemCount(LGitDiffDialogParams *params)
 {
-	LGitDiffCallbackParams *params = (LGitDiffCallbackParams*)payload;
-	LVITEMW lvi;
-	ZeroMemory(&lvi, sizeof(LVITEMW));
-	lvi.iItem = params->index++;
-	lvi.mask = LVIF_TEXT | LVIF_IMAGE;
+	if (params->found_list) {
+		return LGitDiffDocumentFoundCount(params->document);
+	}
+	return params->side_by_side
+		? LGitDiffDocumentPairCount(params->document)
+		: LGitDiffDocumentCount(params->document);
+}
 
-	strlcpy(params->msg, hunk->header, CALLBACK_MSG_SIZE);
-	size_t length = strlen(params->msg);
-	if (length > 1 && !isprint(params->msg[length - 1])) {
-		params->msg[length - 1] = '\0';
+/* Autosizing would ask for the text of every row, so guess from the widest */
+static void SizeDiffColumn(HWND lv, LGitDiffDialogParams *params)
+{
+	HDC dc;
+	HFONT old_font;
+	SIZE char_size;
+	int width;
+	dc = GetDC(lv);
+	old_font = (HFONT)SelectObject(dc, (HFONT)SendMessage(lv, WM_GETFONT, 0, 0));
+	GetTextExtentPoint32(dc, "M", 1, &char_size);
+	SelectObject(dc, old_font);
+	ReleaseDC(lv, dc);
+	/* Room for the icon too */
+	width = (LGitDiffDocumentWidest(params->document) + 2) * char_size.cx
+		+ GetSystemMetrics(SM_CXSMICON);
+	if (width > ListView_GetColumnWidth(lv, 0)) {
+		ListView_SetColumnWidth(lv, 0, width);
 	}
-	if (length > 2 && !isprint(params->msg[length - 2])) {
-		params->msg[length - 2] = '\0';
+	if (params->side_by_side && width > ListView_GetColumnWidth(lv, 1)) {
+		ListView_SetColumnWidth(lv, 1, width);
 	}
-	LGitUtf8ToWide(params->msg, params->msgw, CALLBACK_MSG_SIZE);
-	lvi.pszText = params->msgw;
-
-	lvi.iSubItem = 0;
-	lvi.iImage = 3;
+}
 
-	lvi.iItem = SendMessage(params->lv, LVM_INSERTITEMW, 0, (LPARAM)&lvi);
-	if (lvi.iItem == -1) {
-		LGitLog(" ! ListView_InsertItem failed for hunk\n");
-		return 1;
+static void SetDiffLayout(HWND hwnd, LGitDiffDialogParams *params, BOOL side_by_side)
+{
+	HWND lv = GetDlgItem(hwnd, IDC_DIFFTEXT);
+	if (side_by_side == params->side_by_side) {
+		return;
 	}
-	return 0;
+	params->side_by_side = side_by_side;
+	CheckMenuItem(params->menu,
+		ID_DIFF_SIDE_BY_SIDE,
+		MF_BYCOMMAND | (side_by_side ? MF_CHECKED : MF_UNCHECKED));
+	if (side_by_side) {
+		ListView_InsertColumn(lv, 1, &new_column);
+	} else {
+		ListView_DeleteColumn(lv, 1);
+	}
+	ListView_SetItemCountEx(lv, DiffItemCount(params), LVSICF_NOSCROLL);
+	SizeDiffColumn(lv, params);
+	InvalidateRect(lv, NULL, TRUE);
 }
 
-static int LGitDiffLineCallback(const git_diff_delta *delta,
-								const git_diff_hunk *hunk,
-								const git_diff_line *line,
-								void *payload)
+static void DiffRowsArrived(HWND hwnd, LGitDiffDialogParams *params, LONG state)
 {
-	LGitDiffCallbackParams *params = (LGitDiffCallbackParams*)payload;
-	LVITEMW lvi;
-	size_t base_indent, i, length;
-	ZeroMemory(&lvi, sizeof(LVITEMW));
-	lvi.iItem = params->index++;
-	lvi.mask = LVIF_TEXT | LVIF_IMAGE;
-	if (//line->origin == GIT_DIFF_LINE_CONTEXT ||
-		line->origin == GIT_DIFF_LINE_ADDITION ||
-		line->origin == GIT_DIFF_LINE_DELETION) {
-		lvi.iImage = line->origin == GIT_DIFF_LINE_ADDITION
-			? 4 : 5;
+	HWND lv = GetDlgItem(hwnd, IDC_DIFFTEXT);
+	const char *message;
+	BOOL found_list;
+	found_list = state == LGDD_STREAMING && LGitDiffDocumentCount(params->document) == 0;
+	if (found_list != params->found_list) {
+		/* Every item means something else now */
+		params->found_list = found_list;
+		ListView_SetItemCountEx(lv, DiffItemCount(params), LVSICF_NOSCROLL);
+		InvalidateRect(lv, NULL, TRUE);
 	} else {
-		lvi.iImage = 6; /* doesn't exist or will be nop. */
+		ListView_SetItemCountEx(lv, DiffItemCount(params), LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
 	}
-#if 1
-	/*
-	 * This is going to be ugly because the Win32 controls don't handle tabs
-	 * or newlines very well. We should render newlines when they differ, as
-	 * well as any trailing spaces.
-	 */
-	/* First, check for tabs, then copy compensating */
-	ZeroMemory(params->msg, CALLBACK_MSG_SIZE);
-	for (base_indent = 0, i = 0; i < CALLBACK_MSG_SIZE && i < line->content_len; i++) {
-		if (line->content[i] == '\t') {
-			/* Two spaces because I say so */
-			strlcat(params->msg, "  ", CALLBACK_MSG_SIZE);
-			base_indent++;
-		}
+	SizeDiffColumn(lv, params);
+	SetDiffTitleBar(hwnd, params);
+	if (state == LGDD_FAILED
+		&& LGitDiffDocumentGetState(params->document, &message) == LGDD_FAILED) {
+		MessageBoxA(hwnd, message, "Diff", MB_ICONERROR | MB_OK);
 	}
-	size_t tab_length = strlen(params->msg);
-	length = __min(CALLBACK_MSG_SIZE - tab_length, line->content_len - base_indent);
-	memcpy(params->msg + tab_length, line->content + base_indent, length);
-	/* Truncate because not null terminated, and get newline */
-	params->msg[__min(CALLBACK_MSG_SIZE - 1, length)] = '\0';
-	length = strlen(params->msg);
-	/* We could have a zero-length line. Could be a loop instead. */
-	if (line->content_len >= 1 && !isprint(params->msg[length - 1])) {
-		params->msg[length - 1] = '\0';
+}
+
+/* Draws a changed line with its changed words picked out */
+static void DrawWordDiffCell(HWND lv,
+							 LGitDiffDialogParams *params,
+							 HDC dc,
+							 int item,
+							 int subitem,
+							 LONG row,
+							 const LGitWordSpan *spans,
+							 size_t count,
+							 COLORREF back,
+							 COLORREF word_back)
+{
+	wchar_t text[1024];
+	RECT rc, icon_rc;
+	HBRUSH brush;
+	TEXTMETRIC tm;
+	SIZE extent;
+	size_t i, pos, len, end;
+	int x, y, saved;
+
+	if (subitem == 0) {
+		/* Skipping the default drawing skips the icon too */
+		ListView_GetItemRect(lv, item, &icon_rc, LVIR_ICON);
+		FillRect(dc, &icon_rc, GetSysColorBrush(COLOR_WINDOW));
+		ImageList_Draw(ListView_GetImageList(lv, LVSIL_SMALL),
+			LGitDiffDocumentKind(params->document, row),
+			dc,
+			icon_rc.left,
+			icon_rc.top,
+			ILD_NORMAL);
+		ListView_GetItemRect(lv, item, &rc, LVIR_LABEL);
+	} else if (!ListView_GetSubItemRect(lv, item, subitem, LVIR_BOUNDS, &rc)) {
+		return;
 	}
-	if (line->content_len >= 2 && !isprint(params->msg[length - 2])) {
-		params->msg[length - 2] = '\0';
+	brush = CreateSolidBrush(back);
+	FillRect(dc, &rc, brush);
+	DeleteObject(brush);
+	LGitDiffDocumentText(params->document, row, text, 1024);
+	len = wcslen(text);
+	saved = SaveDC(dc);
+	GetTextMetrics(dc, &tm);
+	SetTextColor(dc, GetSysColor(COLOR_WINDOWTEXT));
+	SetBkMode(dc, OPAQUE);
+	x = rc.left + GetSystemMetrics(SM_CXEDGE) * 2;
+	y = rc.top + ((rc.bottom - rc.top) - tm.tmHeight) / 2;
+	/* Alternate between what's the same and the next changed span */
+	for (i = 0, pos = 0; pos < len && x < rc.right; ) {
+		if (i < count && spans[i].start <= pos) {
+			end = spans[i].start + spans[i].length;
+			SetBkColor(dc, word_back);
+			i++;
+		} else {
+			end = i < count ? spans[i].start : len;
+			SetBkColor(dc, back);
+		}
+		if (end > len) {
+			end = len;
+		}
+		if (end <= pos) {
+			continue;
+		}
+		ExtTextOutW(dc, x, y, ETO_CLIPPED, &rc, text + pos, end - pos, NULL);
+		GetTextExtentPoint32W(dc, text + pos, end - pos, &extent);
+		x += extent.cx;
+		pos = end;
 	}
-#else
-	/* Simplistic implementation */
-	length = __min(CALLBACK_MSG_SIZE, line->content_len);
-	memcpy(params->msg, line->content, length);
-	params->msg[length] = '\0';
-#endif
-	LGitUtf8ToWide(params->msg, params->msgw, CALLBACK_MSG_SIZE);
-	lvi.pszText = params->msgw;
-	lvi.iSubItem = 0;
+	RestoreDC(dc, saved);
+}
 
-	lvi.iItem = SendMessage(params->lv, LVM_INSERTITEMW, 0, (LPARAM)&lvi);
-	if (lvi.iItem == -1) {
-		LGitLog(" ! ListView_InsertItem failed for line\n");
-		return 1;
+/* Side by side, lines are colored by kind, and changed words drawn by us */
+static LRESULT DiffCustomDraw(HWND hwnd, LGitDiffDialogParams *params, NMLVCUSTOMDRAW *cd)
+{
+	HWND lv = cd->nmcd.hdr.hwndFrom;
+	const LGitWordSpan *spans;
+	COLORREF word_back;
+	size_t count;
+	LONG row;
+	int item = cd->nmcd.dwItemSpec, kind;
+	switch (cd->nmcd.dwDrawStage) {
+	case CDDS_PREPAINT:
+		return params->side_by_side && !params->found_list
+			? CDRF_NOTIFYITEMDRAW
+			: CDRF_DODEFAULT;
+	case CDDS_ITEMPREPAINT:
+		return CDRF_NOTIFYSUBITEMDRAW;
+	case CDDS_ITEMPREPAINT | CDDS_SUBITEM:
+		cd->clrText = GetSysColor(COLOR_WINDOWTEXT);
+		cd->clrTextBk = GetSysColor(COLOR_WINDOW);
+		/* Leave the selection looking like one */
+		if ((ListView_GetItemState(lv, item, LVIS_SELECTED) & LVIS_SELECTED)
+			&& GetFocus() == lv) {
+			return CDRF_NEWFONT;
+		}
+		row = DiffItemRow(params, item, cd->iSubItem);
+		kind = row == -1 ? -1 : LGitDiffDocumentKind(params->document, row);
+		switch (kind) {
+		case -1:
+			cd->clrTextBk = DIFF_GAP_BACK;
+			return CDRF_NEWFONT;
+		case LGDR_DELETION:
+			cd->clrTextBk = DIFF_DELETION_BACK;
+			word_back = DIFF_DELETION_WORD;
+			break;
+		case LGDR_ADDITION:
+			cd->clrTextBk = DIFF_ADDITION_BACK;
+			word_back = DIFF_ADDITION_WORD;
+			break;
+		default:
+			return CDRF_NEWFONT;
+		}
+		/* Only lines being drawn get compared, so this is what's on screen */
+		if (!LGitWordDiffSpans(params->words, item, cd->iSubItem != 0, &spans, &count)
+			|| count == 0) {
+			return CDRF_NEWFONT;
+		}
+		DrawWordDiffCell(lv,
+			params,
+			cd->nmcd.hdc,
+			item,
+			cd->iSubItem,
+			row,
+			spans,
+			count,
+			cd->clrTextBk,
+			word_back);
+		return CDRF_SKIPDEFAULT;
 	}
-	return 0;
+	return CDRF_DODEFAULT;
 }
 
-static BOOL FillDiffView(HWND hwnd, LGitDiffDialogParams* params)
+/* Straight into the writer as it's printed, so there's no copy of it all */
+static BOOL WriteDiff(LGitDiffDialogParams *params, LGitPatchWriter *writer)
 {
-	HWND lv;
-	lv = GetDlgItem(hwnd, IDC_DIFFTEXT);
-	if (lv == NULL) {
-		LGitLog(" ! Couldn't get diff control\n");
-		return FALSE;
-	}
-	LGitDiffCallbackParams cbp;
-	cbp.lv = lv;
-	cbp.index = 0;
-	cbp.msg = (char*)malloc(CALLBACK_MSG_SIZE + 1);
-	if (cbp.msg == NULL) {
-		LGitLog(" ! Couldn't alloc callback buffer\n");
-		return FALSE;
-	}
-	cbp.msgw = (wchar_t*)calloc(CALLBACK_MSG_SIZE + 1, sizeof(wchar_t));
-	if (cbp.msgw == NULL) {
-		free(cbp.msg);
-		LGitLog(" ! Couldn't alloc wide callback buffer\n");
+	/* The diff can't be used from two threads at once */
+	git_diff *diff = LGitDiffDocumentDiff(params->document);
+	if (diff == NULL || LGitPatchWriterDiff(writer, diff) != 0) {
+		LGitLog("!! Couldn't write diff\n");
+		LGitPatchWriterClose(writer);
 		return FALSE;
 	}
-	LGitLog(" ! Number of diff deltas: %u\n", git_diff_num_deltas(params->diff));
-	git_diff_foreach(params->diff,
-		LGitDiffFileCallback,
-		LGitDiffBinaryCallback,
-		LGitDiffHunkCallback,
-		LGitDiffLineCallback,
-		&cbp);
-	free(cbp.msg);
-	free(cbp.msgw);
-	LGitLog(" ! LV Index is now %d\n", cbp.index);
-
-	ListView_SetColumnWidth(lv, 0, LVSCW_AUTOSIZE_USEHEADER);
-	return TRUE;
+	return LGitPatchWriterClose(writer);
 }
 
 static void CopyDiff(HWND hwnd, LGitDiffDialogParams* params)
 {
-	git_buf blob = {0, 0};
-	if (git_diff_to_buf(&blob, params->diff, GIT_DIFF_FORMAT_PATCH) != 0) {
-		LGitLog("!! Couldn't put diff into buffer\n");
+	/* Converted to UTF-16 as it goes, because CF_TEXT is ANSI */
+	LGitPatchWriter *writer = LGitPatchWriterOpenClipboard(hwnd);
+	if (writer == NULL) {
+		LGitLog("!! Couldn't start copying diff\n");
 		return;
 	}
-	if (!OpenClipboard(hwnd)) {
-		LGitLog("!! Couldn't open clipboard\n");
-		return;
-	}
-	EmptyClipboard();
-	/*
-	 * convert to UTF-16 because CF_TEXT is ANSI
-	 * XXX: It's implied 
-	 */
-	wchar_t *buf = LGitUtf8ToWideAlloc(blob.ptr);
-	if (SetClipboardData(CF_UNICODETEXT, buf) == NULL) {
-		LGitLog("!! Couldn't set clipboard\n");
-	}
-	CloseClipboard();
-	free(buf);
-	git_buf_dispose(&blob);
+	WriteDiff(params, writer);
 }
 
 static BOOL SaveDiff(HWND hwnd,
 					 LGitDiffDialogParams *params,
 					 const wchar_t *fileName)
 {
-	/* Binary because the diff is LF, not CRLF */
-	FILE *f = _wfopen(fileName, L"wb");
-	if (f == NULL) {
+	LGitPatchWriter *writer = LGitPatchWriterOpenFile(fileName);
+	if (writer == NULL) {
 		return FALSE;
 	}
-	git_buf blob = {0, 0};
-	if (git_diff_to_buf(&blob, params->diff, GIT_DIFF_FORMAT_PATCH) != 0) {
-		LGitLog("!! Couldn't put diff into buffer\n");
+	/* Don't leave half of a diff around to be applied */
+	if (!WriteDiff(params, writer)) {
+		DeleteFileW(fileName);
 		return FALSE;
 	}
-	size_t written = fwrite(blob.ptr, blob.size, 1, f);
-	if (written < blob.size) {
-		fclose(f);
-		git_buf_dispose(&blob);
-		return FALSE;
-	}
-	fclose(f);
-	git_buf_dispose(&blob);
 	return TRUE;
 }
 
@@ -363,6 +415,52 @@ static BOOL CALLBACK DiffDialogProc(HWND hwnd,
 	case WM_SIZE:
 		LGitControlFillsParentDialog(hwnd, IDC_DIFFTEXT);
 		return TRUE;
+	case WM_LGIT_DIFF_ROWS:
+		param = (LGitDiffDialogParams*)GetWindowLong(hwnd, GWL_USERDATA);
+		DiffRowsArrived(hwnd, param, wParam);
+		return TRUE;
+	case WM_NOTIFY:
+		param = (LGitDiffDialogParams*)GetWindowLong(hwnd, GWL_USERDATA);
+		if (wParam != IDC_DIFFTEXT) {
+			return FALSE;
+		}
+		switch (((LPNMHDR)lParam)->code) {
+		case LVN_GETDISPINFOW:
+			{
+				NMLVDISPINFOW *di = (NMLVDISPINFOW*)lParam;
+				LONG row = DiffItemRow(param, di->item.iItem, di->item.iSubItem);
+				if (param->found_list) {
+					if ((di->item.mask & LVIF_TEXT) && di->item.cchTextMax > 0) {
+						di->item.pszText[0] = L'\0';
+						if (di->item.iSubItem == 0) {
+							LGitDiffDocumentFoundPath(param->document,
+								di->item.iItem,
+								di->item.pszText,
+								di->item.cchTextMax);
+						}
+					}
+					if (di->item.mask & LVIF_IMAGE) {
+						di->item.iImage = LGDR_FILE_B;
+					}
+					return TRUE;
+				}
+				if (di->item.mask & LVIF_TEXT) {
+					LGitDiffDocumentText(param->document,
+						row,
+						di->item.pszText,
+						di->item.cchTextMax);
+				}
+				if (di->item.mask & LVIF_IMAGE) {
+					di->item.iImage = LGitDiffDocumentKind(param->document, row);
+				}
+			}
+			return TRUE;
+		case NM_CUSTOMDRAW:
+			SetWindowLong(hwnd, DWL_MSGRESULT,
+				DiffCustomDraw(hwnd, param, (NMLVCUSTOMDRAW*)lParam));
+			return TRUE;
+		}
+		return FALSE;
 	case WM_COMMAND:
 		param = (LGitDiffDialogParams*)GetWindowLong(hwnd, GWL_USERDATA);
 		switch (LOWORD(wParam)) {
@@ -373,6 +471,9 @@ static BOOL CALLBACK DiffDialogProc(HWND hwnd,
 		case ID_DIFF_SAVE:
 			SaveDiffDialog(hwnd, param);
 			break;
+		case ID_DIFF_SIDE_BY_SIDE:
+			SetDiffLayout(hwnd, param, !param->side_by_side);
+			break;
 		case ID_DIFF_CLOSE:
 		case IDOK:
 		case IDCANCEL:
@@ -391,11 +492,29 @@ int LGitDiffWindow(HWND parent, LGitDiffDialogParams *params)
 		return 0;
 	}
 	params->menu = LoadMenu(params->ctx->dllInst, MAKEINTRESOURCE(IDR_DIFF_MENU));
+	params->document = NULL;
+	params->words = NULL;
+	params->side_by_side = FALSE;
+	params->found_list = FALSE;
+	params->deltas = 0;
+	params->state = LGDD_FAILED;
 	int ret = DialogBoxParamW(params->ctx->dllInst,
 		MAKEINTRESOURCEW(IDD_DIFF),
 		parent,
 		DiffDialogProc,
 		(LPARAM)params);
+	/* Stops it before the caller frees the diff */
+	if (params->document != NULL) {
+		LGitDiffDocumentStop(params->document);
+		params->state = LGitDiffDocumentGetState(params->document, NULL);
+		if (LGitDiffDocumentDiff(params->document) != NULL) {
+			params->deltas = git_diff_num_deltas(LGitDiffDocumentDiff(params->document));
+		}
+	}
+	LGitWordDiffFree(params->words);
+	params->words = NULL;
+	LGitDiffDocumentFree(params->document);
+	params->document = NULL;
 	DestroyMenu(params->menu);
 	return ret;
 }
\ No newline at end of file
@@ -0,0 +1,151 @@
+/*
+ * Directory index, for answering whether directories are controlled. Trees
+ * have directories and the index doesn't, but walking HEAD's tree from the
+ * root for each directory the IDE asks about adds up when it asks about a
+ * whole solution. Instead, collect every directory in the tree once per
+ * HEAD, case-folded and sorted, so each query is a binary search.
+ */
+
+#include "stdafx.h"
+
+typedef std::vector<std::string> LGitDirList;
+
+struct _LGitDirIndex {
+	/* What the list was built from; zero if it's never been built */
+	git_oid tree_oid;
+	LGitDirList *dirs;
+	/* Statistics */
+	LONG builds;
+};
+
+/*
+ * Only ASCII, the same as _stricmp in the C locale, so UTF-8 sequences are
+ * left alone and agree with LGitPathLess.
+ */
+static void LGitFoldPath(std::string *path)
+{
+	size_t i;
+	for (i = 0; i < path->size(); i++) {
+		if ((*path)[i] >= 'A' && (*path)[i] <= 'Z') {
+			(*path)[i] += 'a' - 'A';
+		}
+	}
+}
+
+void LGitDirIndexInit(LGitContext *ctx)
+{
+	LGitDirIndex *index = (LGitDirIndex*)calloc(1, sizeof(LGitDirIndex));
+	if (index == NULL) {
+		return;
+	}
+	index->dirs = new LGitDirList();
+	ctx->dirIndex = index;
+}
+
+void LGitDirIndexFree(LGitContext *ctx)
+{
+	LGitDirIndex *index = ctx->dirIndex;
+	if (index == NULL) {
+		return;
+	}
+	LGitLog(" ! Directory index: built %d times, %d dirs\n",
+		index->builds,
+		index->dirs->size());
+	delete index->dirs;
+	free(index);
+	ctx->dirIndex = NULL;
+}
+
+static int LGitDirIndexWalkCallback(const char *root,
+									const git_tree_entry *entry,
+									void *payload)
+{
+	LGitDirList *dirs = (LGitDirList*)payload;
+	std::string path;
+	git_object_t type = git_tree_entry_type(entry);
+	/* Submodules are directories on disk too */
+	if (type != GIT_OBJECT_TREE && type != GIT_OBJECT_COMMIT) {
+		return 0;
+	}
+	path = root;
+	path += git_tree_entry_name(entry);
+	LGitFoldPath(&path);
+	dirs->push_back(path);
+	return 0;
+}
+
+/* Rebuilds if HEAD's tree isn't what the list was built from */
+static BOOL LGitDirIndexUpdate(LGitContext *ctx, git_tree *tree)
+{
+	LGitDirIndex *index = ctx->dirIndex;
+	const git_oid *oid;
+	if (tree == NULL) {
+		/* No commits yet, so nothing's in a tree */
+		index->dirs->clear();
+		ZeroMemory(&index->tree_oid, sizeof(git_oid));
+		return TRUE;
+	}
+	oid = git_tree_id(tree);
+	if (git_oid_equal(oid, &index->tree_oid)) {
+		return TRUE;
+	}
+	index->dirs->clear();
+	if (git_tree_walk(tree, GIT_TREEWALK_PRE, LGitDirIndexWalkCallback, index->dirs) != 0) {
+		index->dirs->clear();
+		ZeroMemory(&index->tree_oid, sizeof(git_oid));
+		return FALSE;
+	}
+	/* Pre-order isn't sorted once folded, and a sibling can sort before a child */
+	std::sort(index->dirs->begin(), index->dirs->end());
+	git_oid_cpy(&index->tree_oid, oid);
+	index->builds++;
+	LGitLogDebug(" ! Directory index built, %d dirs\n", index->dirs->size());
+	return TRUE;
+}
+
+/*
+ * Status of a directory, relative to the workdir with forward slashes, as
+ * an SCC_DIRSTATUS value. A directory is controlled if it's in HEAD's tree,
+ * or if anything under it is staged (i.e. added but not committed yet).
+ */
+LONG LGitDirIndexStatus(LGitContext *ctx, const char *relative_path)
+{
+	LGitDirIndex *index = ctx->dirIndex;
+	std::string path;
+	git_index *stage;
+	size_t pos;
+
+	if (index == NULL) {
+		return SCC_DIRSTATUS_INVALID;
+	}
+	if (!LGitDirIndexUpdate(ctx, LGitSessionHeadTree(ctx))) {
+		LGitLibraryError(NULL, "Directory index");
+		return SCC_DIRSTATUS_INVALID;
+	}
+	path = relative_path;
+	while (path.size() > 0 && path[path.size() - 1] == '/') {
+		path.erase(path.size() - 1);
+	}
+	/* The workdir itself */
+	if (path.size() == 0) {
+		return SCC_DIRSTATUS_CONTROLLED;
+	}
+	LGitFoldPath(&path);
+	if (std::binary_search(index->dirs->begin(), index->dirs->end(), path)) {
+		return SCC_DIRSTATUS_CONTROLLED;
+	}
+	stage = LGitSessionIndex(ctx);
+	if (stage == NULL) {
+		LGitLibraryError(NULL, "Directory index stage");
+		return SCC_DIRSTATUS_INVALID;
+	}
+	/* The index folds case itself if core.ignorecase is set */
+	path = relative_path;
+	if (path[path.size() - 1] != '/') {
+		path += '/';
+	}
+	if (git_index_find_prefix(&pos, stage, path.c_str()) == 0) {
+		return SCC_DIRSTATUS_CONTROLLED;
+	}
+	return SCC_DIRSTATUS_NOTCONTROLLED;
+}
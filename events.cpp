@@ -0,0 +1,465 @@
+/*
+ * Event queue, for SccGetEvents. Rather than the IDE asking about every file
+ * again to notice changes, a thread watches the workdir and the repository,
+ * works out the new status of just the files that changed (out of the ones
+ * the IDE has asked about), and queues those for the IDE to pick up when
+ * it's idle.
+ *
+ * The queue is a fixed ring with one writer (the watcher) and one reader
+ * (the IDE's thread), so it doesn't need a lock. If it fills up, the watcher
+ * doesn't wait for the IDE: what didn't fit isn't marked as told, and once
+ * the IDE has drained the ring, everything is checked again. The queue is
+ * off until the IDE turns it on with SCC_OPT_EVENTQUEUE, and turning it off
+ * only stops events being made; the thread and what it knows stay around,
+ * and what changed meanwhile is checked when it's turned back on.
+ */
+
+#include "stdafx.h"
+
+/* Power of two, so the indices can wrap */
+#define EVENT_QUEUE_SIZE 512
+#define EVENT_BUFFER_SIZE 0x10000
+/* Wait for things to settle, since saves come in bursts */
+#define EVENT_SETTLE_MS 100
+/* Past this many changed paths, just check everything */
+#define EVENT_MAX_DIRTY 4096
+
+#define EVENT_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME \
+	| FILE_NOTIFY_CHANGE_DIR_NAME \
+	| FILE_NOTIFY_CHANGE_SIZE \
+	| FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+typedef struct _LGitEvent {
+	/* Relative with forward slashes */
+	char path[1024];
+	/* As if from git_status_file */
+	int rc;
+	unsigned int flags;
+} LGitEvent;
+
+typedef struct _LGitWatchedFile {
+	int rc;
+	unsigned int flags;
+} LGitWatchedFile;
+
+typedef std::map<std::string, LGitWatchedFile, LGitPathLess> LGitWatchedMap;
+typedef std::set<std::string, LGitPathLess> LGitDirtySet;
+
+struct _LGitEvents {
+	/* Written by the watcher, read by the IDE's thread */
+	LGitEvent *ring;
+	volatile LONG head, tail;
+	/* What the IDE's asked about, and what it was last told */
+	CRITICAL_SECTION lock;
+	LGitWatchedMap *watched;
+	/* Watcher thread; wake is for being turned back on, or drained */
+	HANDLE thread, stop, wake;
+	volatile LONG enabled;
+	/* The ring filled up; check everything once it's empty */
+	volatile LONG overflowed;
+	char repo_path[1024];
+	wchar_t workdir[1024];
+	/* Statistics */
+	LONG queued, drained, scans;
+};
+
+/* FALSE if it's full; an IDE that never polls can't hold up the watcher */
+static BOOL LGitEventsPush(LGitEvents *events, const char *path, int rc, unsigned int flags)
+{
+	LGitEvent *event;
+	if (events->head - events->tail == EVENT_QUEUE_SIZE) {
+		InterlockedExchange(&events->overflowed, 1);
+		return FALSE;
+	}
+	event = &events->ring[events->head & (EVENT_QUEUE_SIZE - 1)];
+	strlcpy(event->path, path, 1024);
+	event->rc = rc;
+	event->flags = flags;
+	/* Publishes the event; interlocked ops are full barriers */
+	InterlockedIncrement(&events->head);
+	events->queued++;
+	return TRUE;
+}
+
+static BOOL LGitEventsPop(LGitEvents *events, LGitEvent *out)
+{
+	if (events->tail == events->head) {
+		return FALSE;
+	}
+	memcpy(out, &events->ring[events->tail & (EVENT_QUEUE_SIZE - 1)], sizeof(LGitEvent));
+	InterlockedIncrement(&events->tail);
+	events->drained++;
+	return TRUE;
+}
+
+typedef struct _LGitEventsScan {
+	LGitWatchedMap *found;
+} LGitEventsScan;
+
+static int LGitEventsStatusCallback(const char *path, unsigned int flags, void *payload)
+{
+	LGitEventsScan *scan = (LGitEventsScan*)payload;
+	LGitWatchedFile file;
+	file.rc = 0;
+	file.flags = flags;
+	(*scan->found)[path] = file;
+	return 0;
+}
+
+/*
+ * Gets status for the dirty paths the IDE cares about, queueing what changed.
+ * Only the dirty paths are looked up in what's watched, unless it's
+ * everything, and the lock isn't held while scanning. FALSE if the ring
+ * filled up before everything that changed was queued.
+ */
+static BOOL LGitEventsScanDirty(LGitEvents *events,
+								git_repository *repo,
+								LGitDirtySet *dirty,
+								BOOL everything)
+{
+	/* What's to be checked, with what the IDE was last told about it */
+	LGitWatchedMap wanted, found;
+	LGitWatchedMap::iterator it, result;
+	LGitDirtySet::iterator dit;
+	std::vector<char*> pathspec;
+	git_status_options sopts;
+	LGitEventsScan scan;
+	LGitWatchedFile now;
+	std::string prefix;
+
+	EnterCriticalSection(&events->lock);
+	if (everything) {
+		wanted = *events->watched;
+	} else {
+		for (dit = dirty->begin(); dit != dirty->end(); dit++) {
+			/* A file can be dirty itself and under a dirty directory */
+			it = events->watched->find(*dit);
+			if (it != events->watched->end()) {
+				wanted.insert(*it);
+			}
+			/* Could be a directory that was renamed or deleted */
+			prefix = *dit + "/";
+			it = events->watched->lower_bound(prefix);
+			while (it != events->watched->end()
+				&& _strnicmp(it->first.c_str(), prefix.c_str(), prefix.size()) == 0) {
+				wanted.insert(*it);
+				it++;
+			}
+		}
+	}
+	LeaveCriticalSection(&events->lock);
+
+	if (wanted.size() == 0) {
+		return TRUE;
+	}
+	for (it = wanted.begin(); it != wanted.end(); it++) {
+		pathspec.push_back((char*)it->first.c_str());
+	}
+	/* Same as batch status, so the answers agree */
+	git_status_options_init(&sopts, GIT_STATUS_OPTIONS_VERSION);
+	sopts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+	sopts.flags = GIT_STATUS_OPT_INCLUDE_IGNORED
+		| GIT_STATUS_OPT_RECURSE_IGNORED_DIRS
+		| GIT_STATUS_OPT_INCLUDE_UNTRACKED
+		| GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS
+		| GIT_STATUS_OPT_INCLUDE_UNMODIFIED
+		| GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH;
+	sopts.pathspec.strings = &pathspec[0];
+	sopts.pathspec.count = pathspec.size();
+	scan.found = &found;
+	events->scans++;
+	if (git_status_foreach_ext(repo, &sopts, LGitEventsStatusCallback, &scan) != 0) {
+		/* Errors are per thread; nobody else would see this one */
+		const git_error *err = git_error_last();
+		LGitLog("!! Event scan failed (%s)\n", err != NULL ? err->message : "?");
+		return TRUE;
+	}
+	for (it = wanted.begin(); it != wanted.end(); it++) {
+		result = found.find(it->first);
+		if (result != found.end()) {
+			now = result->second;
+		} else {
+			now.rc = GIT_ENOTFOUND;
+			now.flags = 0;
+		}
+		if (it->second.rc == now.rc && it->second.flags == now.flags) {
+			continue;
+		}
+		/* Only what made it in counts as told, so the rest shows up again */
+		if (!LGitEventsPush(events, it->first.c_str(), now.rc, now.flags)) {
+			LGitLog(" ! Event queue full, checking everything once it's drained\n");
+			return FALSE;
+		}
+		EnterCriticalSection(&events->lock);
+		(*events->watched)[it->first] = now;
+		LeaveCriticalSection(&events->lock);
+		LGitLogDebug(" ! Event for %s (%x -> %x)\n", it->first.c_str(), it->second.flags, now.flags);
+	}
+	return TRUE;
+}
+
+/* Returns TRUE if the change means everything needs checking */
+static BOOL LGitEventsProcessChanges(BYTE *buffer, LGitDirtySet *dirty)
+{
+	FILE_NOTIFY_INFORMATION *fni;
+	BYTE *cur = buffer;
+	char path[2048];
+	int len;
+	BOOL everything = FALSE;
+	for (;;) {
+		fni = (FILE_NOTIFY_INFORMATION*)cur;
+		len = WideCharToMultiByte(CP_UTF8, 0,
+			fni->FileName, fni->FileNameLength / sizeof(WCHAR),
+			path, sizeof(path) - 1,
+			NULL, NULL);
+		if (len > 0) {
+			path[len] = '\0';
+			LGitTranslateStringChars(path, '\\', '/');
+			/* Staging, commits, switching branches change everything */
+			if (_stricmp(path, ".git/index") == 0
+				|| _stricmp(path, ".git/HEAD") == 0
+				|| _strnicmp(path, ".git/refs/", 10) == 0
+				|| _stricmp(path, ".git/packed-refs") == 0) {
+				everything = TRUE;
+			} else if (_strnicmp(path, ".git/", 5) != 0 && _stricmp(path, ".git") != 0) {
+				dirty->insert(path);
+			}
+		}
+		if (fni->NextEntryOffset == 0) {
+			break;
+		}
+		cur += fni->NextEntryOffset;
+	}
+	return everything;
+}
+
+static unsigned __stdcall LGitEventsThread(void *arg)
+{
+	LGitEvents *events = (LGitEvents*)arg;
+	git_repository *repo = NULL;
+	HANDLE dir, waits[3];
+	OVERLAPPED overlapped;
+	BYTE *buffer = NULL;
+	LGitDirtySet dirty;
+	BOOL everything;
+	DWORD bytes, wait, timeout;
+
+	ZeroMemory(&overlapped, sizeof(overlapped));
+	dir = CreateFileW(events->workdir,
+		FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+		NULL);
+	if (dir == INVALID_HANDLE_VALUE) {
+		LGitLog(" ! Can't watch workdir for events (GLE %x)\n", GetLastError());
+		goto fin;
+	}
+	if (git_repository_open(&repo, events->repo_path) != 0) {
+		LGitLog("!! Event watcher couldn't open repository\n");
+		goto fin;
+	}
+	buffer = (BYTE*)malloc(EVENT_BUFFER_SIZE);
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (buffer == NULL || overlapped.hEvent == NULL) {
+		goto fin;
+	}
+	waits[0] = events->stop;
+	waits[1] = overlapped.hEvent;
+	waits[2] = events->wake;
+	everything = FALSE;
+	for (;;) {
+		ResetEvent(overlapped.hEvent);
+		if (!ReadDirectoryChangesW(dir, buffer, EVENT_BUFFER_SIZE, TRUE,
+			EVENT_FILTER, NULL, &overlapped, NULL)) {
+			LGitLog("!! Event watcher ReadDirectoryChangesW failed (GLE %x)\n", GetLastError());
+			goto fin;
+		}
+		/* Block until something happens, then until it's quiet */
+		timeout = (dirty.size() > 0 || everything) && events->enabled && !events->overflowed
+			? EVENT_SETTLE_MS
+			: INFINITE;
+		wait = WaitForMultipleObjects(3, waits, FALSE, timeout);
+		if (wait == WAIT_OBJECT_0) {
+			break;
+		} else if (wait == WAIT_OBJECT_0 + 1) {
+			if (!GetOverlappedResult(dir, &overlapped, &bytes, FALSE)) {
+				goto fin;
+			}
+			if (bytes == 0) {
+				/* Too much to fit in the buffer */
+				everything = TRUE;
+			} else {
+				everything |= LGitEventsProcessChanges(buffer, &dirty);
+			}
+			/* i.e. a build while the queue is off; no point listing it all */
+			if (dirty.size() > EVENT_MAX_DIRTY) {
+				everything = TRUE;
+				dirty.clear();
+			}
+			continue;
+		}
+		if (wait != WAIT_TIMEOUT && wait != WAIT_OBJECT_0 + 2) {
+			LGitLog("!! Event watcher wait failed (GLE %x)\n", GetLastError());
+			goto fin;
+		}
+		/* Quiet for a bit, or turned back on; the read is still pending */
+		CancelIo(dir);
+		if (GetOverlappedResult(dir, &overlapped, &bytes, TRUE) && bytes > 0) {
+			everything |= LGitEventsProcessChanges(buffer, &dirty);
+		}
+		/* If it's off or full, keep it all for when it's back on or drained */
+		if (events->enabled && !events->overflowed) {
+			if (LGitEventsScanDirty(events, repo, &dirty, everything)) {
+				everything = FALSE;
+			} else {
+				everything = TRUE;
+			}
+			dirty.clear();
+		}
+	}
+fin:
+	if (dir != INVALID_HANDLE_VALUE) {
+		CancelIo(dir);
+		if (overlapped.hEvent != NULL) {
+			GetOverlappedResult(dir, &overlapped, &bytes, TRUE);
+		}
+		CloseHandle(dir);
+	}
+	if (overlapped.hEvent != NULL) {
+		CloseHandle(overlapped.hEvent);
+	}
+	if (buffer != NULL) {
+		free(buffer);
+	}
+	if (repo != NULL) {
+		git_repository_free(repo);
+	}
+	return 0;
+}
+
+void LGitEventsInit(LGitContext *ctx)
+{
+	LGitEvents *events;
+	unsigned thread_id;
+
+	events = (LGitEvents*)calloc(1, sizeof(LGitEvents));
+	if (events == NULL) {
+		return;
+	}
+	events->ring = (LGitEvent*)calloc(EVENT_QUEUE_SIZE, sizeof(LGitEvent));
+	events->stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	events->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (events->ring == NULL || events->stop == NULL || events->wake == NULL) {
+		goto fail;
+	}
+	InitializeCriticalSection(&events->lock);
+	events->watched = new LGitWatchedMap();
+	/* Until the IDE says it'll be reading them */
+	events->enabled = FALSE;
+	strlcpy(events->repo_path, git_repository_path(ctx->repo), 1024);
+	wcslcpy(events->workdir, ctx->workdir_path_utf16, 1024);
+	events->thread = (HANDLE)_beginthreadex(NULL, 0, LGitEventsThread, events, 0, &thread_id);
+	if (events->thread == NULL) {
+		LGitLog("!! Couldn't start event watcher\n");
+		delete events->watched;
+		DeleteCriticalSection(&events->lock);
+		goto fail;
+	}
+	ctx->events = events;
+	return;
+fail:
+	if (events->stop != NULL) {
+		CloseHandle(events->stop);
+	}
+	if (events->wake != NULL) {
+		CloseHandle(events->wake);
+	}
+	if (events->ring != NULL) {
+		free(events->ring);
+	}
+	free(events);
+}
+
+void LGitEventsFree(LGitContext *ctx)
+{
+	LGitEvents *events = ctx->events;
+	if (events == NULL) {
+		return;
+	}
+	SetEvent(events->stop);
+	WaitForSingleObject(events->thread, INFINITE);
+	CloseHandle(events->thread);
+	CloseHandle(events->stop);
+	CloseHandle(events->wake);
+	LGitLog(" ! Events: %d watched, %d scans, %d queued, %d drained\n",
+		events->watched->size(),
+		events->scans,
+		events->queued,
+		events->drained);
+	delete events->watched;
+	DeleteCriticalSection(&events->lock);
+	free(events->ring);
+	free(events);
+	ctx->events = NULL;
+}
+
+void LGitEventsEnable(LGitContext *ctx, BOOL enable)
+{
+	if (ctx->events != NULL) {
+		InterlockedExchange(&ctx->events->enabled, enable);
+		/* Catch up on whatever changed while it was off */
+		if (enable) {
+			SetEvent(ctx->events->wake);
+		}
+	}
+}
+
+/* Starts watching a file, with what the IDE was just told about it */
+void LGitEventsWatch(LGitContext *ctx, const char *path, int rc, unsigned int flags)
+{
+	LGitEvents *events = ctx->events;
+	LGitWatchedFile file;
+	if (events == NULL || path == NULL) {
+		return;
+	}
+	file.rc = rc;
+	file.flags = flags;
+	EnterCriticalSection(&events->lock);
+	(*events->watched)[path] = file;
+	LeaveCriticalSection(&events->lock);
+}
+
+/*
+ * Takes the next event, if any. The path is relative with forward slashes.
+ * remaining is how many are left after this one.
+ */
+BOOL LGitEventsNext(LGitContext *ctx,
+					char *path,
+					size_t pathsz,
+					int *rc,
+					unsigned int *flags,
+					LONG *remaining)
+{
+	LGitEvents *events = ctx->events;
+	LGitEvent event;
+	BOOL popped;
+	*remaining = 0;
+	if (events == NULL) {
+		return FALSE;
+	}
+	popped = LGitEventsPop(events, &event);
+	/* Room again; the watcher has what didn't fit to catch up on */
+	if (events->head == events->tail && InterlockedExchange(&events->overflowed, 0)) {
+		SetEvent(events->wake);
+	}
+	if (!popped) {
+		return FALSE;
+	}
+	strlcpy(path, event.path, pathsz);
+	*rc = event.rc;
+	*flags = event.flags;
+	*remaining = events->head - events->tail;
+	return TRUE;
+}
@@ -410,5 +410,7 @@ SCCRTN LGitManageConfig(LGitContext *ctx, HWND hwnd, git_config *config, const c
 	default:
 		break;
 	}
+	/* Whatever was edited, the snapshot is out of date now */
+	LGitSessionInvalidateConfig(ctx);
 	return SCC_OK;
 }
\ No newline at end of file
@@ -0,0 +1,251 @@
+/*
+ * History cache, so opening history on a repository that hasn't changed is
+ * a file map instead of looking up and converting every commit again. It's
+ * the history model's rows, author table and string pool as they were at
+ * the end of the last full walk, along with the tip the walk started from.
+ *
+ * If the tip moved forward, the model only walks the new commits and puts
+ * them on top of the cached ones; parents are counted from the last row so
+ * the old records don't have to change. If it moved anywhere else, the
+ * cache is thrown out and rewritten after a full walk. Only unfiltered walks
+ * use it, since those are the ones that cover everything.
+ */
+
+#include "stdafx.h"
+
+#define HISTORY_CACHE_MAGIC "LGHC"
+#define HISTORY_CACHE_VERSION 1
+
+/* Records follow, then authors (offsets into the pool), then the pool */
+typedef struct _LGitHistoryCacheHeader {
+	char magic[4];
+	DWORD version;
+	git_oid tip;
+	DWORD count;
+	DWORD author_count;
+	/* In characters, including each string's terminator */
+	DWORD strings_len;
+} LGitHistoryCacheHeader;
+
+struct _LGitHistoryCache {
+	HANDLE file, mapping;
+	const BYTE *data;
+	const LGitHistoryCacheHeader *header;
+	const LGitHistoryRow *rows;
+	const DWORD *authors;
+	const wchar_t *strings;
+};
+
+static BOOL LGitHistoryCachePath(git_repository *repo, wchar_t *buf, size_t bufsz)
+{
+	if (!LGitGetPrivateDir(repo, buf, bufsz)) {
+		return FALSE;
+	}
+	wcslcat(buf, L"\\history", bufsz);
+	return TRUE;
+}
+
+void LGitHistoryCacheClose(LGitHistoryCache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+	if (cache->data != NULL) {
+		UnmapViewOfFile(cache->data);
+	}
+	if (cache->mapping != NULL) {
+		CloseHandle(cache->mapping);
+	}
+	if (cache->file != INVALID_HANDLE_VALUE) {
+		CloseHandle(cache->file);
+	}
+	free(cache);
+}
+
+/* Everything indexes something else, so check it all before it's trusted */
+static BOOL LGitHistoryCacheValid(LGitHistoryCache *cache, DWORD size)
+{
+	const LGitHistoryCacheHeader *header = cache->header;
+	DWORD i, j;
+	if (memcmp(header->magic, HISTORY_CACHE_MAGIC, 4) != 0
+		|| header->version != HISTORY_CACHE_VERSION
+		|| header->count > size / sizeof(LGitHistoryRow)
+		|| header->author_count > size / sizeof(DWORD)
+		|| header->strings_len > size / sizeof(wchar_t)
+		|| sizeof(LGitHistoryCacheHeader)
+			+ (header->count * sizeof(LGitHistoryRow))
+			+ (header->author_count * sizeof(DWORD))
+			+ (header->strings_len * sizeof(wchar_t)) != size) {
+		return FALSE;
+	}
+	if (header->strings_len > 0 && cache->strings[header->strings_len - 1] != L'\0') {
+		return FALSE;
+	}
+	for (i = 0; i < header->author_count; i++) {
+		if (cache->authors[i] >= header->strings_len) {
+			return FALSE;
+		}
+	}
+	for (i = 0; i < header->count; i++) {
+		if ((DWORD)cache->rows[i].author >= header->author_count
+			|| cache->rows[i].summary >= header->strings_len
+			|| cache->rows[i].parent_count > 2) {
+			return FALSE;
+		}
+		for (j = 0; j < cache->rows[i].parent_count; j++) {
+			if (cache->rows[i].parents[j] != LGIT_HISTORY_NO_PARENT
+				&& cache->rows[i].parents[j] >= header->count) {
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+/* Returns NULL if there's no usable cache; the caller walks everything */
+LGitHistoryCache *LGitHistoryCacheOpen(git_repository *repo)
+{
+	LGitHistoryCache *cache;
+	wchar_t path[1024];
+	DWORD size, size_high;
+
+	if (!LGitHistoryCachePath(repo, path, 1024)) {
+		return NULL;
+	}
+	cache = (LGitHistoryCache*)calloc(1, sizeof(LGitHistoryCache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	/* Share delete, so another window's walk can replace it under us */
+	cache->file = CreateFileW(path,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL);
+	if (cache->file == INVALID_HANDLE_VALUE) {
+		/* Never walked before */
+		goto fail;
+	}
+	size = GetFileSize(cache->file, &size_high);
+	if (size == 0xFFFFFFFF || size_high != 0 || size < sizeof(LGitHistoryCacheHeader)) {
+		goto corrupt;
+	}
+	cache->mapping = CreateFileMappingW(cache->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (cache->mapping == NULL) {
+		LGitLog("!! Can't map history cache (GLE %x)\n", GetLastError());
+		goto fail;
+	}
+	cache->data = (const BYTE*)MapViewOfFile(cache->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (cache->data == NULL) {
+		LGitLog("!! Can't map history cache (GLE %x)\n", GetLastError());
+		goto fail;
+	}
+	cache->header = (const LGitHistoryCacheHeader*)cache->data;
+	cache->rows = (const LGitHistoryRow*)(cache->data + sizeof(LGitHistoryCacheHeader));
+	cache->authors = (const DWORD*)(cache->rows + cache->header->count);
+	cache->strings = (const wchar_t*)(cache->authors + cache->header->author_count);
+	if (!LGitHistoryCacheValid(cache, size)) {
+		goto corrupt;
+	}
+	return cache;
+corrupt:
+	LGitLog(" ! History cache is corrupt or too new, ignoring\n");
+fail:
+	LGitHistoryCacheClose(cache);
+	return NULL;
+}
+
+const git_oid *LGitHistoryCacheTip(LGitHistoryCache *cache)
+{
+	return &cache->header->tip;
+}
+
+LONG LGitHistoryCacheCount(LGitHistoryCache *cache)
+{
+	return (LONG)cache->header->count;
+}
+
+const LGitHistoryRow *LGitHistoryCacheRows(LGitHistoryCache *cache)
+{
+	return cache->rows;
+}
+
+LONG LGitHistoryCacheAuthorCount(LGitHistoryCache *cache)
+{
+	return (LONG)cache->header->author_count;
+}
+
+const DWORD *LGitHistoryCacheAuthors(LGitHistoryCache *cache)
+{
+	return cache->authors;
+}
+
+DWORD LGitHistoryCacheStringsLength(LGitHistoryCache *cache)
+{
+	return cache->header->strings_len;
+}
+
+const wchar_t *LGitHistoryCacheStrings(LGitHistoryCache *cache)
+{
+	return cache->strings;
+}
+
+/* Replaces the cache with the rows of a finished walk from tip */
+BOOL LGitHistoryCacheSave(git_repository *repo,
+						  const git_oid *tip,
+						  const LGitHistoryRow *rows,
+						  LONG count,
+						  const DWORD *authors,
+						  LONG author_count,
+						  const wchar_t *strings,
+						  DWORD strings_len)
+{
+	LGitHistoryCacheHeader header;
+	wchar_t path[1024], temp_path[1024];
+	DWORD written;
+	HANDLE file;
+	BOOL ok = TRUE;
+
+	if (!LGitHistoryCachePath(repo, path, 1024)) {
+		return FALSE;
+	}
+	ZeroMemory(&header, sizeof(header));
+	memcpy(header.magic, HISTORY_CACHE_MAGIC, 4);
+	header.version = HISTORY_CACHE_VERSION;
+	git_oid_cpy(&header.tip, tip);
+	header.count = count;
+	header.author_count = author_count;
+	header.strings_len = strings_len;
+
+	wcslcpy(temp_path, path, 1024);
+	wcslcat(temp_path, L".lock", 1024);
+	file = CreateFileW(temp_path, GENERIC_WRITE, 0, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		LGitLog("!! Can't write history cache (GLE %x)\n", GetLastError());
+		return FALSE;
+	}
+#define WRITE_OR_FAIL(ptr, len) if (ok && (!WriteFile(file, ptr, len, &written, NULL) || written != len)) ok = FALSE
+	WRITE_OR_FAIL(&header, sizeof(header));
+	WRITE_OR_FAIL(rows, count * sizeof(LGitHistoryRow));
+	WRITE_OR_FAIL(authors, author_count * sizeof(DWORD));
+	WRITE_OR_FAIL(strings, strings_len * sizeof(wchar_t));
+#undef WRITE_OR_FAIL
+	CloseHandle(file);
+	if (!ok) {
+		LGitLog("!! Failed writing history cache (GLE %x)\n", GetLastError());
+		DeleteFileW(temp_path);
+		return FALSE;
+	}
+	if (!MoveFileExW(temp_path, path, MOVEFILE_REPLACE_EXISTING)) {
+		/* 9x doesn't have MoveFileEx */
+		DeleteFileW(path);
+		if (!MoveFileW(temp_path, path)) {
+			DeleteFileW(temp_path);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
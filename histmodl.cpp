@@ -0,0 +1,1341 @@
+/*
+ * History model: walks commits on a worker thread and keeps just enough
+ * about each one to draw a row, so the history window can be a virtual list
+ * that shows the first screen long before the walk is done.
+ */
+
+#include "stdafx.h"
+
+/* Rows to have before telling the window the first time, then how often */
+#define FIRST_PAGE_SIZE 64
+#define PAGE_SIZE 2048
+#define PAGE_INTERVAL 100
+/* Commits handed to each path matching thread at a time */
+#define MATCH_BATCH_PER_THREAD 32
+#define MATCH_MAX_THREADS 32
+
+struct _LGitHistoryModel {
+	LGitContext *ctx;
+	/* Guards everything below that the window reads */
+	CRITICAL_SECTION lock;
+	LGitHistoryRow *rows;
+	LONG count, capacity;
+	/* NUL-separated wide strings, for summaries and authors */
+	wchar_t *strings;
+	DWORD strings_len, strings_cap;
+	std::vector<DWORD> *authors;
+	/* The graph, a row for each row; only unfiltered walks have one */
+	LGitLaneRow *lanes;
+	LONG lane_count, lane_capacity;
+	LONG lane_width;
+	/* Opened by the first walk and kept, since loading it isn't free */
+	LGitSearchIndex *search;
+	/* Worker state */
+	HANDLE thread;
+	volatile LONG cancel;
+	LONG state;
+	char error[256];
+	/* Walk parameters, borrowed from the caller */
+	HWND notify;
+	const char *ref;
+	git_strarray *paths;
+};
+
+LGitHistoryModel *LGitHistoryModelNew(LGitContext *ctx)
+{
+	LGitHistoryModel *model;
+	model = (LGitHistoryModel*)calloc(1, sizeof(LGitHistoryModel));
+	if (model == NULL) {
+		return NULL;
+	}
+	model->ctx = ctx;
+	InitializeCriticalSection(&model->lock);
+	model->authors = new std::vector<DWORD>();
+	return model;
+}
+
+void LGitHistoryModelFree(LGitHistoryModel *model)
+{
+	if (model == NULL) {
+		return;
+	}
+	LGitHistoryModelStop(model);
+	LGitSearchIndexClose(model->search);
+	DeleteCriticalSection(&model->lock);
+	delete model->authors;
+	free(model);
+}
+
+/* Must be called with the lock held */
+static BOOL LGitHistoryModelReserveStrings(LGitHistoryModel *model, size_t len)
+{
+	if (model->strings_len + len > model->strings_cap) {
+		DWORD new_cap = model->strings_cap ? model->strings_cap : 0x10000;
+		while (model->strings_len + len > new_cap) {
+			new_cap *= 2;
+		}
+		wchar_t *new_strings = (wchar_t*)realloc(model->strings, new_cap * sizeof(wchar_t));
+		if (new_strings == NULL) {
+			return FALSE;
+		}
+		model->strings = new_strings;
+		model->strings_cap = new_cap;
+	}
+	return TRUE;
+}
+
+/* Must be called with the lock held */
+static DWORD LGitHistoryModelAddString(LGitHistoryModel *model, const wchar_t *str, size_t len)
+{
+	DWORD offset;
+	if (!LGitHistoryModelReserveStrings(model, len + 1)) {
+		return (DWORD)-1;
+	}
+	offset = model->strings_len;
+	memcpy(model->strings + offset, str, len * sizeof(wchar_t));
+	model->strings[offset + len] = L'\0';
+	model->strings_len += len + 1;
+	return offset;
+}
+
+/* Must be called with the lock held */
+static BOOL LGitHistoryModelReserveRows(LGitHistoryModel *model, LONG count)
+{
+	if (model->count + count > model->capacity) {
+		LONG new_cap = model->capacity ? model->capacity * 2 : 4096;
+		while (model->count + count > new_cap) {
+			new_cap *= 2;
+		}
+		LGitHistoryRow *new_rows = (LGitHistoryRow*)realloc(model->rows, new_cap * sizeof(LGitHistoryRow));
+		if (new_rows == NULL) {
+			return FALSE;
+		}
+		model->rows = new_rows;
+		model->capacity = new_cap;
+	}
+	return TRUE;
+}
+
+/* Must be called with the lock held */
+static BOOL LGitHistoryModelAddRow(LGitHistoryModel *model, const LGitHistoryRow *row)
+{
+	if (!LGitHistoryModelReserveRows(model, 1)) {
+		return FALSE;
+	}
+	model->rows[model->count++] = *row;
+	return TRUE;
+}
+
+/* Must be called with the lock held */
+static BOOL LGitHistoryModelAddLanes(LGitHistoryModel *model, const LGitLaneRow *lanes, LONG count)
+{
+	if (model->lane_count + count > model->lane_capacity) {
+		LONG new_cap = model->lane_capacity ? model->lane_capacity * 2 : 4096;
+		while (model->lane_count + count > new_cap) {
+			new_cap *= 2;
+		}
+		LGitLaneRow *new_lanes = (LGitLaneRow*)realloc(model->lanes, new_cap * sizeof(LGitLaneRow));
+		if (new_lanes == NULL) {
+			return FALSE;
+		}
+		model->lanes = new_lanes;
+		model->lane_capacity = new_cap;
+	}
+	memcpy(model->lanes + model->lane_count, lanes, count * sizeof(LGitLaneRow));
+	model->lane_count += count;
+	return TRUE;
+}
+
+/*
+ * Puts the cached rows under whatever was walked since, moving their author
+ * and string references past what's already in the model.
+ */
+static BOOL LGitHistoryModelAppendCache(LGitHistoryModel *model, LGitHistoryCache *cache)
+{
+	const DWORD *authors = LGitHistoryCacheAuthors(cache);
+	LONG i, count = LGitHistoryCacheCount(cache);
+	LONG author_count = LGitHistoryCacheAuthorCount(cache), author_base;
+	DWORD strings_len = LGitHistoryCacheStringsLength(cache), strings_base;
+	LGitHistoryRow *rows;
+	BOOL ret = FALSE;
+
+	EnterCriticalSection(&model->lock);
+	if (!LGitHistoryModelReserveStrings(model, strings_len)
+		|| !LGitHistoryModelReserveRows(model, count)) {
+		goto fin;
+	}
+	strings_base = model->strings_len;
+	memcpy(model->strings + strings_base,
+		LGitHistoryCacheStrings(cache),
+		strings_len * sizeof(wchar_t));
+	model->strings_len += strings_len;
+	author_base = (LONG)model->authors->size();
+	for (i = 0; i < author_count; i++) {
+		model->authors->push_back(authors[i] + strings_base);
+	}
+	rows = model->rows + model->count;
+	memcpy(rows, LGitHistoryCacheRows(cache), count * sizeof(LGitHistoryRow));
+	if (author_base != 0 || strings_base != 0) {
+		for (i = 0; i < count; i++) {
+			rows[i].author += author_base;
+			rows[i].summary += strings_base;
+		}
+	}
+	model->count += count;
+	ret = TRUE;
+fin:
+	LeaveCriticalSection(&model->lock);
+	return ret;
+}
+
+/*
+ * Turns the parent OIDs of the first count rows (the ones just walked) into
+ * rows. Only the worker adds rows, so it can read them without the lock.
+ */
+static void LGitHistoryModelResolveParents(LGitHistoryModel *model,
+										   LONG count,
+										   const std::vector<git_oid> &parent_oids)
+{
+	std::map<std::string, LONG> walked;
+	std::map<std::string, LONG>::iterator it;
+	std::vector<DWORD> resolved(count * 2, LGIT_HISTORY_NO_PARENT);
+	LGitHistoryRow *rows = model->rows;
+	LONG i, k, found;
+	DWORD j;
+
+	for (i = 0; i < count; i++) {
+		walked[std::string((const char*)rows[i].oid.id, GIT_OID_RAWSZ)] = i;
+	}
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < rows[i].parent_count; j++) {
+			const git_oid *parent = &parent_oids[i * 2 + j];
+			found = -1;
+			it = walked.find(std::string((const char*)parent->id, GIT_OID_RAWSZ));
+			if (it != walked.end()) {
+				found = it->second;
+			} else {
+				/* From the cache; almost always its tip, right below us */
+				for (k = count; k < model->count; k++) {
+					if (git_oid_equal(&rows[k].oid, parent)) {
+						found = k;
+						break;
+					}
+				}
+			}
+			if (found != -1) {
+				resolved[i * 2 + j] = model->count - 1 - found;
+			}
+		}
+	}
+	EnterCriticalSection(&model->lock);
+	for (i = 0; i < count; i++) {
+		model->rows[i].parents[0] = resolved[i * 2];
+		model->rows[i].parents[1] = resolved[i * 2 + 1];
+	}
+	LeaveCriticalSection(&model->lock);
+}
+
+/** Helper to find how many files in a commit changed from its nth parent. */
+static int match_with_parent(git_commit *commit, int i, git_diff_options *opts)
+{
+	git_commit *parent;
+	git_tree *a, *b;
+	git_diff *diff;
+	int ndeltas;
+
+	if (git_commit_parent(&parent, commit, (size_t)i) != 0) {
+		return -1;
+	}
+	if (git_commit_tree(&a, parent) != 0) {
+		git_commit_free(parent);
+		return -1;
+	}
+	if (git_commit_tree(&b, commit) != 0) {
+		git_tree_free(a);
+		git_commit_free(parent);
+		return -1;
+	}
+	if (git_diff_tree_to_tree(&diff, git_commit_owner(commit), a, b, opts) != 0) {
+		git_tree_free(a);
+		git_tree_free(b);
+		git_commit_free(parent);
+		return -1;
+	}
+
+	ndeltas = (int)git_diff_num_deltas(diff);
+
+	git_diff_free(diff);
+	git_tree_free(a);
+	git_tree_free(b);
+	git_commit_free(parent);
+
+	return ndeltas > 0;
+}
+
+/* Returns 1 if the commit touches the pathspec, 0 if not, -1 on error */
+static int LGitHistoryModelMatches(git_commit *commit, git_pathspec *ps, git_diff_options *diffopts)
+{
+	int parents, unmatched, i, match;
+	parents = (int)git_commit_parentcount(commit);
+	unmatched = parents;
+	if (parents == 0) {
+		git_tree *tree;
+		if (git_commit_tree(&tree, commit) != 0) {
+			return -1;
+		}
+		if (git_pathspec_match_tree(
+				NULL, tree, GIT_PATHSPEC_NO_MATCH_ERROR, ps) != 0)
+			unmatched = 1;
+		git_tree_free(tree);
+	} else if (parents == 1) {
+		match = match_with_parent(commit, 0, diffopts);
+		if (match == -1) {
+			return -1;
+		}
+		unmatched = match ? 0 : 1;
+	} else {
+		for (i = 0; i < parents; ++i) {
+			match = match_with_parent(commit, i, diffopts);
+			if (match == -1) {
+				return -1;
+			}
+			if (match)
+				unmatched--;
+		}
+	}
+	return unmatched > 0 ? 0 : 1;
+}
+
+/* Same as above for a single parent, but with trees from the commit-graph */
+static int LGitHistoryModelMatchesGraph(git_repository *repo,
+										LGitCommitGraph *graph,
+										DWORD pos,
+										DWORD parent_pos,
+										git_diff_options *diffopts)
+{
+	git_oid a_oid, b_oid;
+	git_tree *a = NULL, *b = NULL;
+	git_diff *diff = NULL;
+	int ret = -1;
+
+	LGitCommitGraphTree(graph, parent_pos, &a_oid);
+	LGitCommitGraphTree(graph, pos, &b_oid);
+	if (git_oid_equal(&a_oid, &b_oid)) {
+		/* Empty commit */
+		return 0;
+	}
+	if (git_tree_lookup(&a, repo, &a_oid) != 0
+		|| git_tree_lookup(&b, repo, &b_oid) != 0
+		|| git_diff_tree_to_tree(&diff, repo, a, b, diffopts) != 0) {
+		goto fin;
+	}
+	ret = git_diff_num_deltas(diff) > 0;
+fin:
+	if (diff != NULL) {
+		git_diff_free(diff);
+	}
+	if (a != NULL) {
+		git_tree_free(a);
+	}
+	if (b != NULL) {
+		git_tree_free(b);
+	}
+	return ret;
+}
+
+static void LGitHistoryModelSetError(LGitHistoryModel *model, const char *what)
+{
+	const git_error *gerror = git_error_last();
+	_snprintf(model->error, sizeof(model->error), "%s: %s",
+		what,
+		gerror != NULL ? gerror->message : "libgit2 returned a null error.");
+	LGitLog("!! History model: %s\n", model->error);
+}
+
+/* What's needed to turn commits into rows, kept across the whole walk */
+typedef struct _LGitHistoryEmitter {
+	LGitHistoryModel *model;
+	std::map<std::string, LONG> author_ids;
+	/* Two per row; NULL if parents don't need resolving (filtered walks) */
+	std::vector<git_oid> *parent_oids;
+	/* Same, for the graph */
+	LGitLanes *layout;
+	wchar_t author_buf[256];
+	wchar_t *summary_buf;
+	int summary_cap;
+	LONG posted;
+	DWORD begin, last_post;
+} LGitHistoryEmitter;
+
+/* Adds a row for the commit, telling the window every so often */
+static BOOL LGitHistoryModelEmit(LGitHistoryEmitter *em, git_commit *commit)
+{
+	LGitHistoryModel *model = em->model;
+	LGitHistoryRow row;
+	LGitLaneRow lane_row;
+	git_oid lane_parents[2];
+	git_commit *parent;
+	const git_signature *author;
+	const char *summary;
+	std::string author_key;
+	std::map<std::string, LONG>::iterator it;
+	git_oid zero_oid;
+	unsigned int i, parents;
+	UINT encoding;
+	int summary_len;
+
+	ZeroMemory(&row, sizeof(row));
+	git_oid_cpy(&row.oid, git_commit_id(commit));
+	/* Resolved to rows once the walk's done */
+	parents = git_commit_parentcount(commit);
+	row.parent_count = parents > 2 ? 2 : parents;
+	row.parents[0] = row.parents[1] = LGIT_HISTORY_NO_PARENT;
+	if (em->parent_oids != NULL) {
+		ZeroMemory(&zero_oid, sizeof(git_oid));
+		for (i = 0; i < 2; i++) {
+			em->parent_oids->push_back(i < parents ? *git_commit_parent_id(commit, i) : zero_oid);
+		}
+	}
+	if (em->layout != NULL) {
+		/* Parents cut off by a shallow clone never get a row to end a lane */
+		for (i = 0, parents = 0; i < row.parent_count; i++) {
+			if (git_commit_parent(&parent, commit, i) != 0) {
+				continue;
+			}
+			git_oid_cpy(&lane_parents[parents++], git_commit_id(parent));
+			git_commit_free(parent);
+		}
+		LGitLanesAdd(em->layout, &row.oid, lane_parents, parents, &lane_row);
+	}
+	author = git_commit_author(commit);
+	row.when = author->when;
+	/* Do the conversion work outside of the lock */
+	encoding = LGitGitToWindowsCodepage(git_commit_message_encoding(commit));
+	summary = git_commit_summary(commit);
+	if (summary == NULL) {
+		summary = "";
+	}
+	summary_len = MultiByteToWideChar(encoding, 0, summary, -1, NULL, 0);
+	if (summary_len > em->summary_cap) {
+		em->summary_cap = summary_len * 2;
+		free(em->summary_buf);
+		em->summary_buf = (wchar_t*)malloc(em->summary_cap * sizeof(wchar_t));
+		if (em->summary_buf == NULL) {
+			em->summary_cap = 0;
+			strlcpy(model->error, "Out of memory", sizeof(model->error));
+			return FALSE;
+		}
+	}
+	summary_len = MultiByteToWideChar(encoding, 0, summary, -1, em->summary_buf, em->summary_cap);
+	/* Authors repeat a lot, so only keep each once */
+	author_key = author->name;
+	author_key += '\0';
+	author_key += author->email;
+	it = em->author_ids.find(author_key);
+
+	EnterCriticalSection(&model->lock);
+	if (it == em->author_ids.end()) {
+		LGitFormatSignatureW(author, em->author_buf, 256);
+		row.author = (LONG)model->authors->size();
+		model->authors->push_back(LGitHistoryModelAddString(model,
+			em->author_buf,
+			wcslen(em->author_buf)));
+		em->author_ids[author_key] = row.author;
+	} else {
+		row.author = it->second;
+	}
+	row.summary = LGitHistoryModelAddString(model,
+		em->summary_buf,
+		summary_len > 0 ? summary_len - 1 : 0);
+	if (row.summary == (DWORD)-1
+		|| !LGitHistoryModelAddRow(model, &row)
+		|| (em->layout != NULL && !LGitHistoryModelAddLanes(model, &lane_row, 1))) {
+		LeaveCriticalSection(&model->lock);
+		strlcpy(model->error, "Out of memory", sizeof(model->error));
+		return FALSE;
+	}
+	if (em->layout != NULL) {
+		model->lane_width = LGitLanesWidest(em->layout);
+	}
+	LeaveCriticalSection(&model->lock);
+
+	/* Don't flood the window with messages */
+	if ((em->posted == 0 && model->count >= FIRST_PAGE_SIZE)
+		|| (model->count - em->posted >= PAGE_SIZE)
+		|| (em->posted != 0 && GetTickCount() - em->last_post >= PAGE_INTERVAL)) {
+		if (em->posted == 0) {
+			LGitLog(" ! History: first %d rows in %u ms\n",
+				model->count,
+				GetTickCount() - em->begin);
+		}
+		em->posted = model->count;
+		em->last_post = GetTickCount();
+		PostMessage(model->notify, WM_LGIT_HISTORY_ROWS, LGHM_WALKING, 0);
+	}
+	if (model->search != NULL && !LGitSearchIndexHas(model->search, &row.oid)) {
+		LGitSearchIndexAdd(model->search, commit);
+	}
+	return TRUE;
+}
+
+/*
+ * Lays out rows from first on, which came from the history cache. Their
+ * parents are already rows, and only the worker adds rows, so this can read
+ * them without the lock.
+ */
+static BOOL LGitHistoryModelLayOutRows(LGitHistoryModel *model, LGitLanes *layout, LONG first)
+{
+	std::vector<LGitLaneRow> lanes;
+	const LGitHistoryRow *row;
+	git_oid parents[2];
+	LONG i, parent;
+	DWORD j;
+	int parent_count;
+	BOOL ret;
+
+	lanes.resize(model->count - first);
+	for (i = first; i < model->count; i++) {
+		row = &model->rows[i];
+		parent_count = 0;
+		for (j = 0; j < row->parent_count; j++) {
+			if (row->parents[j] == LGIT_HISTORY_NO_PARENT) {
+				continue;
+			}
+			parent = model->count - 1 - (LONG)row->parents[j];
+			git_oid_cpy(&parents[parent_count++], &model->rows[parent].oid);
+		}
+		LGitLanesAdd(layout, &row->oid, parents, parent_count, &lanes[i - first]);
+	}
+	EnterCriticalSection(&model->lock);
+	ret = lanes.size() == 0 || LGitHistoryModelAddLanes(model, &lanes[0], lanes.size());
+	model->lane_width = LGitLanesWidest(layout);
+	LeaveCriticalSection(&model->lock);
+	return ret;
+}
+
+/*
+ * Adds rows that came from the history cache to the search index, if they
+ * aren't in it yet (i.e. the index is newer than the cache, or was lost).
+ */
+static LONG LGitHistoryModelIndexRows(LGitHistoryModel *model, git_repository *repo, LONG first)
+{
+	git_commit *commit;
+	git_oid oid;
+	LONG i, added = 0;
+	for (i = first; i < model->count; i++) {
+		if (model->cancel) {
+			return LGHM_CANCELLED;
+		}
+		/* Only the worker adds rows, so no lock */
+		git_oid_cpy(&oid, &model->rows[i].oid);
+		if (LGitSearchIndexHas(model->search, &oid)) {
+			continue;
+		}
+		if (git_commit_lookup(&commit, repo, &oid) != 0) {
+			LGitHistoryModelSetError(model, "Looking up commit");
+			return LGHM_FAILED;
+		}
+		LGitSearchIndexAdd(model->search, commit);
+		git_commit_free(commit);
+		added++;
+	}
+	if (added > 0) {
+		LGitLog(" ! History: indexed %d cached commits for search\n", added);
+	}
+	return LGHM_DONE;
+}
+
+/*
+ * Path matching for file history on several threads. Each commit's tree
+ * diff doesn't depend on any other, so the walk hands out batches of
+ * commits in walk order, workers (each with their own repository) diff
+ * them, and the walk adds rows for the matches in the same order once the
+ * batch is done. The commit-graph and changed-path filters are only read
+ * during a batch; new filters are handed back and kept by the walk.
+ */
+typedef struct _LGitMatchItem {
+	git_oid oid;
+	/* Commit-graph positions, if it's in it */
+	DWORD pos, parent_pos;
+	int parents;
+	/* -1 if it still needs a diff, else 0 or 1 */
+	int match;
+	/* If there's no changed-path filter for it, one's made into here */
+	BOOL make_filter;
+	std::string filter;
+} LGitMatchItem;
+
+typedef struct _LGitMatchPool {
+	char repo_path[1024];
+	git_strarray *paths;
+	LGitCommitGraph *graph;
+	std::vector<LGitMatchItem> *items;
+	/* Released once per thread for each batch, and for quitting */
+	HANDLE work;
+	/* Set when every thread is done with the batch */
+	HANDLE done;
+	HANDLE threads[MATCH_MAX_THREADS];
+	int thread_count;
+	volatile LONG next_item, active, quit, failed;
+	char error[256];
+} LGitMatchPool;
+
+static unsigned __stdcall LGitMatchPoolThread(void *context)
+{
+	LGitMatchPool *pool = (LGitMatchPool*)context;
+	git_repository *repo = NULL;
+	git_pathspec *ps = NULL;
+	git_diff_options diffopts;
+	git_commit *commit;
+	LGitMatchItem *item;
+	const git_error *err;
+	LONG next;
+
+	git_diff_options_init(&diffopts, GIT_DIFF_OPTIONS_VERSION);
+	diffopts.pathspec.strings = pool->paths->strings;
+	diffopts.pathspec.count = pool->paths->count;
+	if (git_repository_open(&repo, pool->repo_path) != 0
+		|| git_pathspec_new(&ps, &diffopts.pathspec) != 0) {
+		goto fail;
+	}
+	for (;;) {
+		WaitForSingleObject(pool->work, INFINITE);
+		if (pool->quit) {
+			break;
+		}
+		while (!pool->failed) {
+			next = InterlockedIncrement(&pool->next_item) - 1;
+			if (next >= (LONG)pool->items->size()) {
+				break;
+			}
+			item = &(*pool->items)[next];
+			if (item->match != -1) {
+				continue;
+			}
+			commit = NULL;
+			if (item->make_filter) {
+				if (git_commit_lookup(&commit, repo, &item->oid) != 0) {
+					goto fail_batch;
+				}
+				item->match = LGitChangedPathsMake(commit, ps, &item->filter);
+			}
+			if (item->match == -1 && item->pos != LGIT_GRAPH_NONE && item->parents == 1) {
+				item->match = LGitHistoryModelMatchesGraph(repo,
+					pool->graph,
+					item->pos,
+					item->parent_pos,
+					&diffopts);
+			}
+			if (item->match == -1) {
+				if (commit == NULL && git_commit_lookup(&commit, repo, &item->oid) != 0) {
+					goto fail_batch;
+				}
+				item->match = LGitHistoryModelMatches(commit, ps, &diffopts);
+			}
+			if (commit != NULL) {
+				git_commit_free(commit);
+			}
+			if (item->match == -1) {
+				commit = NULL;
+				goto fail_batch;
+			}
+			continue;
+fail_batch:
+			if (commit != NULL) {
+				git_commit_free(commit);
+			}
+			/* Errors are per thread, so keep the first one for the walk */
+			if (InterlockedExchange(&pool->failed, 1) == 0) {
+				err = git_error_last();
+				strlcpy(pool->error, err != NULL ? err->message : "Unknown error", 256);
+			}
+		}
+		if (InterlockedDecrement(&pool->active) == 0) {
+			SetEvent(pool->done);
+		}
+	}
+	goto fin;
+fail:
+	/* Can't do anything, but still has to say it's done with each batch */
+	if (InterlockedExchange(&pool->failed, 1) == 0) {
+		err = git_error_last();
+		strlcpy(pool->error, err != NULL ? err->message : "Unknown error", 256);
+	}
+	for (;;) {
+		WaitForSingleObject(pool->work, INFINITE);
+		if (pool->quit) {
+			break;
+		}
+		if (InterlockedDecrement(&pool->active) == 0) {
+			SetEvent(pool->done);
+		}
+	}
+fin:
+	if (ps != NULL) {
+		git_pathspec_free(ps);
+	}
+	if (repo != NULL) {
+		git_repository_free(repo);
+	}
+	return 0;
+}
+
+static void LGitMatchPoolFree(LGitMatchPool *pool)
+{
+	int i;
+	if (pool == NULL) {
+		return;
+	}
+	if (pool->thread_count > 0) {
+		InterlockedExchange(&pool->quit, 1);
+		ReleaseSemaphore(pool->work, pool->thread_count, NULL);
+		for (i = 0; i < pool->thread_count; i++) {
+			WaitForSingleObject(pool->threads[i], INFINITE);
+			CloseHandle(pool->threads[i]);
+		}
+	}
+	if (pool->work != NULL) {
+		CloseHandle(pool->work);
+	}
+	if (pool->done != NULL) {
+		CloseHandle(pool->done);
+	}
+	delete pool->items;
+	free(pool);
+}
+
+/* NULL if there's only one processor, or threads couldn't be started */
+static LGitMatchPool *LGitMatchPoolNew(git_repository *repo,
+									   LGitCommitGraph *graph,
+									   git_strarray *paths)
+{
+	LGitMatchPool *pool;
+	unsigned thread_id;
+	int i, count;
+
+	count = LGitScanThreadCount();
+	if (count < 2) {
+		return NULL;
+	}
+	if (count > MATCH_MAX_THREADS) {
+		count = MATCH_MAX_THREADS;
+	}
+	pool = (LGitMatchPool*)calloc(1, sizeof(LGitMatchPool));
+	if (pool == NULL) {
+		return NULL;
+	}
+	strlcpy(pool->repo_path, git_repository_path(repo), 1024);
+	pool->paths = paths;
+	pool->graph = graph;
+	pool->items = new std::vector<LGitMatchItem>();
+	pool->work = CreateSemaphore(NULL, 0, MATCH_MAX_THREADS * 2, NULL);
+	pool->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (pool->work == NULL || pool->done == NULL) {
+		goto fail;
+	}
+	for (i = 0; i < count; i++) {
+		pool->threads[i] = (HANDLE)_beginthreadex(NULL, 0, LGitMatchPoolThread, pool, 0, &thread_id);
+		if (pool->threads[i] == NULL) {
+			break;
+		}
+		pool->thread_count++;
+	}
+	if (pool->thread_count < 2) {
+		goto fail;
+	}
+	return pool;
+fail:
+	LGitLog("!! Couldn't start history match workers\n");
+	LGitMatchPoolFree(pool);
+	return NULL;
+}
+
+/* Diffs whatever in the batch isn't decided yet; FALSE if any failed */
+static BOOL LGitMatchPoolRun(LGitMatchPool *pool)
+{
+	pool->next_item = 0;
+	pool->active = pool->thread_count;
+	ReleaseSemaphore(pool->work, pool->thread_count, NULL);
+	WaitForSingleObject(pool->done, INFINITE);
+	return !pool->failed;
+}
+
+/*
+ * Filtered walk with the pool. Returns the same as the serial walk would
+ * leave in state: LGHM_DONE, LGHM_CANCELLED, or LGHM_FAILED with the error
+ * set in the model.
+ */
+static LONG LGitHistoryModelWalkParallel(LGitHistoryModel *model,
+										 LGitHistoryEmitter *em,
+										 LGitMatchPool *pool,
+										 git_repository *repo,
+										 LGitCommitGraph *graph,
+										 LGitGraphWalk *graph_walk,
+										 git_revwalk *walker,
+										 LGitChangedPaths *cp)
+{
+	std::vector<LGitMatchItem> *items = pool->items;
+	LGitMatchItem item;
+	git_commit *commit;
+	size_t i, batch_size = MATCH_BATCH_PER_THREAD * pool->thread_count;
+	LONG commits = 0, diffed = 0;
+	BOOL last = FALSE;
+	DWORD begin = GetTickCount();
+	int rc;
+
+	while (!last) {
+		if (model->cancel) {
+			return LGHM_CANCELLED;
+		}
+		/* The cheap part: walking, and what the commit-graph and filters say */
+		items->clear();
+		while (items->size() < batch_size) {
+			item.pos = LGIT_GRAPH_NONE;
+			if (graph_walk != NULL) {
+				rc = LGitGraphWalkNext(graph_walk, &item.oid, &item.pos);
+			} else {
+				rc = git_revwalk_next(&item.oid, walker);
+			}
+			if (rc == GIT_ITEROVER) {
+				last = TRUE;
+				break;
+			} else if (rc != 0) {
+				LGitHistoryModelSetError(model, "Walking history");
+				return LGHM_FAILED;
+			}
+			item.parent_pos = 0;
+			item.match = -1;
+			item.make_filter = FALSE;
+			item.filter.erase();
+			if (item.pos != LGIT_GRAPH_NONE) {
+				item.parents = LGitCommitGraphParents(graph, item.pos, &item.parent_pos, 1);
+			} else {
+				if (git_commit_lookup(&commit, repo, &item.oid) != 0) {
+					LGitHistoryModelSetError(model, "Looking up commit");
+					return LGHM_FAILED;
+				}
+				item.parents = (int)git_commit_parentcount(commit);
+				git_commit_free(commit);
+			}
+			if (cp != NULL && item.parents == 1) {
+				item.match = LGitChangedPathsQuery(cp, &item.oid, model->paths);
+				if (item.match == -1) {
+					item.make_filter = TRUE;
+				} else if (item.match == 1) {
+					/* Could be a false positive, so check for real */
+					item.match = -1;
+				}
+			}
+			if (item.match == -1) {
+				diffed++;
+			}
+			items->push_back(item);
+		}
+		commits += items->size();
+		if (!LGitMatchPoolRun(pool)) {
+			_snprintf(model->error, sizeof(model->error), "Matching paths: %s", pool->error);
+			LGitLog("!! History model: %s\n", model->error);
+			return LGHM_FAILED;
+		}
+		/* Back in walk order */
+		for (i = 0; i < items->size(); i++) {
+			if (cp != NULL && (*items)[i].make_filter && !(*items)[i].filter.empty()) {
+				LGitChangedPathsAdd(cp, &(*items)[i].oid, (*items)[i].filter);
+			}
+			if ((*items)[i].match != 1) {
+				continue;
+			}
+			if (git_commit_lookup(&commit, repo, &(*items)[i].oid) != 0) {
+				LGitHistoryModelSetError(model, "Looking up commit");
+				return LGHM_FAILED;
+			}
+			rc = LGitHistoryModelEmit(em, commit);
+			git_commit_free(commit);
+			if (!rc) {
+				return LGHM_FAILED;
+			}
+		}
+	}
+	LGitLog(" ! History: matched %d commits (%d diffed) on %d threads in %u ms\n",
+		commits,
+		diffed,
+		pool->thread_count,
+		GetTickCount() - begin);
+	return LGHM_DONE;
+}
+
+static unsigned __stdcall LGitHistoryModelWorker(void *context)
+{
+	LGitHistoryModel *model = (LGitHistoryModel*)context;
+	git_repository *repo = NULL;
+	git_revwalk *walker = NULL;
+	LGitCommitGraph *graph = NULL;
+	LGitGraphWalk *graph_walk = NULL;
+	git_pathspec *ps = NULL;
+	LGitChangedPaths *cp = NULL;
+	LGitMatchPool *pool = NULL;
+	git_diff_options diffopts;
+	LGitHistoryCache *cache = NULL;
+	LGitHistoryEmitter em;
+	git_commit *commit = NULL;
+	git_oid oid, tip;
+	DWORD pos;
+	int rc;
+	std::vector<git_oid> parent_oids;
+	BOOL walk = TRUE;
+	LONG walked, state = LGHM_FAILED;
+
+	em.model = model;
+	em.parent_oids = NULL;
+	em.layout = NULL;
+	em.summary_buf = NULL;
+	em.summary_cap = 0;
+	em.posted = 0;
+	em.begin = em.last_post = GetTickCount();
+	/* Objects from a repository shouldn't be shared across threads */
+	if (git_repository_open(&repo, git_repository_path(model->ctx->repo)) != 0) {
+		LGitHistoryModelSetError(model, "Opening repository");
+		goto fin;
+	}
+	git_diff_options_init(&diffopts, GIT_DIFF_OPTIONS_VERSION);
+	if (model->paths != NULL && model->paths->count > 0) {
+		diffopts.pathspec.strings = model->paths->strings;
+		diffopts.pathspec.count = model->paths->count;
+		if (git_pathspec_new(&ps, &diffopts.pathspec) != 0) {
+			LGitHistoryModelSetError(model, "Creating pathspec");
+			goto fin;
+		}
+		/* Without it, every commit needs a tree diff */
+		if (LGitChangedPathsUsable(model->paths)) {
+			cp = LGitChangedPathsOpen(repo);
+		}
+	} else {
+		em.parent_oids = &parent_oids;
+		/* Filtered walks skip commits, so there's no graph to draw */
+		em.layout = LGitLanesNew();
+	}
+	if (model->search == NULL) {
+		LGitSearchIndex *search = LGitSearchIndexOpen(repo);
+		EnterCriticalSection(&model->lock);
+		model->search = search;
+		LeaveCriticalSection(&model->lock);
+	}
+	/* With a commit-graph, only commits that make it into a row get looked up */
+	graph = LGitCommitGraphOpen(repo);
+	/* Unfiltered walks can pick up from where the cached one left off */
+	if (ps == NULL) {
+		if (git_reference_name_to_id(&tip, repo, model->ref != NULL ? model->ref : "HEAD") != 0) {
+			LGitHistoryModelSetError(model, "Pushing reference");
+			goto fin;
+		}
+		cache = LGitHistoryCacheOpen(repo);
+	}
+	if (cache != NULL) {
+		if (git_oid_equal(&tip, LGitHistoryCacheTip(cache))) {
+			walk = FALSE;
+		} else if (LGitDescendantOf(repo, graph, &tip, LGitHistoryCacheTip(cache)) != 1) {
+			/* Rewound, or a different branch; start over */
+			LGitHistoryCacheClose(cache);
+			cache = NULL;
+		}
+	}
+	if (!walk) {
+		/* Everything's in the cache */
+	} else if (graph != NULL && cache == NULL) {
+		graph_walk = LGitGraphWalkNew(repo, graph, em.layout != NULL);
+		if (graph_walk == NULL) {
+			strlcpy(model->error, "Out of memory", sizeof(model->error));
+			goto fin;
+		}
+		if (git_reference_name_to_id(&oid, repo, model->ref != NULL ? model->ref : "HEAD") != 0
+			|| LGitGraphWalkPush(graph_walk, &oid) != 0) {
+			LGitHistoryModelSetError(model, "Pushing reference");
+			goto fin;
+		}
+	} else {
+		/* The graph walk can't hide commits, so new ones on a cache use this */
+		if (git_revwalk_new(&walker, repo) != 0) {
+			LGitHistoryModelSetError(model, "Creating walker");
+			goto fin;
+		}
+		/* Lanes need every child before its parents, whatever the clocks say */
+		git_revwalk_sorting(walker, em.layout != NULL
+			? GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME
+			: GIT_SORT_TIME);
+		if (model->ref == NULL && git_revwalk_push_head(walker) != 0) {
+			LGitHistoryModelSetError(model, "Pushing reference");
+			goto fin;
+		}
+		if (model->ref != NULL && git_revwalk_push_ref(walker, model->ref) != 0) {
+			LGitHistoryModelSetError(model, "Pushing reference");
+			goto fin;
+		}
+		if (cache != NULL && git_revwalk_hide(walker, LGitHistoryCacheTip(cache)) != 0) {
+			LGitHistoryModelSetError(model, "Hiding cached commits");
+			goto fin;
+		}
+	}
+
+	/* Filtering is where the time goes, so spread the diffs out if we can */
+	if (ps != NULL) {
+		pool = LGitMatchPoolNew(repo, graph, model->paths);
+	}
+	if (pool != NULL) {
+		state = LGitHistoryModelWalkParallel(model,
+			&em,
+			pool,
+			repo,
+			graph,
+			graph_walk,
+			walker,
+			cp);
+		if (state != LGHM_DONE) {
+			goto fin;
+		}
+		state = LGHM_FAILED;
+		walk = FALSE;
+	}
+	for (; walk; git_commit_free(commit)) {
+		commit = NULL;
+		if (model->cancel) {
+			state = LGHM_CANCELLED;
+			goto fin;
+		}
+		pos = LGIT_GRAPH_NONE;
+		if (graph_walk != NULL) {
+			rc = LGitGraphWalkNext(graph_walk, &oid, &pos);
+		} else {
+			rc = git_revwalk_next(&oid, walker);
+		}
+		if (rc == GIT_ITEROVER) {
+			break;
+		} else if (rc != 0) {
+			LGitHistoryModelSetError(model, "Walking history");
+			goto fin;
+		}
+		if (ps != NULL) {
+			int match = -1, parents;
+			DWORD parent_pos = 0;
+			if (pos != LGIT_GRAPH_NONE) {
+				parents = LGitCommitGraphParents(graph, pos, &parent_pos, 1);
+			} else {
+				if (git_commit_lookup(&commit, repo, &oid) != 0) {
+					LGitHistoryModelSetError(model, "Looking up commit");
+					goto fin;
+				}
+				parents = (int)git_commit_parentcount(commit);
+			}
+			if (cp != NULL && parents == 1) {
+				match = LGitChangedPathsQuery(cp, &oid, model->paths);
+				if (match == -1) {
+					/* First time seeing it; this diffs for us */
+					if (commit == NULL && git_commit_lookup(&commit, repo, &oid) != 0) {
+						LGitHistoryModelSetError(model, "Looking up commit");
+						goto fin;
+					}
+					match = LGitChangedPathsCompute(cp, commit, ps);
+				} else if (match == 1) {
+					/* Could be a false positive, so check for real */
+					match = -1;
+				}
+			}
+			if (match == -1 && pos != LGIT_GRAPH_NONE && parents == 1) {
+				match = LGitHistoryModelMatchesGraph(repo, graph, pos, parent_pos, &diffopts);
+			}
+			if (match == -1) {
+				if (commit == NULL && git_commit_lookup(&commit, repo, &oid) != 0) {
+					LGitHistoryModelSetError(model, "Looking up commit");
+					goto fin;
+				}
+				match = LGitHistoryModelMatches(commit, ps, &diffopts);
+			}
+			if (match == -1) {
+				LGitHistoryModelSetError(model, "Matching paths");
+				goto fin;
+			} else if (match == 0) {
+				continue;
+			}
+		}
+		if (commit == NULL && git_commit_lookup(&commit, repo, &oid) != 0) {
+			LGitHistoryModelSetError(model, "Looking up commit");
+			goto fin;
+		}
+		if (!LGitHistoryModelEmit(&em, commit)) {
+			goto fin;
+		}
+	}
+	commit = NULL;
+	walked = model->count;
+	if (cache != NULL) {
+		if (!LGitHistoryModelAppendCache(model, cache)
+			|| (em.layout != NULL && !LGitHistoryModelLayOutRows(model, em.layout, walked))) {
+			strlcpy(model->error, "Out of memory", sizeof(model->error));
+			goto fin;
+		}
+		/* Let go before it gets replaced */
+		LGitHistoryCacheClose(cache);
+		cache = NULL;
+		PostMessage(model->notify, WM_LGIT_HISTORY_ROWS, LGHM_WALKING, 0);
+	}
+	if (ps == NULL) {
+		LGitHistoryModelResolveParents(model, walked, parent_oids);
+		if (walked > 0) {
+			LGitHistoryCacheSave(repo,
+				&tip,
+				model->rows,
+				model->count,
+				model->authors->size() > 0 ? &(*model->authors)[0] : NULL,
+				(LONG)model->authors->size(),
+				model->strings,
+				model->strings_len);
+		}
+	}
+	if (model->search != NULL && walked < model->count) {
+		state = LGitHistoryModelIndexRows(model, repo, walked);
+		if (state != LGHM_DONE) {
+			goto fin;
+		}
+	}
+	state = LGHM_DONE;
+	LGitLog(" ! History: %d rows (%d walked) in %u ms\n",
+		model->count,
+		walked,
+		GetTickCount() - em.begin);
+fin:
+	/* Whatever was added is good, even if we were cancelled */
+	if (model->search != NULL) {
+		LGitSearchIndexSave(model->search);
+	}
+	LGitMatchPoolFree(pool);
+	LGitHistoryCacheClose(cache);
+	LGitLanesFree(em.layout);
+	if (commit != NULL) {
+		git_commit_free(commit);
+	}
+	if (em.summary_buf != NULL) {
+		free(em.summary_buf);
+	}
+	if (ps != NULL) {
+		git_pathspec_free(ps);
+	}
+	/* Saves any new filters, even if we were cancelled */
+	LGitChangedPathsClose(cp);
+	if (walker != NULL) {
+		git_revwalk_free(walker);
+	}
+	LGitGraphWalkFree(graph_walk);
+	LGitCommitGraphClose(graph);
+	if (repo != NULL) {
+		git_repository_free(repo);
+	}
+	model->state = state;
+	PostMessage(model->notify, WM_LGIT_HISTORY_ROWS, state, 0);
+	return 0;
+}
+
+/*
+ * Starts walking from the ref (or HEAD if NULL), only including commits that
+ * touch paths if they're given. The window is sent WM_LGIT_HISTORY_ROWS as
+ * rows come in, with the state in wParam. ref and paths must outlive it.
+ */
+BOOL LGitHistoryModelStart(LGitHistoryModel *model, HWND notify, const char *ref, git_strarray *paths)
+{
+	unsigned thread_id;
+	LGitHistoryModelStop(model);
+	model->notify = notify;
+	model->ref = ref;
+	model->paths = paths;
+	model->cancel = 0;
+	model->state = LGHM_WALKING;
+	model->error[0] = '\0';
+	model->thread = (HANDLE)_beginthreadex(NULL, 0, LGitHistoryModelWorker, model, 0, &thread_id);
+	if (model->thread == NULL) {
+		LGitLog("!! Couldn't start history worker\n");
+		model->state = LGHM_FAILED;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Cancels any walk in progress and empties the model */
+void LGitHistoryModelStop(LGitHistoryModel *model)
+{
+	if (model->thread != NULL) {
+		InterlockedExchange((LPLONG)&model->cancel, 1);
+		WaitForSingleObject(model->thread, INFINITE);
+		CloseHandle(model->thread);
+		model->thread = NULL;
+	}
+	EnterCriticalSection(&model->lock);
+	free(model->rows);
+	model->rows = NULL;
+	model->count = model->capacity = 0;
+	free(model->strings);
+	model->strings = NULL;
+	model->strings_len = model->strings_cap = 0;
+	model->authors->clear();
+	free(model->lanes);
+	model->lanes = NULL;
+	model->lane_count = model->lane_capacity = model->lane_width = 0;
+	LeaveCriticalSection(&model->lock);
+}
+
+LONG LGitHistoryModelCount(LGitHistoryModel *model)
+{
+	LONG count;
+	EnterCriticalSection(&model->lock);
+	count = model->count;
+	LeaveCriticalSection(&model->lock);
+	return count;
+}
+
+/* One of LGHM_*; if failed, message gets why */
+LONG LGitHistoryModelGetState(LGitHistoryModel *model, const char **message)
+{
+	if (message != NULL) {
+		*message = model->error;
+	}
+	return model->state;
+}
+
+BOOL LGitHistoryModelOid(LGitHistoryModel *model, LONG index, git_oid *oid)
+{
+	BOOL ret = FALSE;
+	EnterCriticalSection(&model->lock);
+	if (index >= 0 && index < model->count) {
+		git_oid_cpy(oid, &model->rows[index].oid);
+		ret = TRUE;
+	}
+	LeaveCriticalSection(&model->lock);
+	return ret;
+}
+
+/*
+ * Row of the nth parent (0 or 1) of a row, or -1 if it isn't in the list.
+ * Only known once the walk is done, and never for filtered walks.
+ */
+LONG LGitHistoryModelParent(LGitHistoryModel *model, LONG index, int n)
+{
+	LGitHistoryRow *row;
+	LONG ret = -1;
+	EnterCriticalSection(&model->lock);
+	if (index >= 0 && index < model->count && n >= 0) {
+		row = &model->rows[index];
+		if ((DWORD)n < row->parent_count
+			&& row->parents[n] != LGIT_HISTORY_NO_PARENT
+			&& row->parents[n] < (DWORD)model->count) {
+			ret = model->count - 1 - (LONG)row->parents[n];
+		}
+	}
+	LeaveCriticalSection(&model->lock);
+	return ret;
+}
+
+/* Where the row is in the graph; FALSE if there's no graph (filtered walks) */
+BOOL LGitHistoryModelLanes(LGitHistoryModel *model, LONG index, LGitLaneRow *row)
+{
+	BOOL ret = FALSE;
+	EnterCriticalSection(&model->lock);
+	if (index >= 0 && index < model->lane_count) {
+		*row = model->lanes[index];
+		ret = TRUE;
+	}
+	LeaveCriticalSection(&model->lock);
+	return ret;
+}
+
+/* How many lanes the graph has needed so far */
+LONG LGitHistoryModelLaneWidth(LGitHistoryModel *model)
+{
+	LONG width;
+	EnterCriticalSection(&model->lock);
+	width = model->lane_width;
+	LeaveCriticalSection(&model->lock);
+	return width;
+}
+
+static bool LGitHistoryOidLess(const git_oid &a, const git_oid &b)
+{
+	return git_oid_cmp(&a, &b) < 0;
+}
+
+/*
+ * Rows (of within, or all of them if NULL) whose author or message has the
+ * query in it, in order. The search index has the text too, so this never
+ * has to read a commit. Returns FALSE if the query can't be searched for
+ * (i.e. it's too short), in which case the caller should show everything.
+ */
+BOOL LGitHistoryModelSearch(LGitHistoryModel *model,
+							const wchar_t *query,
+							const std::vector<LONG> *within,
+							std::vector<LONG> *rows)
+{
+	std::vector<git_oid> matches;
+	LGitSearchIndex *search;
+	char query_utf8[1024];
+	LONG i, k, count;
+	DWORD begin = GetTickCount();
+
+	rows->clear();
+	EnterCriticalSection(&model->lock);
+	search = model->search;
+	LeaveCriticalSection(&model->lock);
+	if (search == NULL || LGitWideToUtf8(query, query_utf8, 1024) == 0) {
+		return FALSE;
+	}
+	if (!LGitSearchIndexQuery(search, query_utf8, &matches)) {
+		return FALSE;
+	}
+
+	EnterCriticalSection(&model->lock);
+	count = within != NULL ? (LONG)within->size() : model->count;
+	for (k = 0; k < count && matches.size() > 0; k++) {
+		i = within != NULL ? (*within)[k] : k;
+		if (i >= 0 && i < model->count
+			&& std::binary_search(matches.begin(), matches.end(), model->rows[i].oid, LGitHistoryOidLess)) {
+			rows->push_back(i);
+		}
+	}
+	LeaveCriticalSection(&model->lock);
+	LGitLog(" ! History search: %d matching commits, %d rows in %u ms\n",
+		matches.size(),
+		rows->size(),
+		GetTickCount() - begin);
+	return TRUE;
+}
+
+/* Text for a history list view column, only made when it's asked for */
+BOOL LGitHistoryModelText(LGitHistoryModel *model, LONG index, int column, wchar_t *buf, size_t bufsz)
+{
+	LGitHistoryRow row;
+	char oid_str[GIT_OID_HEXSZ + 1];
+	if (bufsz < 1) {
+		return FALSE;
+	}
+	buf[0] = L'\0';
+	EnterCriticalSection(&model->lock);
+	if (index < 0 || index >= model->count) {
+		LeaveCriticalSection(&model->lock);
+		return FALSE;
+	}
+	row = model->rows[index];
+	switch (column) {
+	case LGHM_COLUMN_AUTHOR:
+		wcslcpy(buf, model->strings + (*model->authors)[row.author], bufsz);
+		break;
+	case LGHM_COLUMN_SUMMARY:
+		wcslcpy(buf, model->strings + row.summary, bufsz);
+		break;
+	}
+	LeaveCriticalSection(&model->lock);
+	switch (column) {
+	case LGHM_COLUMN_OID:
+		git_oid_tostr(oid_str, GIT_OID_HEXSZ + 1, &row.oid);
+		LGitUtf8ToWide(oid_str, buf, bufsz);
+		break;
+	case LGHM_COLUMN_WHEN:
+		LGitTimeToStringW(&row.when, buf, bufsz);
+		break;
+	}
+	return TRUE;
+}
@@ -4,6 +4,12 @@
 
 #include "stdafx.h"
 
+/* Typing restarts it, so the search runs once they pause */
+#define HISTORY_SEARCH_TIMER 1
+#define HISTORY_SEARCH_DELAY 150
+/* Pixels per lane in the graph */
+#define HISTORY_GRAPH_LANE_WIDTH 10
+
 static LVCOLUMNW author_column = {
 	LVCF_TEXT | LVCF_WIDTH, 0, 175, L"Author"
 };
@@ -16,6 +22,9 @@ static LVCOLUMNW comment_column = {
 static LVCOLUMNW oid_column = {
 	LVCF_TEXT | LVCF_WIDTH, 0, 75, L"Object ID"
 };
+static LVCOLUMNW graph_column = {
+	LVCF_TEXT | LVCF_WIDTH, 0, HISTORY_GRAPH_LANE_WIDTH * 2, L"Graph"
+};
 
 /* 
  * All these variables are a pain to carry indiviually, so we pack a pointer
@@ -25,14 +34,19 @@ static LVCOLUMNW oid_column = {
 typedef struct _LGitHistoryDialogParams {
 	LGitContext *ctx;
 	const char *ref; /* NULL is head */
-	git_revwalk *walker;
-	git_pathspec *ps;
 	git_diff_options *diffopts;
+	git_strarray *pathspec;
 	
 	char **paths;
 	int path_count;
 
-	int max_index;
+	/* Rows come from here, walked in the background */
+	LGitHistoryModel *model;
+	/* If searching, the model's rows that match, in order */
+	std::vector<LONG> *matches;
+	BOOL searching;
+	/* What matches are for, which can be behind what's typed */
+	wchar_t query[256];
 
 	BOOL changed;
 	BOOL is_head;
@@ -81,193 +95,236 @@ static void InitializeHistoryListView(HWND hwnd, LGitHistoryDialogParams *param)
 	SendMessage(lv, LVM_INSERTCOLUMNW, 1, (LPARAM)&author_column);
 	SendMessage(lv, LVM_INSERTCOLUMNW, 2, (LPARAM)&authored_when_column);
 	SendMessage(lv, LVM_INSERTCOLUMNW, 3, (LPARAM)&comment_column);
-	/*
-	 * XXX: Wonder if maybe callbacks are the way to go:
-	 * https://docs.microsoft.com/en-us/windows/win32/controls/add-list-view-items-and-subitems
-	 */
+	/* Only whole histories have a graph; it's last so the rest keep their numbers */
+	if (param->path_count == 0) {
+		int order[5] = { LGHM_COLUMN_GRAPH, 0, 1, 2, 3 };
+		SendMessage(lv, LVM_INSERTCOLUMNW, LGHM_COLUMN_GRAPH, (LPARAM)&graph_column);
+		ListView_SetColumnOrderArray(lv, 5, order);
+	}
 }
 
-/** Helper to find how many files in a commit changed from its nth parent. */
-static int match_with_parent(HWND hwnd, git_commit *commit, int i, git_diff_options *opts)
+/* Search box across the top, list under it */
+static void LayoutHistoryWindow(HWND hwnd)
 {
-	git_commit *parent;
-	git_tree *a, *b;
-	git_diff *diff;
-	int ndeltas;
+	HWND edit = GetDlgItem(hwnd, IDC_HISTORY_SEARCH);
+	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
+	RECT client, edit_rect;
+	int top;
+	GetClientRect(hwnd, &client);
+	GetWindowRect(edit, &edit_rect);
+	MapWindowPoints(NULL, hwnd, (LPPOINT)&edit_rect, 2);
+	SetWindowPos(edit, NULL, 0, 0,
+		client.right - edit_rect.left - edit_rect.top,
+		edit_rect.bottom - edit_rect.top,
+		SWP_NOMOVE | SWP_NOZORDER);
+	top = edit_rect.bottom + edit_rect.top;
+	SetWindowPos(lv, NULL, 0, top, client.right, client.bottom - top, SWP_NOZORDER);
+}
 
-	if (git_commit_parent(&parent, commit, (size_t)i) != 0) {
-		LGitLibraryError(hwnd, "match_with_parent git_commit_parent");
-		return -1;
-	}
-	if (git_commit_tree(&a, parent) != 0) {
-		LGitLibraryError(hwnd, "match_with_parent git_commit_tree A");
-		git_commit_free(parent);
-		return -1;
-	}
-	if (git_commit_tree(&b, commit) != 0) {
-		LGitLibraryError(hwnd, "match_with_parent git_commit_tree B");
-		git_tree_free(a);
-		git_commit_free(parent);
-		return -1;
+/* List view item to model row, since searching shows only some of them */
+static LONG HistoryItemToRow(LGitHistoryDialogParams *params, int item)
+{
+	if (!params->searching) {
+		return item;
 	}
-	if (git_diff_tree_to_tree(&diff, git_commit_owner(commit), a, b, opts) != 0) {
-		LGitLibraryError(hwnd, "match_with_parent git_diff_tree_to_tree");
-		git_tree_free(a);
-		git_tree_free(b);
-		git_commit_free(parent);
+	if (item < 0 || item >= (int)params->matches->size()) {
 		return -1;
 	}
+	return (*params->matches)[item];
+}
 
-	ndeltas = (int)git_diff_num_deltas(diff);
-
-	git_diff_free(diff);
-	git_tree_free(a);
-	git_tree_free(b);
-	git_commit_free(parent);
-
-	return ndeltas > 0;
+/*
+ * Filters the list by what's in the search box. If it's only been added
+ * to, only what matched last time can match now, so just look at those.
+ * With force, it's searched again even if it hasn't changed (new rows).
+ */
+static void UpdateHistorySearch(HWND hwnd, LGitHistoryDialogParams *params, BOOL force)
+{
+	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
+	std::vector<LONG> rows;
+	const std::vector<LONG> *within = NULL;
+	wchar_t query[256];
+	GetDlgItemTextW(hwnd, IDC_HISTORY_SEARCH, query, 256);
+	if (!force && wcscmp(query, params->query) == 0) {
+		return;
+	}
+	if (!force && params->searching && params->query[0] != L'\0'
+		&& wcsstr(query, params->query) != NULL) {
+		within = params->matches;
+	}
+	params->searching = LGitHistoryModelSearch(params->model, query, within, &rows);
+	params->matches->swap(rows);
+	wcslcpy(params->query, query, 256);
+	/* Indices mean something else now */
+	ListView_SetItemState(lv, -1, 0, LVIS_SELECTED | LVIS_FOCUSED);
+	ListView_SetItemCountEx(lv,
+		params->searching ? params->matches->size() : LGitHistoryModelCount(params->model),
+		0);
+	InvalidateRect(lv, NULL, FALSE);
 }
 
+/*
+ * The list is virtual (LVS_OWNERDATA), and only asks for text of the rows it
+ * shows. This just (re)starts the walk; rows show up as the model has them.
+ */
 static BOOL FillHistoryListView(HWND hwnd,
 								LGitHistoryDialogParams *param,
 								BOOL whole_repo)
 {
-	HWND lv;
-	git_oid oid;
-	git_commit *commit = NULL;
-	int parents, i, index;
-
-	LGitContext *ctx = param->ctx;
-	git_revwalk *walker = param->walker;
-	git_pathspec *ps = param->ps;
-	git_diff_options *diffopts = param->diffopts;
-	const char *ref = param->ref;
-
-	lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
-	/* clear if we're replenishing */
-	ListView_DeleteAllItems(lv);
+	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
+	LGitHistoryModelStop(param->model);
+	/* clear if we're replenishing; the search is redone once it's walked */
+	param->searching = FALSE;
+	param->matches->clear();
+	ListView_SetItemCount(lv, 0);
+	return LGitHistoryModelStart(param->model,
+		hwnd,
+		param->ref,
+		whole_repo ? NULL : param->pathspec);
+}
 
-	/* Push HEAD again */
-	if (ref == NULL && git_revwalk_push_head(walker) != 0) {
-		LGitLibraryError(hwnd, "History (Pushing Reference)");
-		return FALSE;
+/* Widens the graph as lanes are added; it's never narrowed, so it doesn't jump */
+static void SizeHistoryGraphColumn(HWND lv, LGitHistoryDialogParams *param)
+{
+	LONG lanes = LGitHistoryModelLaneWidth(param->model);
+	int width;
+	if (param->path_count != 0) {
+		return;
 	}
-	if (ref != NULL && git_revwalk_push_ref(walker, ref) != 0) {
-		LGitLibraryError(hwnd, "History (Pushing Reference)");
-		return FALSE;
+	if (lanes > LGIT_LANE_MAX) {
+		lanes = LGIT_LANE_MAX;
 	}
+	width = (lanes + 1) * HISTORY_GRAPH_LANE_WIDTH;
+	if (width > ListView_GetColumnWidth(lv, LGHM_COLUMN_GRAPH)) {
+		ListView_SetColumnWidth(lv, LGHM_COLUMN_GRAPH, width);
+	}
+}
 
-	/*
-	 * We can only get the revision count by walking it like we're doing now,
-	 * so it's unquantifiable.
-	 */
-	LGitProgressInit(param->ctx, "Walking History", 0);
-	LGitProgressStart(param->ctx, hwnd, FALSE);
-	for (index = 0; !git_revwalk_next(&oid, walker); git_commit_free(commit)) {
-		const git_signature *author, *committer;
-		const char *message;
-		char *oid_str; /* owned by library statically, do not free */
-		wchar_t formatted[256];
-		LVITEMW lvi;
-
-		if (LGitProgressCancelled(param->ctx)) {
-			/* We'll work with what we have. */
-			break;
+static void HistoryRowsArrived(HWND hwnd, LGitHistoryDialogParams *param, LONG state)
+{
+	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
+	const char *message;
+	int old_count = ListView_GetItemCount(lv);
+	int count = LGitHistoryModelCount(param->model);
+	SizeHistoryGraphColumn(lv, param);
+	/* Results stay as they are until everything's walked and indexed */
+	if (!param->searching) {
+		ListView_SetItemCountEx(lv, count, LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
+		/* Recalculate after the first rows because of scroll bars */
+		if (old_count == 0 && count > 0) {
+			ListView_SetColumnWidth(lv, 3, LVSCW_AUTOSIZE_USEHEADER);
 		}
+	}
+	if (state == LGHM_DONE && param->query[0] != L'\0') {
+		UpdateHistorySearch(hwnd, param, TRUE);
+	}
+	if (state == LGHM_FAILED
+		&& LGitHistoryModelGetState(param->model, &message) == LGHM_FAILED) {
+		MessageBoxA(hwnd, message, "History", MB_ICONERROR | MB_OK);
+	}
+}
 
-		if (git_commit_lookup(&commit, ctx->repo, &oid) != 0) {
-			LGitLibraryError(hwnd, "SccHistory git_commit_lookup");
-			git_commit_free(commit);
-			return FALSE;
+/*
+ * Draws a row's cell in the graph column. Lines come in at the top of their
+ * lane and leave at the bottom, with the commit's dot in the middle. There's
+ * no graph for search results, since the rows around aren't its neighbours.
+ */
+static void DrawHistoryGraphCell(HWND lv, LGitHistoryDialogParams *params, HDC dc, int item)
+{
+	LGitLaneRow lanes;
+	RECT rc;
+	HPEN pen, old_pen;
+	HBRUSH brush, old_brush;
+	COLORREF color;
+	BOOL selected;
+	int i, x, mid, node_x, radius, saved;
+	DWORD bit;
+
+	if (!ListView_GetSubItemRect(lv, item, LGHM_COLUMN_GRAPH, LVIR_BOUNDS, &rc)) {
+		return;
+	}
+	selected = (ListView_GetItemState(lv, item, LVIS_SELECTED) & LVIS_SELECTED)
+		&& GetFocus() == lv;
+	FillRect(dc, &rc, GetSysColorBrush(selected ? COLOR_HIGHLIGHT : COLOR_WINDOW));
+	/* Not searching, so the item is the row */
+	if (params->searching || !LGitHistoryModelLanes(params->model, item, &lanes)) {
+		return;
+	}
+	color = GetSysColor(selected ? COLOR_HIGHLIGHTTEXT : COLOR_WINDOWTEXT);
+	pen = CreatePen(PS_SOLID, 1, color);
+	brush = CreateSolidBrush(color);
+	saved = SaveDC(dc);
+	/* Lines to lanes past a narrowed column shouldn't draw over the next */
+	IntersectClipRect(dc, rc.left, rc.top, rc.right, rc.bottom);
+	old_pen = (HPEN)SelectObject(dc, pen);
+	old_brush = (HBRUSH)SelectObject(dc, brush);
+	mid = (rc.top + rc.bottom) / 2;
+	node_x = rc.left + (lanes.node * HISTORY_GRAPH_LANE_WIDTH) + (HISTORY_GRAPH_LANE_WIDTH / 2);
+	for (i = 0; i < LGIT_LANE_MAX; i++) {
+		bit = 1UL << i;
+		x = rc.left + (i * HISTORY_GRAPH_LANE_WIDTH) + (HISTORY_GRAPH_LANE_WIDTH / 2);
+		if (lanes.pass & bit) {
+			MoveToEx(dc, x, rc.top, NULL);
+			LineTo(dc, x, rc.bottom);
 		}
-
-		parents = (int)git_commit_parentcount(commit);
-
-		if (!whole_repo) {
-			int unmatched = parents;
-
-			if (parents == 0) {
-				git_tree *tree;
-				if (git_commit_tree(&tree, commit) != 0) {
-					LGitLibraryError(hwnd, "SccHistory git_commit_tree");
-					git_commit_free(commit);
-					return FALSE;
-				}
-				if (git_pathspec_match_tree(
-						NULL, tree, GIT_PATHSPEC_NO_MATCH_ERROR, ps) != 0)
-					unmatched = 1;
-				git_tree_free(tree);
-			} else if (parents == 1) {
-				unmatched = match_with_parent(hwnd, commit, 0, diffopts) ? 0 : 1;
-			} else {
-				for (i = 0; i < parents; ++i) {
-					if (match_with_parent(hwnd, commit, i, diffopts))
-						unmatched--;
-				}
-			}
-
-			if (unmatched > 0)
-				continue;
+		if (lanes.in & bit) {
+			MoveToEx(dc, x, rc.top, NULL);
+			LineTo(dc, node_x, mid);
 		}
+		if (lanes.out & bit) {
+			MoveToEx(dc, node_x, mid, NULL);
+			LineTo(dc, x, rc.bottom);
+		}
+	}
+	if (lanes.node < LGIT_LANE_MAX) {
+		radius = HISTORY_GRAPH_LANE_WIDTH / 4 + 1;
+		Ellipse(dc, node_x - radius, mid - radius, node_x + radius + 1, mid + radius + 1);
+	}
+	SelectObject(dc, old_brush);
+	SelectObject(dc, old_pen);
+	RestoreDC(dc, saved);
+	DeleteObject(brush);
+	DeleteObject(pen);
+}
 
-		UINT encoding = LGitGitToWindowsCodepage(git_commit_message_encoding(commit));
-
-		/* Actually insert */
-		oid_str = git_oid_tostr_s(&oid);
-		author = git_commit_author(commit);
-		committer = git_commit_committer(commit);
-		message = git_commit_message(commit);
-
-		/* Let's inform the dialog. May spam TextOut tho */
-		LGitProgressText(param->ctx, oid_str, 1);
-
-		ZeroMemory(&lvi, sizeof(LVITEM));
-		lvi.mask = LVIF_TEXT;
-		LGitUtf8ToWide(oid_str, formatted, 256);
-		lvi.pszText = formatted;
-		lvi.iItem = index++;
-		lvi.iSubItem = 0;
-
-		lvi.iItem = SendMessage(lv, LVM_INSERTITEMW, 0, (LPARAM)&lvi);
-		if (lvi.iItem == -1) {
-			LGitLog(" ! ListView_InsertItem failed for %s\n", oid_str);
-			continue;
+/* The graph column is drawn by us, the rest by the list view */
+static LRESULT HistoryCustomDraw(HWND hwnd, LGitHistoryDialogParams *params, NMLVCUSTOMDRAW *cd)
+{
+	switch (cd->nmcd.dwDrawStage) {
+	case CDDS_PREPAINT:
+		return params->path_count == 0 ? CDRF_NOTIFYITEMDRAW : CDRF_DODEFAULT;
+	case CDDS_ITEMPREPAINT:
+		return CDRF_NOTIFYSUBITEMDRAW;
+	case CDDS_ITEMPREPAINT | CDDS_SUBITEM:
+		if (cd->iSubItem != LGHM_COLUMN_GRAPH) {
+			return CDRF_DODEFAULT;
 		}
-		/* now for the subitems... */
-		lvi.iSubItem = 1;
-		LGitFormatSignatureW(author, formatted, 256);
-		SendMessage(lv, LVM_SETITEMW, 0, (LPARAM)&lvi);
-		
-		lvi.iSubItem = 2;
-		LGitTimeToStringW(&author->when, formatted, 256);
-		SendMessage(lv, LVM_SETITEMW, 0, (LPARAM)&lvi);
-		lvi.iSubItem = 3;
-		MultiByteToWideChar(encoding, 0, git_commit_summary(commit), -1, formatted, 256);
-		SendMessage(lv, LVM_SETITEMW, 0, (LPARAM)&lvi);
-	}
-	LGitProgressDeinit(param->ctx);
-	param->max_index = index;
-	/* Recalculate after adding because of scroll bars */
-	ListView_SetColumnWidth(lv, 3, LVSCW_AUTOSIZE_USEHEADER);
-	return TRUE;
+		DrawHistoryGraphCell(cd->nmcd.hdr.hwndFrom,
+			params,
+			cd->nmcd.hdc,
+			cd->nmcd.dwItemSpec);
+		return CDRF_SKIPDEFAULT;
+	}
+	return CDRF_DODEFAULT;
 }
 
-static void ShowSelectedCommitDiff(HWND hwnd, LGitHistoryDialogParams *params)
+static BOOL GetSelectedCommitOid(HWND hwnd, LGitHistoryDialogParams *params, git_oid *oid)
 {
 	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
 	if (lv == NULL) {
-		return;
+		return FALSE;
 	}
 	int selected = ListView_GetNextItem(lv, -1, LVNI_SELECTED);
 	if (selected == -1) {
-		return;
+		return FALSE;
 	}
-	/* get the OID as a string then convert */
-	char oid_s[80];
-	ListView_GetItemText(lv, selected, 0, oid_s, 80);
+	return LGitHistoryModelOid(params->model, HistoryItemToRow(params, selected), oid);
+}
+
+static void ShowSelectedCommitDiff(HWND hwnd, LGitHistoryDialogParams *params)
+{
 	git_oid oid;
-	if (git_oid_fromstr(&oid, oid_s) != 0) {
-		LGitLibraryError(hwnd, "git_oid_fromstr");
+	if (!GetSelectedCommitOid(hwnd, params, &oid)) {
 		return;
 	}
 	/* now try to find the parent to make a diff from */
@@ -294,19 +351,8 @@ static void ShowSelectedCommitDiff(HWND hwnd, LGitHistoryDialogParams *params)
 
 static void ShowSelectedCommitInfo(HWND hwnd, LGitHistoryDialogParams *params)
 {
-	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
-	if (lv == NULL) {
-		return;
-	}
-	int selected = ListView_GetNextItem(lv, -1, LVNI_SELECTED);
-	if (selected == -1) {
-		return;
-	}
-	char oid_s[80];
-	ListView_GetItemText(lv, selected, 0, oid_s, 80);
 	git_oid oid;
-	if (git_oid_fromstr(&oid, oid_s) != 0) {
-		LGitLibraryError(hwnd, "git_oid_fromstr");
+	if (!GetSelectedCommitOid(hwnd, params, &oid)) {
 		return;
 	}
 	git_commit *commit = NULL;
@@ -317,27 +363,60 @@ static void ShowSelectedCommitInfo(HWND hwnd, LGitHistoryDialogParams *params)
 	LGitViewCommitInfo(params->ctx, hwnd, commit, NULL);
 }
 
-static void CheckoutSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params)
+/* The file as of the selected commit; only when it's history for one file */
+static void AnnotateSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params)
 {
-	if (MessageBox(hwnd,
-		"Are you sure you want to check out this commit? It will detach the HEAD.",
-		"Checkout Commit?",
-		MB_ICONQUESTION | MB_YESNO) == IDNO) {
+	git_oid oid;
+	if (params->path_count != 1 || !GetSelectedCommitOid(hwnd, params, &oid)) {
 		return;
 	}
+	LGitAnnotate(params->ctx, hwnd, params->paths[0], &oid);
+}
+
+/* Every selected commit into one mbox, oldest first like format-patch */
+static void FormatPatchSelectedCommits(HWND hwnd, LGitHistoryDialogParams *params)
+{
 	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
-	if (lv == NULL) {
+	std::vector<git_oid> oids;
+	OPENFILENAMEW ofn;
+	wchar_t fileName[MAX_PATH];
+	git_oid oid;
+	int item = -1;
+	while ((item = ListView_GetNextItem(lv, item, LVNI_SELECTED)) != -1) {
+		if (LGitHistoryModelOid(params->model, HistoryItemToRow(params, item), &oid)) {
+			oids.push_back(oid);
+		}
+	}
+	if (oids.size() == 0) {
 		return;
 	}
-	int selected = ListView_GetNextItem(lv, -1, LVNI_SELECTED);
-	if (selected == -1) {
+	/* Listed newest first */
+	std::reverse(oids.begin(), oids.end());
+	ZeroMemory(&ofn, sizeof(ofn));
+	ZeroMemory(fileName, sizeof(fileName));
+	ofn.hwndOwner = hwnd;
+	ofn.lStructSize = sizeof(ofn);
+	ofn.lpstrFilter = L"Mailbox\0*.mbox;*.patch\0";
+	ofn.lpstrTitle = L"Save as Patches";
+	ofn.lpstrDefExt = L"mbox";
+	ofn.lpstrFile = fileName;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.Flags = OFN_EXPLORER | OFN_OVERWRITEPROMPT | OFN_HIDEREADONLY;
+	if (GetSaveFileNameW(&ofn)) {
+		LGitFormatPatches(params->ctx, hwnd, &oids[0], oids.size(), fileName);
+	}
+}
+
+static void CheckoutSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params)
+{
+	if (MessageBox(hwnd,
+		"Are you sure you want to check out this commit? It will detach the HEAD.",
+		"Checkout Commit?",
+		MB_ICONQUESTION | MB_YESNO) == IDNO) {
 		return;
 	}
-	char oid_s[80];
-	ListView_GetItemText(lv, selected, 0, oid_s, 80);
 	git_oid oid;
-	if (git_oid_fromstr(&oid, oid_s) != 0) {
-		LGitLibraryError(hwnd, "git_oid_fromstr");
+	if (!GetSelectedCommitOid(hwnd, params, &oid)) {
 		return;
 	}
 	if (LGitCheckoutTree(params->ctx, hwnd, &oid) == SCC_OK) {
@@ -348,19 +427,8 @@ static void CheckoutSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params)
 
 static void RevertSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params)
 {
-	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
-	if (lv == NULL) {
-		return;
-	}
-	int selected = ListView_GetNextItem(lv, -1, LVNI_SELECTED);
-	if (selected == -1) {
-		return;
-	}
-	char oid_s[80];
-	ListView_GetItemText(lv, selected, 0, oid_s, 80);
 	git_oid oid;
-	if (git_oid_fromstr(&oid, oid_s) != 0) {
-		LGitLibraryError(hwnd, "git_oid_fromstr");
+	if (!GetSelectedCommitOid(hwnd, params, &oid)) {
 		return;
 	}
 	if (LGitRevertCommit(params->ctx, hwnd, &oid) == SCC_OK) {
@@ -373,19 +441,8 @@ static void RevertSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params)
 /* This prob shouldn't be shown for the current branch... */
 static void CherryPickSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params)
 {
-	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
-	if (lv == NULL) {
-		return;
-	}
-	int selected = ListView_GetNextItem(lv, -1, LVNI_SELECTED);
-	if (selected == -1) {
-		return;
-	}
-	char oid_s[80];
-	ListView_GetItemText(lv, selected, 0, oid_s, 80);
 	git_oid oid;
-	if (git_oid_fromstr(&oid, oid_s) != 0) {
-		LGitLibraryError(hwnd, "git_oid_fromstr");
+	if (!GetSelectedCommitOid(hwnd, params, &oid)) {
 		return;
 	}
 	if (LGitCherryPickCommit(params->ctx, hwnd, &oid) == SCC_OK) {
@@ -397,19 +454,8 @@ static void CherryPickSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params)
 
 static void ResetSelectedCommit(HWND hwnd, LGitHistoryDialogParams *params, BOOL hard)
 {
-	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
-	if (lv == NULL) {
-		return;
-	}
-	int selected = ListView_GetNextItem(lv, -1, LVNI_SELECTED);
-	if (selected == -1) {
-		return;
-	}
-	char oid_s[80];
-	ListView_GetItemText(lv, selected, 0, oid_s, 80);
 	git_oid oid;
-	if (git_oid_fromstr(&oid, oid_s) != 0) {
-		LGitLibraryError(hwnd, "git_oid_fromstr");
+	if (!GetSelectedCommitOid(hwnd, params, &oid)) {
 		return;
 	}
 	if (LGitResetToCommit(params->ctx, hwnd, &oid, hard) == SCC_OK) {
@@ -423,8 +469,9 @@ static void UpdateHistoryMenu(HWND hwnd, LGitHistoryDialogParams *params)
 {
 	HWND lv = GetDlgItem(hwnd, IDC_COMMITHISTORY);
 	UINT selected = ListView_GetSelectedCount(lv);
+	/* Only saving patches works on more than one */
 	UINT newState = MF_BYCOMMAND
-		| (selected ? MF_ENABLED : MF_GRAYED);
+		| (selected == 1 ? MF_ENABLED : MF_GRAYED);
 #define EnableMenuItemIfCommitSelected(id) EnableMenuItem(params->menu,id,newState)
 	EnableMenuItemIfCommitSelected(ID_HISTORY_COMMIT_DIFF);
 	EnableMenuItemIfCommitSelected(ID_HISTORY_COMMIT_INFO);
@@ -432,6 +479,10 @@ static void UpdateHistoryMenu(HWND hwnd, LGitHistoryDialogParams *params)
 	EnableMenuItemIfCommitSelected(ID_HISTORY_COMMIT_REVERT);
 	EnableMenuItemIfCommitSelected(ID_HISTORY_COMMIT_RESET_HARD);
 	EnableMenuItemIfCommitSelected(ID_HISTORY_COMMIT_CHERRYPICK);
+	EnableMenuItem(params->menu, ID_HISTORY_COMMIT_ANNOTATE,
+		MF_BYCOMMAND | (selected == 1 && params->path_count == 1 ? MF_ENABLED : MF_GRAYED));
+	EnableMenuItem(params->menu, ID_HISTORY_COMMIT_FORMATPATCH,
+		MF_BYCOMMAND | (selected ? MF_ENABLED : MF_GRAYED));
 	if (params->is_head) {
 		/* it doesn't make sense to show for the branch you're on */
 		EnableMenuItem(params->menu, ID_HISTORY_COMMIT_CHERRYPICK, MF_BYCOMMAND | MF_GRAYED);
@@ -455,11 +506,21 @@ static BOOL CALLBACK HistoryDialogProc(HWND hwnd,
 		if (!FillHistoryListView(hwnd, param, param->path_count == 0)) {
 			EndDialog(hwnd, 0);
 		}
-		LGitControlFillsParentDialog(hwnd, IDC_COMMITHISTORY);
+		LayoutHistoryWindow(hwnd);
 		UpdateHistoryMenu(hwnd, param);
 		return TRUE;
 	case WM_SIZE:
-		LGitControlFillsParentDialog(hwnd, IDC_COMMITHISTORY);
+		LayoutHistoryWindow(hwnd);
+		return TRUE;
+	case WM_TIMER:
+		if (wParam == HISTORY_SEARCH_TIMER) {
+			KillTimer(hwnd, HISTORY_SEARCH_TIMER);
+			UpdateHistorySearch(hwnd, param, FALSE);
+			return TRUE;
+		}
+		return FALSE;
+	case WM_LGIT_HISTORY_ROWS:
+		HistoryRowsArrived(hwnd, param, wParam);
 		return TRUE;
 	case WM_CONTEXTMENU:
 		return LGitContextMenuFromSubmenu(hwnd, param->menu, 1, LOWORD(lParam), HIWORD(lParam));
@@ -471,6 +532,12 @@ static BOOL CALLBACK HistoryDialogProc(HWND hwnd,
 		case ID_HISTORY_COMMIT_INFO:
 			ShowSelectedCommitInfo(hwnd, param);
 			return TRUE;
+		case ID_HISTORY_COMMIT_ANNOTATE:
+			AnnotateSelectedCommit(hwnd, param);
+			return TRUE;
+		case ID_HISTORY_COMMIT_FORMATPATCH:
+			FormatPatchSelectedCommits(hwnd, param);
+			return TRUE;
 		case ID_HISTORY_COMMIT_CHECKOUT:
 			CheckoutSelectedCommit(hwnd, param);
 			return TRUE;
@@ -486,6 +553,12 @@ static BOOL CALLBACK HistoryDialogProc(HWND hwnd,
 		case ID_HISTORY_REFRESH:
 			FillHistoryListView(hwnd, param, param->path_count == 0);
 			return TRUE;
+		case IDC_HISTORY_SEARCH:
+			if (HIWORD(wParam) == EN_CHANGE) {
+				SetTimer(hwnd, HISTORY_SEARCH_TIMER, HISTORY_SEARCH_DELAY, NULL);
+				return TRUE;
+			}
+			return FALSE;
 		case ID_HISTORY_CLOSE:
 		case IDOK:
 		case IDCANCEL:
@@ -498,13 +571,31 @@ static BOOL CALLBACK HistoryDialogProc(HWND hwnd,
 		case IDC_COMMITHISTORY:
 			LPNMHDR child_msg = (LPNMHDR)lParam;
 			switch (child_msg->code) {
+			case LVN_GETDISPINFOW:
+				{
+					NMLVDISPINFOW *di = (NMLVDISPINFOW*)lParam;
+					if (di->item.mask & LVIF_TEXT) {
+						LGitHistoryModelText(param->model,
+							HistoryItemToRow(param, di->item.iItem),
+							di->item.iSubItem,
+							di->item.pszText,
+							di->item.cchTextMax);
+					}
+				}
+				return TRUE;
 			case LVN_ITEMACTIVATE:
 				/* XXX: Could use fields of NMITEMACTIVATE? */
 				ShowSelectedCommitInfo(hwnd, param);
 				return TRUE;
 			case LVN_ITEMCHANGED:
+			/* Shift-clicking a range in a virtual list only sends this */
+			case LVN_ODSTATECHANGED:
 				UpdateHistoryMenu(hwnd, param);
 				return TRUE;
+			case NM_CUSTOMDRAW:
+				SetWindowLong(hwnd, DWL_MSGRESULT,
+					HistoryCustomDraw(hwnd, param, (NMLVCUSTOMDRAW*)lParam));
+				return TRUE;
 			}
 		}
 		return FALSE;
@@ -523,8 +614,6 @@ static SCCRTN LGitHistoryInternal(LGitContext *ctx,
 
 	SCCRTN ret = SCC_OK;
 	git_diff_options diffopts;
-	git_pathspec *ps = NULL;
-	git_revwalk *walker = NULL;
 
 	LGitHistoryDialogParams params;
 	ZeroMemory(&params, sizeof(LGitHistoryDialogParams));
@@ -534,24 +623,10 @@ static SCCRTN LGitHistoryInternal(LGitContext *ctx,
 	if (paths != NULL) {
 		diffopts.pathspec.strings = paths->strings;
 		diffopts.pathspec.count	  = paths->count;
-		if (paths->count > 0) {
-			if (git_pathspec_new(&ps, &diffopts.pathspec) != 0) {
-				LGitLibraryError(hWnd, "SccHistory git_pathspec_new");
-				ret = SCC_E_NONSPECIFICERROR;
-				goto fin;
-			}
-		}
 		params.paths = paths->strings;
 		params.path_count = paths->count;
 	}
 
-	if (git_revwalk_new(&walker, ctx->repo) != 0) {
-		LGitLibraryError(hWnd, "SccHistory git_revwalk_new");
-		ret = SCC_E_NONSPECIFICERROR;
-		goto fin;
-	}
-	git_revwalk_sorting(walker, GIT_SORT_TIME);
-
 	/* are we using the HEAD? */
 	if (ref != NULL && strlen(ref) > 0) {
 		/* it's a branch because only those can be a HEAD */
@@ -568,10 +643,16 @@ static SCCRTN LGitHistoryInternal(LGitContext *ctx,
 		params.is_head = TRUE;
 	}
 
+	params.matches = new std::vector<LONG>();
+	params.model = LGitHistoryModelNew(ctx);
+	if (params.model == NULL) {
+		ret = SCC_E_NONSPECIFICERROR;
+		goto fin;
+	}
+
 	params.ctx = ctx;
-	params.walker = walker;
-	params.ps = ps;
 	params.diffopts = &diffopts;
+	params.pathspec = paths;
 	params.ref = ref;
 	params.menu = LoadMenu(ctx->dllInst, MAKEINTRESOURCE(IDR_HISTORY_MENU));
 	switch (DialogBoxParamW(ctx->dllInst,
@@ -589,12 +670,9 @@ static SCCRTN LGitHistoryInternal(LGitContext *ctx,
 	}
 fin:
 	DestroyMenu(params.menu);
-	if (ps != NULL) {
-		git_pathspec_free(ps);
-	}
-	if (walker != NULL) {
-		git_revwalk_free(walker);
-	}
+	/* Stops the walk if it's still going */
+	LGitHistoryModelFree(params.model);
+	delete params.matches;
 	if (params.changed) {
 		ret = SCC_I_RELOADFILE;
 	}
@@ -614,39 +692,33 @@ SCCRTN SccHistory (LPVOID context,
 {
 	LGitContext *ctx = (LGitContext*)context;
 
+	LGitOpTimer timer(context, "SccHistory", nFiles);
 	LGitLog("**SccHistory** Context=%p\n", context);
 	LGitLog("  files %d\n", nFiles);
 	LGitLog("  flags %x\n", dwFlags);
 
 	git_strarray strings;
 	ZeroMemory(&strings, sizeof(git_strarray));
+	LGitPathBatch batch;
+	ZeroMemory(&batch, sizeof(LGitPathBatch));
 	if (nFiles > 0) {
-		char **paths = NULL;
 		int i, path_count = 0;
-		paths = (char**)calloc(sizeof(char*), nFiles);
-		if (paths == NULL) {
+		if (!LGitNormalizePaths(ctx, nFiles, lpFileNames, &batch)) {
 			return SCC_E_NONSPECIFICERROR;
 		}
 		for (i = 0; i < nFiles; i++) {
-			char *path = LGitAnsiToUtf8Alloc(lpFileNames[i]);
-			const char *raw_path = LGitStripBasePath(ctx, path);
-			if (raw_path == NULL) {
-				LGitLog("    Couldn't get base path for %s\n", path);
-				free(path);
+			if (batch.paths[i] == NULL) {
+				LGitLog("    Couldn't get base path for %s\n", lpFileNames[i]);
 				continue;
 			}
-			/* Translate because libgit2 operates with forward slashes */
-			LGitTranslateStringChars(path, '\\', '/');
-			LGitLog("    %s\n", raw_path);
-			paths[path_count++] = (char*)raw_path;
+			LGitLog("    %s\n", batch.paths[i]);
+			batch.paths[path_count++] = batch.paths[i];
 		}
-		strings.strings = paths;
+		strings.strings = batch.paths;
 		strings.count = path_count;
 	}
 	SCCRTN ret = LGitHistoryInternal(ctx, hWnd, &strings, dwFlags, pvOptions, NULL);
-	if (strings.strings != NULL) {
-		LGitFreePathList(strings.strings, strings.count);
-	}
+	LGitFreePathBatch(ctx, &batch);
 	return ret;
 }
 
@@ -0,0 +1,617 @@
+/*
+ * Search index for the history window, so filtering by message or author
+ * doesn't have to look at every commit. Each commit's author and message
+ * (case-folded) is broken into trigrams, and each trigram has a list of the
+ * commits that have it. A query is every commit in all of its trigrams'
+ * lists, which only might match (the trigrams could be in different places),
+ * so those are checked against the folded text, which is kept in the index
+ * too; that way no commit has to be read to search.
+ *
+ * Commits are numbered in the order they're added, so the lists are sorted
+ * and can be stored as deltas. Commits are added as the history model walks
+ * them; the index is saved to .git/lgit/ so the next time only new commits
+ * need to be added. Like bloom.cpp, what's on disk is read as is, and what's
+ * added since is kept separately until it's written out.
+ */
+
+#include "stdafx.h"
+
+#define SEARCH_INDEX_MAGIC "LGSI"
+#define SEARCH_INDEX_VERSION 2
+
+/* Long messages are mostly trailers and quoted logs; the start is enough */
+#define SEARCH_MAX_TEXT 1024
+
+typedef struct _LGitSearchHeader {
+	char magic[4];
+	DWORD version;
+	DWORD doc_count;
+	DWORD trigram_count;
+	DWORD postings_len;
+	DWORD text_len;
+} LGitSearchHeader;
+
+/* Sorted by key on disk */
+typedef struct _LGitSearchTrigram {
+	DWORD key;
+	/* Where the list is in the postings */
+	DWORD offset;
+	DWORD len;
+	/* One past the last commit in the list, which deltas are from */
+	DWORD base;
+} LGitSearchTrigram;
+
+typedef struct _LGitSearchPostings {
+	std::string bytes;
+	DWORD base;
+} LGitSearchPostings;
+
+typedef struct _LGitSearchDoc {
+	git_oid oid;
+	DWORD doc;
+} LGitSearchDoc;
+
+typedef std::map<DWORD, LGitSearchPostings> LGitSearchAdded;
+
+struct _LGitSearchIndex {
+	/* The history window queries while the walk adds */
+	CRITICAL_SECTION lock;
+	wchar_t path[1024];
+	/* The whole file as it was read */
+	BYTE *file;
+	LGitSearchHeader *header;
+	git_oid *docs;
+	/* Where each commit's text ends; it starts where the last one's did */
+	DWORD *text_ends;
+	LGitSearchTrigram *trigrams;
+	BYTE *postings;
+	char *text;
+	/* Every commit, sorted by OID, for checking if it's in already */
+	std::vector<LGitSearchDoc> *by_oid;
+	/* Added since, unsorted, and their trigrams and text */
+	std::vector<git_oid> *added_docs;
+	std::set<std::string> *added_oids;
+	LGitSearchAdded *added;
+	std::string *added_text;
+	std::vector<DWORD> *added_text_ends;
+	/* How many of those have been written out */
+	size_t saved;
+	/* Statistics */
+	LONG queries;
+};
+
+static bool LGitSearchDocLess(const LGitSearchDoc &a, const LGitSearchDoc &b)
+{
+	return git_oid_cmp(&a.oid, &b.oid) < 0;
+}
+
+static bool LGitSearchOidLess(const git_oid &a, const git_oid &b)
+{
+	return git_oid_cmp(&a, &b) < 0;
+}
+
+static void LGitSearchPutVarint(std::string *out, DWORD value)
+{
+	while (value >= 0x80) {
+		*out += (char)((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	*out += (char)value;
+}
+
+/*
+ * Appends the list's commits to out; FALSE if it runs off the end. Deltas
+ * are from one past the last, starting at 0.
+ */
+static BOOL LGitSearchDecode(const BYTE *data, DWORD len, std::vector<DWORD> *out)
+{
+	DWORD i = 0, value, shift, base = 0;
+	while (i < len) {
+		value = 0;
+		shift = 0;
+		do {
+			if (i >= len || shift > 28) {
+				return FALSE;
+			}
+			value |= (DWORD)(data[i] & 0x7F) << shift;
+			shift += 7;
+		} while (data[i++] & 0x80);
+		out->push_back(base + value);
+		base += value + 1;
+	}
+	return TRUE;
+}
+
+/* Only ASCII is folded, so UTF-8 sequences are left alone */
+static void LGitSearchFold(std::string *text)
+{
+	size_t i;
+	for (i = 0; i < text->size(); i++) {
+		if ((*text)[i] >= 'A' && (*text)[i] <= 'Z') {
+			(*text)[i] += 'a' - 'A';
+		}
+	}
+}
+
+/* Sorted and unique; ones across fields (i.e. with a newline) are left out */
+static void LGitSearchTrigrams(const std::string &text, std::vector<DWORD> *keys)
+{
+	size_t i;
+	const BYTE *p = (const BYTE*)text.data();
+	for (i = 0; i + 2 < text.size(); i++) {
+		if (p[i] == '\n' || p[i + 1] == '\n' || p[i + 2] == '\n') {
+			continue;
+		}
+		keys->push_back((p[i] << 16) | (p[i + 1] << 8) | p[i + 2]);
+	}
+	std::sort(keys->begin(), keys->end());
+	keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+}
+
+static BOOL LGitSearchIndexLoad(LGitSearchIndex *index)
+{
+	HANDLE file;
+	DWORD size, read, i;
+	LGitSearchHeader *header;
+	LGitSearchDoc doc;
+	file = CreateFileW(index->path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return FALSE;
+	}
+	size = GetFileSize(file, NULL);
+	if (size == 0xFFFFFFFF || size < sizeof(LGitSearchHeader)) {
+		CloseHandle(file);
+		return FALSE;
+	}
+	index->file = (BYTE*)malloc(size);
+	if (index->file == NULL) {
+		CloseHandle(file);
+		return FALSE;
+	}
+	if (!ReadFile(file, index->file, size, &read, NULL) || read != size) {
+		goto err;
+	}
+	CloseHandle(file);
+	header = (LGitSearchHeader*)index->file;
+	if (memcmp(header->magic, SEARCH_INDEX_MAGIC, 4) != 0
+		|| header->version != SEARCH_INDEX_VERSION
+		|| header->doc_count > size / sizeof(git_oid)
+		|| header->trigram_count > size / sizeof(LGitSearchTrigram)
+		|| header->postings_len > size
+		|| header->text_len > size
+		|| sizeof(LGitSearchHeader)
+			+ (header->doc_count * (sizeof(git_oid) + sizeof(DWORD)))
+			+ (header->trigram_count * sizeof(LGitSearchTrigram))
+			+ header->postings_len
+			+ header->text_len != size) {
+		goto corrupt;
+	}
+	index->docs = (git_oid*)(index->file + sizeof(LGitSearchHeader));
+	index->text_ends = (DWORD*)(index->docs + header->doc_count);
+	index->trigrams = (LGitSearchTrigram*)(index->text_ends + header->doc_count);
+	index->postings = (BYTE*)(index->trigrams + header->trigram_count);
+	index->text = (char*)(index->postings + header->postings_len);
+	for (i = 0; i < header->doc_count; i++) {
+		if (index->text_ends[i] > header->text_len
+			|| (i > 0 && index->text_ends[i] < index->text_ends[i - 1])) {
+			goto corrupt;
+		}
+	}
+	for (i = 0; i < header->trigram_count; i++) {
+		if (index->trigrams[i].offset > header->postings_len
+			|| index->trigrams[i].len > header->postings_len - index->trigrams[i].offset
+			|| index->trigrams[i].base > header->doc_count
+			|| (i > 0 && index->trigrams[i].key <= index->trigrams[i - 1].key)) {
+			goto corrupt;
+		}
+	}
+	index->header = header;
+	index->by_oid->reserve(header->doc_count);
+	for (i = 0; i < header->doc_count; i++) {
+		git_oid_cpy(&doc.oid, &index->docs[i]);
+		doc.doc = i;
+		index->by_oid->push_back(doc);
+	}
+	std::sort(index->by_oid->begin(), index->by_oid->end(), LGitSearchDocLess);
+	return TRUE;
+corrupt:
+	LGitLog(" ! Search index is corrupt or too new, ignoring\n");
+	free(index->file);
+	index->file = NULL;
+	index->docs = NULL;
+	index->text_ends = NULL;
+	index->trigrams = NULL;
+	index->postings = NULL;
+	index->text = NULL;
+	return FALSE;
+err:
+	CloseHandle(file);
+	free(index->file);
+	index->file = NULL;
+	return FALSE;
+}
+
+LGitSearchIndex *LGitSearchIndexOpen(git_repository *repo)
+{
+	LGitSearchIndex *index;
+	DWORD begin = GetTickCount();
+	index = (LGitSearchIndex*)calloc(1, sizeof(LGitSearchIndex));
+	if (index == NULL) {
+		return NULL;
+	}
+	if (!LGitGetPrivateDir(repo, index->path, 1024)) {
+		free(index);
+		return NULL;
+	}
+	wcslcat(index->path, L"\\search", 1024);
+	InitializeCriticalSection(&index->lock);
+	index->by_oid = new std::vector<LGitSearchDoc>();
+	index->added_docs = new std::vector<git_oid>();
+	index->added_oids = new std::set<std::string>();
+	index->added = new LGitSearchAdded();
+	index->added_text = new std::string();
+	index->added_text_ends = new std::vector<DWORD>();
+	if (LGitSearchIndexLoad(index)) {
+		LGitLog(" ! Loaded search index, %d commits and %d trigrams in %u ms\n",
+			index->header->doc_count,
+			index->header->trigram_count,
+			GetTickCount() - begin);
+	}
+	return index;
+}
+
+/* Must be called with the lock held */
+static const LGitSearchTrigram *LGitSearchIndexFind(LGitSearchIndex *index, DWORD key)
+{
+	LONG low, high, mid;
+	if (index->header == NULL) {
+		return NULL;
+	}
+	low = 0;
+	high = (LONG)index->header->trigram_count - 1;
+	while (low <= high) {
+		mid = low + (high - low) / 2;
+		if (index->trigrams[mid].key == key) {
+			return &index->trigrams[mid];
+		} else if (index->trigrams[mid].key < key) {
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return NULL;
+}
+
+/* Merges what's been added with what was on disk */
+BOOL LGitSearchIndexSave(LGitSearchIndex *index)
+{
+	LGitSearchHeader header;
+	LGitSearchTrigram entry;
+	std::vector<LGitSearchTrigram> table;
+	std::vector<const std::string*> added_bytes;
+	LGitSearchAdded::iterator it;
+	DWORD old_count, old_text_len, i, offset, written, begin = GetTickCount();
+	wchar_t temp_path[1024];
+	HANDLE file;
+	BOOL ok = TRUE;
+
+	EnterCriticalSection(&index->lock);
+	if (index->added_docs->size() == index->saved) {
+		LeaveCriticalSection(&index->lock);
+		return TRUE;
+	}
+	/* Both are sorted by key, so the merged table is too */
+	old_count = index->header != NULL ? index->header->trigram_count : 0;
+	offset = 0;
+	it = index->added->begin();
+	i = 0;
+	while (i < old_count || it != index->added->end()) {
+		if (it == index->added->end()
+			|| (i < old_count && index->trigrams[i].key < it->first)) {
+			entry = index->trigrams[i];
+			added_bytes.push_back(NULL);
+			i++;
+		} else if (i < old_count && index->trigrams[i].key == it->first) {
+			entry = index->trigrams[i];
+			entry.len += it->second.bytes.size();
+			entry.base = it->second.base;
+			added_bytes.push_back(&it->second.bytes);
+			i++;
+			it++;
+		} else {
+			entry.key = it->first;
+			entry.offset = 0;
+			entry.len = it->second.bytes.size();
+			entry.base = it->second.base;
+			added_bytes.push_back(&it->second.bytes);
+			it++;
+		}
+		/* Offset is where it was in the old file until it's written */
+		table.push_back(entry);
+	}
+	memcpy(header.magic, SEARCH_INDEX_MAGIC, 4);
+	header.version = SEARCH_INDEX_VERSION;
+	header.doc_count = (index->header != NULL ? index->header->doc_count : 0)
+		+ index->added_docs->size();
+	header.trigram_count = table.size();
+	header.postings_len = 0;
+	for (i = 0; i < table.size(); i++) {
+		header.postings_len += table[i].len;
+	}
+	old_text_len = index->header != NULL ? index->header->text_len : 0;
+	header.text_len = old_text_len + index->added_text->size();
+
+	wcslcpy(temp_path, index->path, 1024);
+	wcslcat(temp_path, L".lock", 1024);
+	file = CreateFileW(temp_path, GENERIC_WRITE, 0, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		LeaveCriticalSection(&index->lock);
+		LGitLog("!! Can't write search index (GLE %x)\n", GetLastError());
+		return FALSE;
+	}
+#define WRITE_OR_FAIL(ptr, len) if (ok && (!WriteFile(file, ptr, len, &written, NULL) || written != len)) ok = FALSE
+	WRITE_OR_FAIL(&header, sizeof(header));
+	if (index->header != NULL) {
+		WRITE_OR_FAIL(index->docs, index->header->doc_count * sizeof(git_oid));
+	}
+	WRITE_OR_FAIL(&(*index->added_docs)[0], index->added_docs->size() * sizeof(git_oid));
+	if (index->header != NULL) {
+		WRITE_OR_FAIL(index->text_ends, index->header->doc_count * sizeof(DWORD));
+	}
+	/* Added text goes after what was on disk */
+	for (i = 0; ok && i < index->added_text_ends->size(); i++) {
+		offset = old_text_len + (*index->added_text_ends)[i];
+		WRITE_OR_FAIL(&offset, sizeof(DWORD));
+	}
+	offset = 0;
+	for (i = 0; ok && i < table.size(); i++) {
+		entry = table[i];
+		entry.offset = offset;
+		offset += entry.len;
+		WRITE_OR_FAIL(&entry, sizeof(entry));
+	}
+	/* Old part of each list, then what's been added to it */
+	for (i = 0; ok && i < table.size(); i++) {
+		DWORD old_len = table[i].len - (added_bytes[i] != NULL ? added_bytes[i]->size() : 0);
+		if (old_len > 0) {
+			WRITE_OR_FAIL(index->postings + table[i].offset, old_len);
+		}
+		if (added_bytes[i] != NULL) {
+			WRITE_OR_FAIL(added_bytes[i]->data(), added_bytes[i]->size());
+		}
+	}
+	if (old_text_len > 0) {
+		WRITE_OR_FAIL(index->text, old_text_len);
+	}
+	WRITE_OR_FAIL(index->added_text->data(), index->added_text->size());
+#undef WRITE_OR_FAIL
+	CloseHandle(file);
+	if (ok) {
+		/* What's in memory is still what was read plus what was added */
+		index->saved = index->added_docs->size();
+	}
+	LeaveCriticalSection(&index->lock);
+	if (!ok) {
+		LGitLog("!! Failed writing search index (GLE %x)\n", GetLastError());
+		DeleteFileW(temp_path);
+		return FALSE;
+	}
+	if (!MoveFileExW(temp_path, index->path, MOVEFILE_REPLACE_EXISTING)) {
+		/* 9x doesn't have MoveFileEx */
+		DeleteFileW(index->path);
+		if (!MoveFileW(temp_path, index->path)) {
+			DeleteFileW(temp_path);
+			return FALSE;
+		}
+	}
+	LGitLog(" ! Saved search index, %d commits and %d trigrams in %u ms\n",
+		header.doc_count,
+		header.trigram_count,
+		GetTickCount() - begin);
+	return TRUE;
+}
+
+/* Doesn't save; the history model does that when a walk finishes */
+void LGitSearchIndexClose(LGitSearchIndex *index)
+{
+	if (index == NULL) {
+		return;
+	}
+	LGitLog(" ! Search index: %d queries, %d commits added\n",
+		index->queries,
+		index->added_docs->size());
+	DeleteCriticalSection(&index->lock);
+	delete index->added_text_ends;
+	delete index->added_text;
+	delete index->added;
+	delete index->added_oids;
+	delete index->added_docs;
+	delete index->by_oid;
+	if (index->file != NULL) {
+		free(index->file);
+	}
+	free(index);
+}
+
+/* Must be called with the lock held */
+static BOOL LGitSearchIndexHasLocked(LGitSearchIndex *index, const git_oid *oid)
+{
+	LGitSearchDoc doc;
+	git_oid_cpy(&doc.oid, oid);
+	if (std::binary_search(index->by_oid->begin(), index->by_oid->end(), doc, LGitSearchDocLess)) {
+		return TRUE;
+	}
+	return index->added_oids->find(std::string((const char*)oid->id, GIT_OID_RAWSZ))
+		!= index->added_oids->end();
+}
+
+BOOL LGitSearchIndexHas(LGitSearchIndex *index, const git_oid *oid)
+{
+	BOOL ret;
+	EnterCriticalSection(&index->lock);
+	ret = LGitSearchIndexHasLocked(index, oid);
+	LeaveCriticalSection(&index->lock);
+	return ret;
+}
+
+/* Author, email and message, each on their own line, folded */
+static void LGitSearchCommitText(git_commit *commit, std::string *text)
+{
+	const git_signature *author = git_commit_author(commit);
+	const char *message = git_commit_message(commit);
+	size_t len;
+	*text = author->name;
+	*text += '\n';
+	*text += author->email;
+	*text += '\n';
+	if (message != NULL) {
+		len = strlen(message);
+		text->append(message, len > SEARCH_MAX_TEXT ? SEARCH_MAX_TEXT : len);
+	}
+	LGitSearchFold(text);
+}
+
+/* Adds the commit if it isn't in already */
+void LGitSearchIndexAdd(LGitSearchIndex *index, git_commit *commit)
+{
+	const git_oid *oid = git_commit_id(commit);
+	const LGitSearchTrigram *on_disk;
+	LGitSearchAdded::iterator it;
+	LGitSearchPostings postings;
+	std::vector<DWORD> keys;
+	std::string text;
+	DWORD doc;
+	size_t i;
+
+	/* Do the text work outside of the lock */
+	LGitSearchCommitText(commit, &text);
+	LGitSearchTrigrams(text, &keys);
+	EnterCriticalSection(&index->lock);
+	if (LGitSearchIndexHasLocked(index, oid)) {
+		LeaveCriticalSection(&index->lock);
+		return;
+	}
+	doc = (index->header != NULL ? index->header->doc_count : 0) + index->added_docs->size();
+	index->added_docs->push_back(*oid);
+	index->added_oids->insert(std::string((const char*)oid->id, GIT_OID_RAWSZ));
+	*index->added_text += text;
+	index->added_text_ends->push_back(index->added_text->size());
+	for (i = 0; i < keys.size(); i++) {
+		it = index->added->find(keys[i]);
+		if (it == index->added->end()) {
+			/* Continues the list on disk, if there is one */
+			on_disk = LGitSearchIndexFind(index, keys[i]);
+			postings.base = on_disk != NULL ? on_disk->base : 0;
+			it = index->added->insert(LGitSearchAdded::value_type(keys[i], postings)).first;
+		}
+		LGitSearchPutVarint(&it->second.bytes, doc - it->second.base);
+		it->second.base = doc + 1;
+	}
+	LeaveCriticalSection(&index->lock);
+}
+
+/* Must be called with the lock held */
+static BOOL LGitSearchIndexList(LGitSearchIndex *index, DWORD key, std::vector<DWORD> *docs)
+{
+	const LGitSearchTrigram *on_disk;
+	LGitSearchAdded::iterator it;
+	std::vector<DWORD> added;
+	DWORD start;
+	size_t i;
+	on_disk = LGitSearchIndexFind(index, key);
+	if (on_disk != NULL
+		&& !LGitSearchDecode(index->postings + on_disk->offset, on_disk->len, docs)) {
+		return FALSE;
+	}
+	it = index->added->find(key);
+	if (it != index->added->end()) {
+		if (!LGitSearchDecode((const BYTE*)it->second.bytes.data(),
+				it->second.bytes.size(), &added)) {
+			return FALSE;
+		}
+		/* Added lists carry on from the end of the one on disk */
+		start = on_disk != NULL ? on_disk->base : 0;
+		for (i = 0; i < added.size(); i++) {
+			docs->push_back(start + added[i]);
+		}
+	}
+	return TRUE;
+}
+
+/* Must be called with the lock held */
+static BOOL LGitSearchIndexDocMatches(LGitSearchIndex *index, DWORD doc, const std::string &folded)
+{
+	const char *text, *end;
+	DWORD disk_count = index->header != NULL ? index->header->doc_count : 0;
+	if (doc < disk_count) {
+		text = index->text + (doc > 0 ? index->text_ends[doc - 1] : 0);
+		end = index->text + index->text_ends[doc];
+	} else if (doc - disk_count < index->added_text_ends->size()) {
+		doc -= disk_count;
+		text = index->added_text->data() + (doc > 0 ? (*index->added_text_ends)[doc - 1] : 0);
+		end = index->added_text->data() + (*index->added_text_ends)[doc];
+	} else {
+		return FALSE;
+	}
+	return std::search(text, end, folded.begin(), folded.end()) != end;
+}
+
+/*
+ * Commits that match the query (UTF-8, any case; only ASCII is folded),
+ * sorted by OID. Returns FALSE if the query's too short to use the index.
+ */
+BOOL LGitSearchIndexQuery(LGitSearchIndex *index, const char *query, std::vector<git_oid> *oids)
+{
+	std::vector<DWORD> keys, result, list, merged;
+	std::string folded = query;
+	DWORD doc, disk_count;
+	size_t i;
+
+	LGitSearchFold(&folded);
+	LGitSearchTrigrams(folded, &keys);
+	if (keys.size() == 0) {
+		return FALSE;
+	}
+	EnterCriticalSection(&index->lock);
+	index->queries++;
+	disk_count = index->header != NULL ? index->header->doc_count : 0;
+	for (i = 0; i < keys.size(); i++) {
+		list.clear();
+		if (!LGitSearchIndexList(index, keys[i], &list)) {
+			LGitLog("!! Search index list for %x is corrupt\n", keys[i]);
+			result.clear();
+			break;
+		}
+		if (i == 0) {
+			result.swap(list);
+		} else {
+			merged.resize(result.size() < list.size() ? result.size() : list.size());
+			merged.erase(std::set_intersection(result.begin(), result.end(),
+					list.begin(), list.end(),
+					merged.begin()),
+				merged.end());
+			result.swap(merged);
+		}
+		if (result.size() == 0) {
+			break;
+		}
+	}
+	oids->clear();
+	oids->reserve(result.size());
+	for (i = 0; i < result.size(); i++) {
+		doc = result[i];
+		if (!LGitSearchIndexDocMatches(index, doc, folded)) {
+			continue;
+		}
+		if (doc < disk_count) {
+			oids->push_back(index->docs[doc]);
+		} else if (doc - disk_count < index->added_docs->size()) {
+			oids->push_back((*index->added_docs)[doc - disk_count]);
+		}
+	}
+	LeaveCriticalSection(&index->lock);
+	std::sort(oids->begin(), oids->end(), LGitSearchOidLess);
+	return TRUE;
+}
@@ -0,0 +1,148 @@
+/*
+ * Lane layout for the history graph. Commits go in one at a time in the
+ * order they're listed, newest first, and each comes out as a row: which
+ * lane its dot is in, and which lanes have lines through, into, or out of
+ * it. The only state kept is the frontier, what each lane is waiting for,
+ * so the cost of a commit is the width of the graph rather than how much
+ * history is above it, and rows are laid out as fast as the walk makes them.
+ *
+ * Lanes don't shift over when one ends; the hole is reused by the next lane
+ * that starts. That keeps every line that passes through a row vertical,
+ * which is most of them, and means a row never depends on what's below it.
+ */
+
+#include "stdafx.h"
+
+typedef struct _LGitLane {
+	/* The commit the lane is heading down to */
+	git_oid expect;
+	BOOL used;
+} LGitLane;
+
+struct _LGitLanes {
+	std::vector<LGitLane> *frontier;
+	/* Widest the frontier has been, for sizing the column */
+	LONG widest;
+};
+
+LGitLanes *LGitLanesNew(void)
+{
+	LGitLanes *lanes = (LGitLanes*)calloc(1, sizeof(LGitLanes));
+	if (lanes == NULL) {
+		return NULL;
+	}
+	lanes->frontier = new std::vector<LGitLane>();
+	return lanes;
+}
+
+void LGitLanesFree(LGitLanes *lanes)
+{
+	if (lanes == NULL) {
+		return;
+	}
+	delete lanes->frontier;
+	free(lanes);
+}
+
+static DWORD LGitLaneBit(size_t lane)
+{
+	return lane < LGIT_LANE_MAX ? 1UL << lane : 0;
+}
+
+/* The lowest free lane, growing the frontier if there isn't one */
+static size_t LGitLanesClaim(LGitLanes *lanes, const git_oid *expect)
+{
+	std::vector<LGitLane> *frontier = lanes->frontier;
+	LGitLane lane;
+	size_t i;
+	for (i = 0; i < frontier->size(); i++) {
+		if (!(*frontier)[i].used) {
+			break;
+		}
+	}
+	if (i == frontier->size()) {
+		ZeroMemory(&lane, sizeof(lane));
+		frontier->push_back(lane);
+		if ((LONG)frontier->size() > lanes->widest) {
+			lanes->widest = frontier->size();
+		}
+	}
+	git_oid_cpy(&(*frontier)[i].expect, expect);
+	(*frontier)[i].used = TRUE;
+	return i;
+}
+
+/* A lane already heading to the commit, other than skip, or -1 */
+static LONG LGitLanesFind(LGitLanes *lanes, const git_oid *oid, size_t skip)
+{
+	std::vector<LGitLane> *frontier = lanes->frontier;
+	size_t i;
+	for (i = 0; i < frontier->size(); i++) {
+		if (i != skip && (*frontier)[i].used && git_oid_equal(&(*frontier)[i].expect, oid)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Lays out the next commit. Parents that aren't going to be listed (i.e.
+ * cut off by a shallow clone) should be left out, or their lanes never end.
+ */
+void LGitLanesAdd(LGitLanes *lanes,
+				  const git_oid *oid,
+				  const git_oid *parents,
+				  int parent_count,
+				  LGitLaneRow *row)
+{
+	std::vector<LGitLane> *frontier = lanes->frontier;
+	size_t i, node = (size_t)-1;
+	LONG existing;
+	int p;
+
+	ZeroMemory(row, sizeof(LGitLaneRow));
+	/* Every lane waiting for this commit comes together at it */
+	for (i = 0; i < frontier->size(); i++) {
+		if (!(*frontier)[i].used) {
+			continue;
+		}
+		if (git_oid_equal(&(*frontier)[i].expect, oid)) {
+			row->in |= LGitLaneBit(i);
+			(*frontier)[i].used = FALSE;
+			if (node == (size_t)-1) {
+				node = i;
+			}
+		} else {
+			row->pass |= LGitLaneBit(i);
+		}
+	}
+	/* Nothing was waiting, so it's the tip of something */
+	if (node == (size_t)-1) {
+		node = LGitLanesClaim(lanes, oid);
+		(*frontier)[node].used = FALSE;
+	}
+	row->node = node;
+	/* The first parent carries on in this lane, so a branch stays straight */
+	if (parent_count > 0) {
+		git_oid_cpy(&(*frontier)[node].expect, &parents[0]);
+		(*frontier)[node].used = TRUE;
+		row->out |= LGitLaneBit(node);
+	}
+	/* Others join a lane already going there, or start their own */
+	for (p = 1; p < parent_count; p++) {
+		existing = LGitLanesFind(lanes, &parents[p], node);
+		if (existing == -1) {
+			existing = LGitLanesClaim(lanes, &parents[p]);
+		}
+		row->out |= LGitLaneBit(existing);
+	}
+	/* Don't keep dead lanes on the end around */
+	while (frontier->size() > 0 && !frontier->back().used) {
+		frontier->pop_back();
+	}
+}
+
+LONG LGitLanesWidest(LGitLanes *lanes)
+{
+	return lanes->widest;
+}
@@ -1,15 +1,15 @@
 #include "stdafx.h"
 
+/* By convention, "!!" marks errors; everything else is informational */
 void LGitLog(const char *format_str, ...)
 {
 	va_list va;
-	char msg[1024];
+	int level;
 
+	level = strncmp(format_str, "!!", 2) == 0 ? LGTL_ERROR : LGTL_INFO;
 	va_start(va, format_str);
-	_vsnprintf(msg, 1024, format_str, va);
+	LGitTraceV(level, format_str, va);
 	va_end(va);
-
-	OutputDebugString(msg);
 }
 
 void LGitLibraryError(HWND hWnd, LPCSTR title)
@@ -88,6 +88,7 @@ SCCRTN LGitMergeFastForward(LGitContext *ctx, HWND hwnd, const git_oid *target_o
 		goto fin;
 	}
 fin:
+	LGitStatusCacheInvalidate(ctx);
 	LGitFinishCheckoutNotify(ctx, hwnd, &ff_checkout_options);
 	if (target_ref != NULL) {
 		git_reference_free(target_ref);
@@ -138,6 +139,39 @@ SCCRTN LGitMergeNormal(LGitContext *ctx, HWND hwnd, const git_annotated_commit *
 	return SCC_OK;
 }
 
+/*
+ * Up to date and fast-forward only need a reachability check, which is cheap
+ * with a commit-graph. Returns FALSE if it's a real merge or there's no
+ * graph, so git_merge_analysis gets to decide.
+ */
+static BOOL LGitMergeQuickAnalysis(LGitContext *ctx,
+								   const git_annotated_commit *ann,
+								   git_merge_analysis_t *analysis)
+{
+	LGitCommitGraph *graph;
+	const git_oid *target_oid = git_annotated_commit_id(ann);
+	git_oid head_oid;
+	BOOL ret = FALSE;
+	if (git_reference_name_to_id(&head_oid, ctx->repo, "HEAD") != 0) {
+		/* Unborn branch */
+		return FALSE;
+	}
+	graph = LGitCommitGraphOpen(ctx->repo);
+	if (graph == NULL) {
+		return FALSE;
+	}
+	if (git_oid_equal(&head_oid, target_oid)
+		|| LGitDescendantOf(ctx->repo, graph, &head_oid, target_oid) == 1) {
+		*analysis = GIT_MERGE_ANALYSIS_UP_TO_DATE;
+		ret = TRUE;
+	} else if (LGitDescendantOf(ctx->repo, graph, target_oid, &head_oid) == 1) {
+		*analysis = (git_merge_analysis_t)(GIT_MERGE_ANALYSIS_FASTFORWARD | GIT_MERGE_ANALYSIS_NORMAL);
+		ret = TRUE;
+	}
+	LGitCommitGraphClose(graph);
+	return ret;
+}
+
 SCCRTN LGitMerge(LGitContext *ctx, HWND hwnd, const git_annotated_commit *ann)
 {
 	SCCRTN ret = SCC_OK;
@@ -158,7 +192,9 @@ SCCRTN LGitMerge(LGitContext *ctx, HWND hwnd, const git_annotated_commit *ann)
 		ret = SCC_E_UNKNOWNERROR;
 		goto fin;
 	}
-	if (git_merge_analysis(&merge_analysis,
+	merge_preference = GIT_MERGE_PREFERENCE_NONE;
+	if (!LGitMergeQuickAnalysis(ctx, ann, &merge_analysis)
+		&& git_merge_analysis(&merge_analysis,
 		&merge_preference,
 		ctx->repo,
 		&ann, 1) != 0) {
@@ -183,8 +219,9 @@ SCCRTN LGitMerge(LGitContext *ctx, HWND hwnd, const git_annotated_commit *ann)
 		LGitMergeNormal(ctx, hwnd, ann, merge_preference);
 	}
 	/* Check for conflicts now. */
-	if (git_repository_index(&index, ctx->repo) != 0) {
-		LGitLibraryError(hwnd, "git_merge_analysis");
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
+		LGitLibraryError(hwnd, "git_repository_index");
 		ret = SCC_E_UNKNOWNERROR;
 		goto fin;
 	}
@@ -195,9 +232,6 @@ SCCRTN LGitMerge(LGitContext *ctx, HWND hwnd, const git_annotated_commit *ann)
 		git_repository_state_cleanup(ctx->repo);
 	}
 fin:
-	if (index != NULL) {
-		git_index_free(index);
-	}
 	return ret;
 }
 
@@ -0,0 +1,330 @@
+/*
+ * Parallel status scan, for populating whole directories (i.e. opening a
+ * solution). A single status call stats and compares every file on one
+ * thread, and it's mostly waiting on the disk, so with enough files it's
+ * worth splitting the tree up and scanning the pieces at the same time.
+ *
+ * The pieces are the children of each directory asked for: each child
+ * directory is one, and the files directly in it are batched into others.
+ * Workers each open their own repository (libgit2 objects aren't safe to
+ * share) and take pieces until they run out. Results are merged and sorted
+ * by path, so the caller sees the same order a single scan would give.
+ */
+
+#include "stdafx.h"
+
+/* Below this many index entries, a single scan is fast enough */
+#define SCAN_PARALLEL_THRESHOLD 4096
+/* Pathspecs in a batch of plain files; matching them is linear */
+#define SCAN_FILES_PER_UNIT 256
+#define SCAN_MAX_THREADS 32
+
+typedef std::set<std::string, LGitPathLess> LGitScanPathSet;
+
+/* Literal paths; a directory matches everything under it */
+typedef struct _LGitScanUnit {
+	std::vector<std::string> paths;
+} LGitScanUnit;
+
+typedef struct _LGitScan {
+	char repo_path[1024];
+	const git_status_options *sopts;
+	std::vector<LGitScanUnit> *units;
+	volatile LONG next_unit;
+	volatile LONG failed;
+	char error[256];
+} LGitScan;
+
+typedef struct _LGitScanWorker {
+	LGitScan *scan;
+	HANDLE thread;
+	std::vector<LGitScanResult> *results;
+} LGitScanWorker;
+
+static volatile LONG scan_threads = 0;
+
+/* 0 for however many processors there are */
+void LGitSetScanThreads(DWORD threads)
+{
+	InterlockedExchange(&scan_threads, threads > SCAN_MAX_THREADS ? SCAN_MAX_THREADS : threads);
+}
+
+/* Also used for other background work that splits across threads */
+int LGitScanThreadCount(void)
+{
+	SYSTEM_INFO si;
+	if (scan_threads > 0) {
+		return scan_threads;
+	}
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors > SCAN_MAX_THREADS
+		? SCAN_MAX_THREADS
+		: si.dwNumberOfProcessors;
+}
+
+/* Children of prefix (empty, or ending in a slash), from the index and disk */
+static void LGitScanChildren(LGitContext *ctx,
+							 git_index *index,
+							 const char *prefix,
+							 LGitScanPathSet *dirs,
+							 LGitScanPathSet *files)
+{
+	size_t i, count, prefix_len = strlen(prefix);
+	const git_index_entry *entry;
+	const char *rest, *slash;
+	wchar_t search[2048];
+	char found[1024];
+	std::string path;
+	WIN32_FIND_DATAW fd;
+	HANDLE find;
+
+	/*
+	 * The index is sorted, so the prefix's entries are together. It folds
+	 * case itself if core.ignorecase is set.
+	 */
+	count = git_index_entrycount(index);
+	if (prefix_len == 0) {
+		i = 0;
+	} else if (git_index_find_prefix(&i, index, prefix) != 0) {
+		i = count;
+	}
+	for (; i < count; i++) {
+		entry = git_index_get_byindex(index, i);
+		if (entry == NULL || _strnicmp(entry->path, prefix, prefix_len) != 0) {
+			break;
+		}
+		rest = entry->path + prefix_len;
+		slash = strchr(rest, '/');
+		if (slash == NULL) {
+			files->insert(entry->path);
+		} else {
+			path.assign(entry->path, slash - entry->path);
+			dirs->insert(path);
+		}
+	}
+	/* Untracked things have to be found on disk */
+	wcslcpy(search, ctx->workdir_path_utf16, 2048);
+	LGitUtf8ToWide(prefix, search + wcslen(search), 2048 - wcslen(search));
+	LGitTranslateStringCharsW(search, L'/', L'\\');
+	wcslcat(search, L"*", 2048);
+	find = FindFirstFileW(search, &fd);
+	if (find == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	do {
+		if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0) {
+			continue;
+		}
+		if (prefix_len == 0 && _wcsicmp(fd.cFileName, L".git") == 0) {
+			continue;
+		}
+		LGitWideToUtf8(fd.cFileName, found, 1024);
+		path = prefix;
+		path += found;
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			dirs->insert(path);
+		} else {
+			files->insert(path);
+		}
+	} while (FindNextFileW(find, &fd));
+	FindClose(find);
+}
+
+static void LGitScanAddUnits(std::vector<LGitScanUnit> *units,
+							 LGitScanPathSet *dirs,
+							 LGitScanPathSet *files)
+{
+	LGitScanPathSet::iterator it;
+	LGitScanUnit unit;
+	for (it = dirs->begin(); it != dirs->end(); it++) {
+		unit.paths.clear();
+		unit.paths.push_back(*it);
+		units->push_back(unit);
+	}
+	unit.paths.clear();
+	for (it = files->begin(); it != files->end(); it++) {
+		unit.paths.push_back(*it);
+		if (unit.paths.size() == SCAN_FILES_PER_UNIT) {
+			units->push_back(unit);
+			unit.paths.clear();
+		}
+	}
+	if (unit.paths.size() > 0) {
+		units->push_back(unit);
+	}
+}
+
+static int LGitScanCollect(const char *path, unsigned int flags, void *payload)
+{
+	std::vector<LGitScanResult> *results = (std::vector<LGitScanResult>*)payload;
+	LGitScanResult result;
+	result.path = path;
+	result.flags = flags;
+	results->push_back(result);
+	return 0;
+}
+
+static unsigned __stdcall LGitScanWorkerThread(void *arg)
+{
+	LGitScanWorker *worker = (LGitScanWorker*)arg;
+	LGitScan *scan = worker->scan;
+	git_repository *repo = NULL;
+	git_status_options sopts;
+	std::vector<char*> pathspec;
+	LGitScanUnit *unit;
+	const git_error *err;
+	size_t i;
+	LONG next;
+
+	if (git_repository_open(&repo, scan->repo_path) != 0) {
+		goto fail;
+	}
+	for (;;) {
+		if (scan->failed) {
+			break;
+		}
+		next = InterlockedIncrement(&scan->next_unit) - 1;
+		if (next >= (LONG)scan->units->size()) {
+			break;
+		}
+		unit = &(*scan->units)[next];
+		pathspec.clear();
+		for (i = 0; i < unit->paths.size(); i++) {
+			pathspec.push_back((char*)unit->paths[i].c_str());
+		}
+		memcpy(&sopts, scan->sopts, sizeof(git_status_options));
+		sopts.pathspec.strings = &pathspec[0];
+		sopts.pathspec.count = pathspec.size();
+		/*
+		 * Names from disk could have glob characters in them, and literal
+		 * paths let libgit2 narrow what it iterates over to the prefix.
+		 */
+		sopts.flags |= GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH;
+		if (git_status_foreach_ext(repo, &sopts, LGitScanCollect, worker->results) != 0) {
+			goto fail;
+		}
+	}
+	git_repository_free(repo);
+	return 0;
+fail:
+	/* Errors are per thread, so keep the first one for the caller */
+	if (InterlockedExchange(&scan->failed, 1) == 0) {
+		err = git_error_last();
+		strlcpy(scan->error, err != NULL ? err->message : "Unknown error", 256);
+	}
+	if (repo != NULL) {
+		git_repository_free(repo);
+	}
+	return 1;
+}
+
+static bool LGitScanResultLess(const LGitScanResult &a, const LGitScanResult &b)
+{
+	return _stricmp(a.path.c_str(), b.path.c_str()) < 0;
+}
+
+static bool LGitScanResultSame(const LGitScanResult &a, const LGitScanResult &b)
+{
+	return _stricmp(a.path.c_str(), b.path.c_str()) == 0;
+}
+
+/*
+ * Runs status with sopts over the prefixes (relative, with forward slashes;
+ * none means the whole workdir) on several threads, returning results in
+ * path order. Returns FALSE if it wasn't worth it or didn't work, in which
+ * case the caller should do a normal scan.
+ */
+BOOL LGitParallelStatus(LGitContext *ctx,
+						const git_status_options *sopts,
+						const char **prefixes,
+						int prefix_count,
+						std::vector<LGitScanResult> *results)
+{
+	std::vector<LGitScanUnit> units;
+	LGitScanWorker workers[SCAN_MAX_THREADS];
+	LGitScanPathSet dirs, files;
+	std::string prefix;
+	git_index *index;
+	LGitScan scan;
+	int i, thread_count, started = 0;
+	unsigned thread_id;
+	size_t total = 0, before;
+	DWORD begin = GetTickCount();
+	BOOL ret = FALSE;
+
+	thread_count = LGitScanThreadCount();
+	index = LGitSessionIndex(ctx);
+	if (thread_count < 2 || index == NULL
+		|| git_index_entrycount(index) < SCAN_PARALLEL_THRESHOLD) {
+		return FALSE;
+	}
+	if (prefix_count == 0) {
+		LGitScanChildren(ctx, index, "", &dirs, &files);
+	}
+	for (i = 0; i < prefix_count; i++) {
+		prefix = prefixes[i];
+		if (prefix.size() > 0 && prefix[prefix.size() - 1] != '/') {
+			prefix += '/';
+		}
+		before = dirs.size() + files.size();
+		LGitScanChildren(ctx, index, prefix.c_str(), &dirs, &files);
+		/* Not a directory, or an empty one; let status decide what it is */
+		if (dirs.size() + files.size() == before && prefix.size() > 0) {
+			files.insert(prefix.substr(0, prefix.size() - 1));
+		}
+	}
+	LGitScanAddUnits(&units, &dirs, &files);
+	if (units.size() < 2) {
+		return FALSE;
+	}
+	if ((size_t)thread_count > units.size()) {
+		thread_count = units.size();
+	}
+
+	ZeroMemory(&scan, sizeof(scan));
+	strlcpy(scan.repo_path, git_repository_path(ctx->repo), 1024);
+	scan.sopts = sopts;
+	scan.units = &units;
+	for (i = 0; i < thread_count; i++) {
+		workers[i].scan = &scan;
+		workers[i].results = new std::vector<LGitScanResult>();
+		workers[i].thread = (HANDLE)_beginthreadex(NULL, 0, LGitScanWorkerThread, &workers[i], 0, &thread_id);
+		if (workers[i].thread == NULL) {
+			delete workers[i].results;
+			break;
+		}
+		started++;
+	}
+	if (started == 0) {
+		LGitLog("!! Couldn't start any scan workers\n");
+		return FALSE;
+	}
+	for (i = 0; i < started; i++) {
+		WaitForSingleObject(workers[i].thread, INFINITE);
+		CloseHandle(workers[i].thread);
+		total += workers[i].results->size();
+	}
+	if (scan.failed) {
+		LGitLog("!! Parallel scan failed (%s), falling back\n", scan.error);
+		goto fin;
+	}
+	results->reserve(total);
+	for (i = 0; i < started; i++) {
+		results->insert(results->end(), workers[i].results->begin(), workers[i].results->end());
+	}
+	std::sort(results->begin(), results->end(), LGitScanResultLess);
+	/* Nested prefixes can scan the same thing twice */
+	results->erase(std::unique(results->begin(), results->end(), LGitScanResultSame),
+		results->end());
+	ret = TRUE;
+	LGitLog(" ! Parallel scan: %d units on %d threads, %u entries, %u ms\n",
+		units.size(),
+		started,
+		total,
+		GetTickCount() - begin);
+fin:
+	for (i = 0; i < started; i++) {
+		delete workers[i].results;
+	}
+	return ret;
+}
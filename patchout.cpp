@@ -0,0 +1,465 @@
+/*
+ * Patch export. Patches are written as libgit2 prints them, a line at a
+ * time, through a buffer to a file or the clipboard, so a diff is never
+ * held as one big patch on top of itself. Commits from the history go out
+ * as an mbox series like git format-patch makes, one commit at a time, so
+ * memory stays at about one commit's diff no matter how many there are.
+ */
+
+#include "stdafx.h"
+
+#define PATCH_BUFFER_SIZE 0x10000
+
+struct _LGitPatchWriter {
+	/* Written to when the buffer fills; INVALID_HANDLE_VALUE is clipboard */
+	HANDLE file;
+	HWND owner;
+	/* Clipboard text so far, as UTF-16; the clipboard takes it in the end */
+	HGLOBAL text;
+	size_t text_len, text_cap;
+	char *buf;
+	size_t used;
+	BOOL failed;
+	/* Statistics */
+	ULONGLONG written;
+	DWORD begin;
+};
+
+static LGitPatchWriter *LGitPatchWriterNew(void)
+{
+	LGitPatchWriter *writer = (LGitPatchWriter*)calloc(1, sizeof(LGitPatchWriter));
+	if (writer == NULL) {
+		return NULL;
+	}
+	writer->buf = (char*)malloc(PATCH_BUFFER_SIZE);
+	if (writer->buf == NULL) {
+		free(writer);
+		return NULL;
+	}
+	writer->file = INVALID_HANDLE_VALUE;
+	writer->begin = GetTickCount();
+	return writer;
+}
+
+LGitPatchWriter *LGitPatchWriterOpenFile(const wchar_t *path)
+{
+	LGitPatchWriter *writer = LGitPatchWriterNew();
+	if (writer == NULL) {
+		return NULL;
+	}
+	/* Binary, since patches are LF, not CRLF */
+	writer->file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (writer->file == INVALID_HANDLE_VALUE) {
+		free(writer->buf);
+		free(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+/* Put on the clipboard when closed, owned by the window given */
+LGitPatchWriter *LGitPatchWriterOpenClipboard(HWND owner)
+{
+	LGitPatchWriter *writer = LGitPatchWriterNew();
+	if (writer == NULL) {
+		return NULL;
+	}
+	writer->owner = owner;
+	writer->text_cap = PATCH_BUFFER_SIZE;
+	writer->text = GlobalAlloc(GMEM_MOVEABLE, writer->text_cap * sizeof(wchar_t));
+	if (writer->text == NULL) {
+		free(writer->buf);
+		free(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+/* How much of the buffer ends on a whole UTF-8 character */
+static size_t LGitUtf8Whole(const char *buf, size_t len)
+{
+	size_t lead = len, need;
+	BYTE c;
+	while (lead > 0 && len - lead < 4 && ((BYTE)buf[lead - 1] & 0xC0) == 0x80) {
+		lead--;
+	}
+	if (lead == 0) {
+		return len;
+	}
+	c = (BYTE)buf[lead - 1];
+	if (c < 0xC0) {
+		return len;
+	}
+	need = c >= 0xF0 ? 4 : (c >= 0xE0 ? 3 : 2);
+	return len - (lead - 1) >= need ? len : lead - 1;
+}
+
+static BOOL LGitPatchWriterAppendText(LGitPatchWriter *writer, const char *buf, size_t len)
+{
+	HGLOBAL new_text;
+	wchar_t *text;
+	size_t new_cap;
+	int converted;
+	/* UTF-16 never has more units than UTF-8 has bytes; +1 for the NUL */
+	if (writer->text_len + len + 1 > writer->text_cap) {
+		new_cap = writer->text_cap * 2;
+		while (writer->text_len + len + 1 > new_cap) {
+			new_cap *= 2;
+		}
+		new_text = GlobalReAlloc(writer->text, new_cap * sizeof(wchar_t), GMEM_MOVEABLE);
+		if (new_text == NULL) {
+			return FALSE;
+		}
+		writer->text = new_text;
+		writer->text_cap = new_cap;
+	}
+	text = (wchar_t*)GlobalLock(writer->text);
+	if (text == NULL) {
+		return FALSE;
+	}
+	converted = len == 0 ? 0 : MultiByteToWideChar(CP_UTF8, 0, buf, len,
+		text + writer->text_len, writer->text_cap - writer->text_len - 1);
+	if (converted > 0 || len == 0) {
+		writer->text_len += converted;
+	}
+	text[writer->text_len] = L'\0';
+	GlobalUnlock(writer->text);
+	return len == 0 || converted > 0;
+}
+
+static BOOL LGitPatchWriterFlush(LGitPatchWriter *writer)
+{
+	DWORD written;
+	size_t whole;
+	if (writer->failed || writer->used == 0) {
+		return !writer->failed;
+	}
+	if (writer->file != INVALID_HANDLE_VALUE) {
+		if (!WriteFile(writer->file, writer->buf, writer->used, &written, NULL)
+			|| written != writer->used) {
+			writer->failed = TRUE;
+			return FALSE;
+		}
+		writer->used = 0;
+		return TRUE;
+	}
+	/* A character cut off at the end waits for the rest of it */
+	whole = LGitUtf8Whole(writer->buf, writer->used);
+	if (!LGitPatchWriterAppendText(writer, writer->buf, whole)) {
+		writer->failed = TRUE;
+		return FALSE;
+	}
+	memmove(writer->buf, writer->buf + whole, writer->used - whole);
+	writer->used -= whole;
+	return TRUE;
+}
+
+BOOL LGitPatchWriterWrite(LGitPatchWriter *writer, const char *buf, size_t len)
+{
+	size_t chunk;
+	while (len > 0 && !writer->failed) {
+		if (writer->used == PATCH_BUFFER_SIZE && !LGitPatchWriterFlush(writer)) {
+			break;
+		}
+		chunk = PATCH_BUFFER_SIZE - writer->used;
+		if (chunk > len) {
+			chunk = len;
+		}
+		memcpy(writer->buf + writer->used, buf, chunk);
+		writer->used += chunk;
+		writer->written += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+	return !writer->failed;
+}
+
+static BOOL LGitPatchWriterString(LGitPatchWriter *writer, const char *str)
+{
+	return LGitPatchWriterWrite(writer, str, strlen(str));
+}
+
+/* Flushes and closes, or puts it on the clipboard; FALSE if any of it failed */
+BOOL LGitPatchWriterClose(LGitPatchWriter *writer)
+{
+	BOOL ok;
+	if (writer == NULL) {
+		return FALSE;
+	}
+	ok = LGitPatchWriterFlush(writer);
+	if (writer->file != INVALID_HANDLE_VALUE) {
+		CloseHandle(writer->file);
+	} else if (!ok) {
+		LGitLog("!! Patch not put on clipboard\n");
+	} else if (OpenClipboard(writer->owner)) {
+		EmptyClipboard();
+		/* The clipboard owns it if this works */
+		if (SetClipboardData(CF_UNICODETEXT, writer->text) != NULL) {
+			writer->text = NULL;
+		} else {
+			LGitLog("!! Couldn't set clipboard\n");
+			ok = FALSE;
+		}
+		CloseClipboard();
+	} else {
+		LGitLog("!! Couldn't open clipboard\n");
+		ok = FALSE;
+	}
+	if (writer->text != NULL) {
+		GlobalFree(writer->text);
+	}
+	LGitLog(" ! Patch: %I64u bytes in %u ms%s\n",
+		writer->written,
+		GetTickCount() - writer->begin,
+		ok ? "" : " (failed)");
+	free(writer->buf);
+	free(writer);
+	return ok;
+}
+
+static int LGitPatchWriterLineCallback(const git_diff_delta *delta,
+									   const git_diff_hunk *hunk,
+									   const git_diff_line *line,
+									   void *payload)
+{
+	LGitPatchWriter *writer = (LGitPatchWriter*)payload;
+	char origin;
+	/* Content lines leave the prefix to us, like git_diff_to_buf adds it */
+	switch (line->origin) {
+	case GIT_DIFF_LINE_ADDITION:
+	case GIT_DIFF_LINE_DELETION:
+	case GIT_DIFF_LINE_CONTEXT:
+		origin = line->origin;
+		LGitPatchWriterWrite(writer, &origin, 1);
+		break;
+	}
+	if (!LGitPatchWriterWrite(writer, line->content, line->content_len)) {
+		return GIT_EUSER;
+	}
+	return 0;
+}
+
+/* Returns a libgit2 error code; GIT_EUSER if writing failed */
+int LGitPatchWriterDiff(LGitPatchWriter *writer, git_diff *diff)
+{
+	int rc = git_diff_print(diff, GIT_DIFF_FORMAT_PATCH, LGitPatchWriterLineCallback, writer);
+	/* Don't put half a patch on the clipboard */
+	if (rc != 0) {
+		writer->failed = TRUE;
+	}
+	return rc;
+}
+
+/* RFC 2822, in the author's own time zone */
+static void LGitFormatEmailDate(const git_time *when, char *buf, size_t bufsz)
+{
+	static const char *days[] = {
+		"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+	};
+	static const char *months[] = {
+		"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+		"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+	time_t t = (time_t)(when->time + (when->offset * 60));
+	struct tm *tm = gmtime(&t);
+	int offset = when->offset < 0 ? -when->offset : when->offset;
+	if (tm == NULL) {
+		strlcpy(buf, "Thu, 1 Jan 1970 00:00:00 +0000", bufsz);
+		return;
+	}
+	_snprintf(buf, bufsz, "%s, %d %s %d %02d:%02d:%02d %c%02d%02d",
+		days[tm->tm_wday],
+		tm->tm_mday,
+		months[tm->tm_mon],
+		tm->tm_year + 1900,
+		tm->tm_hour,
+		tm->tm_min,
+		tm->tm_sec,
+		when->offset < 0 ? '-' : '+',
+		offset / 60,
+		offset % 60);
+	buf[bufsz - 1] = '\0';
+}
+
+/* One commit of the series, as a message like git format-patch's */
+static int LGitFormatPatch(LGitContext *ctx,
+						   LGitPatchWriter *writer,
+						   git_commit *commit,
+						   size_t number,
+						   size_t total)
+{
+	git_commit *parent = NULL;
+	git_tree *tree = NULL, *parent_tree = NULL;
+	git_diff *diff = NULL;
+	git_diff_stats *stats = NULL;
+	git_buf stats_buf = {0, 0};
+	const git_signature *author = git_commit_author(commit);
+	const char *summary, *body;
+	char line[1024], date[64];
+	int rc;
+
+	if ((rc = git_commit_tree(&tree, commit)) != 0) {
+		goto fin;
+	}
+	if (git_commit_parentcount(commit) > 0) {
+		if ((rc = git_commit_parent(&parent, commit, 0)) != 0
+			|| (rc = git_commit_tree(&parent_tree, parent)) != 0) {
+			goto fin;
+		}
+	}
+	if ((rc = git_diff_tree_to_tree(&diff, ctx->repo, parent_tree, tree, NULL)) != 0) {
+		goto fin;
+	}
+	if (LGitFindRenames(diff, FALSE, NULL) != 0) {
+		LGitLog(" ! Rename detection failed, writing as adds and deletes\n");
+	}
+	/* The mbox separator always has this date; it's what git uses */
+	_snprintf(line, sizeof(line), "From %s Mon Sep 17 00:00:00 2001\n",
+		git_oid_tostr_s(git_commit_id(commit)));
+	line[sizeof(line) - 1] = '\0';
+	LGitPatchWriterString(writer, line);
+	_snprintf(line, sizeof(line), "From: %s <%s>\n", author->name, author->email);
+	line[sizeof(line) - 1] = '\0';
+	LGitPatchWriterString(writer, line);
+	LGitFormatEmailDate(&author->when, date, sizeof(date));
+	_snprintf(line, sizeof(line), "Date: %s\n", date);
+	line[sizeof(line) - 1] = '\0';
+	LGitPatchWriterString(writer, line);
+	if (total > 1) {
+		_snprintf(line, sizeof(line), "Subject: [PATCH %u/%u] ", number, total);
+		line[sizeof(line) - 1] = '\0';
+		LGitPatchWriterString(writer, line);
+	} else {
+		LGitPatchWriterString(writer, "Subject: [PATCH] ");
+	}
+	summary = git_commit_summary(commit);
+	LGitPatchWriterString(writer, summary != NULL ? summary : "");
+	LGitPatchWriterString(writer, "\n\n");
+	body = git_commit_body(commit);
+	if (body != NULL && body[0] != '\0') {
+		LGitPatchWriterString(writer, body);
+		if (body[strlen(body) - 1] != '\n') {
+			LGitPatchWriterString(writer, "\n");
+		}
+	}
+	LGitPatchWriterString(writer, "---\n");
+	if ((rc = git_diff_get_stats(&stats, diff)) != 0
+		|| (rc = git_diff_stats_to_buf(&stats_buf,
+			stats,
+			(git_diff_stats_format_t)(GIT_DIFF_STATS_FULL | GIT_DIFF_STATS_INCLUDE_SUMMARY),
+			72)) != 0) {
+		goto fin;
+	}
+	LGitPatchWriterWrite(writer, stats_buf.ptr, stats_buf.size);
+	LGitPatchWriterString(writer, "\n");
+	if ((rc = LGitPatchWriterDiff(writer, diff)) != 0) {
+		goto fin;
+	}
+	rc = LGitPatchWriterString(writer, "-- \nVisual Git\n\n") ? 0 : GIT_EUSER;
+fin:
+	git_buf_dispose(&stats_buf);
+	if (stats != NULL) {
+		git_diff_stats_free(stats);
+	}
+	if (diff != NULL) {
+		git_diff_free(diff);
+	}
+	if (tree != NULL) {
+		git_tree_free(tree);
+	}
+	if (parent_tree != NULL) {
+		git_tree_free(parent_tree);
+	}
+	if (parent != NULL) {
+		git_commit_free(parent);
+	}
+	return rc;
+}
+
+/*
+ * Writes the commits, oldest first, to one mbox file. Merges are left out,
+ * like git format-patch does, since they don't have one diff to give.
+ */
+SCCRTN LGitFormatPatches(LGitContext *ctx,
+						 HWND hwnd,
+						 const git_oid *oids,
+						 size_t count,
+						 const wchar_t *file_name)
+{
+	LGitPatchWriter *writer = NULL;
+	git_commit *commit = NULL;
+	std::vector<git_oid> series;
+	const char *failed_call = NULL;
+	char msg[128];
+	size_t i;
+	int rc;
+	SCCRTN ret = SCC_OK;
+
+	LGitLog("**LGitFormatPatches** Context=%p\n", ctx);
+	LGitLog("  count %u\n", count);
+	for (i = 0; i < count; i++) {
+		if (git_commit_lookup(&commit, ctx->repo, &oids[i]) != 0) {
+			LGitLibraryError(hwnd, "git_commit_lookup");
+			return SCC_E_NONSPECIFICERROR;
+		}
+		if (git_commit_parentcount(commit) <= 1) {
+			series.push_back(oids[i]);
+		}
+		git_commit_free(commit);
+		commit = NULL;
+	}
+	if (series.size() == 0) {
+		MessageBox(hwnd,
+			"The selected commits are all merges, which can't be made into patches.",
+			"Save as Patches",
+			MB_ICONWARNING | MB_OK);
+		return SCC_I_OPERATIONCANCELED;
+	}
+	writer = LGitPatchWriterOpenFile(file_name);
+	if (writer == NULL) {
+		LGitLog("!! Couldn't open patch file\n");
+		MessageBox(hwnd, "The patch file couldn't be opened.", "Save as Patches", MB_ICONERROR | MB_OK);
+		return SCC_E_NONSPECIFICERROR;
+	}
+	LGitProgressInit(ctx, "Saving Patches", 0);
+	LGitProgressStart(ctx, hwnd, TRUE);
+	for (i = 0; i < series.size(); i++) {
+		if (LGitProgressCancelled(ctx)) {
+			ret = SCC_I_OPERATIONCANCELED;
+			break;
+		}
+		_snprintf(msg, 128, "Commit %u of %u", i + 1, series.size());
+		LGitProgressText(ctx, msg, 1);
+		LGitProgressSet(ctx, i, series.size());
+		if (git_commit_lookup(&commit, ctx->repo, &series[i]) != 0) {
+			failed_call = "git_commit_lookup";
+			ret = SCC_E_NONSPECIFICERROR;
+			break;
+		}
+		rc = LGitFormatPatch(ctx, writer, commit, i + 1, series.size());
+		git_commit_free(commit);
+		/* Write failures are reported when it's closed */
+		if (rc == GIT_EUSER) {
+			break;
+		} else if (rc != 0) {
+			failed_call = "Formatting patch";
+			ret = SCC_E_NONSPECIFICERROR;
+			break;
+		}
+	}
+	LGitProgressDeinit(ctx);
+	if (failed_call != NULL) {
+		LGitLibraryError(hwnd, failed_call);
+	}
+	if (!LGitPatchWriterClose(writer) && ret == SCC_OK) {
+		MessageBox(hwnd, "The patches couldn't be written.", "Save as Patches", MB_ICONERROR | MB_OK);
+		ret = SCC_E_NONSPECIFICERROR;
+	}
+	/* git am would apply what's there, so don't leave part of a series */
+	if (ret != SCC_OK) {
+		LGitLog(" ! Removing incomplete patch file\n");
+		DeleteFileW(file_name);
+	}
+	return ret;
+}
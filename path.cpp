@@ -35,27 +35,254 @@ LGIT_API void LGitTranslateStringCharsW(wchar_t *buf, int char1, int char2)
 
 const char *LGitStripBasePath(LGitContext *ctx, const char *abs)
 {
+	size_t len;
 	if (abs == NULL || ctx == NULL || strlen(ctx->workdir_path) < 1) {
 		return NULL;
 	}
-	char path[_MAX_PATH];
-	/* strip trailing backslash, then accomodate if we need to bump later */
-	strlcpy(path, ctx->workdir_path, _MAX_PATH);
-	char *last_backslash = strrchr(path, '\\');
-	if (last_backslash != NULL && last_backslash[1] == '\0') {
-		last_backslash[0] = '\0';
+	/* ignore the trailing backslash, then accomodate if we need to bump later */
+	len = strlen(ctx->workdir_path);
+	if (ctx->workdir_path[len - 1] == '\\') {
+		len--;
 	}
-	const char *begin = strcasestr(abs, path);
-	if (begin != abs) {
+	if (_strnicmp(abs, ctx->workdir_path, len) != 0) {
 		return NULL;
 	}
-	abs += strlen(path);
+	abs += len;
+	/* Not C:\repo2 for C:\repo */
 	if (abs[0] == '\\') {
 		abs++;
+	} else if (abs[0] != '\0') {
+		return NULL;
 	}
 	return abs;
 }
 
+/*
+ * Path normalization, for the IDE's absolute paths (ANSI, backslashes) to the
+ * ones libgit2 wants (UTF-8, relative to the workdir, forward slashes). Every
+ * entry point does this for every file, so it's done in one pass over the
+ * path against a prefix prepared when the project is opened, without having
+ * to go through UTF-16 or the heap for the usual all-ASCII path.
+ */
+
+/* Only ASCII, like _stricmp in the C locale; UTF-8 sequences are untouched */
+#define LGitFoldChar(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+
+void LGitPreparePathPrefix(LGitContext *ctx)
+{
+	size_t i, len = strlen(ctx->workdir_path);
+	if (len > 0 && ctx->workdir_path[len - 1] == '\\') {
+		len--;
+	}
+	for (i = 0; i < len; i++) {
+		ctx->workdir_fold[i] = LGitFoldChar(ctx->workdir_path[i]);
+	}
+	ctx->workdir_fold[len] = '\0';
+	ctx->workdir_len = len;
+}
+
+/* Strips and translates an already UTF-8 path; see LGitNormalizePath */
+static int LGitNormalizeUtf8Path(LGitContext *ctx, const char *utf8, char *buf, size_t bufsz)
+{
+	const unsigned char *in = (const unsigned char*)utf8;
+	size_t i, out = 0;
+	for (i = 0; i < ctx->workdir_len; i++) {
+		if (LGitFoldChar(in[i]) != (unsigned char)ctx->workdir_fold[i]) {
+			return -1;
+		}
+	}
+	if (in[i] == '\\') {
+		i++;
+	} else if (in[i] != '\0') {
+		return -1;
+	}
+	for (; in[i] != '\0'; i++) {
+		if (out + 1 >= bufsz) {
+			return -1;
+		}
+		buf[out++] = in[i] == '\\' ? '/' : in[i];
+	}
+	buf[out] = '\0';
+	return out;
+}
+
+/*
+ * Converts an absolute ANSI path to a relative UTF-8 one with forward
+ * slashes into buf, returning its length, or -1 if it's outside of the
+ * workdir or doesn't fit. The workdir itself is an empty string.
+ */
+int LGitNormalizePath(LGitContext *ctx, const char *ansi, char *buf, size_t bufsz)
+{
+	const unsigned char *in = (const unsigned char*)ansi;
+	wchar_t wide[2048];
+	char utf8[2048 * 3];
+	size_t i, out = 0;
+
+	if (ansi == NULL || ctx == NULL || bufsz == 0) {
+		return -1;
+	}
+	if (ctx->workdir_len == 0) {
+		if (ctx->workdir_path[0] == '\0') {
+			return -1;
+		}
+		LGitPreparePathPrefix(ctx);
+	}
+	/*
+	 * ASCII is the same in every ANSI codepage and UTF-8 (DBCS trail bytes
+	 * that look like a backslash can only follow a non-ASCII lead byte), so
+	 * only leave the fast path once we see something that isn't.
+	 */
+	for (i = 0; i < ctx->workdir_len; i++) {
+		if (in[i] >= 0x80) {
+			goto convert;
+		}
+		if (LGitFoldChar(in[i]) != (unsigned char)ctx->workdir_fold[i]) {
+			return -1;
+		}
+	}
+	if (in[i] == '\\') {
+		i++;
+	} else if (in[i] != '\0') {
+		return -1;
+	}
+	for (; in[i] != '\0'; i++) {
+		if (in[i] >= 0x80) {
+			goto convert;
+		}
+		if (out + 1 >= bufsz) {
+			return -1;
+		}
+		buf[out++] = in[i] == '\\' ? '/' : in[i];
+	}
+	buf[out] = '\0';
+	return out;
+convert:
+	/* Still no heap, but it has to take the long way through UTF-16 */
+	if (MultiByteToWideChar(CP_ACP, 0, ansi, -1, wide, 2048) == 0) {
+		return -1;
+	}
+	if (LGitWideToUtf8(wide, utf8, 2048 * 3) == 0) {
+		return -1;
+	}
+	return LGitNormalizeUtf8Path(ctx, utf8, buf, bufsz);
+}
+
+/*
+ * Normalizes a whole batch of paths at once, for when they need to be kept
+ * around (i.e. for a pathspec). They all live in one block, which is reused
+ * from call to call, so a batch doesn't allocate once it's been warmed up.
+ * Paths outside the workdir are NULL. Free with LGitFreePathBatch.
+ */
+BOOL LGitNormalizePaths(LGitContext *ctx, LONG nFiles, LPCSTR *lpFileNames, LGitPathBatch *batch)
+{
+	size_t needed, used, room;
+	DWORD begin = GetTickCount();
+	LONG i;
+	int len;
+
+	ZeroMemory(batch, sizeof(LGitPathBatch));
+	/* At worst, an ANSI byte becomes three bytes of UTF-8 */
+	needed = nFiles * sizeof(char*);
+	for (i = 0; i < nFiles; i++) {
+		needed += strlen(lpFileNames[i]) * 3 + 1;
+	}
+	if (!ctx->pathScratch.busy && ctx->pathScratch.block != NULL
+		&& ctx->pathScratch.size >= needed) {
+		batch->block = ctx->pathScratch.block;
+		batch->shared = TRUE;
+	} else if (!ctx->pathScratch.busy) {
+		/* Grow the shared block, rather than allocate for just this batch */
+		if (ctx->pathScratch.block != NULL) {
+			free(ctx->pathScratch.block);
+		}
+		ctx->pathScratch.block = (char*)malloc(needed > 0 ? needed : 1);
+		ctx->pathScratch.size = ctx->pathScratch.block != NULL ? needed : 0;
+		batch->block = ctx->pathScratch.block;
+		batch->shared = TRUE;
+	} else {
+		/* Nested somehow; fine, just don't share */
+		batch->block = (char*)malloc(needed > 0 ? needed : 1);
+	}
+	if (batch->block == NULL) {
+		return FALSE;
+	}
+	if (batch->shared) {
+		ctx->pathScratch.busy = TRUE;
+	}
+	batch->paths = (char**)batch->block;
+	used = nFiles * sizeof(char*);
+	for (i = 0; i < nFiles; i++) {
+		room = strlen(lpFileNames[i]) * 3 + 1;
+		len = LGitNormalizePath(ctx, lpFileNames[i], batch->block + used, room);
+		if (len < 0) {
+			batch->paths[i] = NULL;
+			continue;
+		}
+		batch->paths[i] = batch->block + used;
+		used += len + 1;
+	}
+	batch->count = nFiles;
+	if (nFiles >= 1000) {
+		LGitLog(" ! Normalized %d paths in %u ms\n", nFiles, GetTickCount() - begin);
+	}
+	return TRUE;
+}
+
+void LGitFreePathBatch(LGitContext *ctx, LGitPathBatch *batch)
+{
+	if (batch->block == NULL) {
+		return;
+	}
+	if (batch->shared) {
+		ctx->pathScratch.busy = FALSE;
+	} else {
+		free(batch->block);
+	}
+	ZeroMemory(batch, sizeof(LGitPathBatch));
+}
+
+void LGitFreePathScratch(LGitContext *ctx)
+{
+	if (ctx->pathScratch.block != NULL) {
+		free(ctx->pathScratch.block);
+	}
+	ZeroMemory(&ctx->pathScratch, sizeof(ctx->pathScratch));
+}
+
+/* Returns our directory under .git, creating it if needed */
+BOOL LGitGetPrivateDir(git_repository *repo, wchar_t *buf, size_t bufsz)
+{
+	char path[1024];
+	strlcpy(path, git_repository_path(repo), 1024);
+	strlcat(path, "lgit", 1024);
+	if (LGitUtf8ToWide(path, buf, bufsz) == 0) {
+		return FALSE;
+	}
+	LGitTranslateStringCharsW(buf, L'/', L'\\');
+	if (!CreateDirectoryW(buf, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Compares a file's stat data against what was recorded, updating it. A
+ * missing file compares as all zeroes, so it being created counts.
+ */
+BOOL LGitFileStatChanged(const wchar_t *path, WIN32_FILE_ATTRIBUTE_DATA *attr)
+{
+	WIN32_FILE_ATTRIBUTE_DATA now;
+	ZeroMemory(&now, sizeof(now));
+	GetFileAttributesExW(path, GetFileExInfoStandard, &now);
+	if (CompareFileTime(&now.ftLastWriteTime, &attr->ftLastWriteTime) == 0
+		&& now.nFileSizeLow == attr->nFileSizeLow
+		&& now.nFileSizeHigh == attr->nFileSizeHigh) {
+		return FALSE;
+	}
+	memcpy(attr, &now, sizeof(now));
+	return TRUE;
+}
+
 const wchar_t *LGitStripBasePathW(LGitContext *ctx, const wchar_t *abs)
 {
 	if (abs == NULL || ctx == NULL || strlen(ctx->workdir_path) < 1) {
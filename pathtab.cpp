@@ -0,0 +1,232 @@
+/*
+ * Interned paths, so per-file state (fake checkouts, batch lookups) can be
+ * kept in flat arrays indexed by a small integer instead of sets of strings.
+ * A path is hashed once when it's interned or looked up, and whatever's
+ * keyed by its ID after that doesn't need to hash or compare strings.
+ *
+ * Paths are compared without case, since Windows paths are case-insensitive;
+ * the first spelling seen is the one kept. IDs are stable for the life of
+ * the project and start at 1; 0 is never a path. This isn't locked, so only
+ * use it from the thread the IDE calls in.
+ */
+
+#include "stdafx.h"
+
+/* Strings are packed in blocks this big, unless they're bigger */
+#define PATH_BLOCK_SIZE 0x10000
+#define PATH_INITIAL_SLOTS 1024
+
+typedef struct _LGitPathTableEntry {
+	const char *path;
+	size_t length;
+	DWORD hash;
+} LGitPathTableEntry;
+
+struct _LGitPathTable {
+	/* By ID; the first is a placeholder for 0 */
+	std::vector<LGitPathTableEntry> *entries;
+	/* Open addressing with linear probing; IDs, or 0 if empty */
+	std::vector<LONG> *slots;
+	size_t mask;
+	/* Where the strings live; never moved, so pointers stay good */
+	std::vector<char*> *blocks;
+	size_t block_used, block_size;
+};
+
+/* FNV-1a, over the folded path */
+static DWORD LGitHashPath(const char *path, size_t *length)
+{
+	DWORD hash = 2166136261UL;
+	size_t i;
+	char c;
+	for (i = 0; path[i] != '\0'; i++) {
+		c = path[i];
+		if (c >= 'A' && c <= 'Z') {
+			c += 'a' - 'A';
+		}
+		hash ^= (BYTE)c;
+		hash *= 16777619UL;
+	}
+	*length = i;
+	return hash;
+}
+
+void LGitPathTableInit(LGitContext *ctx)
+{
+	LGitPathTable *table = (LGitPathTable*)calloc(1, sizeof(LGitPathTable));
+	LGitPathTableEntry placeholder;
+	if (table == NULL) {
+		return;
+	}
+	ZeroMemory(&placeholder, sizeof(placeholder));
+	table->entries = new std::vector<LGitPathTableEntry>();
+	table->entries->push_back(placeholder);
+	table->slots = new std::vector<LONG>(PATH_INITIAL_SLOTS, 0);
+	table->mask = PATH_INITIAL_SLOTS - 1;
+	table->blocks = new std::vector<char*>();
+	ctx->pathTable = table;
+}
+
+void LGitPathTableFree(LGitContext *ctx)
+{
+	LGitPathTable *table = ctx->pathTable;
+	size_t i;
+	if (table == NULL) {
+		return;
+	}
+	LGitLog(" ! Path table: %d paths in %d blocks\n",
+		table->entries->size() - 1,
+		table->blocks->size());
+	for (i = 0; i < table->blocks->size(); i++) {
+		free((*table->blocks)[i]);
+	}
+	delete table->blocks;
+	delete table->slots;
+	delete table->entries;
+	free(table);
+	ctx->pathTable = NULL;
+}
+
+/* Slot the path is in, or the empty one it would go in */
+static size_t LGitPathTableProbe(LGitPathTable *table,
+								 const char *path,
+								 size_t length,
+								 DWORD hash)
+{
+	size_t slot = hash & table->mask;
+	LONG id;
+	LGitPathTableEntry *entry;
+	for (;;) {
+		id = (*table->slots)[slot];
+		if (id == 0) {
+			return slot;
+		}
+		entry = &(*table->entries)[id];
+		if (entry->hash == hash
+			&& entry->length == length
+			&& _strnicmp(entry->path, path, length) == 0) {
+			return slot;
+		}
+		slot = (slot + 1) & table->mask;
+	}
+}
+
+/* Keeps the table at most half full, so probes stay short */
+static void LGitPathTableGrow(LGitPathTable *table)
+{
+	size_t i, size = table->slots->size() * 2, slot;
+	LGitPathTableEntry *entry;
+	table->slots->assign(size, 0);
+	table->mask = size - 1;
+	for (i = 1; i < table->entries->size(); i++) {
+		entry = &(*table->entries)[i];
+		slot = entry->hash & table->mask;
+		while ((*table->slots)[slot] != 0) {
+			slot = (slot + 1) & table->mask;
+		}
+		(*table->slots)[slot] = i;
+	}
+}
+
+static char *LGitPathTableCopy(LGitPathTable *table, const char *path, size_t length)
+{
+	char *block, *copy;
+	size_t size;
+	if (table->blocks->size() == 0 || table->block_used + length + 1 > table->block_size) {
+		size = length + 1 > PATH_BLOCK_SIZE ? length + 1 : PATH_BLOCK_SIZE;
+		block = (char*)malloc(size);
+		if (block == NULL) {
+			return NULL;
+		}
+		table->blocks->push_back(block);
+		table->block_used = 0;
+		table->block_size = size;
+	}
+	copy = table->blocks->back() + table->block_used;
+	memcpy(copy, path, length + 1);
+	table->block_used += length + 1;
+	return copy;
+}
+
+/* Relative with forward slashes; the ID for a path, 0 if it's never been seen */
+LONG LGitFindPath(LGitContext *ctx, const char *path)
+{
+	LGitPathTable *table = ctx->pathTable;
+	size_t length;
+	DWORD hash;
+	if (table == NULL || path == NULL) {
+		return 0;
+	}
+	hash = LGitHashPath(path, &length);
+	return (*table->slots)[LGitPathTableProbe(table, path, length, hash)];
+}
+
+/* Like LGitFindPath, but adds it if it's new; 0 if out of memory */
+LONG LGitInternPath(LGitContext *ctx, const char *path)
+{
+	LGitPathTable *table = ctx->pathTable;
+	LGitPathTableEntry entry;
+	size_t length, slot;
+	DWORD hash;
+	LONG id;
+	if (table == NULL || path == NULL) {
+		return 0;
+	}
+	hash = LGitHashPath(path, &length);
+	slot = LGitPathTableProbe(table, path, length, hash);
+	id = (*table->slots)[slot];
+	if (id != 0) {
+		return id;
+	}
+	entry.path = LGitPathTableCopy(table, path, length);
+	if (entry.path == NULL) {
+		return 0;
+	}
+	entry.length = length;
+	entry.hash = hash;
+	id = table->entries->size();
+	table->entries->push_back(entry);
+	(*table->slots)[slot] = id;
+	if ((size_t)id * 2 > table->slots->size()) {
+		LGitPathTableGrow(table);
+	}
+	return id;
+}
+
+/* The path as first interned, or NULL */
+const char *LGitPathFromId(LGitContext *ctx, LONG id)
+{
+	LGitPathTable *table = ctx->pathTable;
+	if (table == NULL || id <= 0 || (size_t)id >= table->entries->size()) {
+		return NULL;
+	}
+	return (*table->entries)[id].path;
+}
+
+/* Flat bitsets of path IDs */
+
+void LGitPathBitsSet(LGitPathBits *bits, LONG id)
+{
+	size_t word = id / 32;
+	if (word >= bits->size()) {
+		bits->resize(word + 1, 0);
+	}
+	(*bits)[word] |= 1UL << (id % 32);
+}
+
+void LGitPathBitsClear(LGitPathBits *bits, LONG id)
+{
+	size_t word = id / 32;
+	if (word < bits->size()) {
+		(*bits)[word] &= ~(1UL << (id % 32));
+	}
+}
+
+BOOL LGitPathBitsTest(const LGitPathBits *bits, LONG id)
+{
+	size_t word = id / 32;
+	if (id <= 0 || word >= bits->size()) {
+		return FALSE;
+	}
+	return ((*bits)[word] & (1UL << (id % 32))) != 0;
+}
@@ -104,6 +104,7 @@ init_again:
 	 */
 	LGitTranslateStringChars(ctx->workdir_path, '/', '\\');
 	LGitUtf8ToWide(ctx->workdir_path, ctx->workdir_path_utf16, 1024);
+	LGitPreparePathPrefix(ctx);
 	LGitLog("  The workdir is %s\n", ctx->workdir_path);
 
 	ctx->active = TRUE;
@@ -113,7 +114,13 @@ init_again:
 	LGitLog(" ! New proj name is %s\n", lpProjName);
 
 	/* XXX: should init/deinit at project level? */
-	ctx->checkouts = new CheckoutQueue();
+	LGitPathTableInit(ctx);
+	ctx->checkouts = new LGitPathBits();
+	LGitStatusCacheInit(ctx);
+	LGitSessionInit(ctx);
+	LGitDirIndexInit(ctx);
+	LGitEventsInit(ctx);
+	LGitUpstreamInit(ctx);
 	
 	LGitInitializeFonts(ctx);
 
@@ -160,6 +167,26 @@ SCCRTN SccCloseProject (LPVOID context)
 		LGitContext *ctx = (LGitContext*)context;
 		/* additional debug logs because VS traps segfault */
 		LGitUninitializeFonts(ctx);
+		if (ctx->graphWriter) {
+			LGitLog(" ! Stop commit-graph writer\n");
+			LGitCommitGraphStopUpdate(ctx);
+		}
+		if (ctx->upstream) {
+			LGitLog(" ! Free upstream changes\n");
+			LGitUpstreamFree(ctx);
+		}
+		if (ctx->events) {
+			LGitLog(" ! Stop event watcher\n");
+			LGitEventsFree(ctx);
+		}
+		if (ctx->dirIndex) {
+			LGitLog(" ! Free directory index\n");
+			LGitDirIndexFree(ctx);
+		}
+		if (ctx->session) {
+			LGitLog(" ! Free session\n");
+			LGitSessionFree(ctx);
+		}
 		if (ctx->repo) {
 			LGitLog(" ! Free repo\n");
 			git_repository_free(ctx->repo);
@@ -170,12 +197,23 @@ SCCRTN SccCloseProject (LPVOID context)
 			delete ctx->checkouts;
 			ctx->checkouts = NULL;
 		}
+		if (ctx->pathTable) {
+			LGitLog(" ! Free path table\n");
+			LGitPathTableFree(ctx);
+		}
+		if (ctx->statusCache) {
+			LGitLog(" ! Free status cache\n");
+			LGitStatusCacheFree(ctx);
+		}
 		ctx->renameCb = NULL;
 		ctx->renameData = NULL;
 		ctx->textoutCb = NULL;
 		ZeroMemory(ctx->path, 1024);
 		ZeroMemory(ctx->workdir_path, 1024);
 		ZeroMemory(ctx->workdir_path_utf16, 1024 * sizeof(wchar_t));
+		ZeroMemory(ctx->workdir_fold, 1024);
+		ctx->workdir_len = 0;
+		LGitFreePathScratch(ctx);
 		ctx->active = FALSE;
 		LGitLog(" ! Cleared, now inactive\n");
 	}
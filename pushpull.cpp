@@ -59,6 +59,7 @@ fin:
 SCCRTN LGitPull(LGitContext *ctx, HWND hwnd, git_remote *remote, LGitPullStrategy strategy)
 {
 	SCCRTN ret = SCC_OK;
+	LGitOpTimer timer(ctx, "LGitPull", 0);
 	LGitLog("**LGitPull** Context=%p\n", ctx);
 	if (remote == NULL) {
 		LGitLog("!! Remote is null\n");
@@ -87,6 +88,10 @@ SCCRTN LGitPull(LGitContext *ctx, HWND hwnd, git_remote *remote, LGitPullStrateg
 	if (fetch_opts.callbacks.payload != NULL) {
 		free(fetch_opts.callbacks.payload);
 	}
+	/* New commits from the remote; catch the graph up with them */
+	LGitCommitGraphUpdate(ctx);
+	/* And work out what they changed now, rather than on the next query */
+	LGitUpstreamRefresh(ctx);
 	if (strategy == LGPS_FETCH) {
 		goto fin;
 	}
@@ -203,6 +208,7 @@ fin:
 SCCRTN LGitPush(LGitContext *ctx, HWND hwnd, git_remote *remote, git_reference *ref)
 {
 	SCCRTN ret = SCC_OK;
+	LGitOpTimer timer(ctx, "LGitPush", 0);
 	LGitLog("**LGitPush** Context=%p\n", ctx);
 	if (remote == NULL) {
 		LGitLog("!! Remote is null\n");
@@ -4,8 +4,10 @@
 
 #include "stdafx.h"
 
+/* fileName is only for logging; id is its interned path, or 0 */
 static long LGitConvertFlags(LGitContext *ctx,
 							 const char *fileName,
+							 LONG id,
 							 unsigned int flags)
 {
 	/*
@@ -44,8 +46,8 @@ static long LGitConvertFlags(LGitContext *ctx,
 		sccFlags |= SCC_STATUS_DELETED;
 	}
 	/* Append fake checkout marker, since VB6 and VS.NET want to see them */
-	if (LGitIsCheckout(ctx, fileName)) {
-		LGitLog(" ! Fake checkout flag for %s\n", fileName);
+	if (LGitIsCheckoutId(ctx, id)) {
+		LGitLogDebug(" ! Fake checkout flag for %s\n", fileName);
 		sccFlags |= SCC_STATUS_OUTBYUSER;
 		sccFlags |= SCC_STATUS_CHECKEDOUT;
 		/* Little marker so we now it's not really modified */
@@ -130,15 +132,21 @@ static int LGitStatusCallback(const char *relative_path,
 							  void *context)
 {
 	LGitStatusCallbackParams *params = (LGitStatusCallbackParams*)context;
-	long sccFlags = LGitConvertFlags(params->ctx, relative_path, flags);
-	LGitLog(" ! Entry \"%s\" (%x -> %x)\n", relative_path, flags, sccFlags);
+	/* Not interned means it can't have been checked out */
+	LONG id = LGitFindPath(params->ctx, relative_path);
+	long sccFlags = LGitConvertFlags(params->ctx, relative_path, id, flags);
+	/* Later file queries for the same paths can skip the scan */
+	LGitStatusCacheStore(params->ctx, relative_path, 0, flags);
+	/* The IDE knows about it now, so tell it when it changes */
+	LGitEventsWatch(params->ctx, relative_path, 0, flags);
+	LGitLogDebug(" ! Entry \"%s\" (%x -> %x)\n", relative_path, flags, sccFlags);
 	/* Merge for absolute path */
 	char path[2048];
 	strlcpy(path, params->ctx->workdir_path, 2048);
 	strlcat(path, relative_path, 2048);
 	LGitTranslateStringChars(path, '/', '\\');
 
-	LGitLog(" ! Pushing absolute path \"%s\"", path);
+	LGitLogDebug(" ! Pushing absolute path \"%s\"", path);
 	LGitCallPopulateAction(params->nCommand,
 		path,
 		flags,
@@ -156,37 +164,33 @@ static SCCRTN LGitPopulateDirs (LPVOID context,
 								LPVOID pvCallerData)
 {
 	LGitContext *ctx = (LGitContext*)context;
-	char **paths = NULL;
+	LGitPathBatch batch;
 
 	git_status_options sopts;
 	LGitStatusCallbackParams cbp;
+	std::vector<LGitScanResult> results;
+	std::vector<LGitScanResult>::iterator it;
 
 	git_status_options_init(&sopts, GIT_STATUS_OPTIONS_VERSION);
+	ZeroMemory(&batch, sizeof(LGitPathBatch));
 
 	/* If there's filenames, generate a pathspec, otherwise all files. */
 	if (nFiles > 0) {
 		LGitLog(" ! Populating directories\n");
-		paths = (char**)calloc(sizeof(char*), nFiles);
-		if (paths == NULL) {
+		if (!LGitNormalizePaths(ctx, nFiles, lpFileNames, &batch)) {
 			return SCC_E_NONSPECIFICERROR;
 		}
 		int i, path_count;
-		const char *raw_path;
 		path_count = 0;
 		for (i = 0; i < nFiles; i++) {
-			char *path;
-			raw_path = LGitStripBasePath(ctx, lpFileNames[i]);
-			if (raw_path == NULL) {
+			if (batch.paths[i] == NULL) {
 				LGitLog("    Couldn't get base path for dir %s\n", lpFileNames[i]);
 				continue;
 			}
-			/* Translate because libgit2 operates with forward slashes */
-			path = strdup(raw_path);
-			LGitTranslateStringChars(path, '\\', '/');
-			LGitLog("    Dir %s\n", path);
-			paths[path_count++] = path;
+			LGitLogDebug("    Dir %s\n", batch.paths[i]);
+			batch.paths[path_count++] = batch.paths[i];
 		}
-		sopts.pathspec.strings = paths;
+		sopts.pathspec.strings = batch.paths;
 		sopts.pathspec.count = path_count;
 	} else {
 		LGitLog(" ! Populating repo root\n");
@@ -207,12 +211,19 @@ static SCCRTN LGitPopulateDirs (LPVOID context,
 	cbp.nCommand = nCommand;
 	cbp.pfnPopulate = pfnPopulate;
 	cbp.pvCallerData = pvCallerData;
-	git_status_foreach_ext(ctx->repo, &sopts, LGitStatusCallback, &cbp);
+	LGitStatusCacheValidate(ctx);
+	/* Big trees are split over threads, then fed back in path order */
+	if (LGitParallelStatus(ctx, &sopts, (const char**)sopts.pathspec.strings,
+		sopts.pathspec.count, &results)) {
+		for (it = results.begin(); it != results.end(); it++) {
+			LGitStatusCallback(it->path.c_str(), it->flags, &cbp);
+		}
+	} else {
+		git_status_foreach_ext(ctx->repo, &sopts, LGitStatusCallback, &cbp);
+	}
 	LGitLog(" ! Done enumerating\n");
 
-	if (paths != NULL) {
-		free(paths);
-	}
+	LGitFreePathBatch(ctx, &batch);
 	return SCC_OK;
 }
 
@@ -225,47 +236,53 @@ static SCCRTN LGitPopulateFiles(LPVOID context,
 								LPLONG lpStatus)
 {
 	LGitContext *ctx = (LGitContext*)context;
+	LGitBatchStatusEntry *entries;
 	int i, rc;
 	long sccFlags;
 	unsigned int flags;
 	LGitLog(" ! Populating files\n");
+	entries = LGitBatchStatus(ctx, nFiles, lpFileNames);
+	if (entries == NULL) {
+		return SCC_E_NONSPECIFICERROR;
+	}
 	for (i = 0; i < nFiles; i++) {
-		char path[2048];
-		LGitAnsiToUtf8(lpFileNames[i], path, 2048);
-		const char *raw_path = LGitStripBasePath(ctx, path);
+		const char *raw_path = entries[i].path;
 		if (raw_path == NULL) {
 			LGitLog("    Error stripping %s\n", lpFileNames[i]);
 			lpStatus[i] = SCC_STATUS_NOTCONTROLLED;
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
-		rc = git_status_file(&flags, ctx->repo, raw_path);
-		LGitLog("    Adding %s, git status flags %x\n", raw_path, flags);
+		rc = entries[i].rc;
+		flags = entries[i].flags;
+		LGitLogDebug("    Adding %s, git status flags %x\n", raw_path, flags);
 		switch (rc) {
 		case 0:
-			sccFlags = LGitConvertFlags(ctx, raw_path, flags);
+			sccFlags = LGitConvertFlags(ctx, raw_path, entries[i].id, flags);
 			break;
 		case GIT_ENOTFOUND:
 			sccFlags = SCC_STATUS_NOTCONTROLLED;
-			LGitLog("      Not found\n");
+			LGitLogDebug("      Not found\n");
 			break;
 		default:
+			/* LGitBatchStatus already reported it */
 			sccFlags = SCC_STATUS_INVALID;
-			LGitLibraryError(NULL, "Populate list");
 			LGitLog("      Error (%x)\n", rc);
 			break;
 		}
 		lpStatus[i] = sccFlags;
+		if (rc == 0 || rc == GIT_ENOTFOUND) {
+			LGitEventsWatch(ctx, raw_path, rc, flags);
+		}
 		if (rc != 0) {
 			continue;
 		}
-		LGitLog("      Success, flags %x\n", lpStatus[i]);
+		LGitLogDebug("      Success, flags %x\n", lpStatus[i]);
 		if (pfnPopulate != NULL) {
 			/* we must use the full ANSI path */
 			LGitCallPopulateAction(nCommand, lpFileNames[i], flags, sccFlags, pfnPopulate, pvCallerData);
 		}
 	}
+	LGitFreeBatchStatus(entries, nFiles);
 	return SCC_OK;
 }
 
@@ -298,6 +315,7 @@ SCCRTN SccPopulateList (LPVOID context,
 						LPLONG lpStatus, 
 						LONG dwFlags)
 {
+	LGitOpTimer timer(context, "SccPopulateList", nFiles);
 	LGitLog("**SccPopulateList** Context=%p\n", context);
 	LGitLog("command %s\n", LGitCommandName(nCommand));
 	LGitLog("  files %d\n", nFiles);
@@ -310,6 +328,7 @@ SCCRTN SccQueryInfo (LPVOID context,
 					 LPCSTR* lpFileNames, 
 					 LPLONG lpStatus)
 {
+	LGitOpTimer timer(context, "SccQueryInfo", nFiles);
 	LGitLog("**SccQueryInfo** Context=%p\n", context);
 	LGitLog("  files %d\n", nFiles);
 	return LGitPopulateList(context, (enum SCCCOMMAND)-1, nFiles, lpFileNames, NULL, NULL, lpStatus, 0);
@@ -321,58 +340,21 @@ SCCRTN SccDirQueryInfo(LPVOID context,
 					   LPLONG lpStatus)
 {
 	LGitContext *ctx = (LGitContext*)context;
-	int i, rc;
+	int i;
+	LGitOpTimer timer(context, "SccDirQueryInfo", nDirs);
 	LGitLog("**SccDirQueryInfo** Context=%p\n", context);
 	LGitLog("  dirs %d\n", nDirs);
-	/* We need a tree to use, since that has directories unlike indices. */
-	git_tree *head_tree = NULL;
-	/* But first, we need to parse it to get it... */
-	git_object *obj = NULL;
-	if (git_revparse_single(&obj, ctx->repo, "HEAD") != 0) {
-		LGitLibraryError(NULL, "SccDirQueryInfo git_revparse_single");
-		return SCC_E_NONSPECIFICERROR;
-	}
-	if (git_object_peel((git_object **)head_tree, obj, GIT_OBJECT_TREE) != 0) {
-		LGitLibraryError(NULL, "SccDirQueryInfo git_revparse_single");
-		git_object_free(obj);
-		return SCC_E_NONSPECIFICERROR;
-	}
-	git_object_free(obj);
 	for (i = 0; i < nDirs; i++) {
-		char path[2048];
-		LGitAnsiToUtf8(lpDirNames[i], path, 2048);
-		const char *raw_path = LGitStripBasePath(ctx, path);
-		if (raw_path == NULL) {
-			LGitLog("    Couldn't get base path for %s\n", path);
+		char raw_path[2048];
+		if (LGitNormalizePath(ctx, lpDirNames[i], raw_path, 2048) < 0) {
+			LGitLog("    Couldn't get base path for %s\n", lpDirNames[i]);
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
-		LGitLog("    Dir %s\n", raw_path);
-		/* if the obj exists, it's under control, otherwise... */
-		git_tree_entry *tree_entry = NULL;
-		rc = git_tree_entry_bypath(&tree_entry, head_tree, raw_path);
-		switch (rc) {
-		case 0:
-			/* XXX: should test if it's a dir */
-			lpStatus[i] = SCC_DIRSTATUS_CONTROLLED;
-			break;
-		case GIT_ENOTFOUND:
-			lpStatus[i] = SCC_DIRSTATUS_NOTCONTROLLED;
-			LGitLog("      Not found\n");
-			break;
-		default:
-			lpStatus[i] = SCC_DIRSTATUS_INVALID;
-			LGitLibraryError(NULL, "Dir Query Info");
-			LGitLog("      Error (%x)\n", rc);
-			break;
-		}
-		if (tree_entry != NULL) {
-			git_tree_entry_free(tree_entry);
-		}
+		LGitLogDebug("    Dir %s\n", raw_path);
+		/* Directories are in trees, not the index; see dirindex.cpp */
+		lpStatus[i] = LGitDirIndexStatus(ctx, raw_path);
+		LGitLogDebug("      Status %d\n", lpStatus[i]);
 	}
-	git_tree_free(head_tree);
-	git_object_free(obj);
 	return SCC_OK;
 }
 
@@ -406,7 +388,8 @@ static DWORD LGitConvertQueryChangesFlags(unsigned int flags)
 }
 
 /* fullFileName should be ANSI because it's passed to the IDE */
-static int LGitQueryChangesFile(LPCSTR fileName,
+static int LGitQueryChangesFile(LGitContext *ctx,
+								LPCSTR fileName,
 								LPCSTR fullFileName,
 								unsigned int lg2flags,
 								int lg2rc,
@@ -414,6 +397,9 @@ static int LGitQueryChangesFile(LPCSTR fileName,
 								LPVOID cbData)
 {
 	QUERYCHANGESDATA qcd;
+	const char *other;
+	char latest[2048], latestAnsi[2048];
+	LONG upstream;
 	ZeroMemory(&qcd, sizeof(QUERYCHANGESDATA));
 	qcd.dwSize = sizeof(QUERYCHANGESDATA);
 	/* VS2005 needs the full path, I think */
@@ -422,20 +408,33 @@ static int LGitQueryChangesFile(LPCSTR fileName,
 	switch (lg2rc) {
 	case 0:
 		qcd.dwChangeType = LGitConvertQueryChangesFlags(lg2flags);
-		LGitLog("    Adding %s, git flags %x sccQC flags %x\n",
+		LGitLogDebug("    Adding %s, git flags %x sccQC flags %x\n",
 			fileName,
 			lg2flags,
 			qcd.dwChangeType);
 		break;
 	case GIT_ENOTFOUND:
 		qcd.dwChangeType = SCC_CHANGE_NONEXISTENT;
-		LGitLog("      Not found\n");
+		LGitLogDebug("      Not found\n");
 		break;
 	default:
 		qcd.dwChangeType = SCC_CHANGE_UNKNOWN;
 		LGitLibraryError(NULL, "Populate list");
 		LGitLog("      Error (%x)\n", lg2rc);
-		break;
+		return cb(cbData, &qcd);
+	}
+	/* What a get would bring in matters more than what's here */
+	upstream = LGitUpstreamLookup(ctx, fileName, &other);
+	if (upstream != SCC_CHANGE_UNCHANGED) {
+		qcd.dwChangeType = upstream;
+		if (other != NULL) {
+			strlcpy(latest, ctx->workdir_path, 2048);
+			strlcat(latest, other, 2048);
+			LGitTranslateStringChars(latest, '/', '\\');
+			LGitUtf8ToAnsi(latest, latestAnsi, 2048);
+			qcd.lpLatestName = latestAnsi;
+		}
+		LGitLogDebug("      Upstream %d\n", upstream);
 	}
 	return cb(cbData, &qcd);
 }
@@ -450,26 +449,27 @@ SCCRTN SccQueryChanges(LPVOID context,
 					   LPVOID pvCallerData)
 {
 	LGitContext *ctx = (LGitContext*)context;
-	int i, rc;
-	unsigned int flags;
+	LGitBatchStatusEntry *entries;
+	int i;
+	LGitOpTimer timer(context, "SccQueryChanges", nFiles);
 	LGitLog("**SccQueryChanges** Context=%p\n", context);
 	LGitLog("  files %d\n", nFiles);
+	LGitUpstreamRefresh(ctx);
+	entries = LGitBatchStatus(ctx, nFiles, lpFileNames);
+	if (entries == NULL) {
+		return SCC_E_NONSPECIFICERROR;
+	}
 	for (i = 0; i < nFiles; i++) {
-		char path[2048];
-		LGitAnsiToUtf8(lpFileNames[i], path, 2048);
-		const char *raw_path = LGitStripBasePath(ctx, path);
+		const char *raw_path = entries[i].path;
 		if (raw_path == NULL) {
-			LGitLog("    Couldn't get base path for %s\n", path);
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
-		LGitLog("    %s\n", raw_path);
-		rc = git_status_file(&flags, ctx->repo, raw_path);
-		int ret = LGitQueryChangesFile(raw_path,
+		LGitLogDebug("    %s\n", raw_path);
+		int ret = LGitQueryChangesFile(ctx,
+			raw_path,
 			lpFileNames[i], /* not the UTF-8 full path */
-			flags,
-			rc,
+			entries[i].flags,
+			entries[i].rc,
 			pfnCallback,
 			pvCallerData);
 		if (ret == SCC_I_OPERATIONCANCELED || ret < 0) {
@@ -477,16 +477,16 @@ SCCRTN SccQueryChanges(LPVOID context,
 			break;
 		}
 	}
+	LGitFreeBatchStatus(entries, nFiles);
 	return SCC_OK;
 }
 
 /**
  * Gets if the files are modified in the remote source control.
  *
- * The semantics are hard under git (because we'd basically need to fetch the
- * tracking branch *and* check the files under the branch, so instead we don't
- * enable the capability. (The implemented version below checks if the files
- * are modified, which isn't quite right.)
+ * Under git, that's if the current branch's upstream (as of the last fetch)
+ * changed them since the merge base; see upstream.cpp. Without an upstream,
+ * fall back to if they're modified here, which isn't quite right.
  */
 SCCRTN SccEnumChangedFiles(LPVOID context,
 						   HWND hWnd,
@@ -495,23 +495,36 @@ SCCRTN SccEnumChangedFiles(LPVOID context,
 						   LONG *different)
 {
 	LGitContext *ctx = (LGitContext*)context;
+	LGitBatchStatusEntry *entries;
 	int i, rc;
 	unsigned int flags;
+	LGitOpTimer timer(context, "SccEnumChangedFiles", nFiles);
 	LGitLog("**SccEnumChangedFiles** Context=%p\n", context);
 	LGitLog("  files %d\n", nFiles);
+	if (LGitUpstreamRefresh(ctx)) {
+		for (i = 0; i < nFiles; i++) {
+			char raw_path[2048];
+			different[i] = FALSE;
+			if (LGitNormalizePath(ctx, lpFileNames[i], raw_path, 2048) < 0) {
+				continue;
+			}
+			different[i] = LGitUpstreamLookup(ctx, raw_path, NULL) != SCC_CHANGE_UNCHANGED;
+			LGitLogDebug("    %s, upstream %d\n", raw_path, different[i]);
+		}
+		return SCC_OK;
+	}
+	entries = LGitBatchStatus(ctx, nFiles, lpFileNames);
+	if (entries == NULL) {
+		return SCC_E_NONSPECIFICERROR;
+	}
 	for (i = 0; i < nFiles; i++) {
-		char path[2048];
-		LGitAnsiToUtf8(lpFileNames[i], path, 2048);
-		const char *raw_path = LGitStripBasePath(ctx, path);
+		const char *raw_path = entries[i].path;
 		if (raw_path == NULL) {
-			LGitLog("    Couldn't get base path for %s\n", path);
 			continue;
 		}
-		/* Translate because libgit2 operates with forward slashes */
-		LGitTranslateStringChars(path, '\\', '/');
-		LGitLog("    %s\n", raw_path);
-		rc = git_status_file(&flags, ctx->repo, raw_path);
-		LGitLog("    Adding %s, git status flags %x\n", raw_path, flags);
+		rc = entries[i].rc;
+		flags = entries[i].flags;
+		LGitLogDebug("    Adding %s, git status flags %x\n", raw_path, flags);
 		switch (rc) {
 		case 0:
 			/* Does add/remove count too? */
@@ -525,15 +538,15 @@ SCCRTN SccEnumChangedFiles(LPVOID context,
 			break;
 		case GIT_ENOTFOUND:
 			different[i] = FALSE;
-			LGitLog("      Not found\n");
+			LGitLogDebug("      Not found\n");
 			break;
 		default:
 			different[i] = FALSE;
-			LGitLibraryError(hWnd, "Populate list");
 			LGitLog("      Error (%x)\n", rc);
 			break;
 		}
 	}
+	LGitFreeBatchStatus(entries, nFiles);
 	return SCC_OK;
 }
 
@@ -542,7 +555,26 @@ SCCRTN SccGetEvents (LPVOID context,
 					 LPLONG lpStatus,
 					 LPLONG pnEventsRemaining)
 {
-	LGitLog("**SccGetEvents** Context=%p\n", context);
-	LGitLog("  %s\n", lpFileName);
-	return SCC_E_OPNOTSUPPORTED;
+	LGitContext *ctx = (LGitContext*)context;
+	char relative_path[1024], path[2048];
+	unsigned int flags;
+	int rc;
+	/* Called on idle, constantly; don't time or log when there's nothing */
+	lpFileName[0] = '\0';
+	*lpStatus = SCC_STATUS_NOTCONTROLLED;
+	if (!LGitEventsNext(ctx, relative_path, 1024, &rc, &flags, pnEventsRemaining)) {
+		return SCC_OK;
+	}
+	LGitOpTimer timer(context, "SccGetEvents", 1);
+	LGitLogDebug("**SccGetEvents** Context=%p\n", context);
+	if (rc == 0) {
+		*lpStatus = LGitConvertFlags(ctx, relative_path, LGitFindPath(ctx, relative_path), flags);
+	}
+	/* The IDE wants it the way it gave it to us: absolute and ANSI */
+	strlcpy(path, ctx->workdir_path, 2048);
+	strlcat(path, relative_path, 2048);
+	LGitTranslateStringChars(path, '/', '\\');
+	LGitUtf8ToAnsi(path, lpFileName, MAX_PATH + 1);
+	LGitLogDebug("  %s -> %x, %d remaining\n", lpFileName, *lpStatus, *pnEventsRemaining);
+	return SCC_OK;
 }
\ No newline at end of file
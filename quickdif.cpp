@@ -0,0 +1,220 @@
+/*
+ * Quick diff: whether a file differs from the stage, without making a diff.
+ * The IDE asks for every open document whenever it gets focus, so this has
+ * to be cheap, and usually it's one stat: the index entry has the size and
+ * modification time the file had when it was staged or checked out, and if
+ * those still match, it hasn't changed. If they don't:
+ *
+ * - SCC_DIFF_QD_TIME goes by that alone.
+ * - SCC_DIFF_QD_CHECKSUM hashes the file through a mapping, so it's never
+ *   copied, and compares that to the entry's OID.
+ * - SCC_DIFF_QD_CONTENTS compares it against the staged blob, stopping at
+ *   the first byte that's different (or before loading it, if the sizes are).
+ *
+ * Files with filters (i.e. line ending conversion) aren't staged as they are
+ * on disk, so libgit2 hashes those. Anything this can't be sure of, like
+ * submodules or ignoring whitespace, is left to a real diff.
+ */
+
+#include "stdafx.h"
+
+/* FILETIME is in 100 ns since 1601; index times are since 1970 */
+static void LGitFileTimeToIndexTime(const FILETIME *ft, git_index_time *out)
+{
+	ULARGE_INTEGER t;
+	t.LowPart = ft->dwLowDateTime;
+	t.HighPart = ft->dwHighDateTime;
+	t.QuadPart -= 116444736000000000;
+	out->seconds = (int32_t)(t.QuadPart / 10000000);
+	out->nanoseconds = (uint32_t)((t.QuadPart % 10000000) * 100);
+}
+
+/*
+ * If racy_after isn't NULL, files changed in the same second the index was
+ * written don't match, since the entry could be from just before the change.
+ */
+static BOOL LGitQuickDiffStatMatches(const git_index_entry *entry,
+									 const WIN32_FILE_ATTRIBUTE_DATA *attr,
+									 const git_index_time *racy_after)
+{
+	git_index_time mtime;
+	if (attr->nFileSizeHigh != 0 || attr->nFileSizeLow != entry->file_size) {
+		return FALSE;
+	}
+	LGitFileTimeToIndexTime(&attr->ftLastWriteTime, &mtime);
+	if (mtime.seconds != entry->mtime.seconds) {
+		return FALSE;
+	}
+	/* Only if libgit2 was built to keep them */
+	if (entry->mtime.nanoseconds != 0 && mtime.nanoseconds != entry->mtime.nanoseconds) {
+		return FALSE;
+	}
+	if (racy_after != NULL && entry->mtime.seconds >= racy_after->seconds) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Path is relative with forward slashes. Returns FALSE if it couldn't tell,
+ * in which case make a diff.
+ */
+BOOL LGitQuickDiff(LGitContext *ctx, const char *path, LONG flags, BOOL *differs)
+{
+	git_index *index;
+	const git_index_entry *entry;
+	git_filter_list *filters = NULL;
+	git_odb *odb = NULL;
+	git_blob *blob = NULL;
+	git_object_t type;
+	git_oid oid;
+	git_index_time index_mtime, *racy_after = NULL;
+	WIN32_FILE_ATTRIBUTE_DATA attr, index_attr;
+	wchar_t full_path[1024], relative_path[1024];
+	HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+	const char *data = "", *view = NULL, *how = NULL;
+	size_t size = 0, blob_size;
+	LONG mode = flags & SCC_DIFF_QUICK_DIFF;
+	DWORD begin = GetTickCount();
+	BOOL ret = FALSE;
+
+	*differs = FALSE;
+	if ((index = LGitSessionIndex(ctx)) == NULL) {
+		goto fin;
+	}
+	entry = git_index_get_bypath(index, path, 0);
+	if (entry == NULL) {
+		/* Conflicted files are only in the other stages */
+		*differs = git_index_get_bypath(index, path, 1) != NULL
+			|| git_index_get_bypath(index, path, 2) != NULL
+			|| git_index_get_bypath(index, path, 3) != NULL;
+		how = *differs ? "conflict" : "not staged";
+		ret = TRUE;
+		goto fin;
+	}
+	/* Links and submodules aren't compared by contents */
+	if ((entry->mode & 0170000) != 0100000) {
+		goto fin;
+	}
+	LGitUtf8ToWide(ctx->workdir_path, full_path, 1024);
+	LGitUtf8ToWide(path, relative_path, 1024);
+	wcslcat(full_path, relative_path, 1024);
+	LGitTranslateStringCharsW(full_path, L'/', L'\\');
+	if (!GetFileAttributesExW(full_path, GetFileExInfoStandard, &attr)
+		|| (attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		*differs = TRUE;
+		how = "missing";
+		ret = TRUE;
+		goto fin;
+	}
+	/* Timestamps are what's asked about, so racy ones are still the answer */
+	if (mode != SCC_DIFF_QD_TIME && git_index_path(index) != NULL) {
+		LGitUtf8ToWide(git_index_path(index), relative_path, 1024);
+		if (GetFileAttributesExW(relative_path, GetFileExInfoStandard, &index_attr)) {
+			LGitFileTimeToIndexTime(&index_attr.ftLastWriteTime, &index_mtime);
+			racy_after = &index_mtime;
+		}
+	}
+	if (LGitQuickDiffStatMatches(entry, &attr, racy_after)) {
+		how = "stat";
+		ret = TRUE;
+		goto fin;
+	}
+	if (mode == SCC_DIFF_QD_TIME) {
+		*differs = TRUE;
+		how = "stat";
+		ret = TRUE;
+		goto fin;
+	}
+	/* Byte for byte can't ignore anything */
+	if (flags & (SCC_DIFF_IGNORESPACE | SCC_DIFF_IGNORECASE)) {
+		goto fin;
+	}
+	if (git_filter_list_load(&filters, ctx->repo, NULL, path, GIT_FILTER_TO_ODB, GIT_FILTER_DEFAULT) != 0) {
+		goto fin;
+	}
+	if (filters != NULL) {
+		if (git_repository_hashfile(&oid, ctx->repo, path, GIT_OBJECT_BLOB, NULL) != 0) {
+			goto fin;
+		}
+		*differs = !git_oid_equal(&oid, &entry->id);
+		how = "filtered hash";
+		ret = TRUE;
+		goto fin;
+	}
+	if (attr.nFileSizeHigh != 0) {
+		goto fin;
+	}
+	size = attr.nFileSizeLow;
+	/* Size first; that needs the object header, not the object */
+	if (mode == SCC_DIFF_QD_CONTENTS) {
+		if (git_repository_odb(&odb, ctx->repo) != 0
+			|| git_odb_read_header(&blob_size, &type, odb, &entry->id) != 0) {
+			goto fin;
+		}
+		if (blob_size != size) {
+			*differs = TRUE;
+			how = "size";
+			ret = TRUE;
+			goto fin;
+		}
+	}
+	/* Empty files can't be mapped, but they're already "" */
+	if (size > 0) {
+		file = CreateFileW(full_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+			NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			goto fin;
+		}
+		mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			goto fin;
+		}
+		view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+		if (view == NULL) {
+			goto fin;
+		}
+		data = view;
+	}
+	if (mode == SCC_DIFF_QD_CONTENTS) {
+		if (git_blob_lookup(&blob, ctx->repo, &entry->id) != 0) {
+			goto fin;
+		}
+		*differs = git_blob_rawsize(blob) != (git_object_size_t)size
+			|| memcmp(git_blob_rawcontent(blob), data, size) != 0;
+		how = "contents";
+	} else {
+		if (git_odb_hash(&oid, data, size, GIT_OBJECT_BLOB) != 0) {
+			goto fin;
+		}
+		*differs = !git_oid_equal(&oid, &entry->id);
+		how = "hash";
+	}
+	ret = TRUE;
+fin:
+	if (ret) {
+		LGitLog(" ! Quick diff: %s by %s in %u ms\n",
+			*differs ? "differs" : "same",
+			how,
+			GetTickCount() - begin);
+	}
+	if (view != NULL) {
+		UnmapViewOfFile(view);
+	}
+	if (mapping != NULL) {
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+	if (blob != NULL) {
+		git_blob_free(blob);
+	}
+	if (odb != NULL) {
+		git_odb_free(odb);
+	}
+	if (filters != NULL) {
+		git_filter_list_free(filters);
+	}
+	return ret;
+}
@@ -49,6 +49,8 @@
 #define IDD_REVPARSE                    145
 #define IDI_HEAD                        146
 #define IDD_CHECKOUT_NOTIFY             147
+#define IDD_DIAGNOSTICS                 148
+#define IDD_BLAME                       149
 #define IDC_COMMITHISTORY               1000
 #define IDC_STATUS_INDEX_NEW            1003
 #define IDC_FILESYSPROPS                1004
@@ -130,6 +132,12 @@
 #define IDC_COMMIT_CREATE_COMMITTER     1079
 #define IDC_CHECKOUT_NOTIFY_LIST        1079
 #define IDC_COMMIT_CREATE_CHANGECOMMITTER 1080
+#define IDC_ABOUT_DIAGNOSTICS           1081
+#define IDC_DIAGNOSTICS_LIST            1082
+#define IDC_DIAGNOSTICS_SAVE            1083
+#define IDC_DIAGNOSTICS_REFRESH         1084
+#define IDC_HISTORY_SEARCH              1085
+#define IDC_BLAME_LINES                 1086
 #define ID_HISTORY_CLOSE                40001
 #define ID_DIFF_COPY                    40002
 #define ID_DIFF_CLOSE                   40003
@@ -186,14 +194,18 @@
 #define ID_REFERENCE_REFRESH            40061
 #define ID_EXPLORER_REPOSITORY_CREATESHORTCUTONDESKTOP 40062
 #define ID_HISTORY_COMMIT_CHERRYPICK    40063
+#define ID_EXPLORER_FILE_ANNOTATE       40064
+#define ID_HISTORY_COMMIT_ANNOTATE      40065
+#define ID_DIFF_SIDE_BY_SIDE            40066
+#define ID_HISTORY_COMMIT_FORMATPATCH   40067
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        148
-#define _APS_NEXT_COMMAND_VALUE         40064
-#define _APS_NEXT_CONTROL_VALUE         1080
+#define _APS_NEXT_RESOURCE_VALUE        150
+#define _APS_NEXT_COMMAND_VALUE         40068
+#define _APS_NEXT_CONTROL_VALUE         1087
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
@@ -38,7 +38,8 @@ SCCRTN LGitRevertCommit(LGitContext *ctx,
 	}
 	LGitProgressDeinit(ctx);
 	/* We now need to commit our changes to the index. Revert mutates repo. */
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		LGitLibraryError(hwnd, "git_repository_index");
 		goto err;
 	}
@@ -51,9 +52,6 @@ err:
 	LGitFinishCheckoutNotify(ctx, hwnd, &revert_opts.checkout_opts);
 	/* The message is provided by the merge message, so remove it. */
 	git_repository_message_remove(ctx->repo);
-	if (index != NULL) {
-		git_index_free(index);
-	}
 	if (commit != NULL) {
 		git_commit_free(commit);
 	}
@@ -93,6 +91,8 @@ SCCRTN LGitResetToCommit(LGitContext *ctx,
 	LGitProgressDeinit(ctx);
 	ret = SCC_OK;
 err:
+	/* Even a failed one may have moved the branch or some files */
+	LGitStatusCacheInvalidate(ctx);
 	if (commit != NULL) {
 		git_commit_free(commit);
 	}
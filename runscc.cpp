@@ -95,6 +95,7 @@ static BOOL StatusToString(unsigned int flags, wchar_t *buf, size_t bufsz)
 	AppendIfStatus(GIT_STATUS_INDEX_NEW, L"New in stage");
 	AppendIfStatus(GIT_STATUS_INDEX_MODIFIED, L"Changed in stage");
 	AppendIfStatus(GIT_STATUS_INDEX_DELETED, L"Deleted from stage");
+	AppendIfStatus(GIT_STATUS_INDEX_RENAMED, L"Renamed in stage");
 	AppendIfStatus(GIT_STATUS_INDEX_TYPECHANGE, L"Type changed in stage");
 	AppendIfStatus(GIT_STATUS_WT_NEW, L"New");
 	AppendIfStatus(GIT_STATUS_WT_MODIFIED, L"Changed");
@@ -107,14 +108,14 @@ static BOOL StatusToString(unsigned int flags, wchar_t *buf, size_t bufsz)
 	return TRUE;
 }
 
+/* For renames, the path is where it went, and renamed_from where it was */
 static int FillStatusItem(const char *relative_path,
 						  unsigned int flags,
-						  void *context)
+						  const char *renamed_from,
+						  LGitExplorerStatusCallbackParams *params)
 {
 	LVITEMW lvi;
 
-	LGitExplorerStatusCallbackParams *params = (LGitExplorerStatusCallbackParams*)context;
-
 	/* Get the system image list index for the file, needing the full path */
 	SHFILEINFOW sfi;
 	ZeroMemory(&sfi, sizeof(sfi));
@@ -145,8 +146,21 @@ static int FillStatusItem(const char *relative_path,
 		return GIT_EUSER;
 	}
 	
-	wchar_t msg[256];
+	/*
+	 * Might as well, since we've done the work for the IDE. Not for renames,
+	 * since the IDE asks about each path without them being paired up.
+	 */
+	if (renamed_from == NULL) {
+		LGitStatusCacheStore(params->ctx, relative_path, 0, flags);
+	}
+
+	wchar_t msg[256], from[256];
 	StatusToString(flags, msg, 256);
+	if (renamed_from != NULL) {
+		LGitUtf8ToWide(renamed_from, from, 256);
+		wcslcat(msg, L" from ", 256);
+		wcslcat(msg, from, 256);
+	}
 	lvi.mask = LVIF_TEXT;
 	lvi.pszText = (wchar_t*)msg;
 	lvi.iItem = params->index;
@@ -157,9 +171,27 @@ static int FillStatusItem(const char *relative_path,
 	return 0;
 }
 
+/* Where the file is now, with where it was if it moved */
+static const char *StatusEntryPath(const git_status_entry *entry, const char **renamed_from)
+{
+	const char *old_path, *new_path;
+	old_path = entry->head_to_index != NULL
+		? entry->head_to_index->old_file.path
+		: entry->index_to_workdir->old_file.path;
+	new_path = entry->index_to_workdir != NULL
+		? entry->index_to_workdir->new_file.path
+		: entry->head_to_index->new_file.path;
+	*renamed_from = strcmp(old_path, new_path) != 0 ? old_path : NULL;
+	return new_path;
+}
+
 static void FillExplorerListView(HWND hwnd, LGitExplorerParams *params)
 {
 	git_status_options sopts;
+	git_status_list *status = NULL;
+	const git_status_entry *entry;
+	const char *path, *renamed_from;
+	size_t i, count;
 	LGitExplorerStatusCallbackParams cbp;
 	git_status_options_init(&sopts, GIT_STATUS_OPTIONS_VERSION);
 	HWND lv = GetDlgItem(hwnd, IDC_EXPLORER_FILES);
@@ -167,10 +199,13 @@ static void FillExplorerListView(HWND hwnd, LGitExplorerParams *params)
 	/* See the notes for the git_status_options use in query,cpp... */
 	sopts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
 	/* XXX: Make configurable */
-	sopts.flags = GIT_STATUS_OPT_INCLUDE_UNREADABLE;
+	sopts.flags = GIT_STATUS_OPT_INCLUDE_UNREADABLE
+		| GIT_STATUS_OPT_RENAMES_HEAD_TO_INDEX;
+	/* Working tree renames are to untracked files, so need those shown */
 	if (params->include_untracked) {
 		sopts.flags |= GIT_STATUS_OPT_INCLUDE_UNTRACKED
-			| GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS;
+			| GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS
+			| GIT_STATUS_OPT_RENAMES_INDEX_TO_WORKDIR;
 	}
 	if (params->include_unmodified) {
 		sopts.flags |= GIT_STATUS_OPT_INCLUDE_UNMODIFIED;
@@ -191,7 +226,20 @@ static void FillExplorerListView(HWND hwnd, LGitExplorerParams *params)
 		return;
 	}
 	/* This gets us a stage scan too */
-	git_status_foreach_ext(params->ctx->repo, &sopts, FillStatusItem, &cbp);
+	LGitStatusCacheValidate(params->ctx);
+	if (git_status_list_new(&status, params->ctx->repo, &sopts) != 0) {
+		LGitLibraryError(hwnd, "git_status_list_new");
+		return;
+	}
+	count = git_status_list_entrycount(status);
+	for (i = 0; i < count; i++) {
+		entry = git_status_byindex(status, i);
+		path = StatusEntryPath(entry, &renamed_from);
+		if (FillStatusItem(path, entry->status, renamed_from, &cbp) != 0) {
+			break;
+		}
+	}
+	git_status_list_free(status);
 }
 
 static void GetHeadState(HWND hwnd, LGitExplorerParams *params, wchar_t *buf, size_t bufsz)
@@ -357,6 +405,15 @@ static void SelectedFileProperties(HWND hwnd, LGitExplorerParams *params)
 	LGitFileProperties(params->ctx, hwnd, path);
 }
 
+static void AnnotateSelectedFile(HWND hwnd, LGitExplorerParams *params)
+{
+	char path[1024];
+	if (!GetSingleSelection(hwnd, path, 1024)) {
+		return;
+	}
+	LGitAnnotate(params->ctx, hwnd, path, NULL);
+}
+
 static void UpdateExplorerMenu(HWND hwnd, LGitExplorerParams *params)
 {
 	HWND lv = GetDlgItem(hwnd, IDC_EXPLORER_FILES);
@@ -369,11 +426,13 @@ static void UpdateExplorerMenu(HWND hwnd, LGitExplorerParams *params)
 	UINT newStateSelected = MF_IF_CMD(active && selected > 0);
 	UINT newStateSelectedBorn = MF_IF_CMD(active && selected > 0 && unborn == 0);
 	UINT newStateSelectedSingle = MF_IF_CMD(active && selected == 1);
+	UINT newStateSelectedSingleBorn = MF_IF_CMD(active && selected == 1 && unborn == 0);
 #define EnableMenuItemIfInRepo(id) EnableMenuItem(params->menu,id,newState)
 #define EnableMenuItemIfInRepoAndBorn(id) EnableMenuItem(params->menu,id,newStateBorn)
 #define EnableMenuItemIfSelected(id) EnableMenuItem(params->menu,id,newStateSelected)
 #define EnableMenuItemIfSelectedAndBorn(id) EnableMenuItem(params->menu,id,newStateSelectedBorn)
 #define EnableMenuItemIfSelectedSingle(id) EnableMenuItem(params->menu,id,newStateSelectedSingle)
+#define EnableMenuItemIfSelectedSingleAndBorn(id) EnableMenuItem(params->menu,id,newStateSelectedSingleBorn)
 	EnableMenuItemIfInRepo(ID_EXPLORER_REPOSITORY_OPENINWINDOWS);
 	EnableMenuItemIfInRepo(ID_EXPLORER_REPOSITORY_CREATESHORTCUTONDESKTOP);
 	EnableMenuItemIfInRepo(ID_EXPLORER_REPOSITORY_REFRESH);
@@ -394,6 +453,7 @@ static void UpdateExplorerMenu(HWND hwnd, LGitExplorerParams *params)
 	EnableMenuItemIfSelectedSingle(ID_EXPLORER_STAGE_FILEPROPERTIES);
 	EnableMenuItemIfSelected(ID_EXPLORER_FILE_OPEN);
 	EnableMenuItemIfSelectedAndBorn(ID_EXPLORER_FILE_HISTORY);
+	EnableMenuItemIfSelectedSingleAndBorn(ID_EXPLORER_FILE_ANNOTATE);
 	EnableMenuItemIfSelected(ID_EXPLORER_FILE_DIFFFROMSTAGE);
 	EnableMenuItemIfSelected(ID_EXPLORER_FILE_DIFFFROMREVISION);
 	EnableMenuItemIfInRepo(ID_EXPLORER_STAGE_COMMITSTAGED);
@@ -668,6 +728,9 @@ static BOOL HandleExplorerCommand(HWND hwnd, UINT cmd, LGitExplorerParams *param
 			LGitFreePathList(strings.strings, strings.count);
 		}
 		return TRUE;
+	case ID_EXPLORER_FILE_ANNOTATE:
+		AnnotateSelectedFile(hwnd, params);
+		return TRUE;
 	case ID_EXPLORER_FILE_DIFFFROMSTAGE:
 		if (GetMultipleSelection(hwnd, &strings)) {
 			LGitDiffStageToWorkdir(params->ctx, hwnd, &strings);
@@ -0,0 +1,224 @@
+/*
+ * Repository session, for things nearly every operation wants from the repo
+ * (the index, config, HEAD's tree) so they're kept between SCC calls instead
+ * of being loaded again by each one. The IDE tends to make a lot of calls in
+ * a row for a single batch operation.
+ *
+ * Everything handed out is borrowed: don't free it, and don't hold on to it
+ * past the current operation, since the next call may replace it. What's
+ * held is checked against the stat data of the files it came from, so
+ * changes made by other git clients are still picked up.
+ */
+
+#include "stdafx.h"
+
+/* Repository, global, XDG, system */
+#define SESSION_CONFIG_FILES 4
+
+typedef struct _LGitSessionFile {
+	wchar_t path[1024];
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+} LGitSessionFile;
+
+struct _LGitSession {
+	git_index *index;
+	LGitSessionFile index_file;
+	git_config *config;
+	LGitSessionFile config_files[SESSION_CONFIG_FILES];
+	int config_file_count;
+	git_tree *head_tree;
+	git_oid head_oid;
+	/* Statistics */
+	LONG index_loads, config_loads, tree_loads;
+};
+
+static void LGitSessionAddConfigFile(LGitSession *session, const char *path)
+{
+	LGitSessionFile *file;
+	if (session->config_file_count == SESSION_CONFIG_FILES) {
+		return;
+	}
+	file = &session->config_files[session->config_file_count];
+	if (LGitUtf8ToWide(path, file->path, 1024) == 0) {
+		return;
+	}
+	LGitTranslateStringCharsW(file->path, L'/', L'\\');
+	session->config_file_count++;
+}
+
+static void LGitSessionAddFoundConfigFile(LGitSession *session,
+										  int (*find)(git_buf *))
+{
+	git_buf buf = {0, 0};
+	/* Not existing is fine; it'll be picked up if one is made */
+	if (find(&buf) == 0) {
+		LGitSessionAddConfigFile(session, buf.ptr);
+	}
+	git_buf_dispose(&buf);
+}
+
+void LGitSessionInit(LGitContext *ctx)
+{
+	LGitSession *session;
+	char path[1024];
+
+	session = (LGitSession*)calloc(1, sizeof(LGitSession));
+	if (session == NULL) {
+		return;
+	}
+	strlcpy(path, git_repository_path(ctx->repo), 1024);
+	strlcat(path, "config", 1024);
+	LGitSessionAddConfigFile(session, path);
+	LGitSessionAddFoundConfigFile(session, git_config_find_global);
+	LGitSessionAddFoundConfigFile(session, git_config_find_xdg);
+	LGitSessionAddFoundConfigFile(session, git_config_find_system);
+	ctx->session = session;
+}
+
+void LGitSessionFree(LGitContext *ctx)
+{
+	LGitSession *session = ctx->session;
+	if (session == NULL) {
+		return;
+	}
+	LGitLog(" ! Session: index loaded %d times, config %d, HEAD tree %d\n",
+		session->index_loads,
+		session->config_loads,
+		session->tree_loads);
+	if (session->index != NULL) {
+		git_index_free(session->index);
+	}
+	if (session->config != NULL) {
+		git_config_free(session->config);
+	}
+	if (session->head_tree != NULL) {
+		git_tree_free(session->head_tree);
+	}
+	free(session);
+	ctx->session = NULL;
+}
+
+/*
+ * The stage. This is the same object the repository uses, so checkouts and
+ * such that go through libgit2 see what we do and vice versa. NULL on error,
+ * with the error in libgit2.
+ */
+git_index *LGitSessionIndex(LGitContext *ctx)
+{
+	LGitSession *session = ctx->session;
+	if (session == NULL) {
+		git_error_set_str(GIT_ERROR_INVALID, "No repository session");
+		return NULL;
+	}
+	if (session->index == NULL) {
+		if (git_repository_index(&session->index, ctx->repo) != 0) {
+			return NULL;
+		}
+		/* In-memory indices have no path; then we never reload */
+		if (git_index_path(session->index) != NULL) {
+			LGitUtf8ToWide(git_index_path(session->index), session->index_file.path, 1024);
+			LGitFileStatChanged(session->index_file.path, &session->index_file.attr);
+		}
+		session->index_loads++;
+	} else if (session->index_file.path[0] != L'\0'
+		&& LGitFileStatChanged(session->index_file.path, &session->index_file.attr)) {
+		/*
+		 * Not forced, so libgit2 can skip it if it was our own write. If
+		 * someone else wrote it, unsaved changes are dropped for theirs.
+		 */
+		if (git_index_read(session->index, 0) != 0) {
+			return NULL;
+		}
+		session->index_loads++;
+	}
+	return session->index;
+}
+
+/* Read-only snapshot of the whole config; NULL on error */
+git_config *LGitSessionConfig(LGitContext *ctx)
+{
+	LGitSession *session = ctx->session;
+	git_config *snapshot;
+	BOOL changed;
+	int i;
+	if (session == NULL) {
+		git_error_set_str(GIT_ERROR_INVALID, "No repository session");
+		return NULL;
+	}
+	/* Check them all, so each gets its new stat data recorded */
+	changed = session->config == NULL;
+	for (i = 0; i < session->config_file_count; i++) {
+		changed |= LGitFileStatChanged(session->config_files[i].path,
+			&session->config_files[i].attr);
+	}
+	if (!changed) {
+		return session->config;
+	}
+	if (git_repository_config_snapshot(&snapshot, ctx->repo) != 0) {
+		return NULL;
+	}
+	if (session->config != NULL) {
+		git_config_free(session->config);
+	}
+	session->config = snapshot;
+	session->config_loads++;
+	return session->config;
+}
+
+/*
+ * HEAD's tree, or NULL if there's no HEAD commit yet (or on error). Refs are
+ * cheap to resolve, so rather than stat HEAD and whatever it points to, just
+ * compare the commit it resolves to.
+ */
+git_tree *LGitSessionHeadTree(LGitContext *ctx)
+{
+	LGitSession *session = ctx->session;
+	git_oid oid;
+	git_commit *commit = NULL;
+	git_tree *tree = NULL;
+	if (session == NULL) {
+		git_error_set_str(GIT_ERROR_INVALID, "No repository session");
+		return NULL;
+	}
+	if (git_reference_name_to_id(&oid, ctx->repo, "HEAD") != 0) {
+		goto drop;
+	}
+	if (session->head_tree != NULL && git_oid_equal(&oid, &session->head_oid)) {
+		return session->head_tree;
+	}
+	if (git_commit_lookup(&commit, ctx->repo, &oid) != 0) {
+		goto drop;
+	}
+	if (git_commit_tree(&tree, commit) != 0) {
+		git_commit_free(commit);
+		goto drop;
+	}
+	git_commit_free(commit);
+	if (session->head_tree != NULL) {
+		git_tree_free(session->head_tree);
+	}
+	session->head_tree = tree;
+	git_oid_cpy(&session->head_oid, &oid);
+	session->tree_loads++;
+	return session->head_tree;
+drop:
+	/* Don't hand out the old one when HEAD is gone */
+	if (session->head_tree != NULL) {
+		git_tree_free(session->head_tree);
+		session->head_tree = NULL;
+	}
+	return NULL;
+}
+
+/*
+ * For when we've written config ourselves; the stat data might not change if
+ * it's within the timestamp resolution and the size is the same.
+ */
+void LGitSessionInvalidateConfig(LGitContext *ctx)
+{
+	LGitSession *session = ctx->session;
+	if (session != NULL && session->config != NULL) {
+		git_config_free(session->config);
+		session->config = NULL;
+	}
+}
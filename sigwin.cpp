@@ -75,6 +75,7 @@ BOOL LGitSetSignature(LGitContext *ctx, HWND hwnd, const char *name, const char
 	if (config != NULL) {
 		git_config_free(config);
 	}
+	LGitSessionInvalidateConfig(ctx);
 	return rc1 == 0 && rc2 == 0;
 }
 
@@ -132,11 +133,31 @@ SCCRTN LGitSignatureDialog(LGitContext *ctx,
 	return SCC_OK;
 }
 
+/*
+ * Like git_signature_default, but from the session's config snapshot. This
+ * can't be cached itself, since it carries the time it was made.
+ */
+static int LGitSignatureFromSession(git_signature **signature, LGitContext *ctx)
+{
+	git_config *config;
+	const char *name, *mail;
+	config = LGitSessionConfig(ctx);
+	if (config == NULL) {
+		return -1;
+	}
+	/* Borrowed from the snapshot, which outlives this */
+	if (git_config_get_string(&name, config, "user.name") != 0
+		|| git_config_get_string(&mail, config, "user.email") != 0) {
+		return -1;
+	}
+	return git_signature_now(signature, name, mail);
+}
+
 SCCRTN LGitGetDefaultSignature(HWND hWnd, LGitContext *ctx, git_signature **signature)
 {
 	SCCRTN ret = SCC_OK;
 	/* The signature may already be provided, don't init unless null */
-	if (*signature == NULL && git_signature_default(signature, ctx->repo) != 0) {
+	if (*signature == NULL && LGitSignatureFromSession(signature, ctx) != 0) {
 		/* The git config is empty, so prompt for a signature */
 		char name[128], mail[128];
 		ZeroMemory(name, 128);
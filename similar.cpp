@@ -0,0 +1,283 @@
+/*
+ * Rename and copy detection. libgit2 pairs up deleted and added files by
+ * comparing every one against every other, so the cost is in how fast a
+ * comparison is, and how many pairs are allowed. It takes a similarity
+ * metric, so this is ours:
+ *
+ * - Files are cut into chunks at newlines (or every 64 bytes, for long
+ *   lines and binaries), and each is hashed a word at a time. A signature
+ *   is the sorted list of distinct chunk hashes with how many bytes each
+ *   covers, so comparing two is one merge over both lists.
+ * - The share of bytes two files can have in common is at most the smaller
+ *   size over the larger, so pairs too different in size to make the
+ *   threshold are turned down before their lists are looked at. Most pairs
+ *   in a big refactor are that, so this is where the time is saved.
+ * - Files with the same contents are paired by OID in a first pass of
+ *   their own, so even if there are too many files for the inexact pass,
+ *   a plain move is still found.
+ *
+ * The candidate limit is libgit2's rename limit; it's set from the registry
+ * (RenameLimit), since the default was picked for its slower metric. The
+ * inexact pass can still take a while, so it checks for being cancelled
+ * between files and pairs.
+ */
+
+#include "stdafx.h"
+
+/* Lines longer than this are cut up, so binaries still get chunks */
+#define SIMILAR_MAX_CHUNK 64
+/* Nothing meaningful to compare; libgit2 skips files that say EBUFS */
+#define SIMILAR_MIN_SIZE 8
+/* Bigger files aren't read for comparison */
+#define SIMILAR_MAX_SIZE (64 * 1024 * 1024)
+#define SIMILAR_DEFAULT_LIMIT 5000
+#define SIMILAR_THRESHOLD 50
+
+typedef struct _LGitSimilarChunk {
+	DWORD hash;
+	DWORD bytes;
+} LGitSimilarChunk;
+
+typedef struct _LGitSimilarSig {
+	size_t size;
+	DWORD count;
+	LGitSimilarChunk chunks[1];
+} LGitSimilarSig;
+
+/* The metric's payload */
+typedef struct _LGitSimilarParams {
+	int threshold;
+	/* Can be NULL */
+	volatile LONG *cancel;
+} LGitSimilarParams;
+
+static volatile LONG rename_limit = SIMILAR_DEFAULT_LIMIT;
+
+/* 0 for the default */
+void LGitSetRenameLimit(DWORD limit)
+{
+	InterlockedExchange(&rename_limit, limit == 0 ? SIMILAR_DEFAULT_LIMIT : limit);
+}
+
+/* FNV-1a, but mixing four bytes at a time */
+static DWORD LGitSimilarHash(const BYTE *data, size_t len)
+{
+	DWORD hash = 2166136261UL, word;
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		memcpy(&word, data + i, 4);
+		hash = (hash ^ word) * 16777619UL;
+	}
+	for (; i < len; i++) {
+		hash = (hash ^ data[i]) * 16777619UL;
+	}
+	/* FNV's low bits are weak after word steps, so fold the top in */
+	return hash ^ (hash >> 15);
+}
+
+/* Sets the error, so it stops libgit2 when returned */
+static BOOL LGitSimilarCancelled(volatile LONG *cancel)
+{
+	if (cancel == NULL || !*cancel) {
+		return FALSE;
+	}
+	git_error_set_str(GIT_ERROR_INVALID, "Rename detection was cancelled.");
+	return TRUE;
+}
+
+static bool LGitSimilarChunkLess(const LGitSimilarChunk &a, const LGitSimilarChunk &b)
+{
+	return a.hash < b.hash;
+}
+
+static int LGitSimilarBufferSignature(void **out,
+									  const git_diff_file *file,
+									  const char *buf,
+									  size_t buflen,
+									  void *payload)
+{
+	std::vector<LGitSimilarChunk> chunks;
+	LGitSimilarChunk chunk;
+	LGitSimilarSig *sig;
+	size_t start, i, j;
+	const BYTE *data = (const BYTE*)buf;
+	LGitSimilarParams *params = (LGitSimilarParams*)payload;
+
+	*out = NULL;
+	if (LGitSimilarCancelled(params->cancel)) {
+		return -1;
+	}
+	if (buflen < SIMILAR_MIN_SIZE) {
+		return GIT_EBUFS;
+	}
+	chunks.reserve(buflen / 32 + 1);
+	for (start = 0, i = 0; i < buflen; i++) {
+		if (data[i] == '\n' || i - start + 1 == SIMILAR_MAX_CHUNK || i + 1 == buflen) {
+			chunk.hash = LGitSimilarHash(data + start, i - start + 1);
+			chunk.bytes = i - start + 1;
+			chunks.push_back(chunk);
+			start = i + 1;
+		}
+	}
+	std::sort(chunks.begin(), chunks.end(), LGitSimilarChunkLess);
+	/* Repeated chunks become one, with all their bytes */
+	for (i = 0, j = 0; i < chunks.size(); i++) {
+		if (j > 0 && chunks[j - 1].hash == chunks[i].hash) {
+			chunks[j - 1].bytes += chunks[i].bytes;
+		} else {
+			chunks[j++] = chunks[i];
+		}
+	}
+	sig = (LGitSimilarSig*)malloc(sizeof(LGitSimilarSig) + (j * sizeof(LGitSimilarChunk)));
+	if (sig == NULL) {
+		git_error_set_str(GIT_ERROR_NOMEMORY, "Out of memory hashing for renames.");
+		return -1;
+	}
+	sig->size = buflen;
+	sig->count = j;
+	if (j > 0) {
+		memcpy(sig->chunks, &chunks[0], j * sizeof(LGitSimilarChunk));
+	}
+	*out = sig;
+	return 0;
+}
+
+/* Files in the working tree; the rest come from the ODB as buffers */
+static int LGitSimilarFileSignature(void **out,
+									const git_diff_file *file,
+									const char *fullpath,
+									void *payload)
+{
+	wchar_t path[1024];
+	char *buf;
+	DWORD size, size_high, read;
+	HANDLE handle;
+	LGitSimilarParams *params = (LGitSimilarParams*)payload;
+	int rc;
+
+	*out = NULL;
+	if (LGitSimilarCancelled(params->cancel)) {
+		return -1;
+	}
+	LGitUtf8ToWide(fullpath, path, 1024);
+	LGitTranslateStringCharsW(path, L'/', L'\\');
+	handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		/* Gone since the diff was made; just don't pair it */
+		return GIT_EBUFS;
+	}
+	size = GetFileSize(handle, &size_high);
+	if (size == 0xFFFFFFFF || size_high != 0 || size > SIMILAR_MAX_SIZE || size < SIMILAR_MIN_SIZE) {
+		CloseHandle(handle);
+		return GIT_EBUFS;
+	}
+	buf = (char*)malloc(size);
+	if (buf == NULL) {
+		CloseHandle(handle);
+		return GIT_EBUFS;
+	}
+	if (!ReadFile(handle, buf, size, &read, NULL) || read != size) {
+		rc = GIT_EBUFS;
+	} else {
+		rc = LGitSimilarBufferSignature(out, file, buf, size, payload);
+	}
+	free(buf);
+	CloseHandle(handle);
+	return rc;
+}
+
+static void LGitSimilarFreeSignature(void *sig, void *payload)
+{
+	free(sig);
+}
+
+static int LGitSimilarScore(int *score, void *siga, void *sigb, void *payload)
+{
+	const LGitSimilarSig *a = (const LGitSimilarSig*)siga;
+	const LGitSimilarSig *b = (const LGitSimilarSig*)sigb;
+	const LGitSimilarParams *params = (const LGitSimilarParams*)payload;
+	size_t larger, smaller, common = 0;
+	DWORD i = 0, j = 0;
+
+	/* Pairs are where the time goes, so check between each */
+	if (LGitSimilarCancelled(params->cancel)) {
+		return -1;
+	}
+
+	larger = a->size > b->size ? a->size : b->size;
+	smaller = a->size > b->size ? b->size : a->size;
+	/* Can't make it even if all of the smaller one is in the larger one */
+	if (larger == 0 || (smaller * 100) / larger < (size_t)params->threshold) {
+		*score = 0;
+		return 0;
+	}
+	while (i < a->count && j < b->count) {
+		if (a->chunks[i].hash < b->chunks[j].hash) {
+			i++;
+		} else if (a->chunks[i].hash > b->chunks[j].hash) {
+			j++;
+		} else {
+			common += a->chunks[i].bytes < b->chunks[j].bytes
+				? a->chunks[i].bytes
+				: b->chunks[j].bytes;
+			i++;
+			j++;
+		}
+	}
+	*score = (int)((common * 100) / larger);
+	return 0;
+}
+
+/*
+ * Turns added and deleted pairs in the diff into renames (and modified or
+ * added into copies, if asked). Returns a libgit2 error code; if cancel
+ * (which can be NULL) gets set, it stops with an error and the diff is left
+ * with what the exact pass found.
+ */
+int LGitFindRenames(git_diff *diff, BOOL copies, volatile LONG *cancel)
+{
+	git_diff_find_options find_opts;
+	git_diff_similarity_metric metric;
+	LGitSimilarParams params;
+	size_t before = git_diff_num_deltas(diff);
+	DWORD begin = GetTickCount(), exact;
+	int rc;
+
+	/* Exact first; cheap, and not subject to the limit pairs are */
+	git_diff_find_options_init(&find_opts, GIT_DIFF_FIND_OPTIONS_VERSION);
+	find_opts.flags = GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_EXACT_MATCH_ONLY;
+	if (copies) {
+		find_opts.flags |= GIT_DIFF_FIND_COPIES;
+	}
+	if ((rc = git_diff_find_similar(diff, &find_opts)) != 0) {
+		return rc;
+	}
+	exact = GetTickCount() - begin;
+	if (LGitSimilarCancelled(cancel)) {
+		return -1;
+	}
+
+	metric.file_signature = LGitSimilarFileSignature;
+	metric.buffer_signature = LGitSimilarBufferSignature;
+	metric.free_signature = LGitSimilarFreeSignature;
+	metric.similarity = LGitSimilarScore;
+	params.threshold = SIMILAR_THRESHOLD;
+	params.cancel = cancel;
+	metric.payload = &params;
+	git_diff_find_options_init(&find_opts, GIT_DIFF_FIND_OPTIONS_VERSION);
+	find_opts.flags = GIT_DIFF_FIND_RENAMES;
+	if (copies) {
+		find_opts.flags |= GIT_DIFF_FIND_COPIES;
+	}
+	find_opts.rename_threshold = find_opts.copy_threshold = SIMILAR_THRESHOLD;
+	find_opts.rename_limit = rename_limit;
+	find_opts.metric = &metric;
+	rc = git_diff_find_similar(diff, &find_opts);
+	LGitLog(" ! Renames: %d deltas to %d, exact in %u ms, all in %u ms\n",
+		before,
+		git_diff_num_deltas(diff),
+		exact,
+		GetTickCount() - begin);
+	return rc;
+}
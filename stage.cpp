@@ -19,7 +19,8 @@ SCCRTN LGitStageAddFiles(LGitContext *ctx, HWND hwnd, git_strarray *paths, BOOL
 	LGitLog("  update? %d\n", update);
 	SCCRTN ret = SCC_OK;
 	git_index *index = NULL;
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		LGitLibraryError(hwnd, "Acquiring Stage");
 		ret = SCC_E_NONSPECIFICERROR;
 		goto fin;
@@ -43,9 +44,6 @@ SCCRTN LGitStageAddFiles(LGitContext *ctx, HWND hwnd, git_strarray *paths, BOOL
 		goto fin;
 	}
 fin:
-	if (index != NULL) {
-		git_index_free(index);
-	}
 	return ret;
 }
 
@@ -55,7 +53,8 @@ SCCRTN LGitStageRemoveFiles(LGitContext *ctx, HWND hwnd, git_strarray *paths)
 	LGitLog("  paths count %u\n", paths->count);
 	SCCRTN ret = SCC_OK;
 	git_index *index = NULL;
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		LGitLibraryError(hwnd, "Acquiring Stage");
 		ret = SCC_E_NONSPECIFICERROR;
 		goto fin;
@@ -71,9 +70,6 @@ SCCRTN LGitStageRemoveFiles(LGitContext *ctx, HWND hwnd, git_strarray *paths)
 		goto fin;
 	}
 fin:
-	if (index != NULL) {
-		git_index_free(index);
-	}
 	return ret;
 }
 
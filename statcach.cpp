@@ -0,0 +1,316 @@
+/*
+ * Status cache, so repeated queries from the IDE don't rescan the workdir.
+ *
+ * Entries are whatever a status scan told us about a path. They're thrown
+ * out when the filesystem says the path changed (ReadDirectoryChangesW on
+ * the workdir), or all at once when the index or HEAD changes on disk. The
+ * change notifications are drained synchronously before each lookup, so a
+ * file saved right before a query can't be answered from a stale entry.
+ *
+ * HEAD's file only changes when it's pointed somewhere else; moving the
+ * branch it's on (soft resets, update-ref, fetches into it) only touches the
+ * refs, so the commit it resolves to is checked too.
+ */
+
+#include "stdafx.h"
+
+typedef struct _LGitStatusCacheEntry {
+	int rc;
+	unsigned int flags;
+} LGitStatusCacheEntry;
+
+typedef std::map<std::string, LGitStatusCacheEntry, LGitPathLess> LGitStatusCacheMap;
+
+/* Notifications in a single read; if it overflows, we drop everything */
+#define CHANGE_BUFFER_SIZE 0x10000
+
+#define CHANGE_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME \
+	| FILE_NOTIFY_CHANGE_DIR_NAME \
+	| FILE_NOTIFY_CHANGE_SIZE \
+	| FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+struct _LGitStatusCache {
+	LGitStatusCacheMap *entries;
+	/* Watching the workdir */
+	HANDLE dir;
+	OVERLAPPED overlapped;
+	BOOL pending;
+	BYTE *buffer;
+	/* Stat data for what invalidates everything */
+	wchar_t index_path[1024], head_path[1024];
+	WIN32_FILE_ATTRIBUTE_DATA index_attr, head_attr;
+	/* What HEAD resolved to; zero if unborn */
+	git_oid head_oid;
+	/* Statistics */
+	LONG hits, misses, invalidations;
+};
+
+static BOOL LGitStatusCacheWatch(LGitStatusCache *cache)
+{
+	ResetEvent(cache->overlapped.hEvent);
+	if (!ReadDirectoryChangesW(cache->dir,
+		cache->buffer,
+		CHANGE_BUFFER_SIZE,
+		TRUE,
+		CHANGE_FILTER,
+		NULL,
+		&cache->overlapped,
+		NULL)) {
+		LGitLog("!! ReadDirectoryChangesW failed (GLE %x)\n", GetLastError());
+		return FALSE;
+	}
+	cache->pending = TRUE;
+	return TRUE;
+}
+
+static void LGitStatusCacheStopWatching(LGitStatusCache *cache)
+{
+	DWORD bytes;
+	if (cache->dir != INVALID_HANDLE_VALUE) {
+		if (cache->pending) {
+			/* The buffer has to outlive the read */
+			CancelIo(cache->dir);
+			GetOverlappedResult(cache->dir, &cache->overlapped, &bytes, TRUE);
+			cache->pending = FALSE;
+		}
+		CloseHandle(cache->dir);
+		cache->dir = INVALID_HANDLE_VALUE;
+	}
+	/* Nothing can tell us about changes anymore */
+	cache->entries->clear();
+}
+
+/* Records the new one either way */
+static BOOL LGitStatusCacheHeadChanged(LGitContext *ctx, LGitStatusCache *cache)
+{
+	git_oid head_oid;
+	if (git_reference_name_to_id(&head_oid, ctx->repo, "HEAD") != 0) {
+		memset(&head_oid, 0, sizeof(git_oid));
+	}
+	if (git_oid_equal(&head_oid, &cache->head_oid)) {
+		return FALSE;
+	}
+	git_oid_cpy(&cache->head_oid, &head_oid);
+	return TRUE;
+}
+
+void LGitStatusCacheInit(LGitContext *ctx)
+{
+	LGitStatusCache *cache;
+	const char *git_dir;
+	char path[1024];
+
+	cache = (LGitStatusCache*)calloc(1, sizeof(LGitStatusCache));
+	if (cache == NULL) {
+		return;
+	}
+	cache->entries = new LGitStatusCacheMap();
+	cache->buffer = (BYTE*)malloc(CHANGE_BUFFER_SIZE);
+	cache->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	/* NT only; on 9x we just won't cache anything */
+	cache->dir = CreateFileW(ctx->workdir_path_utf16,
+		FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+		NULL);
+	if (cache->buffer == NULL || cache->overlapped.hEvent == NULL) {
+		LGitStatusCacheStopWatching(cache);
+	} else if (cache->dir == INVALID_HANDLE_VALUE) {
+		LGitLog(" ! Can't watch workdir (GLE %x), status cache disabled\n", GetLastError());
+	} else if (!LGitStatusCacheWatch(cache)) {
+		LGitStatusCacheStopWatching(cache);
+	}
+
+	git_dir = git_repository_path(ctx->repo);
+	strlcpy(path, git_dir, 1024);
+	strlcat(path, "index", 1024);
+	LGitUtf8ToWide(path, cache->index_path, 1024);
+	strlcpy(path, git_dir, 1024);
+	strlcat(path, "HEAD", 1024);
+	LGitUtf8ToWide(path, cache->head_path, 1024);
+	GetFileAttributesExW(cache->index_path, GetFileExInfoStandard, &cache->index_attr);
+	GetFileAttributesExW(cache->head_path, GetFileExInfoStandard, &cache->head_attr);
+	LGitStatusCacheHeadChanged(ctx, cache);
+
+	ctx->statusCache = cache;
+}
+
+void LGitStatusCacheFree(LGitContext *ctx)
+{
+	LGitStatusCache *cache = ctx->statusCache;
+	if (cache == NULL) {
+		return;
+	}
+	LGitLog(" ! Status cache: %d hits, %d misses, %d invalidations\n",
+		cache->hits,
+		cache->misses,
+		cache->invalidations);
+	LGitStatusCacheStopWatching(cache);
+	if (cache->overlapped.hEvent != NULL) {
+		CloseHandle(cache->overlapped.hEvent);
+	}
+	if (cache->buffer != NULL) {
+		free(cache->buffer);
+	}
+	delete cache->entries;
+	free(cache);
+	ctx->statusCache = NULL;
+}
+
+/* Drops every entry whose path is prefix, or under it if it's a directory */
+static void LGitStatusCacheInvalidatePrefix(LGitStatusCache *cache, const char *prefix)
+{
+	size_t len = strlen(prefix);
+	std::string dir(prefix);
+	LGitStatusCacheMap::iterator it;
+
+	if (len == 0) {
+		cache->invalidations += cache->entries->size();
+		cache->entries->clear();
+		return;
+	}
+	it = cache->entries->find(dir);
+	if (it != cache->entries->end()) {
+		cache->entries->erase(it);
+		cache->invalidations++;
+	}
+	dir += '/';
+	len++;
+	it = cache->entries->lower_bound(dir);
+	while (it != cache->entries->end()
+		&& _strnicmp(it->first.c_str(), dir.c_str(), len) == 0) {
+		cache->entries->erase(it++);
+		cache->invalidations++;
+	}
+}
+
+static void LGitStatusCacheProcessChange(LGitStatusCache *cache,
+										 const FILE_NOTIFY_INFORMATION *fni)
+{
+	char path[2048];
+	int len;
+	len = WideCharToMultiByte(CP_UTF8, 0,
+		fni->FileName, fni->FileNameLength / sizeof(WCHAR),
+		path, sizeof(path) - 1,
+		NULL, NULL);
+	if (len <= 0) {
+		return;
+	}
+	path[len] = '\0';
+	LGitTranslateStringChars(path, '\\', '/');
+	/* The index and HEAD are checked separately; ignore object churn */
+	if (_strnicmp(path, ".git/", 5) == 0 || _stricmp(path, ".git") == 0) {
+		return;
+	}
+	LGitStatusCacheInvalidatePrefix(cache, path);
+	/* Ignore rules apply to everything in the directory */
+	char *last_slash = strrchr(path, '/');
+	const char *base_name = last_slash == NULL ? path : last_slash + 1;
+	if (_stricmp(base_name, ".gitignore") == 0) {
+		if (last_slash == NULL) {
+			path[0] = '\0';
+		} else {
+			last_slash[0] = '\0';
+		}
+		LGitStatusCacheInvalidatePrefix(cache, path);
+	}
+}
+
+/*
+ * Applies any pending invalidations. Call before a batch of lookups; returns
+ * FALSE if the cache can't be used at all.
+ */
+BOOL LGitStatusCacheValidate(LGitContext *ctx)
+{
+	LGitStatusCache *cache = ctx->statusCache;
+	DWORD bytes;
+	if (cache == NULL || cache->dir == INVALID_HANDLE_VALUE) {
+		return FALSE;
+	}
+	while (WaitForSingleObject(cache->overlapped.hEvent, 0) == WAIT_OBJECT_0) {
+		cache->pending = FALSE;
+		if (!GetOverlappedResult(cache->dir, &cache->overlapped, &bytes, FALSE)) {
+			LGitLog("!! GetOverlappedResult failed (GLE %x)\n", GetLastError());
+			LGitStatusCacheStopWatching(cache);
+			return FALSE;
+		}
+		if (bytes == 0) {
+			/* Too much happened to fit in the buffer */
+			LGitLog(" ! Change buffer overflowed, dropping status cache\n");
+			LGitStatusCacheInvalidatePrefix(cache, "");
+		} else {
+			BYTE *cur = cache->buffer;
+			for (;;) {
+				FILE_NOTIFY_INFORMATION *fni = (FILE_NOTIFY_INFORMATION*)cur;
+				LGitStatusCacheProcessChange(cache, fni);
+				if (fni->NextEntryOffset == 0) {
+					break;
+				}
+				cur += fni->NextEntryOffset;
+			}
+		}
+		if (!LGitStatusCacheWatch(cache)) {
+			LGitStatusCacheStopWatching(cache);
+			return FALSE;
+		}
+	}
+	/*
+	 * Staging, commits, checkouts, resets... all touch one of these. Not ||,
+	 * so each gets its new state recorded.
+	 */
+	if (LGitFileStatChanged(cache->index_path, &cache->index_attr)
+		| LGitFileStatChanged(cache->head_path, &cache->head_attr)
+		| LGitStatusCacheHeadChanged(ctx, cache)) {
+		LGitLog(" ! Index or HEAD changed, dropping status cache\n");
+		LGitStatusCacheInvalidatePrefix(cache, "");
+	}
+	return TRUE;
+}
+
+/* Relative path with forward slashes; rc is as if from git_status_file */
+BOOL LGitStatusCacheLookup(LGitContext *ctx, const char *path, int *rc, unsigned int *flags)
+{
+	LGitStatusCache *cache = ctx->statusCache;
+	if (cache == NULL || cache->dir == INVALID_HANDLE_VALUE) {
+		return FALSE;
+	}
+	LGitStatusCacheMap::iterator it = cache->entries->find(path);
+	if (it == cache->entries->end()) {
+		cache->misses++;
+		return FALSE;
+	}
+	cache->hits++;
+	*rc = it->second.rc;
+	*flags = it->second.flags;
+	return TRUE;
+}
+
+void LGitStatusCacheStore(LGitContext *ctx, const char *path, int rc, unsigned int flags)
+{
+	LGitStatusCache *cache = ctx->statusCache;
+	if (cache == NULL || cache->dir == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	LGitStatusCacheEntry entry;
+	entry.rc = rc;
+	entry.flags = flags;
+	(*cache->entries)[path] = entry;
+}
+
+/* For when we know we've changed things behind the watcher's back */
+void LGitStatusCacheInvalidate(LGitContext *ctx)
+{
+	if (ctx->statusCache != NULL) {
+		LGitStatusCacheInvalidatePrefix(ctx->statusCache, "");
+	}
+}
+
+void LGitStatusCacheStats(LGitContext *ctx, LONG *hits, LONG *misses, LONG *invalidations)
+{
+	LGitStatusCache *cache = ctx->statusCache;
+	*hits = cache != NULL ? cache->hits : 0;
+	*misses = cache != NULL ? cache->misses : 0;
+	*invalidations = cache != NULL ? cache->invalidations : 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * Per-operation statistics, for finding out where the time goes when the
+ * IDE stalls. Each Scc* entry point is timed with an LGitOpTimer; results
+ * are kept per context, shown off the about dialog, and appended as a line
+ * of JSON to a file when the context goes away.
+ */
+
+#include "stdafx.h"
+
+typedef std::map<std::string, LGitOpStats> LGitOpStatsMap;
+
+struct _LGitStats {
+	CRITICAL_SECTION lock;
+	LGitOpStatsMap *ops;
+	DWORD started;
+};
+
+/* Kernel and user time of this thread, in ms */
+static DWORD LGitThreadCpuTime(void)
+{
+	FILETIME creation, exit, kernel, user;
+	ULARGE_INTEGER k, u;
+	/* Not on 9x; then CPU time just reads as zero */
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+		return 0;
+	}
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (DWORD)((k.QuadPart + u.QuadPart) / 10000);
+}
+
+LGitOpTimer::LGitOpTimer(LPVOID context, const char *op, LONG files)
+{
+	this->ctx = (LGitContext*)context;
+	this->op = op;
+	this->files = files;
+	this->start = GetTickCount();
+	this->start_cpu = LGitThreadCpuTime();
+}
+
+LGitOpTimer::~LGitOpTimer()
+{
+	if (ctx == NULL) {
+		return;
+	}
+	LGitStatsRecord(ctx,
+		op,
+		GetTickCount() - start,
+		LGitThreadCpuTime() - start_cpu,
+		files);
+}
+
+void LGitStatsInit(LGitContext *ctx)
+{
+	LGitStats *stats = (LGitStats*)calloc(1, sizeof(LGitStats));
+	if (stats == NULL) {
+		return;
+	}
+	InitializeCriticalSection(&stats->lock);
+	stats->ops = new LGitOpStatsMap();
+	stats->started = GetTickCount();
+	ctx->stats = stats;
+}
+
+void LGitStatsFree(LGitContext *ctx)
+{
+	LGitStats *stats = ctx->stats;
+	if (stats == NULL) {
+		return;
+	}
+	delete stats->ops;
+	DeleteCriticalSection(&stats->lock);
+	free(stats);
+	ctx->stats = NULL;
+}
+
+/* Bucket i holds times under 2^i ms; the last is everything longer */
+static int LGitStatsBucket(DWORD ms)
+{
+	int bucket = 0;
+	while (bucket < LGIT_STATS_BUCKETS - 1 && ms >= (DWORD)(1 << bucket)) {
+		bucket++;
+	}
+	return bucket;
+}
+
+void LGitStatsRecord(LGitContext *ctx, const char *op, DWORD ms, DWORD cpu_ms, LONG files)
+{
+	LGitStats *stats = ctx->stats;
+	LGitOpStatsMap::iterator it;
+	LGitOpStats *entry, empty;
+	if (stats == NULL) {
+		return;
+	}
+	EnterCriticalSection(&stats->lock);
+	it = stats->ops->find(op);
+	if (it == stats->ops->end()) {
+		/* VC6 doesn't zero PODs made by operator[] */
+		ZeroMemory(&empty, sizeof(empty));
+		it = stats->ops->insert(LGitOpStatsMap::value_type(op, empty)).first;
+	}
+	entry = &it->second;
+	entry->calls++;
+	entry->total_ms += ms;
+	entry->cpu_ms += cpu_ms;
+	entry->files += files;
+	if (ms > entry->max_ms) {
+		entry->max_ms = ms;
+	}
+	entry->histogram[LGitStatsBucket(ms)]++;
+	LeaveCriticalSection(&stats->lock);
+}
+
+/* Upper bound of the bucket the percentile falls in, in ms */
+DWORD LGitStatsPercentile(const LGitOpStats *entry, int percent)
+{
+	LONG wanted, seen = 0;
+	int i;
+	if (entry->calls == 0) {
+		return 0;
+	}
+	wanted = (entry->calls * percent + 99) / 100;
+	for (i = 0; i < LGIT_STATS_BUCKETS - 1; i++) {
+		seen += entry->histogram[i];
+		if (seen >= wanted) {
+			return 1 << i;
+		}
+	}
+	return entry->max_ms;
+}
+
+/*
+ * Calls back for each operation, in name order, with a copy of its stats,
+ * so the callback can take its time without holding anyone up.
+ */
+void LGitStatsForeach(LGitContext *ctx, LGitStatsCallback cb, void *payload)
+{
+	LGitStats *stats = ctx->stats;
+	LGitOpStatsMap copy;
+	LGitOpStatsMap::iterator it;
+	if (stats == NULL) {
+		return;
+	}
+	EnterCriticalSection(&stats->lock);
+	copy = *stats->ops;
+	LeaveCriticalSection(&stats->lock);
+	for (it = copy.begin(); it != copy.end(); it++) {
+		cb(it->first.c_str(), &it->second, payload);
+	}
+}
+
+typedef struct _LGitStatsDumpParams {
+	std::string *json;
+	BOOL first;
+} LGitStatsDumpParams;
+
+static void LGitStatsDumpOp(const char *op, const LGitOpStats *entry, void *payload)
+{
+	LGitStatsDumpParams *params = (LGitStatsDumpParams*)payload;
+	char buf[512];
+	int i;
+	/* Operation names are our own literals; nothing to escape */
+	_snprintf(buf, 512,
+		"%s\"%s\":{\"calls\":%d,\"total_ms\":%lu,\"cpu_ms\":%lu,"
+		"\"max_ms\":%lu,\"files\":%d,\"histogram_ms\":[",
+		params->first ? "" : ",",
+		op,
+		entry->calls,
+		entry->total_ms,
+		entry->cpu_ms,
+		entry->max_ms,
+		entry->files);
+	buf[511] = '\0';
+	*params->json += buf;
+	for (i = 0; i < LGIT_STATS_BUCKETS; i++) {
+		_snprintf(buf, 512, "%s%d", i == 0 ? "" : ",", entry->histogram[i]);
+		buf[511] = '\0';
+		*params->json += buf;
+	}
+	*params->json += "]}";
+	params->first = FALSE;
+}
+
+/*
+ * Appends the stats as one line of JSON to the file, so sessions from a
+ * machine can be collected. The histogram is bucketed by powers of two ms.
+ */
+BOOL LGitStatsDump(LGitContext *ctx, const wchar_t *path)
+{
+	LGitStatsDumpParams params;
+	std::string json;
+	char header[512], app[SCC_NAME_SIZE];
+	HANDLE file;
+	DWORD written;
+	BOOL ret;
+
+	if (ctx->stats == NULL) {
+		return FALSE;
+	}
+	/* The IDE's name is the only thing in here that might need escaping */
+	strlcpy(app, ctx->appName, SCC_NAME_SIZE);
+	LGitTranslateStringChars(app, '"', '\'');
+	LGitTranslateStringChars(app, '\\', '/');
+	_snprintf(header, 512,
+		"{\"version\":1,\"process\":%lu,\"app\":\"%s\",\"uptime_ms\":%lu,"
+		"\"buckets\":%d,\"ops\":{",
+		GetCurrentProcessId(),
+		app,
+		GetTickCount() - ctx->stats->started,
+		LGIT_STATS_BUCKETS);
+	header[511] = '\0';
+	json = header;
+	params.json = &json;
+	params.first = TRUE;
+	LGitStatsForeach(ctx, LGitStatsDumpOp, &params);
+	json += "}}\r\n";
+
+	file = CreateFileW(path,
+		FILE_APPEND_DATA,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL,
+		OPEN_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		LGitLog("!! Couldn't open stats file (GLE %x)\n", GetLastError());
+		return FALSE;
+	}
+	ret = WriteFile(file, json.c_str(), json.size(), &written, NULL);
+	CloseHandle(file);
+	return ret;
+}
+
+/* Where stats go by default, in the temporary directory */
+BOOL LGitStatsDefaultPath(wchar_t *buf, size_t bufsz)
+{
+	const wchar_t *name = L"VisualGitStats.jsonl";
+	DWORD length = GetTempPathW(bufsz, buf);
+	if (length == 0 || length + wcslen(name) >= bufsz) {
+		return FALSE;
+	}
+	wcscat(buf, name);
+	return TRUE;
+}
@@ -147,8 +147,8 @@ static SCCRTN ShowPropertiesDialog(LGitContext *ctx,
 	}
 
 	/* Get the index entry in case it turns out to be useful */
-	git_index *index = NULL;
-	if (git_repository_index(&index, ctx->repo) != 0) {
+	git_index *index = LGitSessionIndex(ctx);
+	if (index == NULL) {
 		LGitLibraryError(hWnd, "git_repository_index");
 		return SCC_E_NONSPECIFICERROR;
 	}
@@ -196,9 +196,6 @@ static SCCRTN ShowPropertiesDialog(LGitContext *ctx,
 
 	PropertySheetW(&psh);
 
-	if (index != NULL) {
-		git_index_free(index);
-	}
 	return SCC_OK;
 }
 
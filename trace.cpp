@@ -0,0 +1,631 @@
+/*
+ * Tracing behind LGitLog. Formatting and OutputDebugString are slow enough
+ * to show up in profiles when done per file in status loops, so records go
+ * into a per-thread ring with their arguments copied as-is, and a flusher
+ * thread formats and writes them out later.
+ *
+ * Each ring has one writer (its thread) and one reader (whoever holds the
+ * flush lock), so the writer never takes a lock. If a ring fills up before
+ * it's flushed, records are dropped and counted rather than blocking.
+ *
+ * Outside SccInitialize/SccUninitialize there's no flusher, so records are
+ * formatted and written immediately like LGitLog always did.
+ */
+
+#include "stdafx.h"
+
+/* Per thread; must be a power of two */
+#define TRACE_RING_RECORDS 256
+/* Copied arguments, including strings, for a record */
+#define TRACE_ARGS_SIZE 232
+/* Formatted output of a record */
+#define TRACE_LINE_SIZE 1024
+/* How often the flusher wakes up */
+#define TRACE_FLUSH_INTERVAL 50
+
+typedef enum _LGitTraceArg {
+	LGTA_NONE = 0,
+	LGTA_INT,
+	LGTA_INT64,
+	LGTA_DOUBLE,
+	LGTA_POINTER,
+	LGTA_STRING,
+	LGTA_WIDE_STRING,
+	LGTA_PERCENT,
+} LGitTraceArg;
+
+/* One conversion in a format string */
+typedef struct _LGitTraceSpec {
+	LGitTraceArg type;
+	int stars;
+	/* Flags, width and precision, without the length modifier */
+	const char *options;
+	size_t options_length;
+	/* Everything from the % on */
+	const char *spec;
+	size_t spec_length;
+} LGitTraceSpec;
+
+typedef struct _LGitTraceRecord {
+	/* Always a literal, so it outlives the record */
+	const char *format;
+	DWORD time;
+	WORD level;
+	/* Arguments that didn't fit are left out */
+	WORD truncated;
+	WORD length;
+	BYTE args[TRACE_ARGS_SIZE];
+} LGitTraceRecord;
+
+typedef struct _LGitTraceRing {
+	/* Never changed after being put on the list */
+	struct _LGitTraceRing *next;
+	DWORD thread_id;
+	/* The thread's gone; another can claim this once it's drained */
+	BOOL orphaned;
+	/* Free running counters; head is the writer's, tail the reader's */
+	volatile LONG head, tail, dropped;
+	LGitTraceRecord records[TRACE_RING_RECORDS];
+} LGitTraceRing;
+
+static DWORD trace_tls = TLS_OUT_OF_INDEXES;
+static CRITICAL_SECTION trace_rings_lock, trace_flush_lock;
+static LGitTraceRing *trace_rings = NULL;
+static volatile LONG trace_level = LGIT_TRACE_LEVEL;
+/* SccInitialize calls outstanding; the flusher runs while non-zero */
+static volatile LONG trace_users = 0;
+static HANDLE trace_flusher = NULL, trace_stop = NULL;
+static HANDLE trace_file = INVALID_HANDLE_VALUE;
+
+void LGitTraceProcessAttach(void)
+{
+	trace_tls = TlsAlloc();
+	InitializeCriticalSection(&trace_rings_lock);
+	InitializeCriticalSection(&trace_flush_lock);
+}
+
+void LGitTraceProcessDetach(void)
+{
+	LGitTraceRing *ring, *next;
+	/* No other threads are running by now */
+	LGitTraceFlush();
+	for (ring = trace_rings; ring != NULL; ring = next) {
+		next = ring->next;
+		free(ring);
+	}
+	trace_rings = NULL;
+	if (trace_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(trace_file);
+		trace_file = INVALID_HANDLE_VALUE;
+	}
+	if (trace_tls != TLS_OUT_OF_INDEXES) {
+		TlsFree(trace_tls);
+		trace_tls = TLS_OUT_OF_INDEXES;
+	}
+	DeleteCriticalSection(&trace_flush_lock);
+	DeleteCriticalSection(&trace_rings_lock);
+}
+
+void LGitTraceThreadDetach(void)
+{
+	LGitTraceRing *ring;
+	if (trace_tls == TLS_OUT_OF_INDEXES) {
+		return;
+	}
+	ring = (LGitTraceRing*)TlsGetValue(trace_tls);
+	if (ring != NULL) {
+		ring->orphaned = TRUE;
+		TlsSetValue(trace_tls, NULL);
+	}
+}
+
+static LGitTraceRing *LGitTraceThreadRing(void)
+{
+	LGitTraceRing *ring;
+	if (trace_tls == TLS_OUT_OF_INDEXES) {
+		return NULL;
+	}
+	ring = (LGitTraceRing*)TlsGetValue(trace_tls);
+	if (ring != NULL) {
+		return ring;
+	}
+	EnterCriticalSection(&trace_rings_lock);
+	/* Threads come and go (i.e. workers), so reuse what they left */
+	for (ring = trace_rings; ring != NULL; ring = ring->next) {
+		if (ring->orphaned && ring->head == ring->tail) {
+			break;
+		}
+	}
+	if (ring == NULL) {
+		ring = (LGitTraceRing*)calloc(1, sizeof(LGitTraceRing));
+		if (ring != NULL) {
+			ring->next = trace_rings;
+			trace_rings = ring;
+		}
+	}
+	if (ring != NULL) {
+		ring->orphaned = FALSE;
+		ring->thread_id = GetCurrentThreadId();
+	}
+	LeaveCriticalSection(&trace_rings_lock);
+	TlsSetValue(trace_tls, ring);
+	return ring;
+}
+
+/*
+ * Parses the conversion starting at the %, returning what's after it. Has
+ * to agree with the CRT on what consumes which arguments, since the record
+ * is decoded by walking the format again.
+ */
+static const char *LGitTraceParseSpec(const char *format, LGitTraceSpec *spec)
+{
+	const char *cur = format + 1;
+	BOOL wide = FALSE, narrow = FALSE, big = FALSE;
+	spec->spec = format;
+	spec->stars = 0;
+	spec->type = LGTA_NONE;
+	spec->options = cur;
+	while (*cur != '\0' && strchr("-+ #0", *cur) != NULL) {
+		cur++;
+	}
+	if (*cur == '*') {
+		spec->stars++;
+		cur++;
+	}
+	while (isdigit((unsigned char)*cur)) {
+		cur++;
+	}
+	if (*cur == '.') {
+		cur++;
+		if (*cur == '*') {
+			spec->stars++;
+			cur++;
+		}
+		while (isdigit((unsigned char)*cur)) {
+			cur++;
+		}
+	}
+	spec->options_length = cur - spec->options;
+	/* Length modifiers */
+	if (strncmp(cur, "I64", 3) == 0) {
+		big = TRUE;
+		cur += 3;
+	} else if (strncmp(cur, "I32", 3) == 0) {
+		cur += 3;
+	} else if (strncmp(cur, "ll", 2) == 0) {
+		big = TRUE;
+		cur += 2;
+	} else if (*cur == 'l' || *cur == 'w') {
+		wide = TRUE;
+		cur++;
+	} else if (*cur == 'h') {
+		narrow = TRUE;
+		cur++;
+	} else if (*cur == 'I' || *cur == 'L') {
+		cur++;
+	}
+	switch (*cur) {
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+	case 'c': case 'C':
+		spec->type = big ? LGTA_INT64 : LGTA_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'g': case 'G':
+		spec->type = LGTA_DOUBLE;
+		break;
+	case 'p': case 'n':
+		spec->type = LGTA_POINTER;
+		break;
+	case 's':
+		spec->type = wide ? LGTA_WIDE_STRING : LGTA_STRING;
+		break;
+	case 'S':
+		spec->type = narrow ? LGTA_STRING : LGTA_WIDE_STRING;
+		break;
+	case '%':
+		spec->type = LGTA_PERCENT;
+		break;
+	case '\0':
+		/* Trailing %, don't run off the end */
+		spec->spec_length = cur - format;
+		return cur;
+	}
+	cur++;
+	spec->spec_length = cur - format;
+	return cur;
+}
+
+static BOOL LGitTraceEncode(BYTE **cur, BYTE *end, const void *value, size_t length)
+{
+	if ((size_t)(end - *cur) < length) {
+		return FALSE;
+	}
+	memcpy(*cur, value, length);
+	*cur += length;
+	return TRUE;
+}
+
+/* Copies the arguments the format would use; FALSE if they didn't all fit */
+static BOOL LGitTraceEncodeArgs(LGitTraceRecord *record, va_list va)
+{
+	const char *format = record->format;
+	BYTE *cur = record->args, *end = record->args + TRACE_ARGS_SIZE;
+	LGitTraceSpec spec;
+	int i, int_value, length;
+	__int64 int64_value;
+	double double_value;
+	void *pointer_value;
+	const char *string_value;
+	const wchar_t *wide_value;
+
+	/* Whatever's decoded has to be in here, not left over from before */
+	record->length = 0;
+
+	while ((format = strchr(format, '%')) != NULL) {
+		format = LGitTraceParseSpec(format, &spec);
+		for (i = 0; i < spec.stars; i++) {
+			int_value = va_arg(va, int);
+			if (!LGitTraceEncode(&cur, end, &int_value, sizeof(int))) {
+				return FALSE;
+			}
+		}
+		switch (spec.type) {
+		case LGTA_INT:
+			int_value = va_arg(va, int);
+			if (!LGitTraceEncode(&cur, end, &int_value, sizeof(int))) {
+				return FALSE;
+			}
+			break;
+		case LGTA_INT64:
+			int64_value = va_arg(va, __int64);
+			if (!LGitTraceEncode(&cur, end, &int64_value, sizeof(__int64))) {
+				return FALSE;
+			}
+			break;
+		case LGTA_DOUBLE:
+			double_value = va_arg(va, double);
+			if (!LGitTraceEncode(&cur, end, &double_value, sizeof(double))) {
+				return FALSE;
+			}
+			break;
+		case LGTA_POINTER:
+			pointer_value = va_arg(va, void*);
+			if (!LGitTraceEncode(&cur, end, &pointer_value, sizeof(void*))) {
+				return FALSE;
+			}
+			break;
+		case LGTA_STRING:
+			/* The caller's buffer is long gone by the time it's formatted */
+			string_value = va_arg(va, const char*);
+			if (string_value == NULL) {
+				string_value = "(null)";
+			}
+			length = strlen(string_value) + 1;
+			if (!LGitTraceEncode(&cur, end, string_value, length)) {
+				/* Keep what fits of it, at least */
+				if (cur < end) {
+					length = end - cur - 1;
+					memcpy(cur, string_value, length);
+					cur[length] = '\0';
+					cur = end;
+				}
+				record->length = cur - record->args;
+				return FALSE;
+			}
+			break;
+		case LGTA_WIDE_STRING:
+			/* Stored as UTF-8 and printed with %s */
+			wide_value = va_arg(va, const wchar_t*);
+			if (wide_value == NULL) {
+				wide_value = L"(null)";
+			}
+			length = WideCharToMultiByte(CP_UTF8, 0, wide_value, -1,
+				(char*)cur, end - cur, NULL, NULL);
+			if (length == 0) {
+				record->length = cur - record->args;
+				return FALSE;
+			}
+			cur += length;
+			break;
+		default:
+			break;
+		}
+		record->length = cur - record->args;
+	}
+	return TRUE;
+}
+
+static BOOL LGitTraceDecode(const BYTE **cur, const BYTE *end, void *value, size_t length)
+{
+	if ((size_t)(end - *cur) < length) {
+		return FALSE;
+	}
+	memcpy(value, *cur, length);
+	*cur += length;
+	return TRUE;
+}
+
+/* Formats one conversion; the stars' values are in star */
+static void LGitTraceFormatSpec(char *buf, size_t bufsz,
+								const char *spec, int stars, int *star,
+								LGitTraceArg type, const BYTE **cur, const BYTE *end)
+{
+	int int_value;
+	__int64 int64_value;
+	double double_value;
+	void *pointer_value;
+	const char *string_value;
+	buf[0] = '\0';
+	/* Each case decodes the value, then uses the spec once */
+#define TRACE_FORMAT(value) \
+	switch (stars) { \
+	case 0: _snprintf(buf, bufsz, spec, value); break; \
+	case 1: _snprintf(buf, bufsz, spec, star[0], value); break; \
+	default: _snprintf(buf, bufsz, spec, star[0], star[1], value); break; \
+	}
+	switch (type) {
+	case LGTA_INT:
+		if (LGitTraceDecode(cur, end, &int_value, sizeof(int))) {
+			TRACE_FORMAT(int_value);
+		}
+		break;
+	case LGTA_INT64:
+		if (LGitTraceDecode(cur, end, &int64_value, sizeof(__int64))) {
+			TRACE_FORMAT(int64_value);
+		}
+		break;
+	case LGTA_DOUBLE:
+		if (LGitTraceDecode(cur, end, &double_value, sizeof(double))) {
+			TRACE_FORMAT(double_value);
+		}
+		break;
+	case LGTA_POINTER:
+		/* %n is consumed, but never written through */
+		if (LGitTraceDecode(cur, end, &pointer_value, sizeof(void*))
+			&& spec[strlen(spec) - 1] != 'n') {
+			TRACE_FORMAT(pointer_value);
+		}
+		break;
+	case LGTA_STRING:
+	case LGTA_WIDE_STRING:
+		string_value = (const char*)*cur;
+		if (memchr(string_value, '\0', end - *cur) != NULL) {
+			*cur += strlen(string_value) + 1;
+			TRACE_FORMAT(string_value);
+		}
+		break;
+	default:
+		break;
+	}
+	buf[bufsz - 1] = '\0';
+#undef TRACE_FORMAT
+}
+
+/* Walks the format again, this time consuming copied arguments */
+static void LGitTraceFormat(const LGitTraceRecord *record, char *line, size_t linesz)
+{
+	const char *format = record->format, *next;
+	const BYTE *cur = record->args, *end = record->args + record->length;
+	LGitTraceSpec spec;
+	char spec_buf[64], value[TRACE_LINE_SIZE];
+	size_t used = 0, length;
+	int star[2], i;
+
+	line[0] = '\0';
+	while (*format != '\0' && used < linesz - 1) {
+		next = strchr(format, '%');
+		length = next == NULL ? strlen(format) : (size_t)(next - format);
+		if (length > linesz - 1 - used) {
+			length = linesz - 1 - used;
+		}
+		memcpy(line + used, format, length);
+		used += length;
+		line[used] = '\0';
+		if (next == NULL) {
+			break;
+		}
+		format = LGitTraceParseSpec(next, &spec);
+		if (spec.type == LGTA_PERCENT) {
+			strlcat(line, "%", linesz);
+			used = strlen(line);
+			continue;
+		} else if (spec.type == LGTA_NONE || spec.spec_length + 2 > sizeof(spec_buf)) {
+			continue;
+		}
+		for (i = 0; i < spec.stars; i++) {
+			if (!LGitTraceDecode(&cur, end, &star[i], sizeof(int))) {
+				star[i] = 0;
+			}
+		}
+		/* Strings are always narrow by now */
+		if (spec.type == LGTA_STRING || spec.type == LGTA_WIDE_STRING) {
+			spec_buf[0] = '%';
+			memcpy(spec_buf + 1, spec.options, spec.options_length);
+			spec_buf[spec.options_length + 1] = 's';
+			spec_buf[spec.options_length + 2] = '\0';
+		} else {
+			memcpy(spec_buf, spec.spec, spec.spec_length);
+			spec_buf[spec.spec_length] = '\0';
+		}
+		LGitTraceFormatSpec(value, sizeof(value), spec_buf, spec.stars, star,
+			spec.type, &cur, end);
+		strlcat(line, value, linesz);
+		used = strlen(line);
+	}
+	if (record->truncated) {
+		strlcat(line, " (...)\n", linesz);
+	}
+}
+
+static void LGitTraceWrite(DWORD thread_id, DWORD time, const char *line)
+{
+	char prefix[32];
+	DWORD written;
+	if (trace_file == INVALID_HANDLE_VALUE) {
+		OutputDebugStringA(line);
+		return;
+	}
+	/* Nothing else to tell threads apart in a file */
+	_snprintf(prefix, 32, "%10lu %5lu ", time, thread_id);
+	prefix[31] = '\0';
+	WriteFile(trace_file, prefix, strlen(prefix), &written, NULL);
+	WriteFile(trace_file, line, strlen(line), &written, NULL);
+}
+
+void LGitTraceFlush(void)
+{
+	LGitTraceRing *ring;
+	LGitTraceRecord *record;
+	char line[TRACE_LINE_SIZE];
+	LONG head, tail, dropped;
+
+	EnterCriticalSection(&trace_flush_lock);
+	EnterCriticalSection(&trace_rings_lock);
+	ring = trace_rings;
+	LeaveCriticalSection(&trace_rings_lock);
+	for (; ring != NULL; ring = ring->next) {
+		head = ring->head;
+		tail = ring->tail;
+		while (tail != head) {
+			record = &ring->records[(DWORD)tail & (TRACE_RING_RECORDS - 1)];
+			LGitTraceFormat(record, line, TRACE_LINE_SIZE);
+			LGitTraceWrite(ring->thread_id, record->time, line);
+			tail++;
+		}
+		/* Only now can the writer reuse the slots */
+		InterlockedExchange(&ring->tail, tail);
+		dropped = InterlockedExchange(&ring->dropped, 0);
+		if (dropped > 0) {
+			_snprintf(line, TRACE_LINE_SIZE, " ! Trace: dropped %d records\n", dropped);
+			line[TRACE_LINE_SIZE - 1] = '\0';
+			LGitTraceWrite(ring->thread_id, GetTickCount(), line);
+		}
+	}
+	LeaveCriticalSection(&trace_flush_lock);
+}
+
+static unsigned __stdcall LGitTraceFlusher(void *unused)
+{
+	while (WaitForSingleObject(trace_stop, TRACE_FLUSH_INTERVAL) == WAIT_TIMEOUT) {
+		LGitTraceFlush();
+	}
+	return 0;
+}
+
+void LGitTraceV(int level, const char *format_str, va_list va)
+{
+	LGitTraceRing *ring;
+	LGitTraceRecord *record, immediate;
+	char line[TRACE_LINE_SIZE];
+	LONG head;
+
+	if (level > trace_level) {
+		return;
+	}
+	ring = trace_users > 0 ? LGitTraceThreadRing() : NULL;
+	if (ring == NULL) {
+		/* No flusher (or no memory); do it now */
+		immediate.format = format_str;
+		immediate.time = GetTickCount();
+		immediate.level = level;
+		immediate.truncated = !LGitTraceEncodeArgs(&immediate, va);
+		LGitTraceFormat(&immediate, line, TRACE_LINE_SIZE);
+		EnterCriticalSection(&trace_flush_lock);
+		LGitTraceWrite(GetCurrentThreadId(), immediate.time, line);
+		LeaveCriticalSection(&trace_flush_lock);
+		return;
+	}
+	head = ring->head;
+	if ((DWORD)(head - ring->tail) >= TRACE_RING_RECORDS) {
+		InterlockedIncrement(&ring->dropped);
+		return;
+	}
+	record = &ring->records[(DWORD)head & (TRACE_RING_RECORDS - 1)];
+	record->format = format_str;
+	record->time = GetTickCount();
+	record->level = level;
+	record->truncated = !LGitTraceEncodeArgs(record, va);
+	/* Publishes the record to the flusher */
+	InterlockedExchange(&ring->head, head + 1);
+}
+
+void LGitTrace(int level, const char *format_str, ...)
+{
+	va_list va;
+	va_start(va, format_str);
+	LGitTraceV(level, format_str, va);
+	va_end(va);
+}
+
+void LGitTraceDebug(const char *format_str, ...)
+{
+	va_list va;
+	va_start(va, format_str);
+	LGitTraceV(LGTL_DEBUG, format_str, va);
+	va_end(va);
+}
+
+/* Runtime filter, on top of what's compiled in */
+void LGitTraceSetLevel(int level)
+{
+	InterlockedExchange(&trace_level, level);
+}
+
+/* Sends records to a file instead of the debugger; the first one set wins */
+void LGitTraceSetFile(const char *path)
+{
+	HANDLE file;
+	wchar_t path_utf16[1024];
+	if (trace_file != INVALID_HANDLE_VALUE || path == NULL || path[0] == '\0') {
+		return;
+	}
+	LGitUtf8ToWide(path, path_utf16, 1024);
+	file = CreateFileW(path_utf16,
+		GENERIC_WRITE,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		LGitLog("!! Couldn't open trace file %s (GLE %x)\n", path, GetLastError());
+		return;
+	}
+	SetFilePointer(file, 0, NULL, FILE_END);
+	EnterCriticalSection(&trace_flush_lock);
+	trace_file = file;
+	LeaveCriticalSection(&trace_flush_lock);
+}
+
+/* Called from SccInitialize; starts the flusher for the first one */
+void LGitTraceInit(void)
+{
+	unsigned thread_id;
+	if (InterlockedIncrement(&trace_users) != 1) {
+		return;
+	}
+	trace_stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	trace_flusher = (HANDLE)_beginthreadex(NULL, 0, LGitTraceFlusher, NULL, 0, &thread_id);
+	if (trace_stop == NULL || trace_flusher == NULL) {
+		/* Everything will go out immediately instead */
+		InterlockedDecrement(&trace_users);
+		if (trace_stop != NULL) {
+			CloseHandle(trace_stop);
+			trace_stop = NULL;
+		}
+	}
+}
+
+/* Called from SccUninitialize; the flusher has to be gone before we unload */
+void LGitTraceShutdown(void)
+{
+	if (trace_users == 0 || InterlockedDecrement(&trace_users) != 0) {
+		return;
+	}
+	SetEvent(trace_stop);
+	WaitForSingleObject(trace_flusher, INFINITE);
+	CloseHandle(trace_flusher);
+	CloseHandle(trace_stop);
+	trace_flusher = NULL;
+	trace_stop = NULL;
+	LGitTraceFlush();
+}
@@ -47,15 +47,34 @@ char *LGitAnsiToUtf8Alloc(const char *buf)
 
 int LGitAnsiToUtf8(const char *buf, char *utf8_buf, size_t utf8_bufsz)
 {
-	size_t required_size = MultiByteToWideChar(CP_ACP, 0, buf, -1, NULL, 0);
-	wchar_t *allocated = (wchar_t*)calloc(required_size, 2);
-	if (allocated == NULL) {
-		return NULL;
+	const unsigned char *in = (const unsigned char*)buf;
+	wchar_t stack[1024], *allocated;
+	size_t i, required_size;
+	int ret;
+	/* ASCII is the same in both, and it's what most paths are */
+	for (i = 0; in[i] != '\0' && in[i] < 0x80; i++);
+	if (in[i] == '\0') {
+		if (i + 1 > utf8_bufsz) {
+			return 0;
+		}
+		memcpy(utf8_buf, buf, i + 1);
+		return i + 1;
+	}
+	required_size = MultiByteToWideChar(CP_ACP, 0, buf, -1, NULL, 0);
+	if (required_size <= 1024) {
+		allocated = stack;
+	} else {
+		allocated = (wchar_t*)calloc(required_size, 2);
+		if (allocated == NULL) {
+			return NULL;
+		}
 	}
 	MultiByteToWideChar(CP_ACP, 0, buf, -1, allocated, required_size);
 	/* now to utf8 */
-	int ret = LGitWideToUtf8(allocated, utf8_buf, utf8_bufsz);
-	free(allocated);
+	ret = LGitWideToUtf8(allocated, utf8_buf, utf8_bufsz);
+	if (allocated != stack) {
+		free(allocated);
+	}
 	return ret;
 }
 
@@ -0,0 +1,221 @@
+/*
+ * Upstream changes, for telling the IDE what's changed "on the server". With
+ * git, that's what's different between the merge base of HEAD and its
+ * upstream branch, and the upstream branch as of the last fetch. Rather than
+ * diff trees for every query, diff once per upstream tip (and HEAD, since
+ * the merge base moves when we merge) and keep the result as a map of path
+ * to change.
+ */
+
+#include "stdafx.h"
+
+typedef struct _LGitUpstreamEntry {
+	/* SCC_CHANGE_* */
+	LONG change;
+	/* For renames, the path on the other end */
+	std::string other;
+} LGitUpstreamEntry;
+
+typedef std::map<std::string, LGitUpstreamEntry, LGitPathLess> LGitUpstreamMap;
+
+struct _LGitUpstream {
+	/* What the map was built from; if HEAD or upstream move, rebuild */
+	git_oid head_oid, upstream_oid;
+	/* Tried building for those, even if it failed (i.e. unrelated histories) */
+	BOOL built;
+	BOOL valid;
+	LGitUpstreamMap *changes;
+	/* Statistics */
+	LONG builds;
+};
+
+void LGitUpstreamInit(LGitContext *ctx)
+{
+	LGitUpstream *upstream = (LGitUpstream*)calloc(1, sizeof(LGitUpstream));
+	if (upstream == NULL) {
+		return;
+	}
+	upstream->changes = new LGitUpstreamMap();
+	ctx->upstream = upstream;
+}
+
+void LGitUpstreamFree(LGitContext *ctx)
+{
+	LGitUpstream *upstream = ctx->upstream;
+	if (upstream == NULL) {
+		return;
+	}
+	LGitLog(" ! Upstream: built %d times, %d changes\n",
+		upstream->builds,
+		upstream->changes->size());
+	delete upstream->changes;
+	free(upstream);
+	ctx->upstream = NULL;
+}
+
+static void LGitUpstreamAdd(LGitUpstreamMap *changes,
+							const char *path,
+							LONG change,
+							const char *other)
+{
+	LGitUpstreamEntry entry;
+	entry.change = change;
+	if (other != NULL) {
+		entry.other = other;
+	}
+	(*changes)[path] = entry;
+}
+
+/* Diffs the merge base against upstream, filling the map */
+static BOOL LGitUpstreamBuild(LGitContext *ctx,
+							  const git_oid *head_oid,
+							  const git_oid *upstream_oid)
+{
+	LGitUpstream *upstream = ctx->upstream;
+	git_commit *base_commit = NULL, *upstream_commit = NULL;
+	git_tree *base_tree = NULL, *upstream_tree = NULL;
+	git_diff *diff = NULL;
+	const git_diff_delta *delta;
+	git_oid base_oid;
+	size_t i, count;
+	DWORD begin = GetTickCount();
+	BOOL ret = FALSE;
+
+	upstream->changes->clear();
+	upstream->valid = FALSE;
+	/* Failing is expensive too, so don't try again until something moves */
+	git_oid_cpy(&upstream->head_oid, head_oid);
+	git_oid_cpy(&upstream->upstream_oid, upstream_oid);
+	upstream->built = TRUE;
+	if (git_merge_base(&base_oid, ctx->repo, head_oid, upstream_oid) != 0) {
+		/* Unrelated histories; nothing sensible to say */
+		goto fin;
+	}
+	if (git_commit_lookup(&base_commit, ctx->repo, &base_oid) != 0
+		|| git_commit_tree(&base_tree, base_commit) != 0
+		|| git_commit_lookup(&upstream_commit, ctx->repo, upstream_oid) != 0
+		|| git_commit_tree(&upstream_tree, upstream_commit) != 0) {
+		goto fin;
+	}
+	if (git_diff_tree_to_tree(&diff, ctx->repo, base_tree, upstream_tree, NULL) != 0) {
+		goto fin;
+	}
+	if (LGitFindRenames(diff, FALSE, NULL) != 0) {
+		goto fin;
+	}
+	count = git_diff_num_deltas(diff);
+	for (i = 0; i < count; i++) {
+		delta = git_diff_get_delta(diff, i);
+		switch (delta->status) {
+		case GIT_DELTA_ADDED:
+			LGitUpstreamAdd(upstream->changes, delta->new_file.path, SCC_CHANGE_DATABASE_ADDED, NULL);
+			break;
+		case GIT_DELTA_DELETED:
+			LGitUpstreamAdd(upstream->changes, delta->old_file.path, SCC_CHANGE_DATABASE_DELETED, NULL);
+			break;
+		case GIT_DELTA_RENAMED:
+			LGitUpstreamAdd(upstream->changes, delta->old_file.path, SCC_CHANGE_RENAMED_TO, delta->new_file.path);
+			LGitUpstreamAdd(upstream->changes, delta->new_file.path, SCC_CHANGE_RENAMED_FROM, delta->old_file.path);
+			break;
+		case GIT_DELTA_MODIFIED:
+		case GIT_DELTA_TYPECHANGE:
+			LGitUpstreamAdd(upstream->changes, delta->new_file.path, SCC_CHANGE_DIFFERENT, NULL);
+			break;
+		default:
+			break;
+		}
+	}
+	upstream->valid = TRUE;
+	upstream->builds++;
+	ret = TRUE;
+	LGitLog(" ! Upstream changes: %d paths, %u ms\n",
+		upstream->changes->size(),
+		GetTickCount() - begin);
+fin:
+	if (diff != NULL) {
+		git_diff_free(diff);
+	}
+	if (base_tree != NULL) {
+		git_tree_free(base_tree);
+	}
+	if (upstream_tree != NULL) {
+		git_tree_free(upstream_tree);
+	}
+	if (base_commit != NULL) {
+		git_commit_free(base_commit);
+	}
+	if (upstream_commit != NULL) {
+		git_commit_free(upstream_commit);
+	}
+	return ret;
+}
+
+/*
+ * Makes sure the map is for the current HEAD and upstream, rebuilding if
+ * either moved. This only resolves refs, so it's cheap when nothing has.
+ * Returns FALSE if there's no upstream to compare against, or the build
+ * for these failed; that isn't retried until one of them moves.
+ */
+BOOL LGitUpstreamRefresh(LGitContext *ctx)
+{
+	LGitUpstream *upstream = ctx->upstream;
+	git_reference *head = NULL, *tracking = NULL;
+	git_oid head_oid, upstream_oid;
+	BOOL ret = FALSE;
+
+	if (upstream == NULL) {
+		return FALSE;
+	}
+	/* Detached or unborn HEADs don't have an upstream */
+	if (git_repository_head(&head, ctx->repo) != 0
+		|| !git_reference_is_branch(head)
+		|| git_branch_upstream(&tracking, head) != 0
+		|| git_reference_name_to_id(&head_oid, ctx->repo, git_reference_name(head)) != 0
+		|| git_reference_name_to_id(&upstream_oid, ctx->repo, git_reference_name(tracking)) != 0) {
+		upstream->built = FALSE;
+		upstream->valid = FALSE;
+		upstream->changes->clear();
+		goto fin;
+	}
+	if (upstream->built
+		&& git_oid_equal(&head_oid, &upstream->head_oid)
+		&& git_oid_equal(&upstream_oid, &upstream->upstream_oid)) {
+		ret = upstream->valid;
+		goto fin;
+	}
+	ret = LGitUpstreamBuild(ctx, &head_oid, &upstream_oid);
+fin:
+	if (tracking != NULL) {
+		git_reference_free(tracking);
+	}
+	if (head != NULL) {
+		git_reference_free(head);
+	}
+	return ret;
+}
+
+/*
+ * What happened to the path (relative, forward slashes) upstream, as an
+ * SCC_CHANGE value; SCC_CHANGE_UNCHANGED if nothing. For renames, other gets
+ * the path on the other end, if it's not NULL. Call LGitUpstreamRefresh
+ * first, once per batch.
+ */
+LONG LGitUpstreamLookup(LGitContext *ctx, const char *path, const char **other)
+{
+	LGitUpstream *upstream = ctx->upstream;
+	LGitUpstreamMap::iterator it;
+	if (other != NULL) {
+		*other = NULL;
+	}
+	if (upstream == NULL || !upstream->valid) {
+		return SCC_CHANGE_UNCHANGED;
+	}
+	it = upstream->changes->find(path);
+	if (it == upstream->changes->end()) {
+		return SCC_CHANGE_UNCHANGED;
+	}
+	if (other != NULL && it->second.other.size() > 0) {
+		*other = it->second.other.c_str();
+	}
+	return it->second.change;
+}
@@ -0,0 +1,221 @@
+/*
+ * Word diff within lines, for the side by side view. Lines in a changed
+ * block are lined up one to one, and each pair is compared by words to find
+ * what in it actually changed.
+ *
+ * This is only done for lines as they're drawn, one pair at a time, since a
+ * rewritten file can be one block of thousands of them. Results are kept,
+ * so scrolling back doesn't redo them, and a huge diff costs nothing here
+ * until someone looks at it.
+ */
+
+#include "stdafx.h"
+
+/* Past this many cells, give up on matching the middle of a line up */
+#define WORD_DIFF_MAX_CELLS 65536
+
+typedef struct _LGitWordToken {
+	unsigned short start, length;
+} LGitWordToken;
+
+typedef struct _LGitWordLine {
+	std::vector<LGitWordSpan> left, right;
+} LGitWordLine;
+
+typedef std::map<LONG, LGitWordLine> LGitWordLines;
+
+struct _LGitWordDiff {
+	LGitDiffDocument *doc;
+	/* By pair */
+	LGitWordLines *pairs;
+	/* Statistics */
+	LONG lines;
+	DWORD time;
+};
+
+LGitWordDiff *LGitWordDiffNew(LGitDiffDocument *doc)
+{
+	LGitWordDiff *wd = (LGitWordDiff*)calloc(1, sizeof(LGitWordDiff));
+	if (wd == NULL) {
+		return NULL;
+	}
+	wd->doc = doc;
+	wd->pairs = new LGitWordLines();
+	return wd;
+}
+
+void LGitWordDiffFree(LGitWordDiff *wd)
+{
+	if (wd == NULL) {
+		return;
+	}
+	LGitLog(" ! Word diff: %d lines compared in %u ms\n",
+		wd->lines,
+		wd->time);
+	delete wd->pairs;
+	free(wd);
+}
+
+static int LGitWordClass(wchar_t c)
+{
+	if (c == L' ') {
+		return 1;
+	}
+	if (iswalnum(c) || c == L'_' || c >= 0x80) {
+		return 2;
+	}
+	/* Punctuation is a word on its own */
+	return 0;
+}
+
+/* Runs of word characters or spaces; anything else is a token by itself */
+static void LGitWordTokenize(const wchar_t *text, std::vector<LGitWordToken> *tokens)
+{
+	LGitWordToken token;
+	size_t i = 0, start;
+	int kind;
+	while (text[i] != L'\0') {
+		start = i;
+		kind = LGitWordClass(text[i++]);
+		while (kind != 0 && text[i] != L'\0' && LGitWordClass(text[i]) == kind) {
+			i++;
+		}
+		token.start = (unsigned short)start;
+		token.length = (unsigned short)(i - start);
+		tokens->push_back(token);
+	}
+}
+
+static BOOL LGitWordEqual(const wchar_t *a, const LGitWordToken &ta,
+						  const wchar_t *b, const LGitWordToken &tb)
+{
+	return ta.length == tb.length
+		&& memcmp(a + ta.start, b + tb.start, ta.length * sizeof(wchar_t)) == 0;
+}
+
+/* Joins changed tokens that touch into spans */
+static void LGitWordAddSpan(std::vector<LGitWordSpan> *spans, const LGitWordToken &token)
+{
+	LGitWordSpan span;
+	if (spans->size() > 0 && spans->back().start + spans->back().length == token.start) {
+		spans->back().length += token.length;
+		return;
+	}
+	span.start = token.start;
+	span.length = token.length;
+	spans->push_back(span);
+}
+
+/*
+ * What's different between two versions of a line, by word. Common words
+ * at either end are trimmed off first, since most edits are in one place,
+ * then the rest is matched with a longest common subsequence.
+ */
+static void LGitWordCompare(const wchar_t *a, const wchar_t *b, LGitWordLine *line)
+{
+	std::vector<LGitWordToken> ta, tb;
+	std::vector<unsigned short> lcs;
+	size_t prefix = 0, suffix = 0, n, m, i, j, w;
+
+	LGitWordTokenize(a, &ta);
+	LGitWordTokenize(b, &tb);
+	while (prefix < ta.size() && prefix < tb.size()
+		&& LGitWordEqual(a, ta[prefix], b, tb[prefix])) {
+		prefix++;
+	}
+	while (suffix < ta.size() - prefix && suffix < tb.size() - prefix
+		&& LGitWordEqual(a, ta[ta.size() - suffix - 1], b, tb[tb.size() - suffix - 1])) {
+		suffix++;
+	}
+	n = ta.size() - prefix - suffix;
+	m = tb.size() - prefix - suffix;
+	if (n == 0 || m == 0 || (n + 1) * (m + 1) > WORD_DIFF_MAX_CELLS) {
+		/* Nothing to match up, or too much; the whole middle changed */
+		for (i = 0; i < n; i++) {
+			LGitWordAddSpan(&line->left, ta[prefix + i]);
+		}
+		for (j = 0; j < m; j++) {
+			LGitWordAddSpan(&line->right, tb[prefix + j]);
+		}
+		return;
+	}
+	/* lcs[i][j] is the longest for the tails from i and j */
+	w = m + 1;
+	lcs.resize((n + 1) * w, 0);
+	for (i = n; i-- > 0;) {
+		for (j = m; j-- > 0;) {
+			if (LGitWordEqual(a, ta[prefix + i], b, tb[prefix + j])) {
+				lcs[(i * w) + j] = (unsigned short)(lcs[((i + 1) * w) + j + 1] + 1);
+			} else {
+				lcs[(i * w) + j] = (unsigned short)max(lcs[((i + 1) * w) + j], lcs[(i * w) + j + 1]);
+			}
+		}
+	}
+	i = j = 0;
+	while (i < n && j < m) {
+		if (LGitWordEqual(a, ta[prefix + i], b, tb[prefix + j])) {
+			i++;
+			j++;
+		} else if (lcs[((i + 1) * w) + j] >= lcs[(i * w) + j + 1]) {
+			LGitWordAddSpan(&line->left, ta[prefix + i++]);
+		} else {
+			LGitWordAddSpan(&line->right, tb[prefix + j++]);
+		}
+	}
+	for (; i < n; i++) {
+		LGitWordAddSpan(&line->left, ta[prefix + i]);
+	}
+	for (; j < m; j++) {
+		LGitWordAddSpan(&line->right, tb[prefix + j]);
+	}
+}
+
+/* Same text the view shows, so spans line up with what's drawn */
+static void LGitWordDiffPair(LGitWordDiff *wd, LONG left, LONG right, LGitWordLine *line)
+{
+	wchar_t left_text[1024], right_text[1024];
+	DWORD begin = GetTickCount();
+
+	LGitDiffDocumentText(wd->doc, left, left_text, 1024);
+	LGitDiffDocumentText(wd->doc, right, right_text, 1024);
+	LGitWordCompare(left_text, right_text, line);
+	wd->lines++;
+	wd->time += GetTickCount() - begin;
+}
+
+/*
+ * The changed parts of one side of a line in the side by side view, as
+ * character ranges of its display text. FALSE if the line isn't in a
+ * changed block.
+ */
+BOOL LGitWordDiffSpans(LGitWordDiff *wd,
+					   LONG pair,
+					   BOOL right,
+					   const LGitWordSpan **spans,
+					   size_t *count)
+{
+	LGitWordLines::iterator it;
+	std::vector<LGitWordSpan> *side;
+	LONG left_row, right_row, block;
+
+	*spans = NULL;
+	*count = 0;
+	if (!LGitDiffDocumentPair(wd->doc, pair, &left_row, &right_row, &block) || block == -1) {
+		return FALSE;
+	}
+	/* One sided lines are all changed, which the row already says */
+	if (left_row == -1 || right_row == -1) {
+		return TRUE;
+	}
+	it = wd->pairs->find(pair);
+	if (it == wd->pairs->end()) {
+		it = wd->pairs->insert(LGitWordLines::value_type(pair, LGitWordLine())).first;
+		LGitWordDiffPair(wd, left_row, right_row, &it->second);
+	}
+	side = right ? &it->second.right : &it->second.left;
+	if (side->size() > 0) {
+		*spans = &(*side)[0];
+		*count = side->size();
+	}
+	return TRUE;
+}